@@ -737,6 +737,165 @@ size_t SeedAligner::exactSweep(
 	return nelt;
 }
 
+/**
+ * Sweep many reads right-to-left using exact matching, as exactSweep()
+ * does one read at a time.  Each strand of each read is a lane; lanes
+ * take turns doing one step (a restart from the ftab/fchr or one LF
+ * mapping) and prefetch the side(s) their next step will touch, so by
+ * the time a lane comes around again its side is likely in cache.
+ * Lanes keep just their top/bot and redo the cheap SideLocus
+ * arithmetic when they need it.
+ */
+void SeedAligner::exactSweepBatch(
+	const Ebwt&            ebwt,    // BWT index
+	EList<ExactSweepJob>&  jobs,    // reads to sweep; results go here
+	size_t                 mineMax, // don't care about edit bounds > this
+	bool                   repex,   // report 0mm hits?
+	SeedSearchMetrics&     met)     // metrics
+{
+	assert_gt(mineMax, 0);
+	const EbwtParams& eh = ebwt.eh();
+	const uint8_t *bwt = ebwt.ebwt();
+	const int ftabLen = eh.ftabChars();
+	lanes_.clear();
+	for(size_t j = 0; j < jobs.size(); j++) {
+		const ExactSweepJob& job = jobs[j];
+		if(job.read == NULL) {
+			continue;
+		}
+		for(int fwi = 0; fwi < 2; fwi++) {
+			if(fwi == 0 && job.nofw) continue;
+			if(fwi == 1 && job.norc) continue;
+			lanes_.expand();
+			SweepLane& l = lanes_.back();
+			l.job = j;
+			l.fwi = fwi;
+			l.seq = fwi == 0 ? &job.read->patFw : &job.read->patRc;
+			l.len = job.read->length();
+			assert(!l.seq->empty());
+			l.dep = l.nedit = 0;
+			l.extending = false;
+			l.top = l.bot = 0;
+		}
+	}
+	while(!lanes_.empty()) {
+		for(size_t i = 0; i < lanes_.size();) {
+			SweepLane& l = lanes_[i];
+			ExactSweepJob& job = jobs[l.job];
+			const BTDnaString& seq = *l.seq;
+			const size_t len = l.len;
+			bool finished = false;
+			if(!l.extending) {
+				if(l.dep >= len) {
+					// Ran off the end without establishing a bound
+					finished = true;
+				} else {
+					// Start a new exact match at dep
+					l.top = l.bot = 0;
+					size_t left = len - l.dep;
+					bool doFtab = ftabLen > 1 && left >= (size_t)ftabLen;
+					if(doFtab) {
+						// Does N interfere with use of Ftab?
+						for(size_t k = 0; k < (size_t)ftabLen; k++) {
+							int c = seq[len-l.dep-1-k];
+							if(c > 3) {
+								doFtab = false;
+								break;
+							}
+						}
+					}
+					if(doFtab) {
+						ebwt.ftabLoHi(seq, len - l.dep - ftabLen, false, l.top, l.bot);
+						l.dep += (size_t)ftabLen;
+					} else {
+						int c = seq[len-l.dep-1];
+						if(c < 4) {
+							l.top = ebwt.fchr()[c];
+							l.bot = ebwt.fchr()[c+1];
+						}
+						l.dep++;
+					}
+					if(l.bot <= l.top) {
+						l.nedit++;
+						if(l.nedit >= mineMax) {
+							job.mine[l.fwi] = l.nedit;
+							job.mineSet[l.fwi] = true;
+							finished = true;
+						}
+					} else {
+						l.extending = true;
+					}
+				}
+			} else if(l.dep == len) {
+				// Matched all the way to the end
+				job.mine[l.fwi] = l.nedit;
+				job.mineSet[l.fwi] = true;
+				if(l.nedit == 0 && l.bot > l.top) {
+					if(repex) {
+						job.top[l.fwi] = l.top;
+						job.bot[l.fwi] = l.bot;
+						assert(ebwt.contains(seq, NULL, NULL));
+					}
+					job.nelt += (l.bot - l.top);
+				}
+				finished = true;
+			} else {
+				// Extend the current exact match by one character
+				int c = seq[len-l.dep-1];
+				if(c > 3) {
+					l.top = l.bot = 0;
+				} else {
+					SideLocus tloc, bloc;
+					INIT_LOCS(l.top, l.bot, tloc, bloc, ebwt);
+					if(bloc.valid()) {
+						bwops_ += 2;
+						l.top = ebwt.mapLF(tloc, c);
+						l.bot = ebwt.mapLF(bloc, c);
+					} else {
+						bwops_++;
+						l.top = ebwt.mapLF1(l.top, tloc, c);
+						if(l.top == OFF_MASK) {
+							l.top = l.bot = 0;
+						} else {
+							l.bot = l.top+1;
+						}
+					}
+				}
+				if(l.bot <= l.top) {
+					l.nedit++;
+					if(l.nedit >= mineMax) {
+						job.mine[l.fwi] = l.nedit;
+						job.mineSet[l.fwi] = true;
+						finished = true;
+					} else {
+						// Skip past the mismatch and start anew
+						l.dep++;
+						l.extending = false;
+					}
+				} else {
+					l.dep++;
+				}
+			}
+			if(finished) {
+				// Retire the lane; the last one takes its place
+				lanes_[i] = lanes_.back();
+				lanes_.pop_back();
+				continue;
+			}
+			if(l.extending && l.dep < len) {
+				// Get the side(s) for the next step on their way
+				SideLocus tloc, bloc;
+				INIT_LOCS(l.top, l.bot, tloc, bloc, ebwt);
+				tloc.prefetch(eh, bwt);
+				if(bloc.valid()) {
+					bloc.prefetch(eh, bwt);
+				}
+			}
+			i++;
+		}
+	}
+}
+
 /**
  * Search for end-to-end exact hit for read.  Return true iff one is found.
  */
@@ -1451,6 +1451,61 @@ struct SeedSearchMetrics {
 	MUTEX_T  mutex_m;
 };
 
+/**
+ * A read (or mate) for SeedAligner::exactSweepBatch() to sweep, and what
+ * the sweep found: the same things exactSweep() would have found.
+ */
+struct ExactSweepJob {
+
+	/**
+	 * Set up to sweep 'rd', or nothing if 'rd' is NULL.
+	 */
+	void init(const Read* rd, bool nf, bool nr) {
+		read = rd;
+		nofw = nf;
+		norc = nr;
+		nelt = 0;
+		for(int fwi = 0; fwi < 2; fwi++) {
+			mine[fwi] = 0;
+			mineSet[fwi] = false;
+			top[fwi] = bot[fwi] = 0;
+		}
+	}
+
+	/**
+	 * Hand over the results as exactSweep() would have: set the edit
+	 * bounds it would have set, add exact end-to-end hits to 'hits',
+	 * and return the number of BW elements they cover.
+	 */
+	size_t install(
+		const Scoring& sc,
+		size_t&        mineFw,
+		size_t&        mineRc,
+		SeedResults&   hits) const
+	{
+		assert(read != NULL);
+		if(mineSet[0]) mineFw = mine[0];
+		if(mineSet[1]) mineRc = mine[1];
+		int64_t score = read->length() * sc.match();
+		if(bot[0] > top[0]) {
+			hits.addExactEeFw(top[0], bot[0], NULL, NULL, true, score);
+		}
+		if(bot[1] > top[1]) {
+			hits.addExactEeRc(top[1], bot[1], NULL, NULL, false, score);
+		}
+		return nelt;
+	}
+
+	const Read *read;       // read to sweep; NULL if none
+	bool        nofw;       // don't align forward read
+	bool        norc;       // don't align revcomp read
+	size_t      nelt;       // # BW elements in exact hits
+	size_t      mine[2];    // minimum # edits, fw and rc
+	bool        mineSet[2]; // whether mine[] was established
+	TIndexOffU  top[2];     // exact hit range, fw and rc, if bot > top
+	TIndexOffU  bot[2];
+};
+
 /**
  * Given an index and a seeding scheme, searches for seed hits.
  */
@@ -1461,7 +1516,7 @@ public:
 	/**
 	 * Initialize with index.
 	 */
-	SeedAligner() : edits_(AL_CAT), offIdx2off_(AL_CAT) { }
+	SeedAligner() : edits_(AL_CAT), offIdx2off_(AL_CAT), lanes_(AL_CAT) { }
 
 	/**
 	 * Given a read and a few coordinates that describe a substring of the
@@ -1541,6 +1596,20 @@ public:
 		SeedResults&       hits,    // holds all the seed hits (and exact hit)
 		SeedSearchMetrics& met);    // metrics
 
+	/**
+	 * Do what exactSweep() does for many reads at once.  The sweeps of
+	 * every read and strand take turns, one LF step at a time, and each
+	 * prefetches the BWT side its next step needs, so that the cache
+	 * misses of different sweeps overlap instead of each stalling in
+	 * turn.  Results are left in the jobs, for ExactSweepJob::install().
+	 */
+	void exactSweepBatch(
+		const Ebwt&            ebwt,    // BWT index
+		EList<ExactSweepJob>&  jobs,    // reads to sweep; results go here
+		size_t                 mineMax, // don't care about edit bounds > this
+		bool                   repex,   // report 0mm hits?
+		SeedSearchMetrics&     met);    // metrics
+
 	/**
 	 * Search for end-to-end alignments with up to 1 mismatch.
 	 */
@@ -1643,6 +1712,21 @@ protected:
 	uint64_t bwops_;           // Burrows-Wheeler operations
 	uint64_t bwedits_;         // Burrows-Wheeler edits
 	BTDnaString tmprfdnastr_;  // used in reportHit
+
+	/**
+	 * State of one strand of one read's sweep in exactSweepBatch().
+	 */
+	struct SweepLane {
+		size_t             job;    // index into jobs
+		int                fwi;    // 0 = fw, 1 = rc
+		const BTDnaString* seq;
+		size_t             len;
+		size_t             dep;
+		size_t             nedit;
+		bool               extending; // false -> start anew at dep
+		TIndexOffU         top, bot;
+	};
+	EList<SweepLane> lanes_;   // sweeps underway in exactSweepBatch()
 	
 	ASSERT_ONLY(ESet<BTDnaString> hits_); // Ref hits so far for seed being aligned
 	BTDnaString tmpdnastr_;
@@ -207,12 +207,20 @@ void SwAligner::initRef(
 	// rfbuf_ = uint32_t list large enough to accommodate both the reference
 	// sequence and any Ns we might add to either side.
 	rfwbuf_.resize((rflen + 16) / 4);
-	int offset = refs.getStretch(
-		rfwbuf_.ptr(),               // buffer to store words in
-		refidx,                      // which reference
-		(rfi < 0) ? 0 : (size_t)rfi, // starting offset (can't be < 0)
-		rflenInner                   // length to grab (exclude overhang)
-		ASSERT_ONLY(, tmp_destU32_));// for BitPairReference::getStretch()
+	int offset = rcache_ != NULL ?
+		rcache_->getStretch(
+			refs,                        // reference strings
+			rfwbuf_.ptr(),               // buffer to store words in
+			refidx,                      // which reference
+			(rfi < 0) ? 0 : (size_t)rfi, // starting offset (can't be < 0)
+			rflenInner                   // length to grab (exclude overhang)
+			ASSERT_ONLY(, tmp_destU32_)) :
+		refs.getStretch(
+			rfwbuf_.ptr(),               // buffer to store words in
+			refidx,                      // which reference
+			(rfi < 0) ? 0 : (size_t)rfi, // starting offset (can't be < 0)
+			rflenInner                   // length to grab (exclude overhang)
+			ASSERT_ONLY(, tmp_destU32_));// for BitPairReference::getStretch()
 	assert_leq(offset, 16);
 	rf_ = (char*)rfwbuf_.ptr() + offset;
 	// Shift ref chars away from 0 so we can stick Ns at the beginning
@@ -344,12 +352,20 @@ int SwAligner::ungappedAlign(
 	// rfbuf_ = uint32_t list large enough to accommodate both the reference
 	// sequence and any Ns we might add to either side.
 	rfwbuf_.resize((len + 16) / 4);
-	int offset = refs.getStretch(
-		rfwbuf_.ptr(),               // buffer to store words in
-		refidx,                      // which reference
-		(rfi < 0) ? 0 : (size_t)rfi, // starting offset (can't be < 0)
-		rflenInner                   // length to grab (exclude overhang)
-		ASSERT_ONLY(, tmp_destU32_));// for BitPairReference::getStretch()
+	int offset = rcache_ != NULL ?
+		rcache_->getStretch(
+			refs,                        // reference strings
+			rfwbuf_.ptr(),               // buffer to store words in
+			refidx,                      // which reference
+			(rfi < 0) ? 0 : (size_t)rfi, // starting offset (can't be < 0)
+			rflenInner                   // length to grab (exclude overhang)
+			ASSERT_ONLY(, tmp_destU32_)) :
+		refs.getStretch(
+			rfwbuf_.ptr(),               // buffer to store words in
+			refidx,                      // which reference
+			(rfi < 0) ? 0 : (size_t)rfi, // starting offset (can't be < 0)
+			rflenInner                   // length to grab (exclude overhang)
+			ASSERT_ONLY(, tmp_destU32_));// for BitPairReference::getStretch()
 	assert_leq(offset, 16);
 	rf_ = (char*)rfwbuf_.ptr() + offset;
 	// Shift ref chars away from 0 so we can stick Ns at the beginning
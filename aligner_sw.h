@@ -214,6 +214,7 @@ public:
 		readSse16_(false),
 		initedRef_(false),
 		rfwbuf_(DP_CAT),
+		rcache_(NULL),
 		btnstack_(DP_CAT),
 		btcells_(DP_CAT),
 		btdiag_(),
@@ -414,6 +415,15 @@ public:
 		nbtfiltdo += nbtfiltdo_;
 	}
 	
+	/**
+	 * Fetch reference stretches through 'rcache' from now on, or
+	 * straight from the reference if it's NULL.  The cache may be shared
+	 * with other aligners owned by the same thread.
+	 */
+	void setRefCache(RefWindowCache *rcache) {
+		rcache_ = rcache;
+	}
+
 	/**
 	 * Reset all the counters related to filling in the DP table to 0.
 	 */
@@ -620,6 +630,7 @@ protected:
 	bool                readSse16_;    // true -> sse16 from now on for read
 	bool                initedRef_;    // true iff initialized with initRef
 	EList<uint32_t>     rfwbuf_;       // buffer for wordized ref stretches
+	RefWindowCache     *rcache_;       // recently fetched ref stretches, or NULL
 	
 	EList<DpNucFrame>    btnstack_;    // backtrace stack for nucleotides
 	EList<SizeTPair>     btcells_;     // cells involved in current backtrace
@@ -118,6 +118,7 @@ struct SwMetrics {
 		exatts = exranges = exrows = exsucc = exooms = 0;
 		mm1atts = mm1ranges = mm1rows = mm1succ = mm1ooms = 0;
 		sdatts = sdranges = sdrows = sdsucc = sdooms = 0;
+		rchits = rcmisses = rcbypass = 0;
 	}
 	
 	void init(
@@ -241,6 +242,9 @@ struct SwMetrics {
 		sdrows     += r.sdrows;
 		sdsucc     += r.sdsucc;
 		sdooms     += r.sdooms;
+		rchits     += r.rchits;
+		rcmisses   += r.rcmisses;
+		rcbypass   += r.rcbypass;
 	}
 	
 	void tallyGappedDp(size_t readGaps, size_t refGaps) {
@@ -284,6 +288,10 @@ struct SwMetrics {
 	uint64_t sdsucc;     // # times seed alignment yielded >= 1 hit
 	uint64_t sdooms;     // # times an OOM occurred during seed alignment
 
+	uint64_t rchits;     // # ref stretches sliced from the window cache
+	uint64_t rcmisses;   // # ref stretches that filled a cache slot
+	uint64_t rcbypass;   // # ref stretches too long for the cache
+
 	MUTEX_T mutex_m;
 };
 
@@ -440,6 +440,25 @@ public:
 		redAnchor_.init(maxlen);
 	}
 
+	/**
+	 * Return the cache of recently fetched reference stretches, for the
+	 * aligners used with this driver to share.
+	 */
+	RefWindowCache& refCache() {
+		return rcache_;
+	}
+
+	/**
+	 * Add the reference cache's hit and miss counts to 'met' and reset
+	 * them.
+	 */
+	void mergeRefCache(SwMetrics& met) {
+		met.rchits   += rcache_.hits();
+		met.rcmisses += rcache_.misses();
+		met.rcbypass += rcache_.bypasses();
+		rcache_.resetCounters();
+	}
+
 protected:
 
 	bool eeSaTups(
@@ -524,6 +543,7 @@ protected:
 	Pool           pool_;      // memory pages for salistExact_
 	TSAList        salistEe_;  // PList for offsets for end-to-end hits
 	GroupWalkState gwstate_;   // some per-thread state shared by all GroupWalks
+	RefWindowCache rcache_;    // ref stretches DP windows were cut from
 	
 	// For AlnRes::matchesRef:
 	ASSERT_ONLY(SStringExpandable<char>     raw_refbuf_);
@@ -42,6 +42,7 @@
 #include "ds.h"
 #include "mem_ids.h"
 #include "word_io.h"
+#include "build_metrics.h"
 
 using namespace std;
 
@@ -219,7 +220,9 @@ public:
 		_built(false),
 		_base_fname(base_fname),
 		_bigEndian(currentlyBigEndian()),
-		_done(NULL)
+		_pool(NULL),
+		_done(NULL),
+		_sortPhase(NULL)
 #ifdef WITH_TBB
 ,thread_group_started(false)
 #endif
@@ -239,6 +242,8 @@ public:
 #endif
 	    if (_done != NULL)
 		    delete[] _done;
+	    delete _pool;
+	    delete _sortPhase;
     }
 
     /**
@@ -262,6 +267,9 @@ public:
 	 */
 	virtual TIndexOffU nextSuffix()
 	{
+		if(_sortPhase == NULL && this->_itrBucketIdx == 0) {
+			_sortPhase = new BuildPhase(_base_fname, "block_sort", "suffixes", this->text().length() + 1);
+		}
 		// Launch threads if not
 		if(this->_nthreads > 1) {
 #ifdef WITH_TBB
@@ -273,6 +281,7 @@ public:
                 for (size_t i = 0; i < _sampleSuffs.size() + 1; i++) {
                     _done[i] = false;
                 }
+                _pool = new MkeyStealPool(this->_nthreads);
 				_itrBuckets.resize(this->_nthreads);
 				_tparams.resize(this->_nthreads);
 				for(int tid = 0; tid < this->_nthreads; tid++) {
@@ -301,7 +310,10 @@ public:
 				throw out_of_range("No more suffixes");
 			}
 			if(this->_nthreads == 1) {
+				uint64_t start = BuildMetrics::now();
 				nextBlock((int)_cur);
+				_sortPhase->block(_cur, _sampleSuffs.size() + 1, 0, this->_itrBucket.size(),
+				                  BuildMetrics::now() - start);
 				_cur++;
 			} else {
 				while(!_done[this->_itrBucketIdx]) {
@@ -322,6 +334,21 @@ public:
 				}
 				sa_file.close();
 				std::remove(fname.c_str());
+				if(this->_itrBucketIdx == _sampleSuffs.size()) {
+					// That was the last block; wait for the workers to
+					// retire so we can say how well they were kept busy
+					joinWorkers();
+					if(this->verbose()) {
+						std::ostringstream oss;
+						_pool->report(oss);
+						this->verbose(oss.str());
+					}
+				}
+			}
+			if(this->_itrBucketIdx == _sampleSuffs.size()) {
+				// Every block is sorted
+				delete _sortPhase;
+				_sortPhase = NULL;
 			}
 			this->_itrBucketIdx++;
 			this->_itrBucketPos = 0;
@@ -333,7 +360,7 @@ public:
     virtual void nextBlock(int cur_block, int tid = 0);
     
     /// Defined in blockwise_sa.cpp
-    virtual void qsort(EList<TIndexOffU>& bucket);
+    virtual void qsort(EList<TIndexOffU>& bucket, int tid = -1);
     
     /// Return true iff more blocks are available
     virtual bool hasMoreBlocks() const {
@@ -362,13 +389,20 @@ public:
         int tid = param.second;
         while(true) {
             size_t cur = 0;
+            sa->_pool->enter();
             {
                 ThreadSafe ts(sa->_mutex);
                 cur = sa->_cur;
-                if(cur > sa->_sampleSuffs.size()) break;
-                sa->_cur++;
+                if(cur <= sa->_sampleSuffs.size()) sa->_cur++;
             }
+            if(cur > sa->_sampleSuffs.size()) {
+                sa->_pool->leave();
+                break;
+            }
+            uint64_t start = BuildMetrics::now();
             sa->nextBlock((int)cur, tid);
+            sa->_sortPhase->block(cur, sa->_sampleSuffs.size() + 1, tid, sa->_itrBuckets[tid].size(),
+                                  BuildMetrics::now() - start);
             // Write suffixes into a file
             std::ostringstream number; number << cur;
             const string fname = sa->_base_fname + "." + number.str() + ".sa";
@@ -385,7 +419,10 @@ public:
             sa_file.close();
             sa->_itrBuckets[tid].clear();
             sa->_done[cur] = true;
+            sa->_pool->leave();
         }
+        // Help sort the blocks other threads are still working on
+        sa->_pool->help(tid);
     }
 #ifdef WITH_TBB
 };
@@ -414,6 +451,21 @@ protected:
 
 private:
 
+	/**
+	 * Wait for all the block-sorting threads to finish.
+	 */
+	void joinWorkers() {
+#ifdef WITH_TBB
+		tbb_grp.wait();
+#else
+		for (size_t tid = 0; tid < _threads.size(); tid++) {
+			_threads[tid]->join();
+			delete _threads[tid];
+		}
+		_threads.clear();
+#endif
+	}
+
     /**
      * Calculate the difference-cover sample and sample suffixes.
      */
@@ -421,12 +473,14 @@ private:
         // Calculate difference-cover sample
         assert(_dc.get() == NULL);
         if(_dcV != 0) {
+            BuildPhase phase(_base_fname, "dc_sample", "bases", this->text().length());
             _dc.init(new TDC(this->text(), _dcV, this->verbose(), this->sanityCheck()));
             _dc.get()->build(this->_nthreads);
         }
         // Calculate sample suffixes
         if(this->bucketSz() <= this->text().length()) {
             VMSG_NL("Building samples");
+            BuildPhase phase(_base_fname, "sample_suffixes", "bases", this->text().length());
             buildSamples();
         } else {
             VMSG_NL("Skipping building samples since text length " <<
@@ -472,6 +526,7 @@ private:
 	MUTEX_T                 _mutex;       /// synchronization of output message
 	string                  _base_fname;  /// base file name for storing SA blocks
 	bool                    _bigEndian;   /// bigEndian?
+	MkeyStealPool          *_pool;        /// shares sorting work among threads
 #ifdef WITH_TBB
 	tbb::task_group 	    tbb_grp;	/// thread "list" via Intel TBB
 	bool		    thread_group_started;
@@ -481,6 +536,7 @@ private:
 	EList<pair<KarkkainenBlockwiseSA*, int> > _tparams;
 	ELList<TIndexOffU>      _itrBuckets;  /// buckets
 	volatile bool *_done;        /// is a block processed?
+	BuildPhase    *_sortPhase;   /// reports block sorting to --met-file
 };
 
 
@@ -489,7 +545,7 @@ private:
  * Qsort the set of suffixes whose offsets are in 'bucket'.
  */
 template<typename TStr>
-inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
+inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket, int tid) {
 	const TStr& t = this->text();
 	TIndexOffU *s = bucket.ptr();
 	size_t slen = bucket.size();
@@ -501,8 +557,13 @@ inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
 		// with than the EList<> container
 		const uint8_t *host = (const uint8_t *)t.buf();
 		assert(_dc.get() != NULL);
-		mkeyQSortSufDcU8(t, host, len, s, slen, *_dc.get(), 4,
-		                 this->verbose(), this->sanityCheck());
+		if(_pool != NULL && tid >= 0) {
+			mkeyQSortSufDcU8(*_pool, tid, t, host, len, s, slen, *_dc.get(), 4,
+			                 this->verbose(), this->sanityCheck());
+		} else {
+			mkeyQSortSufDcU8(t, host, len, s, slen, *_dc.get(), 4,
+			                 this->verbose(), this->sanityCheck());
+		}
 	} else {
 		VMSG_NL("  (Not using difference cover)");
 		// We don't have a difference cover - just do a normal
@@ -520,7 +581,8 @@ inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
  */
 template<>
 inline void KarkkainenBlockwiseSA<S2bDnaString>::qsort(
-	EList<TIndexOffU>& bucket)
+	EList<TIndexOffU>& bucket,
+	int tid)
 {
 	const S2bDnaString& t = this->text();
 	TIndexOffU *s = bucket.ptr();
@@ -531,8 +593,13 @@ inline void KarkkainenBlockwiseSA<S2bDnaString>::qsort(
 		VMSG_NL("  (Using difference cover)");
 		// Can't use the text's 'host' array because the backing
 		// store for the packed string is not one-char-per-elt.
-		mkeyQSortSufDcU8(t, t, len, s, slen, *_dc.get(), 4,
-		                 this->verbose(), this->sanityCheck());
+		if(_pool != NULL && tid >= 0) {
+			mkeyQSortSufDcU8(*_pool, tid, t, t, len, s, slen, *_dc.get(), 4,
+			                 this->verbose(), this->sanityCheck());
+		} else {
+			mkeyQSortSufDcU8(t, t, len, s, slen, *_dc.get(), 4,
+			                 this->verbose(), this->sanityCheck());
+		}
 	} else {
 		VMSG_NL("  (Not using difference cover)");
 		// We don't have a difference cover - just do a normal
@@ -710,7 +777,11 @@ void KarkkainenBlockwiseSA<TStr>::buildSamples() {
             tparams[tid].begin = (tid == 0 ? 0 : len / this->_nthreads * tid);
             tparams[tid].end = (tid + 1 == this->_nthreads ? len : len / this->_nthreads * (tid + 1));
             if(this->_nthreads == 1) {
+#ifdef WITH_TBB
+                BinarySorting_worker<TStr>((void*)&tparams[tid])();
+#else
                 BinarySorting_worker<TStr>((void*)&tparams[tid]);
+#endif
             } else {
 #ifdef WITH_TBB
         			tbb_grp.run(BinarySorting_worker<TStr>(((void*)&tparams[tid])));
@@ -1179,7 +1250,7 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock(int cur_block, int tid) {
             ThreadSafe ts(_mutex);
             VMSG_NL("  Sorting block of length " << bucket.size() << " for bucket " << (cur_block+1));
         }
-        this->qsort(bucket);
+        this->qsort(bucket, this->_nthreads > 1 ? tid : -1);
     }
     if(hi != OFF_MASK) {
         // Not the final bucket; throw in the sample on the RHS
@@ -23,6 +23,9 @@
 #include <string>
 #include <cassert>
 #include <getopt.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 #include "assert_helpers.h"
 #include "endian_swap.h"
 #include "bt2_idx.h"
@@ -34,6 +37,11 @@
 #include "filebuf.h"
 #include "reference.h"
 #include "ds.h"
+#include "threading.h"
+#include "build_metrics.h"
+#ifdef WITH_TBB
+ #include <thread>
+#endif
 
 /**
  * \file Driver for the bowtie-build indexing tool.
@@ -67,6 +75,14 @@ static bool justRef;
 static bool reverseEach;
 static int nthreads;
 static string wrapper;
+static bool writeContainer; // also write single-file .idx container
+static bool concurrentMirror; // build forward and mirror indexes at once
+static uint64_t maxMem;     // memory budget in bytes; 0 = no budget
+static bool append;         // add the input to an existing index
+static bool dedupRef;       // store identical sequences once in .3/.4
+static int metricsIval;     // seconds between progress reports
+static string metricsFile;  // file to write build metrics to
+static bool metricsStderr;  // write build metrics to stderr
 
 static void resetOptions() {
 	verbose      = true;  // be talkative (default)
@@ -77,7 +93,7 @@ static void resetOptions() {
 	bmaxDivN     = 4;          // same, as divisor of n
 	dcv          = 1024;  // bwise SA difference-cover sample sz
 	noDc         = 0;     // disable difference-cover sample
-	entireSA     = 0;     // 1 = disable blockwise SA
+	entireSA     = 0;     // 1 = build whole SA at once with SA-IS
 	seed         = 0;     // srandom seed
 	showVersion  = 0;     // just print version and quit?
 	//   Ebwt parameters
@@ -96,6 +112,14 @@ static void resetOptions() {
 	reverseEach  = false;
 	nthreads     = 1;
 	wrapper.clear();
+	writeContainer = false; // don't write .idx container
+	concurrentMirror = false; // build mirror index after forward index
+	maxMem       = 0;     // no memory budget
+	append       = false; // build a new index
+	dedupRef     = false; // store every sequence's bases
+	metricsIval  = 1;     // report progress every second
+	metricsFile  = "";    // no metrics file
+	metricsStderr = false; // no metrics on stderr
 }
 
 // Argument constants for getopts
@@ -112,7 +136,16 @@ enum {
 	ARG_REVERSE_EACH,
 	ARG_SA,
 	ARG_THREADS,
-	ARG_WRAPPER
+	ARG_WRAPPER,
+	ARG_CONTAINER,
+	ARG_SA_ALGO,
+	ARG_CONCURRENT_MIRROR,
+	ARG_MAX_MEM,
+	ARG_APPEND,
+	ARG_DEDUP_REF,
+	ARG_METRIC_IVAL,
+	ARG_METRIC_FILE,
+	ARG_METRIC_STDERR
 };
 
 /**
@@ -152,12 +185,24 @@ static void printUsage(ostream& out) {
 	    << "    --bmax <int>            max bucket sz for blockwise suffix-array builder" << endl
 	    << "    --bmaxdivn <int>        max bucket sz as divisor of ref len (default: 4)" << endl
 	    << "    --dcv <int>             diff-cover period for blockwise (default: 1024)" << endl
+	    << "    --max-mem <size>        pick -p/--bmax/--dcv to fit in <size> bytes; K/M/G ok" << endl
 	    << "    --nodc                  disable diff-cover (algorithm becomes quadratic)" << endl
+	    << "    --sa-algo <alg>         suffix-array algorithm: blockwise or sais; sais is" << endl
+	    << "                            faster but needs 4-8 bytes/ref char (default: blockwise)" << endl
 	    << "    -r/--noref              don't build .3/.4 index files" << endl
 	    << "    -3/--justref            just build .3/.4 index files" << endl
+	    << "    --dedup-ref             store identical sequences once in .3/.4 files" << endl
 	    << "    -o/--offrate <int>      SA is sampled every 2^<int> BWT chars (default: 5)" << endl
 	    << "    -t/--ftabchars <int>    # of chars consumed in initial lookup (default: 10)" << endl
 	    << "    --threads <int>         # of threads" << endl
+	    << "    --concurrent-mirror     read ref once; build fw and mirror index at the same" << endl
+	    << "                            time, splitting --threads between them" << endl
+	    << "    --container             also write index as a single mmap-ready file" << endl
+	    << "    --append                add <reference_in> to the existing index at" << endl
+	    << "                            <bt2_index_base> instead of building a new one" << endl
+	    << "    --met-file <path>       write progress & metrics as JSON lines to <path>" << endl
+	    << "    --met-stderr            write progress & metrics as JSON lines to stderr" << endl
+	    << "    --met <int>             report progress every <int> secs (default: 1)" << endl
 	    //<< "    --ntoa                  convert Ns in reference to As" << endl
 	    //<< "    --big --little          endianness (default: little, this host: "
 	    //<< (currentlyBigEndian()? "big":"little") << ")" << endl
@@ -207,6 +252,15 @@ static struct option long_options[] = {
 	{(char*)"threads",      required_argument, 0,            ARG_THREADS},
 	{(char*)"usage",        no_argument,       0,            ARG_USAGE},
 	{(char*)"wrapper",      required_argument, 0,            ARG_WRAPPER},
+	{(char*)"container",    no_argument,       0,            ARG_CONTAINER},
+	{(char*)"sa-algo",      required_argument, 0,            ARG_SA_ALGO},
+	{(char*)"concurrent-mirror", no_argument,  0,            ARG_CONCURRENT_MIRROR},
+	{(char*)"max-mem",      required_argument, 0,            ARG_MAX_MEM},
+	{(char*)"append",       no_argument,       0,            ARG_APPEND},
+	{(char*)"dedup-ref",    no_argument,       0,            ARG_DEDUP_REF},
+	{(char*)"met",          required_argument, 0,            ARG_METRIC_IVAL},
+	{(char*)"met-file",     required_argument, 0,            ARG_METRIC_FILE},
+	{(char*)"met-stderr",   no_argument,       0,            ARG_METRIC_STDERR},
 	{(char*)0, 0, 0, 0} // terminator
 };
 
@@ -233,6 +287,32 @@ static T parseNumber(T lower, const char *errmsg) {
 	return -1;
 }
 
+/**
+ * Parse a size in bytes, optionally followed by K, M, G or T, out of
+ * optarg.  Prints the given error message and throws 1 if it isn't
+ * a positive size.
+ */
+static uint64_t parseMemSize(const char *errmsg) {
+	char *endPtr = NULL;
+	double sz = strtod(optarg, &endPtr);
+	if(endPtr != NULL && endPtr != optarg && sz > 0) {
+		switch(toupper(*endPtr)) {
+			case 'T': sz *= 1024.0;
+			case 'G': sz *= 1024.0;
+			case 'M': sz *= 1024.0;
+			case 'K': sz *= 1024.0; endPtr++;
+			default: break;
+		}
+		if(*endPtr == '\0' || (toupper(*endPtr) == 'B' && endPtr[1] == '\0')) {
+			return (uint64_t)sz;
+		}
+	}
+	cerr << errmsg << endl;
+	printUsage(cerr);
+	throw 1;
+	return 0;
+}
+
 /**
  * Read command-line arguments
  */
@@ -309,9 +389,32 @@ static bool parseOptions(int argc, const char **argv) {
 				doSaFile = true;
 				break;
 			case ARG_NTOA: nsToAs = true; break;
+			case ARG_CONTAINER: writeContainer = true; break;
+			case ARG_CONCURRENT_MIRROR: concurrentMirror = true; break;
+			case ARG_APPEND: append = true; break;
+			case ARG_DEDUP_REF: dedupRef = true; break;
+			case ARG_METRIC_FILE: metricsFile = optarg; break;
+			case ARG_METRIC_STDERR: metricsStderr = true; break;
+			case ARG_METRIC_IVAL:
+				metricsIval = parseNumber<int>(0, "--met arg must be at least 0");
+				break;
+			case ARG_SA_ALGO:
+				if(strcmp(optarg, "sais") == 0) {
+					entireSA = 1;
+				} else if(strcmp(optarg, "blockwise") == 0) {
+					entireSA = 0;
+				} else {
+					cerr << "--sa-algo arg must be \"blockwise\" or \"sais\"" << endl;
+					printUsage(cerr);
+					throw 1;
+				}
+				break;
 			case ARG_THREADS:
 				nthreads = parseNumber<int>(0, "--threads arg must be at least 1");
 				break;
+			case ARG_MAX_MEM:
+				maxMem = parseMemSize("--max-mem arg must be a size such as 4096M or 64G");
+				break;
 			case 'a': autoMem = false; break;
 			case 'q': verbose = false; break;
 			case 's': sanityCheck = true; break;
@@ -335,6 +438,16 @@ static bool parseOptions(int argc, const char **argv) {
 	if (!bmaxDivNSet) {
 		bmaxDivN *= nthreads;
 	}
+	if(writeContainer && (!writeRef || justRef)) {
+		cerr << "Error: --container requires both the index and the reference (.3/.4) files;" << endl
+		     << "it can't be combined with -r/--noref or -3/--justref" << endl;
+		throw 1;
+	}
+	if(append && (!writeRef || justRef || reverseEach || doSaFile || dedupRef)) {
+		cerr << "Error: --append can't be combined with -r/--noref, -3/--justref," << endl
+		     << "--reverse-each, --sa or --dedup-ref" << endl;
+		throw 1;
+	}
 	return abort;
 }
 
@@ -358,20 +471,170 @@ static void deleteIdxFiles(
 }
 
 /**
- * Drive the index construction process and optionally sanity-check the
- * result.
+ * Re-read the forward index, mirror index and reference that were just
+ * written and copy them into a single-file container.  Each Ebwt is
+ * evicted before the next is loaded so that peak memory stays about the
+ * same as for the build itself.
  */
-template<typename TStr>
-static void driver(
+static void buildContainer(const string& outfile) {
+	string fname = containerFilename(outfile);
+	// A stale container must not be picked up while we re-read the
+	// index below
+	remove(fname.c_str());
+	filesWritten.push_back(fname);
+	IndexContainerWriter w(fname);
+	for(int fw = 1; fw >= 0; fw--) {
+		Ebwt ebwt(
+			fw ? outfile : (outfile + ".rev"),
+			0,                    // index is colorspace
+			-1,                   // don't care about entire-reverse
+			fw == 1,              // index is for the forward direction
+			-1,                   // offrate (-1 = index default)
+			0,                    // offrate-plus (0 = index default)
+			false,                // use memory-mapped IO
+			false,                // use shared memory
+			false,                // sweep memory-mapped memory
+			true,                 // load names?
+			fw == 1,              // load SA sample?
+			true,                 // load ftab?
+			true,                 // load rstarts?
+			false,                // be talkative?
+			false,                // be talkative at startup?
+			false,                // pass up memory exceptions?
+			false);               // sanity check?
+		ebwt.loadIntoMemory(
+			0,      // color
+			-1,     // need entire reverse
+			fw == 1,// load SA sample
+			true,   // load ftab
+			true,   // load rstarts
+			true,   // load names
+			false); // verbose
+		ebwt.writeToContainer(w);
+		ebwt.evictFromMemory();
+	}
+	BitPairReference ref(outfile, false);
+	if(!ref.loaded()) {
+		throw 1;
+	}
+	ref.writeToContainer(w);
+	w.finish();
+}
+
+/**
+ * Estimate the peak number of bytes used by one index build over a
+ * reference of 'len' unambiguous characters with the given settings.
+ * 'text' is what the joined reference itself takes; blockwise builds
+ * are modeled after the ahead-of-time allocation test in
+ * Ebwt::initFromVector().
+ */
+static uint64_t buildMemUsage(
+	uint64_t len,
+	uint64_t text,
+	bool sais,
+	uint64_t bm,
+	uint32_t v,
+	int nthr)
+{
+	const uint64_t osz = sizeof(TIndexOffU);
+	// ftab and absorbFtab in buildToDisk(), one more ftab and 80 MB of
+	// caution for the ahead-of-time allocation test, plus 16 MB for the
+	// rest of the program
+	uint64_t ftabLen = (1ull << (ftabChars * 2)) + 1;
+	uint64_t fixed = ftabLen * (2 * osz + 1) + (96ull << 20);
+	if(sais) {
+		return text + fixed + (len + 1) * sizeof(TIndexOff) + ((len + 8) >> 3);
+	}
+	uint64_t dcPeak = 0, dcResident = 0;
+	if(v > 0) {
+		uint64_t sPrime = (len / v) * getDiffCover<uint32_t>(v).size();
+		// sPrime, sPrimeOrder and _isaPrime exist at once while the
+		// sample is built; _isaPrime stays for the rest of the build
+		dcPeak = max<uint64_t>(3 * sPrime * osz, 4 * sPrime * (nthr + 1));
+		dcResident = sPrime * osz;
+	}
+	// Every sorting thread and the consumer hold a bucket, with as
+	// much again for sorting them; plus the sample suffixes
+	uint64_t blocks = (uint64_t)(nthr + 1) * 2 * bm * osz + (len / max<uint64_t>(bm, 1)) * osz;
+	return text + fixed + max<uint64_t>(dcPeak, dcResident + blocks);
+}
+
+/**
+ * Choose -p/--packed, --bmax and --dcv (and whether --sa-algo sais is
+ * affordable) so that building the index of a reference with 'len'
+ * unambiguous characters fits in --max-mem.  Returns false if the
+ * build only fits with a packed reference and 'packed' is false.
+ * Throws 1 if it doesn't fit at all.
+ */
+static bool fitMaxMem(uint64_t len, bool packed) {
+	// With --concurrent-mirror, two builds and two copies of the
+	// reference share the budget
+	int nbuilds = concurrentMirror ? 2 : 1;
+	uint64_t budget = maxMem / nbuilds;
+	int nthr = max<int>(1, (nthreads + nbuilds - 1) / nbuilds);
+	uint64_t text = packed ? ((len + 3) >> 2) : len;
+	if(entireSA) {
+		if(buildMemUsage(len, text, true, 0, 0, nthr) <= budget) {
+			if(verbose) {
+				cout << "Memory budget of " << (maxMem >> 20) << " MB fits --sa-algo sais" << endl;
+			}
+			return true;
+		}
+		if(verbose) {
+			cout << "SA-IS needs more than the memory budget; using the blockwise algorithm" << endl;
+		}
+		entireSA = 0;
+	}
+	// Buckets much smaller than sqrt(len) make for so many sample
+	// suffixes that building gets very slow
+	uint64_t minBmax = max<uint64_t>((uint64_t)sqrt((double)len), 1024);
+	uint64_t maxBmax = max<uint64_t>(len / 4, minBmax);
+	uint32_t v0 = noDc ? 0 : max<uint32_t>(dcv, 1024);
+	for(uint32_t v = v0; ; v <<= 1) {
+		// Find the largest bucket size that fits
+		uint64_t lo = minBmax, hi = maxBmax;
+		if(buildMemUsage(len, text, false, lo, v, nthr) <= budget) {
+			while(lo < hi) {
+				uint64_t mid = lo + (hi - lo + 1) / 2;
+				if(buildMemUsage(len, text, false, mid, v, nthr) <= budget) {
+					lo = mid;
+				} else {
+					hi = mid - 1;
+				}
+			}
+			bmax = (TIndexOffU)lo;
+			bmaxMultSqrt = OFF_MASK;
+			bmaxDivN = 0xffffffff;
+			dcv = (int)v;
+			if(verbose) {
+				cout << "Memory budget of " << (maxMem >> 20) << " MB: --bmax " << bmax
+				     << " --dcv " << dcv << (packed ? " --packed" : "") << endl;
+			}
+			return true;
+		}
+		if(v == 0 || v >= 4096) break;
+	}
+	if(!packed) {
+		// Try again with a 2-bit-per-base reference
+		return false;
+	}
+	uint64_t need = buildMemUsage(len, text, false, minBmax, noDc ? 0 : 4096, nthr) * nbuilds;
+	cerr << "A --max-mem of " << (maxMem >> 20) << " MB is too small to index this reference;" << endl
+	     << "it needs at least about " << ((need >> 20) + 1) << " MB." << endl;
+	throw 1;
+	return false;
+}
+
+/**
+ * Open each reference input, or with -c adapt each sequence given on
+ * the command line, as a FileBuf and append it to 'is'.  Throws 1 if
+ * none has any content.
+ */
+static void openRefInputs(
 	const string& infile,
 	EList<string>& infiles,
-	const string& outfile,
-	bool packed,
-	int reverse)
+	EList<FileBuf*>& is)
 {
-	EList<FileBuf*> is(MISC_CAT);
-	bool bisulfite = false;
-	RefReadInParams refparams(false, reverse, nsToAs, bisulfite);
 	assert_gt(infiles.size(), 0);
 	if(format == CMDLINE) {
 		// Adapt sequence strings to stringstreams open for input
@@ -425,6 +688,116 @@ static void driver(
 		cerr << "Warning: All fasta inputs were empty" << endl;
 		throw 1;
 	}
+}
+
+/**
+ * Delete the FileBufs opened by openRefInputs().
+ */
+static void closeRefInputs(EList<FileBuf*>& is) {
+        for (size_t i = 0; i < is.size(); ++i) {
+		if (is[i] != NULL)
+			// FileBuf object closes file when deconstructed
+			delete is[i];
+        }
+	is.clear();
+}
+
+/**
+ * Read the reference sizes from 'is' into 'szs', writing the .3/.4
+ * files as we go if this is the forward index and they're wanted.
+ */
+static std::pair<size_t, size_t> readRefSizes(
+	EList<FileBuf*>& is,
+	const string& outfile,
+	const RefReadInParams& refparams,
+	int reverse,
+	EList<RefRecord>& szs)
+{
+	if(verbose) cout << "Reading reference sizes" << endl;
+	Timer _t(cout, "  Time reading reference sizes: ", verbose);
+	BuildPhase phase(outfile, "ref_sizes", "bases");
+	std::pair<size_t, size_t> sztot;
+	if(!reverse && (writeRef || justRef)) {
+		filesWritten.push_back(outfile + ".3." + gEbwt_ext);
+		filesWritten.push_back(outfile + ".4." + gEbwt_ext);
+		sztot = BitPairReference::szsFromFasta(is, outfile, bigEndian, refparams, szs, sanityCheck, nthreads);
+		if(dedupRef) {
+			BuildPhase dedupPhase(outfile, "dedup_ref", "bases", sztot.first);
+			TIndexOffU saved = 0;
+			TIndexOffU n = BitPairReference::dedupRefFiles(outfile, saved);
+			if(verbose) {
+				cout << "Stored " << n << " duplicate reference sequence(s) as aliases, saving "
+				     << saved << " bases in the .4." << gEbwt_ext << " file" << endl;
+			}
+		}
+	} else {
+		sztot = BitPairReference::szsFromFasta(is, string(), bigEndian, refparams, szs, sanityCheck, nthreads);
+	}
+	phase.progress(sztot.second);
+	return sztot;
+}
+
+/**
+ * Try restoring the original string from a freshly built index (if
+ * there were multiple texts, what we'll get back is the joined,
+ * padded string, not a list) and check it against the reference.
+ */
+static void checkRestore(
+	Ebwt& ebwt,
+	EList<FileBuf*>& is,
+	EList<RefRecord>& szs,
+	TIndexOffU sztot,
+	const RefReadInParams& refparams)
+{
+	ebwt.loadIntoMemory(
+		0,
+		refparams.reverse ? (refparams.reverse == REF_READ_REVERSE) : 0,
+		true,  // load SA sample?
+		true,  // load ftab?
+		true,  // load rstarts?
+		false,
+		false);
+	SString<char> s2;
+	ebwt.restore(s2);
+	ebwt.evictFromMemory();
+	{
+		SString<char> joinedss = Ebwt::join<SString<char> >(
+			is,          // list of input streams
+			szs,         // list of reference sizes
+			sztot,       // total size of all unambiguous ref chars
+			refparams,   // reference read-in parameters
+			seed);       // pseudo-random number generator seed
+		if(refparams.reverse == REF_READ_REVERSE) {
+			joinedss.reverse();
+		}
+		assert_eq(joinedss.length(), s2.length());
+		assert(sstr_eq(joinedss, s2));
+	}
+	if(verbose) {
+		if(s2.length() < 1000) {
+			cout << "Passed restore check: " << s2.toZBuf() << endl;
+		} else {
+			cout << "Passed restore check: (" << s2.length() << " chars)" << endl;
+		}
+	}
+}
+
+/**
+ * Drive the index construction process and optionally sanity-check the
+ * result.
+ */
+template<typename TStr>
+static void driver(
+	const string& infile,
+	EList<string>& infiles,
+	const string& outfile,
+	bool packed,
+	int reverse)
+{
+	EList<FileBuf*> is(MISC_CAT);
+	bool bisulfite = false;
+	RefReadInParams refparams(false, reverse, nsToAs, bisulfite);
+	openRefInputs(infile, infiles, is);
 	if(!reverse) {
 #ifdef BOWTIE_64BIT_INDEX
 		if (verbose) cerr << "Building a LARGE index" << endl;
@@ -436,19 +809,15 @@ static void driver(
 	// sequences.  A record represents a stretch of unambiguous
 	// characters in one of the input sequences.
 	EList<RefRecord> szs(MISC_CAT);
-	std::pair<size_t, size_t> sztot;
-	{
-		if(verbose) cout << "Reading reference sizes" << endl;
-		Timer _t(cout, "  Time reading reference sizes: ", verbose);
-		if(!reverse && (writeRef || justRef)) {
-			filesWritten.push_back(outfile + ".3." + gEbwt_ext);
-			filesWritten.push_back(outfile + ".4." + gEbwt_ext);
-			sztot = BitPairReference::szsFromFasta(is, outfile, bigEndian, refparams, szs, sanityCheck);
-		} else {
-			sztot = BitPairReference::szsFromFasta(is, string(), bigEndian, refparams, szs, sanityCheck);
-		}
+	std::pair<size_t, size_t> sztot = readRefSizes(is, outfile, refparams, reverse, szs);
+	if(justRef) {
+		closeRefInputs(is);
+		return;
+	}
+	if(maxMem > 0 && !fitMaxMem(sztot.first, packed)) {
+		closeRefInputs(is);
+		throw bad_alloc();
 	}
-	if(justRef) return;
 	assert_gt(sztot.first, 0);
 	assert_gt(sztot.second, 0);
 	assert_gt(szs.size(), 0);
@@ -489,51 +858,508 @@ static void driver(
 		ebwt.eh().print(cout);
 	}
 	if(sanityCheck) {
-		// Try restoring the original string (if there were
-		// multiple texts, what we'll get back is the joined,
-		// padded string, not a list)
-		ebwt.loadIntoMemory(
+		checkRestore(ebwt, is, szs, (TIndexOffU)sztot.first, refparams);
+	}
+	closeRefInputs(is);
+}
+
+/**
+ * One of the two builds run at once by driverConcurrent().
+ */
+template<typename TStr>
+struct IndexBuildJob {
+	const TStr          *joined;   // reference, oriented for this index
+	const EList<string> *names;    // reference sequence names
+	EList<FileBuf*>     *is;       // input streams (not read)
+	EList<RefRecord>    *szs;      // reference sizes
+	TIndexOffU           sztot;    // total size of all unambiguous ref chars
+	string               outfile;  // basename for the index files
+	bool                 packed;
+	int                  reverse;  // REF_READ_FORWARD or REF_READ_REVERSE
+	int                  nthreads; // this build's share of --threads
+	bool                 verbose;
+	Ebwt                *ebwt;     // the built index
+	bool                 oom;      // ran out of memory
+	int                  err;      // nonzero if an int was thrown
+};
+
+/**
+ * Build the index described by an IndexBuildJob, recording rather than
+ * throwing any failure so the other build can finish.
+ */
+template<typename TStr>
+static void indexBuildWorker(void *vp) {
+	IndexBuildJob<TStr>* job = (IndexBuildJob<TStr>*)vp;
+	RefReadInParams refparams(false, job->reverse, nsToAs, false);
+	try {
+		job->ebwt = new Ebwt(
+			TStr(),
+			job->packed,
 			0,
-			reverse ? (refparams.reverse == REF_READ_REVERSE) : 0,
-			true,  // load SA sample?
-			true,  // load ftab?
-			true,  // load rstarts?
-			false,
-			false);
-		SString<char> s2;
-		ebwt.restore(s2);
-		ebwt.evictFromMemory();
+			1,            // TODO: maybe not?
+			lineRate,
+			offRate,      // suffix-array sampling rate
+			ftabChars,    // number of chars in initial arrow-pair calc
+			job->nthreads,// number of threads
+			job->outfile, // basename for .?.ebwt files
+			job->reverse == 0, // fw
+			!entireSA,    // useBlockwise
+			bmax,         // block size for blockwise SA builder
+			bmaxMultSqrt, // block size as multiplier of sqrt(len)
+			bmaxDivN,     // block size as divisor of len
+			noDc? 0 : dcv,// difference-cover period
+			*job->is,     // list of input streams
+			*job->szs,    // list of reference sizes
+			job->sztot,   // total size of all unambiguous ref chars
+			refparams,    // reference read-in parameters
+			seed,         // pseudo-random number generator seed
+			-1,           // override offRate
+			doSaFile,     // make a file with just the suffix array in it
+			doBwtFile,    // make a file with just the BWT string in it
+			job->verbose, // be talkative
+			autoMem,      // pass exceptions up to the toplevel so that we can adjust memory settings automatically
+			sanityCheck,  // verify results and internal consistency
+			job->joined,  // reference, already joined
+			job->names);  // and its sequence names
+	} catch(bad_alloc& e) {
+		job->oom = true;
+	} catch(int e) {
+		job->err = (e == 0) ? 1 : e;
+	} catch(std::exception& e) {
+		cerr << "Error: Encountered exception: '" << e.what() << "'" << endl;
+		job->err = 1;
+	}
+}
+
+/**
+ * Like driver(), but read and join the reference just once and then
+ * build the forward and mirror indexes at the same time, each on its
+ * own thread with half of --threads.  Only the forward build reports
+ * its progress.
+ */
+template<typename TStr>
+static void driverConcurrent(
+	const string& infile,
+	EList<string>& infiles,
+	const string& outfile,
+	bool packed)
+{
+	EList<FileBuf*> is(MISC_CAT);
+	RefReadInParams refparams(false, REF_READ_FORWARD, nsToAs, false);
+	openRefInputs(infile, infiles, is);
+#ifdef BOWTIE_64BIT_INDEX
+	if (verbose) cerr << "Building a LARGE index" << endl;
+#else
+	if (verbose) cerr << "Building a SMALL index" << endl;
+#endif
+	EList<RefRecord> szs(MISC_CAT);
+	std::pair<size_t, size_t> sztot = readRefSizes(is, outfile, refparams, REF_READ_FORWARD, szs);
+	if(justRef) {
+		closeRefInputs(is);
+		return;
+	}
+	if(maxMem > 0 && !fitMaxMem(sztot.first, packed)) {
+		closeRefInputs(is);
+		throw bad_alloc();
+	}
+	assert_gt(sztot.first, 0);
+	assert_gt(sztot.second, 0);
+	assert_gt(szs.size(), 0);
+	EList<string> names(EBWT_CAT);
+	if(verbose) cout << "Joining reference sequences" << endl;
+	BuildPhase joinPhase(outfile, "join", "bases", sztot.second);
+	TStr fwStr = Ebwt::join<TStr>(is, szs, (TIndexOffU)sztot.first, refparams, seed, &names, nthreads);
+	joinPhase.end();
+	BuildPhase revPhase(outfile + ".rev", "reverse", "bases", sztot.second);
+	TStr revStr(fwStr);
+	revStr.reverse();
+	revPhase.end();
+	IndexBuildJob<TStr> jobs[2];
+	for(int i = 0; i < 2; i++) {
+		IndexBuildJob<TStr>& job = jobs[i];
+		job.joined   = (i == 0) ? &fwStr : &revStr;
+		job.names    = &names;
+		job.is       = &is;
+		job.szs      = &szs;
+		job.sztot    = (TIndexOffU)sztot.first;
+		job.outfile  = (i == 0) ? outfile : (outfile + ".rev");
+		job.packed   = packed;
+		job.reverse  = (i == 0) ? REF_READ_FORWARD : REF_READ_REVERSE;
+		// The forward build gets the odd thread, if any
+		job.nthreads = max<int>(1, (i == 0) ? (nthreads + 1) / 2 : nthreads / 2);
+		job.verbose  = verbose && i == 0;
+		job.ebwt     = NULL;
+		job.oom      = false;
+		job.err      = 0;
+		filesWritten.push_back(job.outfile + ".1." + gEbwt_ext);
+		filesWritten.push_back(job.outfile + ".2." + gEbwt_ext);
+	}
+	if(verbose) {
+		cout << "Building forward and mirror indexes concurrently with "
+		     << jobs[0].nthreads << " and " << jobs[1].nthreads << " thread(s)" << endl;
+	}
+#ifdef WITH_TBB
+	EList<std::thread*> builders;
+#else
+	EList<tthread::thread*> builders;
+#endif
+	for(int i = 0; i < 2; i++) {
+#ifdef WITH_TBB
+		builders.push_back(new std::thread(indexBuildWorker<TStr>, (void*)&jobs[i]));
+#else
+		builders.push_back(new tthread::thread(indexBuildWorker<TStr>, (void*)&jobs[i]));
+#endif
+	}
+	for(size_t i = 0; i < builders.size(); i++) {
+		builders[i]->join();
+		delete builders[i];
+	}
+	// Both builds are over, so give up if either failed
+	bool oom = false;
+	int err = 0;
+	for(int i = 0; i < 2; i++) {
+		oom = oom || jobs[i].oom;
+		if(err == 0) err = jobs[i].err;
+	}
+	if(oom || err != 0) {
+		for(int i = 0; i < 2; i++) delete jobs[i].ebwt;
+		closeRefInputs(is);
+		if(err != 0) throw err;
+		throw bad_alloc();
+	}
+	for(int i = 0; i < 2; i++) {
+		if(verbose) {
+			// Print Ebwt's vital stats
+			jobs[i].ebwt->eh().print(cout);
+		}
+		if(sanityCheck) {
+			RefReadInParams rp(false, jobs[i].reverse, nsToAs, false);
+			checkRestore(*jobs[i].ebwt, is, szs, (TIndexOffU)sztot.first, rp);
+		}
+		delete jobs[i].ebwt;
+	}
+	closeRefInputs(is);
+}
+
+/**
+ * Return true iff the named file exists.
+ */
+static bool fileExists(const string& fname) {
+	struct stat sbuf;
+	return stat(fname.c_str(), &sbuf) == 0;
+}
+
+/**
+ * Read the records of an existing .3 file into 'szs'.  Sets 'be' to
+ * true iff the file is big-endian.
+ */
+static void readRefRecords(const string& fname, EList<RefRecord>& szs, bool& be) {
+	FILE *f3 = fopen(fname.c_str(), "rb");
+	if(f3 == NULL) {
+		cerr << "Could not open reference-string index file " << fname.c_str() << " for reading." << endl;
+		throw 1;
+	}
+	bool swap = false;
+	uint32_t one = readU<int32_t>(f3, swap);
+	if(one != 1) {
+		assert_eq(0x1000000, one);
+		swap = true; // have to endian swap U32s
+	}
+	be = (currentlyBigEndian() != swap);
+	TIndexOffU sz = readU<TIndexOffU>(f3, swap);
+	for(TIndexOffU i = 0; i < sz; i++) {
+		szs.push_back(RefRecord(f3, swap));
+	}
+	if(fgetc(f3) != EOF) {
+		// The .4 file doesn't hold every sequence's bases
+		cerr << "Error: can't --append to an index built with --dedup-ref; rebuild it from scratch" << endl;
+		fclose(f3);
+		throw 1;
+	}
+	fclose(f3);
+}
+
+/**
+ * Write the .3 and .4 files for the existing reference at 'base' with
+ * the sequences in 'szs'/'add' appended to 'outfile'.  The .4 file of
+ * 'base', holding 'baseLen' bases, is copied and the new bases packed
+ * on after it.
+ */
+template<typename TStr>
+static void appendRefFiles(
+	const string& base,
+	const string& outfile,
+	const EList<RefRecord>& szs,
+	bool be,
+	TIndexOffU baseLen,
+	const TStr& add)
+{
+	string file3 = outfile + ".3." + gEbwt_ext;
+	string file4 = outfile + ".4." + gEbwt_ext;
+	ofstream fout3(file3.c_str(), ios::binary);
+	ofstream fout4(file4.c_str(), ios::binary);
+	if(!fout3.good() || !fout4.good()) {
+		cerr << "Could not open index file for writing: \""
+		     << (fout3.good() ? file4 : file3).c_str() << "\"" << endl
+		     << "Please make sure the directory exists and that permissions allow writing by" << endl
+		     << "Bowtie." << endl;
+		throw 1;
+	}
+	writeU<int32_t>(fout3, 1, be); // endianness sentinel
+	writeU<TIndexOffU>(fout3, (TIndexOffU)szs.size(), be);
+	for(size_t i = 0; i < szs.size(); i++) {
+		RefRecord r = szs[i];
+		r.write(fout3, be);
+	}
+	// Copy the whole bytes of the old .4 file and pack the new bases in
+	// after the last old one
+	string in4 = base + ".4." + gEbwt_ext;
+	FILE *f4 = fopen(in4.c_str(), "rb");
+	if(f4 == NULL) {
+		cerr << "Could not open reference-string index file " << in4.c_str() << " for reading." << endl;
+		throw 1;
+	}
+	uint64_t whole = baseLen >> 2;
+	char buf[64 * 1024];
+	while(whole > 0) {
+		size_t n = fread(buf, 1, (size_t)min<uint64_t>(whole, sizeof(buf)), f4);
+		if(n == 0) {
+			cerr << "Error: " << in4.c_str() << " is shorter than its index says" << endl;
+			throw 1;
+		}
+		fout4.write(buf, n);
+		whole -= n;
+	}
+	int bp = baseLen & 3;
+	int cur = (bp > 0) ? fgetc(f4) : 0;
+	fclose(f4);
+	if(cur == EOF) {
+		cerr << "Error: " << in4.c_str() << " is shorter than its index says" << endl;
+		throw 1;
+	}
+	for(size_t i = 0; i < add.length(); i++) {
+		cur |= ((int)add[i] << (bp << 1));
+		if(++bp == 4) {
+			fout4.put((char)cur);
+			cur = bp = 0;
+		}
+	}
+	if(bp > 0) fout4.put((char)cur);
+	fout3.close();
+	fout4.close();
+	if(fout3.fail() || fout4.fail()) {
+		cerr << "An error occurred writing the index to disk.  Please check if the disk is full." << endl;
+		throw 1;
+	}
+}
+
+/**
+ * Add the sequences in 'infiles' to the existing index 'outfile'.
+ * Only the new suffixes are sorted; each of the forward and mirror
+ * indexes is loaded and merged with them (see Ebwt::mergeToDisk()).
+ * The new files are written next to the old ones and renamed over
+ * them once they're all complete, so the old index stays intact if
+ * anything goes wrong.  The result is the same as building the index
+ * for the old sequences followed by the new ones from scratch.
+ */
+template<typename TStr>
+static void driverAppend(
+	const string& infile,
+	EList<string>& infiles,
+	const string& outfile,
+	bool packed)
+{
+	const char *exts[] = { ".1.", ".2.", ".rev.1.", ".rev.2.", ".3.", ".4." };
+	const size_t nexts = sizeof(exts) / sizeof(exts[0]);
+	for(size_t i = 0; i < nexts; i++) {
+		string fname = outfile + exts[i] + gEbwt_ext;
+		if(!fileExists(fname)) {
+			cerr << "Error: --append needs an existing index; could not find \"" << fname.c_str() << "\"" << endl;
+#ifndef BOWTIE_64BIT_INDEX
+			if(fileExists(outfile + exts[i] + "bt2l")) {
+				cerr << "To add to a large index, use bowtie2-build --large-index" << endl;
+			}
+#endif
+			throw 1;
+		}
+	}
+	EList<RefRecord> szs(MISC_CAT);
+	bool be = false;
+	readRefRecords(outfile + ".3." + gEbwt_ext, szs, be);
+	ASSERT_ONLY(size_t nold = szs.size());
+
+	EList<FileBuf*> is(MISC_CAT);
+	RefReadInParams refparams(false, REF_READ_FORWARD, nsToAs, false);
+	openRefInputs(infile, infiles, is);
+	EList<RefRecord> szsAdd(MISC_CAT);
+	std::pair<size_t, size_t> sztot;
+	{
+		if(verbose) cout << "Reading reference sizes" << endl;
+		Timer _t(cout, "  Time reading reference sizes: ", verbose);
+		BuildPhase phase(outfile, "ref_sizes", "bases");
+		sztot = BitPairReference::szsFromFasta(is, string(), bigEndian, refparams, szsAdd, sanityCheck, nthreads);
+		phase.progress(sztot.second);
+	}
+	if(sztot.first == 0) {
+		cerr << "Error: No unambiguous stretches of characters in the input.  Aborting..." << endl;
+		closeRefInputs(is);
+		throw 1;
+	}
+	EList<string> names(EBWT_CAT);
+	if(verbose) cout << "Joining new reference sequences" << endl;
+	BuildPhase joinPhase(outfile, "join", "bases", sztot.second);
+	TStr fwStr = Ebwt::join<TStr>(is, szsAdd, (TIndexOffU)sztot.first, refparams, seed, &names, nthreads);
+	joinPhase.end();
+	TStr revStr(fwStr);
+	revStr.reverse();
+	for(size_t i = 0; i < szsAdd.size(); i++) {
+		szs.push_back(szsAdd[i]);
+	}
+
+	string tmpfile = outfile + ".append";
+	TIndexOffU baseLen = 0;
+	for(int fw = 1; fw >= 0; fw--) {
+		string basefile = fw ? outfile : (outfile + ".rev");
+		Ebwt base(
+			basefile,
+			0,                    // index is colorspace
+			-1,                   // don't care about entire-reverse
+			fw == 1,              // index is for the forward direction
+			-1,                   // offrate (-1 = index default)
+			0,                    // offrate-plus (0 = index default)
+			false,                // use memory-mapped IO
+			false,                // use shared memory
+			false,                // sweep memory-mapped memory
+			true,                 // load names?
+			true,                 // load SA sample?
+			true,                 // load ftab?
+			true,                 // load rstarts?
+			false,                // be talkative?
+			false,                // be talkative at startup?
+			false,                // pass up memory exceptions?
+			false);               // sanity check?
 		{
-			SString<char> joinedss = Ebwt::join<SString<char> >(
-				is,          // list of input streams
-				szs,         // list of reference sizes
-				(TIndexOffU)sztot.first, // total size of all unambiguous ref chars
-				refparams,   // reference read-in parameters
-				seed);       // pseudo-random number generator seed
-			if(refparams.reverse == REF_READ_REVERSE) {
-				joinedss.reverse();
+			Timer timer(cout, "  Time loading existing index: ", verbose);
+			base.loadIntoMemory(
+				0,      // color
+				-1,     // need entire reverse
+				true,   // load SA sample
+				true,   // load ftab
+				true,   // load rstarts
+				true,   // load names
+				false); // verbose
+		}
+		if(fw) {
+			baseLen = base.eh()._len;
+			if(baseLen + (TIndexOffU)sztot.first < baseLen ||
+			   baseLen + (TIndexOffU)sztot.first == OFF_MASK)
+			{
+				cerr << "Error: The index would be too long for "
+#ifdef BOWTIE_64BIT_INDEX
+				     << "this version of bowtie2-build" << endl;
+#else
+				     << "a small index; rebuild it from scratch with" << endl
+				     << "bowtie2-build --large-index" << endl;
+#endif
+				closeRefInputs(is);
+				throw 1;
 			}
-			assert_eq(joinedss.length(), s2.length());
-			assert(sstr_eq(joinedss, s2));
+			EList<string>& baseNames = base.refnames();
+			// The name list ends with an empty name after the last newline
+			if(!baseNames.empty() && baseNames.back().empty()) {
+				baseNames.pop_back();
+			}
+			for(size_t i = 0; i < names.size(); i++) {
+				baseNames.push_back(names[i]);
+			}
+			names = baseNames;
 		}
+		assert_eq(baseLen, base.eh()._len);
 		if(verbose) {
-			if(s2.length() < 1000) {
-				cout << "Passed restore check: " << s2.toZBuf() << endl;
-			} else {
-				cout << "Passed restore check: (" << s2.length() << " chars)" << endl;
-			}
+			cout << "Adding " << sztot.first << " characters to the "
+			     << (fw ? "forward" : "mirror") << " index of " << baseLen << endl;
+		}
+		string tmpbase = fw ? tmpfile : (tmpfile + ".rev");
+		filesWritten.push_back(tmpbase + ".1." + gEbwt_ext);
+		filesWritten.push_back(tmpbase + ".2." + gEbwt_ext);
+		RefReadInParams rp(false, fw ? REF_READ_FORWARD : REF_READ_REVERSE, nsToAs, false);
+		Ebwt ebwt(
+			TStr(),
+			packed,
+			0,
+			1,            // TODO: maybe not?
+			base.eh()._lineRate,
+			base.eh()._offRate,   // suffix-array sampling rate
+			base.eh()._ftabChars, // number of chars in initial arrow-pair calc
+			nthreads,     // number of threads
+			tmpbase,      // basename for .?.ebwt files
+			fw == 1,      // fw
+			!entireSA,    // useBlockwise
+			bmax,         // block size for blockwise SA builder
+			bmaxMultSqrt, // block size as multiplier of sqrt(len)
+			bmaxDivN,     // block size as divisor of len
+			noDc? 0 : dcv,// difference-cover period
+			is,           // list of input streams
+			szs,          // list of reference sizes
+			baseLen + (TIndexOffU)sztot.first, // total size of all unambiguous ref chars
+			rp,           // reference read-in parameters
+			seed,         // pseudo-random number generator seed
+			-1,           // override offRate
+			false,        // make a file with just the suffix array in it
+			false,        // make a file with just the BWT string in it
+			verbose,      // be talkative
+			false,        // pass exceptions up to the toplevel
+			sanityCheck,  // verify results and internal consistency
+			fw ? &fwStr : &revStr, // new sequences, already joined
+			&names,       // names of all the sequences
+			&base);       // index to add them to
+		if(verbose) {
+			// Print Ebwt's vital stats
+			ebwt.eh().print(cout);
 		}
 	}
-
-        for (size_t i = 0; i < is.size(); ++i) {
-		if (is[i] != NULL)
-			// FileBuf object closes file when deconstructed
-			delete is[i];
-        }
+	closeRefInputs(is);
+	filesWritten.push_back(tmpfile + ".3." + gEbwt_ext);
+	filesWritten.push_back(tmpfile + ".4." + gEbwt_ext);
+	appendRefFiles(outfile, tmpfile, szs, be, baseLen, fwStr);
+	assert_eq(nold + szsAdd.size(), szs.size());
+	// Everything's written; swap the new files in
+	for(size_t i = 0; i < nexts; i++) {
+		string from = tmpfile + exts[i] + gEbwt_ext;
+		string to = outfile + exts[i] + gEbwt_ext;
+		if(rename(from.c_str(), to.c_str()) != 0) {
+			cerr << "Error: Could not rename \"" << from.c_str() << "\" to \"" << to.c_str() << "\"" << endl;
+			throw 1;
+		}
+	}
+	filesWritten.clear();
+	if(IndexContainer::exists(outfile)) {
+		// Don't leave a stale container behind
+		writeContainer = true;
+	}
 }
 
 static const char *argv0 = NULL;
 
+/**
+ * Print the peak resident set size of the process so far, so that the
+ * suffix-array algorithms can be compared on memory as well as time.
+ */
+static void printPeakRss(ostream& out, const char *what) {
+#ifndef _WIN32
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0) {
+		return;
+	}
+#ifdef __APPLE__
+	uint64_t kb = (uint64_t)ru.ru_maxrss >> 10; // bytes on macOS
+#else
+	uint64_t kb = (uint64_t)ru.ru_maxrss;       // kilobytes elsewhere
+#endif
+	out << "Peak resident set size after " << what << ": " << (kb >> 10) << " MB" << endl;
+#endif
+}
+
 extern "C" {
 /**
  * main function.  Parses command-line arguments.
@@ -622,6 +1448,12 @@ int bowtie_build(int argc, const char **argv) {
 				cout << "  Max bucket size, len divisor: " << bmaxDivN << endl;
 			}
 			cout << "  Difference-cover sample period: " << dcv << endl;
+			cout << "  Suffix-array algorithm: " << (entireSA ? "sais (bmax, dcv and threads are ignored)" : "blockwise") << endl;
+			if(maxMem == 0) {
+				cout << "  Memory budget: none" << endl;
+			} else {
+				cout << "  Memory budget: " << (maxMem >> 20) << " MB (sets bmax, dcv, packed and algorithm)" << endl;
+			}
 			cout << "  Endianness: " << (bigEndian? "big":"little") << endl
 				 << "  Actual local endianness: " << (currentlyBigEndian()? "big":"little") << endl
 				 << "  Sanity checking: " << (sanityCheck? "enabled":"disabled") << endl;
@@ -637,50 +1469,102 @@ int bowtie_build(int argc, const char **argv) {
 				cout << "  " << infiles[i].c_str() << endl;
 			}
 		}
-		// Seed random number generator
-		srand(seed);
-		{
-			Timer timer(cout, "Total time for call to driver() for forward index: ", verbose);
-			if(!packed) {
-				try {
-					driver<SString<char> >(infile, infiles, outfile, false, REF_READ_FORWARD);
-				} catch(bad_alloc& e) {
-					if(autoMem) {
-						cerr << "Switching to a packed string representation." << endl;
-						packed = true;
-					} else {
-						throw e;
+		if(!metricsFile.empty() || metricsStderr) {
+			gBuildMetrics.open(metricsFile, metricsStderr, metricsIval);
+		}
+		int reverseType = reverseEach ? REF_READ_REVERSE_EACH : REF_READ_REVERSE;
+		if(concurrentMirror && reverseType != REF_READ_REVERSE) {
+			cerr << "Warning: --concurrent-mirror doesn't support --reverse-each; building the" << endl
+			     << "forward and mirror indexes one after the other" << endl;
+			concurrentMirror = false;
+		}
+		if(append) {
+			srand(seed);
+			{
+				Timer timer(cout, "Total time for adding to the forward and mirror index: ", verbose);
+				if(!packed) {
+					driverAppend<SString<char> >(infile, infiles, outfile, false);
+				} else {
+					driverAppend<S2bDnaString>(infile, infiles, outfile, true);
+				}
+			}
+			if(verbose) printPeakRss(cout, "forward and mirror index");
+		} else if(concurrentMirror) {
+			srand(seed);
+			{
+				Timer timer(cout, "Total time for concurrent calls to driver() for forward and mirror index: ", verbose);
+				if(!packed) {
+					try {
+						driverConcurrent<SString<char> >(infile, infiles, outfile, false);
+					} catch(bad_alloc& e) {
+						if(autoMem || maxMem > 0) {
+							cerr << "Switching to a packed string representation." << endl;
+							packed = true;
+						} else {
+							throw e;
+						}
 					}
 				}
+				if(packed) {
+					driverConcurrent<S2bDnaString>(infile, infiles, outfile, true);
+				}
 			}
-			if(packed) {
-				driver<S2bDnaString>(infile, infiles, outfile, true, REF_READ_FORWARD);
+			if(verbose) printPeakRss(cout, "forward and mirror index");
+		} else {
+			// Seed random number generator
+			srand(seed);
+			{
+				Timer timer(cout, "Total time for call to driver() for forward index: ", verbose);
+				if(!packed) {
+					try {
+						driver<SString<char> >(infile, infiles, outfile, false, REF_READ_FORWARD);
+					} catch(bad_alloc& e) {
+						if(autoMem || maxMem > 0) {
+							cerr << "Switching to a packed string representation." << endl;
+							packed = true;
+						} else {
+							throw e;
+						}
+					}
+				}
+				if(packed) {
+					driver<S2bDnaString>(infile, infiles, outfile, true, REF_READ_FORWARD);
+				}
 			}
-		}
-		int reverseType = reverseEach ? REF_READ_REVERSE_EACH : REF_READ_REVERSE;
-		srand(seed);
-		Timer timer(cout, "Total time for backward call to driver() for mirror index: ", verbose);
-		if(!packed) {
-			try {
-				driver<SString<char> >(infile, infiles, outfile + ".rev", false, reverseType);
-			} catch(bad_alloc& e) {
-				if(autoMem) {
-					cerr << "Switching to a packed string representation." << endl;
-					packed = true;
-				} else {
-					throw e;
+			if(verbose) printPeakRss(cout, "forward index");
+			srand(seed);
+			{
+				Timer timer(cout, "Total time for backward call to driver() for mirror index: ", verbose);
+				if(!packed) {
+					try {
+						driver<SString<char> >(infile, infiles, outfile + ".rev", false, reverseType);
+					} catch(bad_alloc& e) {
+						if(autoMem || maxMem > 0) {
+							cerr << "Switching to a packed string representation." << endl;
+							packed = true;
+						} else {
+							throw e;
+						}
+					}
+				}
+				if(packed) {
+					driver<S2bDnaString>(infile, infiles, outfile + ".rev", true, reverseType);
 				}
 			}
+			if(verbose) printPeakRss(cout, "mirror index");
 		}
-		if(packed) {
-			driver<S2bDnaString>(infile, infiles, outfile + ".rev", true, reverseType);
+		if(writeContainer) {
+			Timer timer(cout, "Total time for writing index container: ", verbose);
+			buildContainer(outfile);
 		}
+		gBuildMetrics.close();
 		return 0;
 	} catch(std::exception& e) {
 		cerr << "Error: Encountered exception: '" << e.what() << "'" << endl;
 		cerr << "Command: ";
 		for(int i = 0; i < argc; i++) cerr << argv[i] << " ";
 		cerr << endl;
+		gBuildMetrics.close();
 		deleteIdxFiles(outfile, writeRef || justRef, justRef);
 		return 1;
 	} catch(int e) {
@@ -690,6 +1574,7 @@ int bowtie_build(int argc, const char **argv) {
 			for(int i = 0; i < argc; i++) cerr << argv[i] << " ";
 			cerr << endl;
 		}
+		gBuildMetrics.close();
 		deleteIdxFiles(outfile, writeRef || justRef, justRef);
 		return e;
 	}
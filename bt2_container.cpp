@@ -0,0 +1,282 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef BOWTIE_MM
+#include <sys/mman.h>
+#endif
+#include "bt2_container.h"
+#include "mem_ids.h"
+#include "timer.h"
+
+using namespace std;
+
+static const char cntMagic[8] = { 'B', 'T', '2', 'C', 'N', 'T', 'R', '\0' };
+
+string containerFilename(const string& base) {
+	return base + ".idx." + gEbwt_ext;
+}
+
+uint64_t containerChecksum(const void *data, uint64_t len) {
+	const uint64_t prime = 1099511628211ULL;
+	uint64_t h = 14695981039346656037ULL;
+	const uint8_t *p = (const uint8_t*)data;
+	uint64_t nwords = len >> 3;
+	for(uint64_t i = 0; i < nwords; i++) {
+		uint64_t w;
+		memcpy(&w, p + (i << 3), 8);
+		h ^= w;
+		h *= prime;
+	}
+	for(uint64_t i = nwords << 3; i < len; i++) {
+		h ^= p[i];
+		h *= prime;
+	}
+	return h;
+}
+
+IndexContainerWriter::IndexContainerWriter(const string& fname) :
+	fname_(fname),
+	f_(NULL),
+	cur_(CNT_HEADER_SZ),
+	secs_(MISC_CAT)
+{
+	if((f_ = fopen(fname.c_str(), "wb")) == NULL) {
+		cerr << "Could not open index container file for writing: \"" << fname.c_str() << "\"" << endl
+		     << "Please make sure the directory exists and that permissions allow writing by" << endl
+		     << "Bowtie." << endl;
+		throw 1;
+	}
+	// Reserve the header area; it's filled in by finish()
+	if(fseeko(f_, (off_t)CNT_HEADER_SZ, SEEK_SET) != 0) {
+		cerr << "Error seeking in index container file " << fname.c_str() << endl;
+		throw 1;
+	}
+}
+
+IndexContainerWriter::~IndexContainerWriter() {
+	if(f_ != NULL) fclose(f_);
+}
+
+void IndexContainerWriter::addSection(uint32_t id, const void *data, uint64_t len) {
+	assert(f_ != NULL);
+	if(secs_.size() >= CNT_MAX_SECS) {
+		cerr << "Too many sections for index container " << fname_.c_str() << endl;
+		throw 1;
+	}
+	uint64_t align = (len >= CNT_LARGE_ALIGN) ? CNT_LARGE_ALIGN : CNT_SMALL_ALIGN;
+	uint64_t start = (cur_ + align - 1) & ~(align - 1);
+	if(fseeko(f_, (off_t)start, SEEK_SET) != 0) {
+		cerr << "Error seeking in index container file " << fname_.c_str() << endl;
+		throw 1;
+	}
+	// Write in bounded chunks; fwrite can't always handle >2GB at once
+	const char *p = (const char *)data;
+	uint64_t left = len;
+	while(left > 0) {
+		size_t chunk = (size_t)min<uint64_t>(left, 1024 * 1024 * 1024);
+		if(fwrite(p, 1, chunk, f_) != chunk) {
+			cerr << "Error writing section " << id << " of index container file " << fname_.c_str() << endl;
+			throw 1;
+		}
+		p += chunk;
+		left -= chunk;
+	}
+	Entry e;
+	e.id = id;
+	e.off = start;
+	e.len = len;
+	e.cksum = containerChecksum(data, len);
+	secs_.push_back(e);
+	cur_ = start + len;
+}
+
+void IndexContainerWriter::finish() {
+	assert(f_ != NULL);
+	// Pad the file out to a page boundary so the last section can be
+	// mapped whole
+	uint64_t end = (cur_ + CNT_SMALL_ALIGN - 1) & ~(CNT_SMALL_ALIGN - 1);
+	if(end > cur_) {
+		if(fseeko(f_, (off_t)(end - 1), SEEK_SET) != 0 || fputc(0, f_) == EOF) {
+			cerr << "Error padding index container file " << fname_.c_str() << endl;
+			throw 1;
+		}
+	}
+	char hdr[CNT_HEADER_SZ];
+	memset(hdr, 0, CNT_HEADER_SZ);
+	uint32_t one = 1, offSz = OFF_SIZE, nsecs = (uint32_t)secs_.size();
+	memcpy(hdr,      cntMagic, 8);
+	memcpy(hdr + 8,  &one, 4);
+	memcpy(hdr + 12, &offSz, 4);
+	memcpy(hdr + 16, &nsecs, 4);
+	memcpy(hdr + 20, &CNT_VERSION, 4);
+	memcpy(hdr + 24, &end, 8);
+	for(size_t i = 0; i < secs_.size(); i++) {
+		char *ent = hdr + 32 + i * 32;
+		memcpy(ent,      &secs_[i].id, 4);
+		memcpy(ent + 8,  &secs_[i].off, 8);
+		memcpy(ent + 16, &secs_[i].len, 8);
+		memcpy(ent + 24, &secs_[i].cksum, 8);
+	}
+	if(fseeko(f_, 0, SEEK_SET) != 0 || fwrite(hdr, 1, CNT_HEADER_SZ, f_) != CNT_HEADER_SZ) {
+		cerr << "Error writing header of index container file " << fname_.c_str() << endl;
+		throw 1;
+	}
+	if(fclose(f_) != 0) {
+		cerr << "Error closing index container file " << fname_.c_str() << endl;
+		f_ = NULL;
+		throw 1;
+	}
+	f_ = NULL;
+}
+
+IndexContainer::IndexContainer() :
+	map_(NULL),
+	mapSz_(0),
+	nsecs_(0)
+{ }
+
+IndexContainer::~IndexContainer() {
+#ifdef BOWTIE_MM
+	if(map_ != NULL) munmap(map_, (size_t)mapSz_);
+#endif
+}
+
+bool IndexContainer::exists(const string& base) {
+	struct stat sbuf;
+	return stat(containerFilename(base).c_str(), &sbuf) == 0;
+}
+
+void IndexContainer::open(const string& base, bool mmSweep, bool verbose) {
+	assert(map_ == NULL);
+	fname_ = containerFilename(base);
+#ifdef BOWTIE_MM
+	if(verbose) {
+		cerr << "  Memory-mapping index container " << fname_.c_str() << ": ";
+		logTime(cerr);
+	}
+	FILE *f = fopen(fname_.c_str(), "rb");
+	if(f == NULL) {
+		cerr << "Could not open index container file " << fname_.c_str() << endl;
+		throw 1;
+	}
+	struct stat sbuf;
+	if(fstat(fileno(f), &sbuf) == -1 || (uint64_t)sbuf.st_size < CNT_HEADER_SZ) {
+		cerr << "Error: " << fname_.c_str() << " is too small to be an index container" << endl;
+		fclose(f);
+		throw 1;
+	}
+	mapSz_ = (uint64_t)sbuf.st_size;
+	void *m = mmap((void *)0, (size_t)mapSz_, PROT_READ, MAP_SHARED, fileno(f), 0);
+	fclose(f); // the mapping outlives the descriptor
+	if(m == MAP_FAILED) {
+		perror("mmap");
+		cerr << "Error: Could not memory-map the index container " << fname_.c_str() << endl;
+		throw 1;
+	}
+	map_ = (char*)m;
+#ifdef MADV_HUGEPAGE
+	madvise(map_, (size_t)mapSz_, MADV_HUGEPAGE);
+#endif
+	uint32_t one, offSz, version;
+	uint64_t fileSz;
+	memcpy(&one,     map_ + 8, 4);
+	memcpy(&offSz,   map_ + 12, 4);
+	memcpy(&nsecs_,  map_ + 16, 4);
+	memcpy(&version, map_ + 20, 4);
+	memcpy(&fileSz,  map_ + 24, 8);
+	if(memcmp(map_, cntMagic, 8) != 0) {
+		cerr << "Error: " << fname_.c_str() << " is not a Bowtie 2 index container" << endl;
+		throw 1;
+	}
+	if(one != 1) {
+		cerr << "Error: Index container " << fname_.c_str() << " has the opposite endianness" << endl;
+		throw 1;
+	}
+	if(offSz != OFF_SIZE) {
+		cerr << "Error: Index container " << fname_.c_str() << " was built for "
+		     << (offSz == 8 ? "large" : "small") << " indexes" << endl;
+		throw 1;
+	}
+	if(version != CNT_VERSION || nsecs_ > CNT_MAX_SECS || fileSz != mapSz_) {
+		cerr << "Error: Index container " << fname_.c_str() << " is corrupt or from an "
+		     << "incompatible version of bowtie2-build" << endl;
+		throw 1;
+	}
+	for(uint32_t i = 0; i < nsecs_; i++) {
+		uint64_t off, len;
+		memcpy(&off, map_ + 32 + i * 32 + 8, 8);
+		memcpy(&len, map_ + 32 + i * 32 + 16, 8);
+		if(off < CNT_HEADER_SZ || off + len > mapSz_) {
+			cerr << "Error: Section " << i << " of index container " << fname_.c_str()
+			     << " lies outside the file" << endl;
+			throw 1;
+		}
+	}
+	if(mmSweep) {
+		if(!verify()) {
+			cerr << "Error: Checksum mismatch in index container " << fname_.c_str() << endl;
+			throw 1;
+		}
+		if(verbose) {
+			cerr << "  Swept and verified the index container: ";
+			logTime(cerr);
+		}
+	}
+#else
+	cerr << "Index containers require memory-mapped I/O, which is disabled because bowtie" << endl
+	     << "was not compiled with BOWTIE_MM defined." << endl;
+	throw 1;
+#endif
+}
+
+const char *IndexContainer::section(uint32_t id, uint64_t& len) const {
+	assert(map_ != NULL);
+	for(uint32_t i = 0; i < nsecs_; i++) {
+		const char *ent = map_ + 32 + i * 32;
+		uint32_t eid;
+		memcpy(&eid, ent, 4);
+		if(eid == id) {
+			uint64_t off;
+			memcpy(&off, ent + 8, 8);
+			memcpy(&len, ent + 16, 8);
+			return map_ + off;
+		}
+	}
+	len = 0;
+	return NULL;
+}
+
+bool IndexContainer::verify() const {
+	assert(map_ != NULL);
+	for(uint32_t i = 0; i < nsecs_; i++) {
+		const char *ent = map_ + 32 + i * 32;
+		uint64_t off, len, cksum;
+		memcpy(&off,   ent + 8, 8);
+		memcpy(&len,   ent + 16, 8);
+		memcpy(&cksum, ent + 24, 8);
+		if(containerChecksum(map_ + off, len) != cksum) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BT2_CONTAINER_H_
+#define BT2_CONTAINER_H_
+
+/**
+ * \file Single-file index container.
+ *
+ * The container holds everything that is otherwise spread across the
+ * .1/.2/.3/.4/.rev.1/.rev.2 files, laid out so that every array can be
+ * used directly from a read-only memory mapping: host byte order,
+ * no per-field encoding, and each section starting on a page
+ * boundary (4 KiB, or 2 MiB for sections at least that large, so that
+ * transparent huge pages can back them).
+ *
+ * Layout:
+ *
+ *   [header (32 bytes)][section table][pad to 4 KiB]
+ *   [section 0][pad][section 1][pad]...
+ *
+ * Header: 8-byte magic, uint32 endianness sentinel (1), uint32
+ * OFF_SIZE of the index, uint32 # sections, uint32 version, uint64
+ * total file size.  Each section-table entry is 32 bytes: uint32 id,
+ * uint32 reserved, uint64 offset, uint64 length, uint64 checksum.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "ds.h"
+#include "btypes.h"
+
+/**
+ * Section ids.  The low byte says what the section holds, the next
+ * byte which component it belongs to.
+ */
+enum {
+	CNT_PARAMS = 1, // len, lineRate, offRate, ftabChars, flags, zOff
+	CNT_PLEN,       // _plen[]
+	CNT_RSTARTS,    // _rstarts[]
+	CNT_EBWT,       // _ebwt[]
+	CNT_FCHR,       // _fchr[5]
+	CNT_FTAB,       // _ftab[]
+	CNT_EFTAB,      // _eftab[]
+	CNT_NAMES,      // newline-separated reference names
+	CNT_OFFS,       // _offs[]
+	CNT_REF_RECS,   // RefRecords as (off, len, first) triples
+	CNT_REF_BUF,    // bit-pair-packed reference
+	CNT_REF_ALIASES // (alias, source) pairs of duplicate sequences
+};
+
+enum {
+	CNT_COMP_FW  = 0x000, // forward Ebwt
+	CNT_COMP_REV = 0x100, // mirror Ebwt
+	CNT_COMP_REF = 0x200  // BitPairReference
+};
+
+static const uint32_t CNT_VERSION     = 1;
+static const uint64_t CNT_HEADER_SZ   = 4096;
+static const uint64_t CNT_SMALL_ALIGN = 4096;
+static const uint64_t CNT_LARGE_ALIGN = 2 * 1024 * 1024;
+static const uint32_t CNT_MAX_SECS    = (uint32_t)((CNT_HEADER_SZ - 32) / 32);
+
+/**
+ * Return the name of the container file for the index with basename
+ * 'base'.
+ */
+extern std::string containerFilename(const std::string& base);
+
+/**
+ * Writes a container one section at a time so that only the section
+ * being written needs to be in memory.  The header and section table
+ * are written last, by finish().
+ */
+class IndexContainerWriter {
+
+public:
+
+	IndexContainerWriter(const std::string& fname);
+
+	~IndexContainerWriter();
+
+	/**
+	 * Append a section, padding the file up to the section's
+	 * alignment first.  Throws 1 on I/O error.
+	 */
+	void addSection(uint32_t id, const void *data, uint64_t len);
+
+	/**
+	 * Write the header and section table and close the file.
+	 */
+	void finish();
+
+protected:
+
+	struct Entry {
+		uint32_t id;
+		uint64_t off;
+		uint64_t len;
+		uint64_t cksum;
+	};
+
+	std::string  fname_;
+	FILE        *f_;
+	uint64_t     cur_;  // current end of file
+	EList<Entry> secs_;
+};
+
+/**
+ * Read-only view of a container.  The whole file is memory-mapped
+ * with MAP_SHARED, so concurrent processes share one copy in the page
+ * cache, and section() hands out pointers straight into the mapping.
+ */
+class IndexContainer {
+
+public:
+
+	IndexContainer();
+
+	~IndexContainer();
+
+	/**
+	 * Return true iff a container exists for the given basename.
+	 */
+	static bool exists(const std::string& base);
+
+	/**
+	 * Map the container for the given basename.  Throws 1 if the file
+	 * exists but is not a valid container for this binary.
+	 */
+	void open(const std::string& base, bool mmSweep, bool verbose);
+
+	/**
+	 * Return a pointer to the section with the given id and set 'len'
+	 * to its length, or return NULL if there is no such section.
+	 */
+	const char *section(uint32_t id, uint64_t& len) const;
+
+	/**
+	 * Recompute every section's checksum and compare it against the
+	 * section table.  Touches every page of the file.
+	 */
+	bool verify() const;
+
+	bool isOpen() const { return map_ != NULL; }
+
+	const std::string& filename() const { return fname_; }
+
+protected:
+
+	std::string fname_;
+	char       *map_;
+	uint64_t    mapSz_;
+	uint32_t    nsecs_;
+};
+
+/**
+ * 64-bit FNV-1a, consumed a word at a time; used for section
+ * checksums.
+ */
+extern uint64_t containerChecksum(const void *data, uint64_t len);
+
+#endif /* BT2_CONTAINER_H_ */
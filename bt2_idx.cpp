@@ -49,7 +49,8 @@ string gLastIOErrMsg;
  * Take an offset into the joined text and translate it into the
  * reference of the index it falls on, the offset into the reference,
  * and the length of the reference.  Use a binary search through the
- * sorted list of reference fragment ranges t
+ * sorted list of reference fragment ranges t, or, when there are many
+ * fragments, look the fragment up in _fragIdx.
  */
 void Ebwt::joinedToTextOff(
 	TIndexOffU qlen, 
@@ -64,6 +65,11 @@ void Ebwt::joinedToTextOff(
 	TIndexOffU top = 0;
 	TIndexOffU bot = _nFrag; // 1 greater than largest addressable element
 	TIndexOffU elt = OFF_MASK;
+	if(_fragIdx.inited() && off < _eh._len) {
+		// Go straight to the fragment
+		top = (TIndexOffU)_fragIdx.find(off);
+		bot = top + 1;
+	}
 	// Begin binary search
 	while(true) {
 		ASSERT_ONLY(TIndexOffU oldelt = elt);
@@ -271,30 +277,41 @@ bool Ebwt::contains(
  * executable, then try the provided string appended onto
  * "$BOWTIE2_INDEXES/".
  */
+/**
+ * Return true iff there's an index with basename 'str', either as
+ * separate files or as a single-file container.
+ */
+static bool ebwtExists(const string& str) {
+	ifstream in;
+	in.open((str + ".1." + gEbwt_ext).c_str(), ios_base::in | ios::binary);
+	if(in.is_open()) {
+		in.close();
+		return true;
+	}
+	return IndexContainer::exists(str);
+}
+
 string adjustEbwtBase(const string& cmdline,
 					  const string& ebwtFileBase,
 					  bool verbose = false)
 {
 	string str = ebwtFileBase;
-	ifstream in;
 	if(verbose) cout << "Trying " << str.c_str() << endl;
-	in.open((str + ".1." + gEbwt_ext).c_str(), ios_base::in | ios::binary);
-	if(!in.is_open()) {
+	bool found = ebwtExists(str);
+	if(!found) {
 		if(verbose) cout << "  didn't work" << endl;
-		in.close();
 		if(getenv("BOWTIE2_INDEXES") != NULL) {
 			str = string(getenv("BOWTIE2_INDEXES")) + "/" + ebwtFileBase;
 			if(verbose) cout << "Trying " << str.c_str() << endl;
-			in.open((str + ".1." + gEbwt_ext).c_str(), ios_base::in | ios::binary);
-			if(!in.is_open()) {
+			found = ebwtExists(str);
+			if(!found) {
 				if(verbose) cout << "  didn't work" << endl;
-				in.close();
 			} else {
 				if(verbose) cout << "  worked" << endl;
 			}
 		}
 	}
-	if(!in.is_open()) {
+	if(!found) {
 		cerr << "Could not locate a Bowtie index corresponding to basename \"" << ebwtFileBase.c_str() << "\"" << endl;
 		throw 1;
 	}
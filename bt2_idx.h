@@ -40,6 +40,7 @@
 #include "assert_helpers.h"
 #include "bitpack.h"
 #include "blockwise_sa.h"
+#include "sais.h"
 #include "endian_swap.h"
 #include "word_io.h"
 #include "random_source.h"
@@ -54,6 +55,9 @@
 #include "random_source.h"
 #include "mem_ids.h"
 #include "btypes.h"
+#include "bt2_container.h"
+#include "build_metrics.h"
+#include "offset_index.h"
 
 #ifdef POPCNT_CAPABILITY
     #include "processor_support.h"
@@ -389,6 +393,18 @@ struct SideLocus {
 		return false;
 	}
 
+	/**
+	 * Ask for the side this locus refers to to be brought into cache,
+	 * for callers with other work to do before they call mapLF().
+	 */
+	void prefetch(const EbwtParams& ep, const uint8_t* ebwt) const {
+		const uint8_t *side = ebwt + _sideByteOff;
+		__builtin_prefetch(side);
+		if(ep._sideSz > 64) {
+			__builtin_prefetch(side + 64);
+		}
+	}
+
 	/**
 	 * Convert locus to BW row it corresponds to.
 	 */
@@ -505,6 +521,7 @@ public:
 	    _nFrag(0), \
 	    _plen(EBWT_CAT), \
 	    _rstarts(EBWT_CAT), \
+	    _fragIdx(EBWT_CAT), \
 	    _fchr(EBWT_CAT), \
 	    _ftab(EBWT_CAT), \
 	    _eftab(EBWT_CAT), \
@@ -514,7 +531,8 @@ public:
 	    useShmem_(false), \
 	    _refnames(EBWT_CAT), \
 	    mmFile1_(NULL), \
-	    mmFile2_(NULL)
+	    mmFile2_(NULL), \
+	    cnt_(NULL)
 
 	/// Construct an Ebwt from the given input file
 	Ebwt(const string& in,
@@ -546,6 +564,21 @@ public:
 		useShmem_ = useShmem;
 		_in1Str = in + ".1." + gEbwt_ext;
 		_in2Str = in + ".2." + gEbwt_ext;
+		// Use the single-file container if we're memory-mapping anyway
+		// or if it's the only form of the index present.  The mirror
+		// index lives in the same container as the forward one.
+		string cntBase = in;
+		if(!fw && cntBase.length() > 4 && cntBase.substr(cntBase.length() - 4) == ".rev") {
+			cntBase.erase(cntBase.length() - 4);
+		}
+		struct stat sbuf;
+		if(IndexContainer::exists(cntBase) &&
+		   (useMm || stat(_in1Str.c_str(), &sbuf) != 0))
+		{
+			_cntBase = cntBase;
+			_useMm = true;
+			useShmem_ = false;
+		}
 		readIntoMemory(
 			color,       // expect index to be colorspace?
 			fw ? -1 : needEntireReverse, // need REF_READ_REVERSE
@@ -569,10 +602,73 @@ public:
 		assert(repOk());
 	}
 
+	/// Construct a private copy of in-memory Ebwt 'o' for the threads
+	/// of one NUMA node (--numa).  Only the arrays are copied; call
+	/// this from a thread bound to that node so that the first touch of
+	/// each page places it in the node's local memory.
+	Ebwt(const Ebwt& o, int numaNode) :
+	    _toBigEndian(o._toBigEndian),
+	    _overrideOffRate(o._overrideOffRate),
+	    _verbose(o._verbose),
+	    _passMemExc(o._passMemExc),
+	    _sanity(o._sanity),
+	    fw_(o.fw_),
+	    _in1(NULL),
+	    _in2(NULL),
+	    _in1Str(o._in1Str),
+	    _in2Str(o._in2Str),
+	    _zOff(o._zOff),
+	    _zEbwtByteOff(o._zEbwtByteOff),
+	    _zEbwtBpOff(o._zEbwtBpOff),
+	    _nPat(o._nPat),
+	    _nFrag(o._nFrag),
+	    _plen(EBWT_CAT),
+	    _rstarts(EBWT_CAT),
+	    _fragIdx(o._fragIdx),
+	    _fchr(EBWT_CAT),
+	    _ftab(EBWT_CAT),
+	    _eftab(EBWT_CAT),
+	    _offs(EBWT_CAT),
+	    _ebwt(EBWT_CAT),
+	    _useMm(false),
+	    useShmem_(false),
+	    _refnames(o._refnames, EBWT_CAT),
+	    mmFile1_(NULL),
+	    mmFile2_(NULL),
+	    cnt_(NULL),
+	    _eh(o._eh),
+	    packed_(o.packed_)
+	{
+		assert(o.isInMemory());
+#ifdef POPCNT_CAPABILITY
+		_usePOPCNTinstruction = o._usePOPCNTinstruction;
+#endif
+		try {
+			copyArray(_plen, o._plen);
+			copyArray(_rstarts, o._rstarts);
+			copyArray(_fchr, o._fchr);
+			copyArray(_ftab, o._ftab);
+			copyArray(_eftab, o._eftab);
+			copyArray(_offs, o._offs);
+			copyArray(_ebwt, o._ebwt);
+		} catch(bad_alloc& e) {
+			cerr << "Out of memory copying the Bowtie index to NUMA node " << numaNode << endl;
+			throw 1;
+		}
+		assert(repOk());
+	}
+
 	/// Construct an Ebwt from the given header parameters and string
 	/// vector, optionally using a blockwise suffix sorter with the
 	/// given 'bmax' and 'dcv' parameters.  The string vector is
 	/// ultimately joined and the joined string is passed to buildToDisk().
+	/// If 'joined' is non-NULL, it is the reference already joined by
+	/// the caller (see join()), in this index's orientation, and 'is'
+	/// isn't read; 'joinedNames' then holds the sequence names.  If
+	/// 'base' is also non-NULL, 'joined' holds just the sequences being
+	/// added to the index 'base', which are merged into it rather than
+	/// sorting the whole reference (see mergeToDisk()); 'szs' and
+	/// 'joinedNames' then cover the old sequences and the new.
 	template<typename TStr>
 	Ebwt(
 		TStr exampleStr,
@@ -600,7 +696,10 @@ public:
 		bool doBwtFile = false,
 		bool verbose = false,
 		bool passMemExc = false,
-		bool sanityCheck = false) :
+		bool sanityCheck = false,
+		const TStr* joined = NULL,
+		const EList<string>* joinedNames = NULL,
+		const Ebwt* base = NULL) :
 		Ebwt_INITS,
 		_eh(
 			joinedLen(szs),
@@ -671,7 +770,10 @@ public:
 			bmaxDivN,
 			dcv,
 			seed,
-			verbose);
+			verbose,
+			joined,
+			joinedNames,
+			base);
 		// Close output files
 		fout1.flush();
 
@@ -908,6 +1010,12 @@ public:
 	 */
 	void szsToDisk(const EList<RefRecord>& szs, ostream& os, int reverse);
 
+	/**
+	 * Write the sequence count, sequence lengths and fragment count
+	 * given the szs array for the reference.
+	 */
+	void joinHeaderToDisk(const EList<RefRecord>& szs, ostream& out1);
+
 	/**
 	 * Helper for the constructors above.  Takes a vector of text
 	 * strings and joins them into a single string with a call to
@@ -935,35 +1043,58 @@ public:
 	                    TIndexOffU bmaxDivN,
 	                    int dcv,
 	                    uint32_t seed,
-	                    bool verbose)
+	                    bool verbose,
+	                    const TStr* joined = NULL,
+	                    const EList<string>* joinedNames = NULL,
+	                    const Ebwt* base = NULL)
 	{
 		// Compose text strings into single string
 		VMSG_NL("Calculating joined length");
-		TStr s; // holds the entire joined reference after call to joinToDisk
+		TStr sJoined; // holds the entire joined reference after call to joinToDisk
+		const TStr& s = (joined != NULL) ? *joined : sJoined;
 		TIndexOffU jlen;
 		jlen = joinedLen(szs);
 		assert_geq(jlen, sztot);
 		VMSG_NL("Writing header");
 		writeFromMemory(true, out1, out2);
-		try {
+		if(joined != NULL) {
+			// The caller already read and joined the reference (or,
+			// if we're extending 'base', just the new part of it)
+			assert_eq(jlen, joined->length() + (base != NULL ? base->_eh._len : 0));
+			assert(joinedNames != NULL);
+			assert_neq(REF_READ_REVERSE_EACH, refparams.reverse);
+			VMSG_NL("Using reference sequences joined by the caller");
+			joinHeaderToDisk(szs, out1);
+			_refnames = *joinedNames;
+			if(refparams.reverse == REF_READ_REVERSE) {
+				EList<RefRecord> tmp(EBWT_CAT);
+				reverseRefRecords(szs, tmp, false, verbose);
+				szsToDisk(tmp, out1, refparams.reverse);
+			} else {
+				szsToDisk(szs, out1, refparams.reverse);
+			}
+		} else try {
 			VMSG_NL("Reserving space for joined string");
-			s.resize(jlen);
+			sJoined.resize(jlen);
 			VMSG_NL("Joining reference sequences");
 			if(refparams.reverse == REF_READ_REVERSE) {
 				{
 					Timer timer(cout, "  Time to join reference sequences: ", _verbose);
-					joinToDisk(is, szs, sztot, refparams, s, out1, out2);
+					BuildPhase phase(outfile, "join", "bases", jlen);
+					joinToDisk(is, szs, sztot, refparams, sJoined, out1, out2, nthreads);
 				}
                                 {
 					Timer timer(cout, "  Time to reverse reference sequence: ", _verbose);
+					BuildPhase phase(outfile, "reverse", "bases", jlen);
 					EList<RefRecord> tmp(EBWT_CAT);
-					s.reverse();
+					sJoined.reverse();
 					reverseRefRecords(szs, tmp, false, verbose);
 					szsToDisk(tmp, out1, refparams.reverse);
 				}
 			} else {
 				Timer timer(cout, "  Time to join reference sequences: ", _verbose);
-				joinToDisk(is, szs, sztot, refparams, s, out1, out2);
+				BuildPhase phase(outfile, "join", "bases", jlen);
+				joinToDisk(is, szs, sztot, refparams, sJoined, out1, out2, nthreads);
 				szsToDisk(szs, out1, refparams.reverse);
 			}
 			// Joined reference sequence now in 's'
@@ -997,7 +1128,7 @@ public:
 			throw 1;
 		}
 		// Succesfully obtained joined reference string
-		assert_geq(s.length(), jlen);
+		assert(base != NULL || s.length() >= jlen);
 		if(bmax != OFF_MASK) {
 			VMSG_NL("bmax according to bmax setting: " << bmax);
 		}
@@ -1017,8 +1148,21 @@ public:
 		bool first = true;
 		streampos out1pos = out1.tellp();
 		streampos out2pos = out2.tellp();
+		bool saDone = false;
+		if(base != NULL) {
+			VMSG_NL("Merging the new sequences into the existing index");
+			mergeToDisk(*base, s, out1, out2);
+			flushIndexFiles(out1, out2, saOut, bwtOut);
+			saDone = true;
+		} else if(!useBlockwise) {
+			saDone = buildToDiskSais(s, out1, out2, saOut, bwtOut);
+			if(!saDone) {
+				out1.seekp(out1pos);
+				out2.seekp(out2pos);
+			}
+		}
 		// Look for bmax/dcv parameters that work.
-		while(true) {
+		while(!saDone) {
 			if(!first && bmax < 40 && _passMemExc) {
 				cerr << "Could not find approrpiate bmax/dcv settings for building this index." << endl;
 				if(!isPacked()) {
@@ -1086,20 +1230,7 @@ public:
 				assert_eq(bsa.size(), s.length()+1);
 				VMSG_NL("Converting suffix-array elements to index image");
 				buildToDisk(bsa, s, out1, out2, saOut, bwtOut);
-				out1.flush(); out2.flush();
-				bool failed = out1.fail() || out2.fail();
-				if(saOut != NULL) {
-					saOut->flush();
-					failed = failed || saOut->fail();
-				}
-				if(bwtOut != NULL) {
-					bwtOut->flush();
-					failed = failed || bwtOut->fail();
-				}
-				if(failed) {
-					cerr << "An error occurred writing the index to disk.  Please check if the disk is full." << endl;
-					throw 1;
-				}
+				flushIndexFiles(out1, out2, saOut, bwtOut);
 				break;
 			} catch(bad_alloc& e) {
 				if(_passMemExc) {
@@ -1127,6 +1258,83 @@ public:
 		VMSG_NL("Returning from initFromVector");
 	}
 
+	/**
+	 * Build the whole suffix array of 's' at once with SA-IS and
+	 * convert it to an index image.  Returns false, having written
+	 * nothing worth keeping, if the suffix array won't fit in memory
+	 * (or in a TIndexOff) and we may fall back on the blockwise
+	 * builder.
+	 */
+	template <typename TStr>
+	bool buildToDiskSais(const TStr& s,
+	                     ostream& out1,
+	                     ostream& out2,
+	                     ostream* saOut,
+	                     ostream* bwtOut)
+	{
+		if(!SaisSA<TStr>::fits(s.length() + 1)) {
+			VMSG_NL("Reference is too long for SA-IS with this index width; using the blockwise builder");
+			return false;
+		}
+		try {
+			{
+				VMSG_NL("  Doing ahead-of-time memory usage test");
+				AutoArray<uint8_t> tmp(SaisSA<TStr>::memUsage(s), EBWT_CAT);
+				AutoArray<TIndexOffU> ftab(_eh._ftabLen * 2, EBWT_CAT);
+				AutoArray<uint8_t> side(_eh._sideSz, EBWT_CAT);
+				AutoArray<uint32_t> extra(20*1024*1024, EBWT_CAT);
+				VMSG_NL("  Passed!  Constructing the whole suffix array with SA-IS");
+			}
+			VMSG_NL("Constructing suffix-array element generator");
+			BuildPhase phase(metricsName(), "sais", "suffixes", s.length() + 1);
+			SaisSA<TStr> ssa(s, _sanity, _passMemExc, _verbose);
+			phase.progress(s.length() + 1);
+			assert(ssa.suffixItrIsReset());
+			assert_eq(ssa.size(), s.length()+1);
+			VMSG_NL("Converting suffix-array elements to index image");
+			buildToDisk(ssa, s, out1, out2, saOut, bwtOut);
+			flushIndexFiles(out1, out2, saOut, bwtOut);
+		} catch(bad_alloc& e) {
+			if(_passMemExc) {
+				VMSG_NL("  Ran out of memory; falling back to the blockwise suffix-array builder.");
+				return false;
+			}
+			cerr << "Out of memory while constructing suffix array with SA-IS.  Please try" << endl
+			     << "--sa-algo blockwise, which builds the suffix array a block at a time" << endl;
+			throw 1;
+		}
+		return true;
+	}
+
+	/**
+	 * Return the basename of the index files, which names this index
+	 * in build metrics.
+	 */
+	string metricsName() const {
+		return _in1Str.substr(0, _in1Str.length() - (3 + gEbwt_ext.length()));
+	}
+
+	/**
+	 * Flush the index files and throw 1 if any of them couldn't be
+	 * written.
+	 */
+	void flushIndexFiles(ostream& out1, ostream& out2, ostream* saOut, ostream* bwtOut) {
+		out1.flush(); out2.flush();
+		bool failed = out1.fail() || out2.fail();
+		if(saOut != NULL) {
+			saOut->flush();
+			failed = failed || saOut->fail();
+		}
+		if(bwtOut != NULL) {
+			bwtOut->flush();
+			failed = failed || bwtOut->fail();
+		}
+		if(failed) {
+			cerr << "An error occurred writing the index to disk.  Please check if the disk is full." << endl;
+			throw 1;
+		}
+	}
+
 	/**
 	 * Return the length that the joined string of the given string
 	 * list will have.  Note that this is indifferent to how the text
@@ -1158,6 +1366,7 @@ public:
 		}
 		if (_in1 != NULL) fclose(_in1);
 		if (_in2 != NULL) fclose(_in2);
+		delete cnt_;
 	}
 
 	/// Accessors
@@ -1280,6 +1489,7 @@ public:
 		_ftab.free();
 		_eftab.free();
 		_rstarts.free();
+		_fragIdx.clear();
 		_offs.free(); // might not be under control of APtrWrap
 		_ebwt.free(); // might not be under control of APtrWrap
 		// Keep plen; it's small and the client may want to seq it
@@ -1516,6 +1726,12 @@ public:
 		_zEbwtBpOff = sideCharOff & 3;
 		assert_lt(_zEbwtBpOff, 4);
 		_zEbwtByteOff += sideByteOff;
+		// With many fragments, joinedToTextOff() looks them up through
+		// _fragIdx instead of binary-searching rstarts[]
+		_fragIdx.clear();
+		if(rstarts() != NULL && _nFrag >= 256) {
+			_fragIdx.init(rstarts(), _nFrag, 3, eh._len);
+		}
 		assert(repOk(eh)); // Ebwt should be fully initialized now
 	}
 
@@ -1588,12 +1804,16 @@ public:
 
 	// Building
 	template <typename TStr> static TStr join(EList<TStr>& l, uint32_t seed);
-	template <typename TStr> static TStr join(EList<FileBuf*>& l, EList<RefRecord>& szs, TIndexOffU sztot, const RefReadInParams& refparams, uint32_t seed);
-	template <typename TStr> void joinToDisk(EList<FileBuf*>& l, EList<RefRecord>& szs, TIndexOffU sztot, const RefReadInParams& refparams, TStr& ret, ostream& out1, ostream& out2);
+	template <typename TStr> static TStr join(EList<FileBuf*>& l, EList<RefRecord>& szs, TIndexOffU sztot, const RefReadInParams& refparams, uint32_t seed, EList<string>* names = NULL, int nthreads = 1);
+	template <typename TStr> void joinToDisk(EList<FileBuf*>& l, EList<RefRecord>& szs, TIndexOffU sztot, const RefReadInParams& refparams, TStr& ret, ostream& out1, ostream& out2, int nthreads = 1);
 	template <typename TStr> void buildToDisk(InorderBlockwiseSA<TStr>& sa, const TStr& s, ostream& out1, ostream& out2, ostream* saOut, ostream* bwtOut);
+	template <typename TStr> void mergeToDisk(const Ebwt& base, const TStr& add, ostream& out1, ostream& out2);
 
 	// I/O
 	void readIntoMemory(int color, int needEntireRev, bool loadSASamp, bool loadFtab, bool loadRstarts, bool justHeader, EbwtParams *params, bool mmSweep, bool loadNames, bool startVerbose);
+	void readFromContainer(int color, int needEntireRev, bool loadSASamp, bool loadFtab, bool loadRstarts, bool justHeader, EbwtParams *params, bool mmSweep, bool loadNames, bool startVerbose);
+	void writeToContainer(IndexContainerWriter& w) const;
+	static void checkFlags(int32_t flags, int& color, int needEntireRev, bool& entireRev);
 	void writeFromMemory(bool justHeader, ostream& out1, ostream& out2) const;
 	void writeFromMemory(bool justHeader, const string& out1, const string& out2) const;
 
@@ -2384,6 +2604,7 @@ template<typename Operation>
 	string     _in2Str; // filename for secondary index file
 	string     _inSaStr;  // filename for suffix-array file
 	string     _inBwtStr; // filename for BWT file
+	string     _cntBase;  // basename of single-file container, if in use
 	TIndexOffU  _zOff;
 	TIndexOffU  _zEbwtByteOff;
 	TIndexOff   _zEbwtBpOff;
@@ -2391,6 +2612,7 @@ template<typename Operation>
 	TIndexOffU  _nFrag; /// number of fragments
 	APtrWrap<TIndexOffU> _plen;
 	APtrWrap<TIndexOffU> _rstarts; // starting offset of fragments / text indexes
+	OffsetIndex<TIndexOffU> _fragIdx; // finds the fragment an offset falls in
 	// _fchr, _ftab and _eftab are expected to be relatively small
 	// (usually < 1MB, perhaps a few MB if _fchr is particularly large
 	// - like, say, 11).  For this reason, we don't bother with writing
@@ -2410,6 +2632,7 @@ template<typename Operation>
 	EList<string> _refnames; /// names of the reference sequences
 	char *mmFile1_;
 	char *mmFile2_;
+	IndexContainer *cnt_; /// mapped single-file container, if in use
 	EbwtParams _eh;
 	bool packed_;
 
@@ -2432,6 +2655,16 @@ template<typename Operation>
 
 private:
 
+	/// Fill 'dst' with a newly allocated copy of 'src', if 'src' is
+	/// populated
+	template<typename T>
+	static void copyArray(APtrWrap<T>& dst, const APtrWrap<T>& src) {
+		if(src.get() == NULL) return;
+		T *p = new T[src.size()];
+		memcpy(p, src.get(), src.size() * sizeof(T));
+		dst.init(p, src.size(), true);
+	}
+
 	ostream& log() const {
 		return cout; // TODO: turn this into a parameter
 	}
@@ -2518,7 +2751,9 @@ TStr Ebwt::join(EList<FileBuf*>& l,
                 EList<RefRecord>& szs,
                 TIndexOffU sztot,
                 const RefReadInParams& refparams,
-                uint32_t seed)
+                uint32_t seed,
+                EList<string>* names,
+                int nthreads)
 {
 	RandomSource rand; // reproducible given same seed
 	rand.init(seed);
@@ -2528,23 +2763,33 @@ TStr Ebwt::join(EList<FileBuf*>& l,
 	ret.resize(guessLen);
 	ASSERT_ONLY(TIndexOffU szsi = 0);
 	TIndexOffU dstoff = 0;
-	for(TIndexOffU i = 0; i < l.size(); i++) {
-		// For each sequence we can pull out of istream l[i]...
-		assert(!l[i]->eof());
-		bool first = true;
-		while(!l[i]->eof()) {
-			RefRecord rec = fastaRefReadAppend(*l[i], first, ret, dstoff, rpcp);
-			first = false;
-			if(rec.first && rec.len == 0) {
-				continue;
+	TIndexOffU seqsRead = 0;
+	// Read each sequence we can pull out of the istreams
+	EList<RefRecord> recs(MISC_CAT);
+	EList<string> recNames(MISC_CAT);
+	fastaRefReadAppends(l, ret, dstoff, rpcp, recs, recNames, nthreads);
+	for(size_t i = 0; i < recs.size(); i++) {
+		const RefRecord& rec = recs[i];
+		string& name = recNames[i];
+		if(names != NULL && rec.first && rec.len > 0) {
+			// Name the sequence the same way joinToDisk() does
+			if(name.length() == 0) {
+				ostringstream stm;
+				stm << seqsRead;
+				name = stm.str();
 			}
-			TIndexOffU bases = rec.len;
-			assert_eq(rec.off, szs[szsi].off);
-			assert_eq(rec.len, szs[szsi].len);
-			assert_eq(rec.first, szs[szsi].first);
-			ASSERT_ONLY(szsi++);
-			if(bases == 0) continue;
+			names->push_back(name);
+		}
+		if(rec.first && rec.len == 0) {
+			continue;
 		}
+		TIndexOffU bases = rec.len;
+		assert_eq(rec.off, szs[szsi].off);
+		assert_eq(rec.len, szs[szsi].len);
+		assert_eq(rec.first, szs[szsi].first);
+		ASSERT_ONLY(szsi++);
+		if(rec.first) seqsRead++;
+		if(bases == 0) continue;
 	}
 	return ret;
 }
@@ -2568,123 +2813,369 @@ void Ebwt::joinToDisk(
 	const RefReadInParams& refparams,
 	TStr& ret,
 	ostream& out1,
-	ostream& out2)
+	ostream& out2,
+	int nthreads)
 {
 	RefReadInParams rpcp = refparams;
-	assert_gt(szs.size(), 0);
 	assert_gt(l.size(), 0);
 	assert_gt(sztot, 0);
-	// Not every fragment represents a distinct sequence - many
-	// fragments may correspond to a single sequence.  Count the
-	// number of sequences here by counting the number of "first"
-	// fragments.
-	this->_nPat = 0;
-	this->_nFrag = 0;
-	for(TIndexOffU i = 0; i < szs.size(); i++) {
-		if(szs[i].len > 0) this->_nFrag++;
-		if(szs[i].first && szs[i].len > 0) this->_nPat++;
-	}
-	assert_gt(this->_nPat, 0);
-	assert_geq(this->_nFrag, this->_nPat);
-	_rstarts.reset();
-	writeU<TIndexOffU>(out1, this->_nPat, this->toBe());
-	// Allocate plen[]
-	try {
-		this->_plen.init(new TIndexOffU[this->_nPat], this->_nPat);
-	} catch(bad_alloc& e) {
-		cerr << "Out of memory allocating plen[] in Ebwt::join()"
-		     << " at " << __FILE__ << ":" << __LINE__ << endl;
-		throw e;
-	}
-	// For each pattern, set plen
-	TIndexOff npat = -1;
-	for(TIndexOffU i = 0; i < szs.size(); i++) {
-		if(szs[i].first && szs[i].len > 0) {
-			if(npat >= 0) {
-				writeU<TIndexOffU>(out1, this->plen()[npat], this->toBe());
-			}
-			this->plen()[++npat] = (szs[i].len + szs[i].off);
-		} else if(!szs[i].first) {
-			// edge case, but we could get here with npat == -1
-			// e.g. when building from a reference of all Ns
-			if (npat < 0) npat = 0;
-			this->plen()[npat] += (szs[i].len + szs[i].off);
-		}
-	}
-	assert_eq((TIndexOffU)npat, this->_nPat-1);
-	writeU<TIndexOffU>(out1, this->plen()[npat], this->toBe());
-	// Write the number of fragments
-	writeU<TIndexOffU>(out1, this->_nFrag, this->toBe());
+	joinHeaderToDisk(szs, out1);
 	TIndexOffU seqsRead = 0;
 	ASSERT_ONLY(TIndexOffU szsi = 0);
 	ASSERT_ONLY(TIndexOffU entsWritten = 0);
 	TIndexOffU dstoff = 0;
-	// For each filebuf
-	for(unsigned int i = 0; i < l.size(); i++) {
-		assert(!l[i]->eof());
-		bool first = true;
-		TIndexOffU patoff = 0;
-		// For each *fragment* (not necessary an entire sequence) we
-		// can pull out of istream l[i]...
-		while(!l[i]->eof()) {
-			string name;
+	TIndexOffU patoff = 0;
+	// Read each *fragment* (not necessary an entire sequence) we can
+	// pull out of the filebufs
+	EList<RefRecord> recs(MISC_CAT);
+	EList<string> names(MISC_CAT);
+	fastaRefReadAppends(l, ret, dstoff, rpcp, recs, names, nthreads);
+	for(size_t i = 0; i < recs.size(); i++) {
+		const RefRecord& rec = recs[i];
+		TIndexOffU bases = rec.len;
+		if(rec.first && rec.len > 0) {
 			// Push a new name onto our vector
-			_refnames.push_back("");
-			RefRecord rec = fastaRefReadAppend(
-				*l[i], first, ret, dstoff, rpcp, &_refnames.back());
-			first = false;
-			TIndexOffU bases = rec.len;
-			if(rec.first && rec.len > 0) {
-				if(_refnames.back().length() == 0) {
-					// If name was empty, replace with an index
-					ostringstream stm;
-					stm << seqsRead;
-					_refnames.back() = stm.str();
-				}
-			} else {
-				// This record didn't actually start a new sequence so
-				// no need to add a name
-				//assert_eq(0, _refnames.back().length());
-				_refnames.pop_back();
+			_refnames.push_back(names[i]);
+			if(_refnames.back().length() == 0) {
+				// If name was empty, replace with an index
+				ostringstream stm;
+				stm << seqsRead;
+				_refnames.back() = stm.str();
 			}
-			if(rec.first && rec.len == 0) {
-				continue;
+		}
+		// Otherwise this record didn't actually start a new sequence
+		// so no need to add a name
+		if(rec.first && rec.len == 0) {
+			continue;
+		}
+		assert_lt(szsi, szs.size());
+		assert_eq(rec.off, szs[szsi].off);
+		assert_eq(rec.len, szs[szsi].len);
+		assert_eq(rec.first, szs[szsi].first);
+		assert(rec.first || rec.off > 0);
+		ASSERT_ONLY(szsi++);
+		// Increment seqsRead if this is the first fragment
+		if(rec.first) seqsRead++;
+		if(bases == 0) continue;
+		assert_leq(bases, this->plen()[seqsRead-1]);
+		// Reset the patoff if this is the first fragment
+		if(rec.first) patoff = 0;
+		patoff += rec.off; // add fragment's offset from end of last frag.
+		// Adjust rpcps
+		//uint32_t seq = seqsRead-1;
+		ASSERT_ONLY(entsWritten++);
+		// This is where rstarts elements are written to the output stream
+		//writeU32(out1, oldRetLen, this->toBe()); // offset from beginning of joined string
+		//writeU32(out1, seq,       this->toBe()); // sequence id
+		//writeU32(out1, patoff,    this->toBe()); // offset into sequence
+		patoff += bases;
+	}
+	assert_gt(szsi, 0);
+	assert_eq(entsWritten, this->_nFrag);
+}
+
+/**
+ * Turns the rows of a BWT matrix, handed over one at a time in
+ * suffix-array order, into the parts of an index image: the ebwt sides
+ * with their occurrence tallies, the offs sample, zOff, fchr, ftab and
+ * eftab.  Sides and offs are written to the primary and secondary
+ * streams as they are completed; the rest is written by finish().
+ * Used by Ebwt::buildToDisk() and Ebwt::mergeToDisk().
+ */
+class EbwtRowWriter {
+public:
+
+	EbwtRowWriter(
+		const EbwtParams& eh,
+		bool toBe,
+		bool verbose,
+		ostream& out1,
+		ostream& out2) :
+		eh_(eh),
+		toBe_(toBe),
+		verbose_(verbose),
+		out1_(out1),
+		out2_(out2),
+		ftab_(EBWT_CAT),
+		absorbFtab_(EBWT_CAT),
+		ebwtSide_(EBWT_CAT),
+		zOff_(OFF_MASK),
+		si_(0),
+		side_(0),
+		sideCur_(0),
+		bpi_(0),
+		absorbCnt_(0)
+	{
+		for(int i = 0; i < 4; i++) {
+			fchr_[i] = occ_[i] = occSave_[i] = 0;
+		}
+		try {
+			ftab_.resize(eh_._ftabLen);
+			ftab_.fillZero();
+			absorbFtab_.resize(eh_._ftabLen);
+			absorbFtab_.fillZero();
+		} catch(bad_alloc &e) {
+			cerr << "Out of memory allocating ftab[] or absorbFtab[] "
+			     << "in EbwtRowWriter at " << __FILE__ << ":"
+			     << __LINE__ << endl;
+			throw e;
+		}
+		// Holds a single side as it's being constructed and then
+		// written to disk.  Reused across all sides.
+		try {
+#ifdef SIXTY4_FORMAT
+			ebwtSide_.resize(eh_._sideSz >> 3);
+#else
+			ebwtSide_.resize(eh_._sideSz);
+#endif
+		} catch(bad_alloc &e) {
+			cerr << "Out of memory allocating ebwtSide[] in "
+			     << "EbwtRowWriter at " << __FILE__ << ":"
+			     << __LINE__ << endl;
+			throw e;
+		}
+	}
+
+	/**
+	 * Return true iff the suffix-array element of the next row belongs
+	 * in the offs sample.
+	 */
+	bool sampled() const {
+		return (si_ & eh_._offMask) == si_;
+	}
+
+	/**
+	 * Return the number of rows added so far.
+	 */
+	TIndexOffU rows() const {
+		return si_;
+	}
+
+	/**
+	 * Add the next row.  'bwtChar' is its last character, or -1 if
+	 * that's the '$'; 'sufInt' is the ftab index of its first
+	 * ftabChars characters, or OFF_MASK if the suffix is shorter than
+	 * that; 'saElt' is its suffix-array element, only needed if
+	 * sampled().
+	 */
+	void push(int bwtChar, TIndexOffU sufInt, TIndexOffU saElt) {
+		assert_leq(si_, eh_._len);
+		bool count = true;
+		if(bwtChar < 0) {
+			// Don't add the '$' in the last column to the BWT
+			// transform; we can't encode a $ (only A C T or G)
+			// and counting it as, say, an A, will mess up the
+			// LR mapping
+			bwtChar = 0; count = false;
+			assert_eq(OFF_MASK, zOff_);
+			zOff_ = si_; // remember the SA row that
+			             // corresponds to the 0th suffix
+		} else {
+			assert_lt(bwtChar, 4);
+			// Update the fchr
+			fchr_[bwtChar]++;
+		}
+		// Update ftab
+		if(sufInt != OFF_MASK) {
+			assert_lt(sufInt+1, eh_._ftabLen);
+			ftab_[sufInt+1]++;
+			if(absorbCnt_ > 0) {
+				// Absorb all short suffixes since the last
+				// transition into this transition
+				absorbFtab_[sufInt] = absorbCnt_;
+				absorbCnt_ = 0;
 			}
-			assert_lt(szsi, szs.size());
-			assert_eq(rec.off, szs[szsi].off);
-			assert_eq(rec.len, szs[szsi].len);
-			assert_eq(rec.first, szs[szsi].first);
-			assert(rec.first || rec.off > 0);
-			ASSERT_ONLY(szsi++);
-			// Increment seqsRead if this is the first fragment
-			if(rec.first) seqsRead++;
-			if(bases == 0) continue;
-			assert_leq(bases, this->plen()[seqsRead-1]);
-			// Reset the patoff if this is the first fragment
-			if(rec.first) patoff = 0;
-			patoff += rec.off; // add fragment's offset from end of last frag.
-			// Adjust rpcps
-			//uint32_t seq = seqsRead-1;
-			ASSERT_ONLY(entsWritten++);
-			// This is where rstarts elements are written to the output stream
-			//writeU32(out1, oldRetLen, this->toBe()); // offset from beginning of joined string
-			//writeU32(out1, seq,       this->toBe()); // sequence id
-			//writeU32(out1, patoff,    this->toBe()); // offset into sequence
-			patoff += bases;
-		}
-		assert_gt(szsi, 0);
-		l[i]->reset();
-		assert(!l[i]->eof());
-#ifndef NDEBUG
-		int c = l[i]->get();
-		assert_eq('>', c);
-		assert(!l[i]->eof());
-		l[i]->reset();
-		assert(!l[i]->eof());
+		} else {
+			// Otherwise if suffix is fewer than ftabChars
+			// characters long, then add it to the 'absorbCnt';
+			// it will be absorbed into the next transition
+			assert_lt(absorbCnt_, 255);
+			absorbCnt_++;
+		}
+		// Suffix array offset boundary? - update offset array
+		if(sampled()) {
+			assert_lt((si_ >> eh_._offRate), eh_._offsLen);
+			// Write offsets directly to the secondary output
+			// stream, thereby avoiding keeping them in memory
+			writeU<TIndexOffU>(out2_, saElt, toBe_);
+		}
+		si_++;
+		pack(bwtChar, count);
+	}
+
+	/**
+	 * Pad out the final side, then write zOff, fchr, ftab and eftab
+	 * to the primary stream.
+	 */
+	void finish() {
+		assert_eq(si_, eh_._len + 1);
+		assert_neq(zOff_, OFF_MASK);
+		// 'A' used for padding; important that padding be
+		// counted in the occ[] array
+		while(side_ < eh_._ebwtTotSz) {
+			pack(0, true);
+		}
+		assert_eq(side_, eh_._ebwtTotSz);
+		if(absorbCnt_ > 0) {
+			// Absorb any trailing, as-yet-unabsorbed short suffixes into
+			// the last element of ftab
+			absorbFtab_[eh_._ftabLen-1] = absorbCnt_;
+		}
+
+		//
+		// Write zOff to primary stream
+		//
+		writeU<TIndexOffU>(out1_, zOff_, toBe_);
+
+		//
+		// Finish building fchr
+		//
+		// Exclusive prefix sum on fchr
+		TIndexOffU fchr[] = {fchr_[0], fchr_[1], fchr_[2], fchr_[3], 0};
+		for(int i = 1; i < 4; i++) {
+			fchr[i] += fchr[i-1];
+		}
+		assert_eq(fchr[3], eh_._len);
+		// Shift everybody up by one
+		for(int i = 4; i >= 1; i--) {
+			fchr[i] = fchr[i-1];
+		}
+		fchr[0] = 0;
+		if(verbose_) {
+			for(int i = 0; i < 5; i++)
+				cout << "fchr[" << "ACGT$"[i] << "]: " << fchr[i] << endl;
+		}
+		// Write fchr to primary file
+		for(int i = 0; i < 5; i++) {
+			writeU<TIndexOffU>(out1_, fchr[i], toBe_);
+		}
+
+		//
+		// Finish building ftab and build eftab
+		//
+		// Prefix sum on ftable
+		TIndexOffU len = eh_._len;
+		TIndexOffU ftabLen = eh_._ftabLen;
+		TIndexOffU eftabLen = 0;
+		assert_eq(0, absorbFtab_[0]);
+		for(TIndexOffU i = 1; i < ftabLen; i++) {
+			if(absorbFtab_[i] > 0) eftabLen += 2;
+		}
+		assert_leq(eftabLen, (TIndexOffU)eh_._ftabChars*2);
+		eftabLen = eh_._ftabChars*2;
+		EList<TIndexOffU> eftab(EBWT_CAT);
+		try {
+			eftab.resize(eftabLen);
+			eftab.fillZero();
+		} catch(bad_alloc &e) {
+			cerr << "Out of memory allocating eftab[] "
+			     << "in EbwtRowWriter at " << __FILE__ << ":"
+			     << __LINE__ << endl;
+			throw e;
+		}
+		TIndexOffU eftabCur = 0;
+		for(TIndexOffU i = 1; i < ftabLen; i++) {
+			TIndexOffU lo = ftab_[i] + Ebwt::ftabHi(ftab_.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i-1);
+			if(absorbFtab_[i] > 0) {
+				// Skip a number of short pattern indicated by absorbFtab[i]
+				TIndexOffU hi = lo + absorbFtab_[i];
+				assert_lt(eftabCur*2+1, eftabLen);
+				eftab[eftabCur*2] = lo;
+				eftab[eftabCur*2+1] = hi;
+				ftab_[i] = (eftabCur++) ^ OFF_MASK; // insert pointer into eftab
+				assert_eq(lo, Ebwt::ftabLo(ftab_.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i));
+				assert_eq(hi, Ebwt::ftabHi(ftab_.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i));
+			} else {
+				ftab_[i] = lo;
+			}
+		}
+		assert_eq(Ebwt::ftabHi(ftab_.ptr(), eftab.ptr(), len, ftabLen, eftabLen, ftabLen-1), len+1);
+		// Write ftab to primary file
+		for(TIndexOffU i = 0; i < ftabLen; i++) {
+			writeU<TIndexOffU>(out1_, ftab_[i], toBe_);
+		}
+		// Write eftab to primary file
+		for(TIndexOffU i = 0; i < eftabLen; i++) {
+			writeU<TIndexOffU>(out1_, eftab[i], toBe_);
+		}
+	}
+
+private:
+
+	/**
+	 * Append a character to the bwt section of the current side,
+	 * writing the side out once it's full.
+	 */
+	void pack(int bwtChar, bool count) {
+		assert_lt(side_, eh_._ebwtTotSz);
+		if(bpi_ == 0) {
+			ebwtSide_[sideCur_] = 0; // clear
+		}
+		if(count) occ_[bwtChar]++;
+		// Forward bucket: fill from least to most
+#ifdef SIXTY4_FORMAT
+		ebwtSide_[sideCur_] |= ((uint64_t)bwtChar << (bpi_ << 1));
+		if(++bpi_ < 32) return;
+#else
+		pack_2b_in_8b(bwtChar, ebwtSide_[sideCur_], bpi_);
+		assert_eq((ebwtSide_[sideCur_] >> (bpi_*2)) & 3, bwtChar);
+		if(++bpi_ < 4) return;
+#endif
+		bpi_ = 0;
+		sideCur_++;
+		if(sideCur_ == (int)eh_._sideBwtSz) {
+			sideCur_ = 0;
+			TIndexOffU sideSz = eh_._sideSz;
+			TIndexOffU *cpptr = reinterpret_cast<TIndexOffU*>(ebwtSide_.ptr());
+			// Write 'A', 'C', 'G' and 'T' tallies
+			side_ += sideSz;
+			assert_leq(side_, eh_._ebwtTotSz);
+#ifdef BOWTIE_64BIT_INDEX
+			cpptr[(sideSz >> 3)-4] = endianizeU<TIndexOffU>(occSave_[0], toBe_);
+			cpptr[(sideSz >> 3)-3] = endianizeU<TIndexOffU>(occSave_[1], toBe_);
+			cpptr[(sideSz >> 3)-2] = endianizeU<TIndexOffU>(occSave_[2], toBe_);
+			cpptr[(sideSz >> 3)-1] = endianizeU<TIndexOffU>(occSave_[3], toBe_);
+#else
+			cpptr[(sideSz >> 2)-4] = endianizeU<TIndexOffU>(occSave_[0], toBe_);
+			cpptr[(sideSz >> 2)-3] = endianizeU<TIndexOffU>(occSave_[1], toBe_);
+			cpptr[(sideSz >> 2)-2] = endianizeU<TIndexOffU>(occSave_[2], toBe_);
+			cpptr[(sideSz >> 2)-1] = endianizeU<TIndexOffU>(occSave_[3], toBe_);
 #endif
+			occSave_[0] = occ_[0];
+			occSave_[1] = occ_[1];
+			occSave_[2] = occ_[2];
+			occSave_[3] = occ_[3];
+			// Write backward side to primary file
+			out1_.write((const char *)ebwtSide_.ptr(), sideSz);
+		}
 	}
-	assert_eq(entsWritten, this->_nFrag);
-}
+
+	const EbwtParams& eh_;
+	bool              toBe_;
+	bool              verbose_;
+	ostream&          out1_;
+	ostream&          out2_;
+	EList<TIndexOffU> ftab_;
+	// Record rows that should "absorb" adjacent rows in the ftab.
+	// The absorbed rows represent suffixes shorter than the ftabChars
+	// cutoff.
+	EList<uint8_t>    absorbFtab_;
+#ifdef SIXTY4_FORMAT
+	EList<uint64_t>   ebwtSide_;
+#else
+	EList<uint8_t>    ebwtSide_;
+#endif
+	TIndexOffU        zOff_;
+	TIndexOffU        fchr_[4];
+	// Save # of occurrences of each character as we walk along the bwt
+	TIndexOffU        occ_[4];
+	TIndexOffU        occSave_[4];
+	TIndexOffU        si_;      // rows added so far
+	TIndexOffU        side_;    // offset of the side being assembled
+	int               sideCur_; // element of the side being assembled
+	int               bpi_;     // bit-pair within that element
+	uint8_t           absorbCnt_;
+};
 
 /**
  * Build an Ebwt from a string 's' and its suffix array 'sa' (which
@@ -2726,72 +3217,10 @@ void Ebwt::buildToDisk(
 	assert(sa.suffixItrIsReset());
 
 	TIndexOffU len = eh._len;
-	TIndexOffU ftabLen = eh._ftabLen;
-	TIndexOffU sideSz = eh._sideSz;
-	TIndexOffU ebwtTotSz = eh._ebwtTotSz;
-	TIndexOffU fchr[] = {0, 0, 0, 0, 0};
-	EList<TIndexOffU> ftab(EBWT_CAT);
-	TIndexOffU zOff = OFF_MASK;
-
-	// Save # of occurrences of each character as we walk along the bwt
-	TIndexOffU occ[4] = {0, 0, 0, 0};
-	TIndexOffU occSave[4] = {0, 0, 0, 0};
-
-	// Record rows that should "absorb" adjacent rows in the ftab.
-	// The absorbed rows represent suffixes shorter than the ftabChars
-	// cutoff.
-	uint8_t absorbCnt = 0;
-	EList<uint8_t> absorbFtab(EBWT_CAT);
-	try {
-		VMSG_NL("Allocating ftab, absorbFtab");
-		ftab.resize(ftabLen);
-		ftab.fillZero();
-		absorbFtab.resize(ftabLen);
-		absorbFtab.fillZero();
-	} catch(bad_alloc &e) {
-		cerr << "Out of memory allocating ftab[] or absorbFtab[] "
-		     << "in Ebwt::buildToDisk() at " << __FILE__ << ":"
-		     << __LINE__ << endl;
-		throw e;
-	}
-
-	// Allocate the side buffer; holds a single side as its being
-	// constructed and then written to disk.  Reused across all sides.
-#ifdef SIXTY4_FORMAT
-	EList<uint64_t> ebwtSide(EBWT_CAT);
-#else
-	EList<uint8_t> ebwtSide(EBWT_CAT);
-#endif
-	try {
-#ifdef SIXTY4_FORMAT
-		ebwtSide.resize(sideSz >> 3);
-#else
-		ebwtSide.resize(sideSz);
-#endif
-	} catch(bad_alloc &e) {
-		cerr << "Out of memory allocating ebwtSide[] in "
-		     << "Ebwt::buildToDisk() at " << __FILE__ << ":"
-		     << __LINE__ << endl;
-		throw e;
-	}
-
-	// Points to the base offset within ebwt for the side currently
-	// being written
-	TIndexOffU side = 0;
-
-	// Whether we're assembling a forward or a reverse bucket
-	bool fw;
-	TIndexOff sideCur = 0;
-	fw = true;
-
-	// Have we skipped the '$' in the last column yet?
-	ASSERT_ONLY(bool dollarSkipped = false);
+	VMSG_NL("Allocating ftab, absorbFtab");
+	EbwtRowWriter w(eh, this->toBe(), _verbose, out1, out2);
 
-	TIndexOffU si = 0;   // string offset (chars)
 	ASSERT_ONLY(TIndexOffU lastSufInt = 0);
-	ASSERT_ONLY(bool inSA = true); // true iff saI still points inside suffix
-	                               // array (as opposed to the padding at the
-	                               // end)
 	// Iterate over packed bwt bytes
 	VMSG_NL("Entering Ebwt loop");
 	ASSERT_ONLY(TIndexOffU beforeEbwtOff = (TIndexOffU)out1.tellp()); // @double-check - pos_type, std::streampos
@@ -2809,252 +3238,305 @@ void Ebwt::buildToDisk(
 		writeU<TIndexOffU>(*bwtOut, len+1, this->toBe());
 	}
 
-	while(side < ebwtTotSz) {
-		// Sanity-check our cursor into the side buffer
-		assert_geq(sideCur, 0);
-		assert_lt(sideCur, (int)eh._sideBwtSz);
-		assert_eq(0, side % sideSz); // 'side' must be on side boundary
-		ebwtSide[sideCur] = 0; // clear
-		assert_lt(side + sideCur, ebwtTotSz);
-		// Iterate over bit-pairs in the si'th character of the BWT
-#ifdef SIXTY4_FORMAT
-		for(int bpi = 0; bpi < 32; bpi++, si++)
-#else
-		for(int bpi = 0; bpi < 4; bpi++, si++)
-#endif
+	// The BWT, the occ checkpoints interleaved with it and the offs
+	// sample are all written row by row in this one pass
+	BuildPhase phase(metricsName(), "bwt", "rows", len+1);
+	for(TIndexOffU si = 0; si <= len; si++) {
+		if((si & 0xfffff) == 0) {
+			phase.progress(si);
+		}
+		TIndexOffU saElt = sa.nextSuffix();
+		// Write it to the optional suffix-array output file
+		if(saOut != NULL) {
+			writeU<TIndexOffU>(*saOut, saElt, this->toBe());
+		}
+		// TODO: what exactly to write to the BWT output file?  How to
+		// represent $?  How to pack nucleotides into bytes/words?
+
+		// (that might have triggered sa to calc next suf block)
+		int bwtChar = (saElt == 0) ? -1 : (int)(s[saElt-1]);
+		TIndexOffU sufInt = OFF_MASK;
+		if((len-saElt) >= (TIndexOffU)eh._ftabChars) {
+			// Turn the first ftabChars characters of the
+			// suffix into an integer index into ftab.  The
+			// leftmost (lowest index) character of the suffix
+			// goes in the most significant bit pair if the
+			// integer.
+			sufInt = 0;
+			for(int i = 0; i < eh._ftabChars; i++) {
+				sufInt <<= 2;
+				assert_lt((TIndexOffU)i, len-saElt);
+				sufInt |= (unsigned char)(s[saElt+i]);
+			}
+			// Assert that this prefix-of-suffix is greater
+			// than or equal to the last one (true b/c the
+			// suffix array is sorted)
+			#ifndef NDEBUG
+			if(lastSufInt > 0) assert_geq(sufInt, lastSufInt);
+			lastSufInt = sufInt;
+			#endif
+		}
+		w.push(bwtChar, sufInt, saElt);
+	}
+	phase.progress(len+1);
+	phase.end();
+	VMSG_NL("Exited Ebwt loop");
+	{
+		BuildPhase ftabPhase(metricsName(), "ftab", "entries", eh._ftabLen);
+		w.finish();
+	}
+	// Assert that we wrote the expected amount to out1
+	assert_geq(((TIndexOffU)out1.tellp() - beforeEbwtOff), eh._ebwtTotSz); // @double-check - pos_type
+
+	// Note: if you'd like to sanity-check the Ebwt, you'll have to
+	// read it back into memory first!
+	assert(!isInMemory());
+	VMSG_NL("Exiting Ebwt::buildToDisk()");
+}
+
+/**
+ * Like buildToDisk(), but rather than sorting all the suffixes of the
+ * joined reference, merge the suffixes of newly added sequences into
+ * those of the existing index 'base', which must be resident in
+ * memory.  'add' holds the new sequences, joined and oriented for this
+ * index: for a forward index the reference is base's text followed by
+ * 'add', and for a mirror index it's 'add' (already reversed) followed
+ * by base's text.  Only the new suffixes are sorted; the old ones keep
+ * their order and are read back from base in a single pass, so the
+ * cost of the sort scales with the size of 'add'.
+ *
+ * Forward: appending changes the relative order of two old suffixes
+ * only if one is a prefix of the other, which can happen only near the
+ * end of base's text.  We walk back from the end with LF until the
+ * old suffix reached occurs nowhere else, sort the old tail beyond it
+ * together with 'add' (SA-IS), and find where each of those suffixes
+ * falls among the remaining old ones by backward search.
+ *
+ * Mirror: the old suffixes are unchanged, so their order stands.  The
+ * new suffixes are placed among them by backward search, and ties
+ * between new suffixes are broken by sorting the string of (position,
+ * character) pairs with SA-IS.
+ */
+template<typename TStr>
+void Ebwt::mergeToDisk(
+	const Ebwt& base,
+	const TStr& add,
+	ostream& out1,
+	ostream& out2)
+{
+	const EbwtParams& eh = this->_eh;
+	const EbwtParams& beh = base._eh;
+	assert(base.isInMemory());
+	assert(base.offs() != NULL);
+	assert_eq(beh._len + add.length(), eh._len);
+	assert_eq(beh._ftabChars, eh._ftabChars);
+	assert_eq(beh._offRate, eh._offRate);
+	BuildPhase phase(metricsName(), "merge", "rows", eh._len + 1);
+	const bool prepend = !this->fw();
+	const TIndexOffU n1 = beh._len;
+	const TIndexOffU ftabLen = beh._ftabLen;
+	const int fc = eh._ftabChars;
+
+	// Number of old rows whose suffix is less than c followed by the
+	// suffix at or just below row p
+	struct {
+		const Ebwt& e;
+		TIndexOffU operator()(TIndexOffU p, int c) const {
+			if(p == e._eh._bwtLen) return e.fchr()[c+1];
+			SideLocus l;
+			l.initFromRow(p, e._eh, e.ebwt());
+			return e.countBt2Side(l, c);
+		}
+	} lfPos = { base };
+
+	SString<char> x;     // new suffixes are those of 'x' (then 'xTail')
+	SString<char> xTail; // text following 'x' (mirror only)
+	int xPrev = -1;      // character preceding 'x' (-1 = $)
+	TIndexOffU xOff = 0; // offset of 'x' in the merged text
+	TIndexOffU shift = 0;         // added to old rows' offsets
+	int zOffChar = -1;            // new last char of base's zOff row
+	EList<TIndexOffU> order(EBWT_CAT);   // new suffixes, in order
+	EList<TIndexOffU> pos(EBWT_CAT);     // # old rows before each
+	EList<TIndexOffU> dropped(EBWT_CAT); // old rows re-sorted as new
+	if(!prepend) {
+		Timer timer(cout, "  Time to sort the appended suffixes: ", _verbose);
+		// Walk back from the end of base's text until we reach a suffix
+		// that occurs nowhere else and is at least ftabChars+1 long.
+		// Everything beyond it becomes part of 'x'
+		EList<char> tail(EBWT_CAT);
+		TIndexOffU row = n1, top = 0, bot = n1 + 1;
+		TIndexOffU j = n1, rowJ0m1 = OFF_MASK;
+		dropped.push_back(row);
+		while(j > 0) {
+			SideLocus l;
+			l.initFromRow(row, beh, base.ebwt());
+			int c = base.rowL(l);
+			TIndexOffU prow = base.countBt2Side(l, c);
+			top = lfPos(top, c);
+			bot = lfPos(bot, c);
+			j--;
+			if(bot - top == 1 && n1 - j > (TIndexOffU)fc) {
+				rowJ0m1 = prow;
+				xPrev = c;
+				break;
+			}
+			tail.push_back((char)c);
+			row = prow;
+			dropped.push_back(row);
+		}
+		const TIndexOffU j0 = (xPrev < 0) ? 0 : j + 1;
+		const TIndexOffU rowJ0 = dropped.back();
+		xOff = j0;
+		VMSG_NL("Re-sorting the last " << (n1 - j0) << " characters of the existing reference with the new ones");
+		TIndexOffU nx = (TIndexOffU)(tail.size() + add.length());
+		x.resize(nx);
+		for(size_t i = 0; i < tail.size(); i++) {
+			x.set(tail[tail.size() - 1 - i], i);
+		}
+		for(size_t i = 0; i < add.length(); i++) {
+			x.set((char)add[i], tail.size() + i);
+		}
+		// Order the suffixes of x (including the empty one) among
+		// themselves
+		EList<TIndexOffU> xRank(EBWT_CAT);
 		{
-			int bwtChar;
-			bool count = true;
-			if(si <= len) {
-				// Still in the SA; extract the bwtChar
-				TIndexOffU saElt = sa.nextSuffix();
-				// Write it to the optional suffix-array output file
-				if(saOut != NULL) {
-					writeU<TIndexOffU>(*saOut, saElt, this->toBe());
-				}
-				// TODO: what exactly to write to the BWT output file?  How to
-				// represent $?  How to pack nucleotides into bytes/words?
-
-				// (that might have triggered sa to calc next suf block)
-				if(saElt == 0) {
-					// Don't add the '$' in the last column to the BWT
-					// transform; we can't encode a $ (only A C T or G)
-					// and counting it as, say, an A, will mess up the
-					// LR mapping
-					bwtChar = 0; count = false;
-					ASSERT_ONLY(dollarSkipped = true);
-					zOff = si; // remember the SA row that
-					           // corresponds to the 0th suffix
-				} else {
-					bwtChar = (int)(s[saElt-1]);
-					assert_lt(bwtChar, 4);
-					// Update the fchr
-					fchr[bwtChar]++;
-				}
-				// Update ftab
-				if((len-saElt) >= (TIndexOffU)eh._ftabChars) {
-					// Turn the first ftabChars characters of the
-					// suffix into an integer index into ftab.  The
-					// leftmost (lowest index) character of the suffix
-					// goes in the most significant bit pair if the
-					// integer.
-					TIndexOffU sufInt = 0;
-					for(int i = 0; i < eh._ftabChars; i++) {
-						sufInt <<= 2;
-						assert_lt((TIndexOffU)i, len-saElt);
-						sufInt |= (unsigned char)(s[saElt+i]);
-					}
-					// Assert that this prefix-of-suffix is greater
-					// than or equal to the last one (true b/c the
-					// suffix array is sorted)
-					#ifndef NDEBUG
-					if(lastSufInt > 0) assert_geq(sufInt, lastSufInt);
-					lastSufInt = sufInt;
-					#endif
-					// Update ftab
-					assert_lt(sufInt+1, ftabLen);
-					ftab[sufInt+1]++;
-					if(absorbCnt > 0) {
-						// Absorb all short suffixes since the last
-						// transition into this transition
-						absorbFtab[sufInt] = absorbCnt;
-						absorbCnt = 0;
-					}
-				} else {
-					// Otherwise if suffix is fewer than ftabChars
-					// characters long, then add it to the 'absorbCnt';
-					// it will be absorbed into the next transition
-					assert_lt(absorbCnt, 255);
-					absorbCnt++;
-				}
-				// Suffix array offset boundary? - update offset array
-				if((si & eh._offMask) == si) {
-					assert_lt((si >> eh._offRate), eh._offsLen);
-					// Write offsets directly to the secondary output
-					// stream, thereby avoiding keeping them in memory
-					writeU<TIndexOffU>(out2, saElt, this->toBe());
-				}
-			} else {
-				// Strayed off the end of the SA, now we're just
-				// padding out a bucket
-				#ifndef NDEBUG
-				if(inSA) {
-					// Assert that we wrote all the characters in the
-					// string before now
-					assert_eq(si, len+1);
-					inSA = false;
+			AutoArray<TIndexOff> sa((size_t)nx + 1, EBWT_CAT);
+			saisBuild(SaisTextChars<SString<char> >(x, nx), &sa[0], (TIndexOff)nx + 1, 4);
+			order.resize(nx + 1);
+			xRank.resize(nx + 1);
+			for(TIndexOffU k = 0; k <= nx; k++) {
+				// Back to front; see SaisTextChars
+				order[k] = (TIndexOffU)sa[nx - k];
+				xRank[order[k]] = k;
+			}
+		}
+		// Find each one's place among the old suffixes before j0.
+		// Backward search is right except where it steps from x[0]
+		// onto the old row of suffix j0-1, since the old row of suffix
+		// j0 isn't where suffix j0 now belongs
+		pos.resize(nx + 1);
+		pos[nx] = n1 + 1;
+		for(TIndexOffU i = nx; i-- > 0; ) {
+			int c = x[i];
+			TIndexOffU p = lfPos(pos[i+1], c);
+			if(j0 > 0 && c == xPrev) {
+				bool lfHas = rowJ0 < pos[i+1];
+				bool has = xRank[0] < xRank[i+1];
+				if(lfHas && !has) {
+					p = rowJ0m1;
+				} else if(!lfHas && has) {
+					p = rowJ0m1 + 1;
 				}
-				#endif
-				// 'A' used for padding; important that padding be
-				// counted in the occ[] array
-				bwtChar = 0;
 			}
-			if(count) occ[bwtChar]++;
-			// Append BWT char to bwt section of current side
-			if(fw) {
-				// Forward bucket: fill from least to most
-#ifdef SIXTY4_FORMAT
-				ebwtSide[sideCur] |= ((uint64_t)bwtChar << (bpi << 1));
-				if(bwtChar > 0) assert_gt(ebwtSide[sideCur], 0);
-#else
-				pack_2b_in_8b(bwtChar, ebwtSide[sideCur], bpi);
-				assert_eq((ebwtSide[sideCur] >> (bpi*2)) & 3, bwtChar);
-#endif
-			} else {
-				// Backward bucket: fill from most to least
-#ifdef SIXTY4_FORMAT
-				ebwtSide[sideCur] |= ((uint64_t)bwtChar << ((31 - bpi) << 1));
-				if(bwtChar > 0) assert_gt(ebwtSide[sideCur], 0);
-#else
-				pack_2b_in_8b(bwtChar, ebwtSide[sideCur], 3-bpi);
-				assert_eq((ebwtSide[sideCur] >> ((3-bpi)*2)) & 3, bwtChar);
-#endif
+			pos[i] = p;
+		}
+		dropped.sort();
+	} else {
+		Timer timer(cout, "  Time to sort the prepended suffixes: ", _verbose);
+		const TIndexOffU m = (TIndexOffU)add.length();
+		shift = m;
+		x.resize(m);
+		for(TIndexOffU i = 0; i < m; i++) {
+			x.set((char)add[i], i);
+		}
+		zOffChar = x[m-1];
+		// The first ftabChars characters of base's text follow x
+		if(n1 >= (TIndexOffU)fc) {
+			TIndexOffU lo = 0, hi = ftabLen - 1;
+			while(hi - lo > 1) {
+				TIndexOffU mid = lo + ((hi - lo) >> 1);
+				if(base.ftabLo(mid) <= base._zOff) lo = mid; else hi = mid;
+			}
+			assert_geq(base._zOff, base.ftabHi(lo));
+			xTail.resize(fc);
+			for(int i = 0; i < fc; i++) {
+				xTail.set((char)((lo >> ((fc - 1 - i) << 1)) & 3), i);
 			}
-		} // end loop over bit-pairs
-		assert_eq(dollarSkipped ? 3 : 0, (occ[0] + occ[1] + occ[2] + occ[3]) & 3);
-#ifdef SIXTY4_FORMAT
-		assert_eq(0, si & 31);
-#else
-		assert_eq(0, si & 3);
-#endif
-
-		sideCur++;
-		if(sideCur == (int)eh._sideBwtSz) {
-			sideCur = 0;
-			TIndexOffU *cpptr = reinterpret_cast<TIndexOffU*>(ebwtSide.ptr());
-			// Write 'A', 'C', 'G' and 'T' tallies
-			side += sideSz;
-			assert_leq(side, eh._ebwtTotSz);
-#ifdef BOWTIE_64BIT_INDEX
-			cpptr[(sideSz >> 3)-4] = endianizeU<TIndexOffU>(occSave[0], this->toBe());
-			cpptr[(sideSz >> 3)-3] = endianizeU<TIndexOffU>(occSave[1], this->toBe());
-			cpptr[(sideSz >> 3)-2] = endianizeU<TIndexOffU>(occSave[2], this->toBe());
-			cpptr[(sideSz >> 3)-1] = endianizeU<TIndexOffU>(occSave[3], this->toBe());
-#else
-			cpptr[(sideSz >> 2)-4] = endianizeU<TIndexOffU>(occSave[0], this->toBe());
-			cpptr[(sideSz >> 2)-3] = endianizeU<TIndexOffU>(occSave[1], this->toBe());
-			cpptr[(sideSz >> 2)-2] = endianizeU<TIndexOffU>(occSave[2], this->toBe());
-			cpptr[(sideSz >> 2)-1] = endianizeU<TIndexOffU>(occSave[3], this->toBe());
-#endif
-			occSave[0] = occ[0];
-			occSave[1] = occ[1];
-			occSave[2] = occ[2];
-			occSave[3] = occ[3];
-			// Write backward side to primary file
-			out1.write((const char *)ebwtSide.ptr(), sideSz);
-		}
-	}
-	VMSG_NL("Exited Ebwt loop");
-	assert_neq(zOff, OFF_MASK);
-	if(absorbCnt > 0) {
-		// Absorb any trailing, as-yet-unabsorbed short suffixes into
-		// the last element of ftab
-		absorbFtab[ftabLen-1] = absorbCnt;
-	}
-	// Assert that our loop counter got incremented right to the end
-	assert_eq(side, eh._ebwtTotSz);
-	// Assert that we wrote the expected amount to out1
-	assert_eq(((TIndexOffU)out1.tellp() - beforeEbwtOff), eh._ebwtTotSz); // @double-check - pos_type
-	// assert that the last thing we did was write a forward bucket
-
-	//
-	// Write zOff to primary stream
-	//
-	writeU<TIndexOffU>(out1, zOff, this->toBe());
-
-	//
-	// Finish building fchr
-	//
-	// Exclusive prefix sum on fchr
-	for(int i = 1; i < 4; i++) {
-		fchr[i] += fchr[i-1];
-	}
-	assert_eq(fchr[3], len);
-	// Shift everybody up by one
-	for(int i = 4; i >= 1; i--) {
-		fchr[i] = fchr[i-1];
-	}
-	fchr[0] = 0;
-	if(_verbose) {
-		for(int i = 0; i < 5; i++)
-			cout << "fchr[" << "ACGT$"[i] << "]: " << fchr[i] << endl;
-	}
-	// Write fchr to primary file
-	for(int i = 0; i < 5; i++) {
-		writeU<TIndexOffU>(out1, fchr[i], this->toBe());
-	}
-
-	//
-	// Finish building ftab and build eftab
-	//
-	// Prefix sum on ftable
-	TIndexOffU eftabLen = 0;
-	assert_eq(0, absorbFtab[0]);
-	for(TIndexOffU i = 1; i < ftabLen; i++) {
-		if(absorbFtab[i] > 0) eftabLen += 2;
-	}
-	assert_leq(eftabLen, (TIndexOffU)eh._ftabChars*2);
-	eftabLen = eh._ftabChars*2;
-	EList<TIndexOffU> eftab(EBWT_CAT);
-	try {
-		eftab.resize(eftabLen);
-		eftab.fillZero();
-	} catch(bad_alloc &e) {
-		cerr << "Out of memory allocating eftab[] "
-		     << "in Ebwt::buildToDisk() at " << __FILE__ << ":"
-		     << __LINE__ << endl;
-		throw e;
-	}
-	TIndexOffU eftabCur = 0;
-	for(TIndexOffU i = 1; i < ftabLen; i++) {
-		TIndexOffU lo = ftab[i] + Ebwt::ftabHi(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i-1);
-		if(absorbFtab[i] > 0) {
-			// Skip a number of short pattern indicated by absorbFtab[i]
-			TIndexOffU hi = lo + absorbFtab[i];
-			assert_lt(eftabCur*2+1, eftabLen);
-			eftab[eftabCur*2] = lo;
-			eftab[eftabCur*2+1] = hi;
-			ftab[i] = (eftabCur++) ^ OFF_MASK; // insert pointer into eftab
-			assert_eq(lo, Ebwt::ftabLo(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i));
-			assert_eq(hi, Ebwt::ftabHi(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i));
 		} else {
-			ftab[i] = lo;
-		}
-	}
-	assert_eq(Ebwt::ftabHi(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, ftabLen-1), len+1);
-	// Write ftab to primary file
-	for(TIndexOffU i = 0; i < ftabLen; i++) {
-		writeU<TIndexOffU>(out1, ftab[i], this->toBe());
+			xTail.resize(n1);
+			TIndexOffU row = n1;
+			for(TIndexOffU j = n1; j > 0; j--) {
+				SideLocus l;
+				l.initFromRow(row, beh, base.ebwt());
+				int c = base.rowL(l);
+				xTail.set((char)c, j - 1);
+				row = base.countBt2Side(l, c);
+			}
+			assert_eq(base._zOff, row);
+		}
+		pos.resize(m + 1);
+		pos[m] = base._zOff;
+		for(TIndexOffU i = m; i-- > 0; ) {
+			pos[i] = lfPos(pos[i+1], x[i]);
+		}
+		// Suffixes placed before the same old row are ordered by the
+		// string of (place, character) pairs that follows them
+		EList<pair<uint64_t, TIndexOffU> > keys(EBWT_CAT);
+		keys.resize(m + 1);
+		for(TIndexOffU i = 0; i < m; i++) {
+			keys[i] = make_pair((uint64_t)pos[i] * 5 + x[i], i);
+		}
+		keys[m] = make_pair((uint64_t)base._zOff * 5 + 4, m);
+		keys.sort();
+		AutoArray<TIndexOff> s((size_t)m + 2, EBWT_CAT);
+		TIndexOff name = 0;
+		for(TIndexOffU k = 0; k <= m; k++) {
+			if(k == 0 || keys[k].first != keys[k-1].first) name++;
+			s[keys[k].second] = name;
+		}
+		s[m + 1] = 0;
+		keys.clear();
+		AutoArray<TIndexOff> sa((size_t)m + 2, EBWT_CAT);
+		saisBuild(SaisIntChars(&s[0]), &sa[0], (TIndexOff)m + 2, name);
+		for(TIndexOffU k = 1; k < m + 2; k++) {
+			if((TIndexOffU)sa[k] < m) order.push_back((TIndexOffU)sa[k]);
+		}
+		assert_eq(m, order.size());
 	}
-	// Write eftab to primary file
-	for(TIndexOffU i = 0; i < eftabLen; i++) {
-		writeU<TIndexOffU>(out1, eftab[i], this->toBe());
+#ifndef NDEBUG
+	for(size_t k = 1; k < order.size(); k++) {
+		assert_leq(pos[order[k-1]], pos[order[k]]);
 	}
+#endif
 
-	// Note: if you'd like to sanity-check the Ebwt, you'll have to
-	// read it back into memory first!
+	// Merge the new suffixes into the old ones, converting rows to
+	// index image as we go
+	Timer timer(cout, "  Time to merge the new suffixes into the index: ", _verbose);
+	VMSG_NL("Allocating ftab, absorbFtab");
+	EbwtRowWriter w(eh, this->toBe(), _verbose, out1, out2);
+	const TIndexOffU nx = (TIndexOffU)x.length();
+	size_t ni = 0, di = 0;
+	TIndexOffU fi = 0; // ftab cursor for the old rows
+	for(TIndexOffU r = 0; r <= n1 + 1; r++) {
+		while(ni < order.size() && (r > n1 || pos[order[ni]] <= r)) {
+			// Next row is a new suffix
+			TIndexOffU i = order[ni++];
+			int c = (i > 0) ? (int)x[i-1] : xPrev;
+			TIndexOffU sufInt = OFF_MASK;
+			if(nx - i + xTail.length() >= (TIndexOffU)fc) {
+				sufInt = 0;
+				for(int k = 0; k < fc; k++) {
+					TIndexOffU xi = i + k;
+					sufInt = (sufInt << 2) | (unsigned char)(xi < nx ? x[xi] : xTail[xi - nx]);
+				}
+			}
+			w.push(c, sufInt, xOff + i);
+		}
+		if(r > n1) break;
+		if(di < dropped.size() && dropped[di] == r) {
+			di++;
+			continue;
+		}
+		// Next row is an old suffix
+		int c = (r == base._zOff) ? zOffChar : base.rowL(r);
+		while(fi + 1 < ftabLen && base.ftabLo(fi + 1) <= r) fi++;
+		TIndexOffU sufInt = (fi + 1 < ftabLen && r >= base.ftabHi(fi)) ? fi : OFF_MASK;
+		w.push(c, sufInt, w.sampled() ? (base.getOffset(r) + shift) : 0);
+	}
+	assert_eq(di, dropped.size());
+	assert_eq(eh._len + 1, w.rows());
+	w.finish();
 	assert(!isInMemory());
-	VMSG_NL("Exiting Ebwt::buildToDisk()");
 }
 
 /**
@@ -190,20 +190,35 @@ static void print_ref_sequence(
 	bool newlines = across > 0;
 	int myacross = across > 0 ? across : 60;
 	size_t incr = myacross * 1000;
-	uint32_t *buf = new uint32_t[(incr + 128)/4];
+	// Fetch a few chunks at a time so that their cache misses overlap
+	const size_t nbatch = 4;
+	const size_t bufWords = (incr + 128)/4;
+	uint32_t *buf = new uint32_t[nbatch * bufWords];
+	EList<RefWindow> wins;
 	fout << ">" << name.c_str() << "\n";
 	ASSERT_ONLY(SStringExpandable<uint32_t> destU32);
-	for(size_t i = 0; i < len; i += incr) {
-		size_t amt = min(incr, len-i);
-		assert_leq(amt, incr);
-		int off = ref.getStretch(buf, refi, i, amt ASSERT_ONLY(, destU32));
-		uint8_t *cb = ((uint8_t*)buf) + off;
-		for(size_t j = 0; j < amt; j++) {
-			if(newlines && j > 0 && (j % myacross) == 0) fout << "\n";
-			assert_range(0, 4, (int)cb[j]);
-			fout << "ACGTN"[(int)cb[j]];
+	for(size_t i = 0; i < len; i += incr * nbatch) {
+		wins.clear();
+		for(size_t k = 0; k < nbatch && i + k * incr < len; k++) {
+			RefWindow w;
+			w.dest = buf + k * bufWords;
+			w.tidx = refi;
+			w.toff = i + k * incr;
+			w.count = min(incr, len - w.toff);
+			wins.push_back(w);
+		}
+		ref.getStretches(wins ASSERT_ONLY(, destU32));
+		for(size_t k = 0; k < wins.size(); k++) {
+			size_t amt = wins[k].count;
+			assert_leq(amt, incr);
+			uint8_t *cb = ((uint8_t*)wins[k].dest) + wins[k].offset;
+			for(size_t j = 0; j < amt; j++) {
+				if(newlines && j > 0 && (j % myacross) == 0) fout << "\n";
+				assert_range(0, 4, (int)cb[j]);
+				fout << "ACGTN"[(int)cb[j]];
+			}
+			fout << "\n";
 		}
-		fout << "\n";
 	}
 	delete [] buf;
 }
@@ -33,6 +33,48 @@ using namespace std;
 //
 ///////////////////////////////////////////////////////////////////////
 
+/**
+ * Check the flags word from an index header against what the caller
+ * expects, throwing 1 with a helpful message on a mismatch.  Sets
+ * 'color' to the index's colorspace-ness and 'entireRev' to whether
+ * the index was built over the entire reversed reference.
+ */
+void Ebwt::checkFlags(
+	int32_t flags,
+	int& color,
+	int needEntireRev,
+	bool& entireRev)
+{
+	entireRev = false;
+	if(flags < 0 && (((-flags) & EBWT_COLOR) != 0)) {
+		if(color != -1 && !color) {
+			cerr << "Error: -C was not specified when running bowtie, but index is in colorspace.  If" << endl
+			     << "your reads are in colorspace, please use the -C option.  If your reads are not" << endl
+			     << "in colorspace, please use a normal index (one built without specifying -C to" << endl
+			     << "bowtie-build)." << endl;
+			throw 1;
+		}
+		color = 1;
+	} else if(flags < 0) {
+		if(color != -1 && color) {
+			cerr << "Error: -C was specified when running bowtie, but index is not in colorspace.  If" << endl
+			     << "your reads are in colorspace, please use a colorspace index (one built using" << endl
+			     << "bowtie-build -C).  If your reads are not in colorspace, don't specify -C when" << endl
+			     << "running bowtie." << endl;
+			throw 1;
+		}
+		color = 0;
+	}
+	if(flags < 0 && (((-flags) & EBWT_ENTIRE_REV) == 0)) {
+		if(needEntireRev != -1 && needEntireRev != 0) {
+			cerr << "Error: This index is compatible with 0.* versions of Bowtie, but not with 2.*" << endl
+			     << "versions.  Please build or download a version of the index that is compitble" << endl
+				 << "with Bowtie 2.* (i.e. built with bowtie-build 2.* or later)" << endl;
+			throw 1;
+		}
+	} else entireRev = true;
+}
+
 /**
  * Read an Ebwt from file with given filename.
  */
@@ -48,6 +90,12 @@ void Ebwt::readIntoMemory(
 	bool loadNames,
 	bool startVerbose)
 {
+	if(!_cntBase.empty()) {
+		readFromContainer(color, needEntireRev, loadSASamp, loadFtab,
+		                  loadRstarts, justHeader, params, mmSweep,
+		                  loadNames, startVerbose);
+		return;
+	}
 	bool switchEndian; // dummy; caller doesn't care
 #ifdef BOWTIE_MM
 	char *mmFile[] = { NULL, NULL };
@@ -174,33 +222,7 @@ void Ebwt::readIntoMemory(
 	// we use it to hold flags.
 	int32_t flags = readI<int32_t>(_in1, switchEndian);
 	bool entireRev = false;
-	if(flags < 0 && (((-flags) & EBWT_COLOR) != 0)) {
-		if(color != -1 && !color) {
-			cerr << "Error: -C was not specified when running bowtie, but index is in colorspace.  If" << endl
-			     << "your reads are in colorspace, please use the -C option.  If your reads are not" << endl
-			     << "in colorspace, please use a normal index (one built without specifying -C to" << endl
-			     << "bowtie-build)." << endl;
-			throw 1;
-		}
-		color = 1;
-	} else if(flags < 0) {
-		if(color != -1 && color) {
-			cerr << "Error: -C was specified when running bowtie, but index is not in colorspace.  If" << endl
-			     << "your reads are in colorspace, please use a colorspace index (one built using" << endl
-			     << "bowtie-build -C).  If your reads are not in colorspace, don't specify -C when" << endl
-			     << "running bowtie." << endl;
-			throw 1;
-		}
-		color = 0;
-	}
-	if(flags < 0 && (((-flags) & EBWT_ENTIRE_REV) == 0)) {
-		if(needEntireRev != -1 && needEntireRev != 0) {
-			cerr << "Error: This index is compatible with 0.* versions of Bowtie, but not with 2.*" << endl
-			     << "versions.  Please build or download a version of the index that is compitble" << endl
-				 << "with Bowtie 2.* (i.e. built with bowtie-build 2.* or later)" << endl;
-			throw 1;
-		}
-	} else entireRev = true;
+	checkFlags(flags, color, needEntireRev, entireRev);
 	bytesRead += 4;
 	
 	// Create a new EbwtParams from the entries read from primary stream
@@ -411,8 +433,19 @@ void Ebwt::readIntoMemory(
 #endif
 		} else {
 			_fchr.init(new TIndexOffU[5], 5, true);
+			if(switchEndian) {
+				for(int i = 0; i < 5; i++) {
+					this->fchr()[i] = readU<TIndexOffU>(_in1, switchEndian);
+				}
+			} else {
+				// Same byte order as us; take all 5 words in one read
+				size_t r = MM_READ(_in1, (void *)fchr(), 5*OFF_SIZE);
+				if(r != (size_t)(5*OFF_SIZE)) {
+					cerr << "Error reading _fchr[] array: " << r << ", " << (5*OFF_SIZE) << endl;
+					throw 1;
+				}
+			}
 			for(int i = 0; i < 5; i++) {
-				this->fchr()[i] = readU<TIndexOffU>(_in1, switchEndian);
 				assert_leq(this->fchr()[i], len);
 				assert(i <= 0 || this->fchr()[i] >= this->fchr()[i-1]);
 			}
@@ -642,6 +675,199 @@ done: // Exit hatch for both justHeader and !justHeader
 	}
 }
 
+/**
+ * Layout of the CNT_PARAMS section of an index container.
+ */
+struct ContainerParams {
+	TIndexOffU len;
+	TIndexOffU zOff;
+	int32_t    lineRate;
+	int32_t    offRate;
+	int32_t    ftabChars;
+	int32_t    flags;
+};
+
+/**
+ * Split a names blob (names separated by newlines, optionally
+ * terminated by a NUL) into 'refnames'.
+ */
+static void parseRefnames(const char *buf, uint64_t len, EList<string>& refnames) {
+	for(uint64_t i = 0; i < len; i++) {
+		char c = buf[i];
+		if(c == '\0') break;
+		else if(c == '\n') {
+			refnames.push_back("");
+		} else {
+			if(refnames.size() == 0) {
+				refnames.push_back("");
+			}
+			refnames.back().push_back(c);
+		}
+	}
+}
+
+/**
+ * Point this Ebwt's arrays at the sections of a memory-mapped
+ * single-file container.  Nothing is copied or byte-swapped; the
+ * container was written in this host's byte order by bowtie2-build.
+ * Takes the same arguments as readIntoMemory().
+ */
+void Ebwt::readFromContainer(
+	int color,
+	int needEntireRev,
+	bool loadSASamp,
+	bool loadFtab,
+	bool loadRstarts,
+	bool justHeader,
+	EbwtParams *params,
+	bool mmSweep,
+	bool loadNames,
+	bool startVerbose)
+{
+	if(cnt_ == NULL) {
+		cnt_ = new IndexContainer();
+		cnt_->open(_cntBase, mmSweep, _verbose || startVerbose);
+	}
+	const uint32_t comp = fw_ ? CNT_COMP_FW : CNT_COMP_REV;
+	const string& fname = cnt_->filename();
+	uint64_t sz = 0;
+	const char *p = cnt_->section(comp | CNT_PARAMS, sz);
+	if(p == NULL || sz != sizeof(ContainerParams)) {
+		cerr << "Error: Index container " << fname.c_str() << " has no "
+		     << (fw_ ? "forward" : "mirror") << " index" << endl;
+		throw 1;
+	}
+	ContainerParams cp;
+	memcpy(&cp, p, sizeof(cp));
+	bool entireRev = false;
+	checkFlags(cp.flags, color, needEntireRev, entireRev);
+	EbwtParams *eh;
+	bool deleteEh = false;
+	if(params != NULL) {
+		params->init(cp.len, cp.lineRate, cp.offRate, cp.ftabChars, color, entireRev);
+		if(_verbose || startVerbose) params->print(cerr);
+		eh = params;
+	} else {
+		eh = new EbwtParams(cp.len, cp.lineRate, cp.offRate, cp.ftabChars, color, entireRev);
+		deleteEh = true;
+	}
+	// As with --mm, every process shares the same image of the offs,
+	// so the offrate can't be overridden
+	if(_overrideOffRate > cp.offRate) {
+		cerr << "Error: Can't use an index container when the offrate is overridden" << endl;
+		throw 1;
+	}
+	p = cnt_->section(comp | CNT_PLEN, sz);
+	_nPat = (TIndexOffU)(sz / OFF_SIZE);
+	_plen.reset();
+	_plen.init((TIndexOffU*)p, _nPat, false);
+	if(!justHeader) {
+		_rstarts.reset();
+		p = cnt_->section(comp | CNT_RSTARTS, sz);
+		_nFrag = (TIndexOffU)(sz / (OFF_SIZE * 3));
+		assert_geq(_nFrag, _nPat);
+		if(loadRstarts) {
+			_rstarts.init((TIndexOffU*)p, _nFrag*3, false);
+		}
+		_ebwt.reset();
+		p = cnt_->section(comp | CNT_EBWT, sz);
+		if(p == NULL || sz != eh->_ebwtTotLen) {
+			cerr << "Error: ebwt[] section of index container " << fname.c_str()
+			     << " has the wrong size" << endl;
+			throw 1;
+		}
+		_ebwt.init((uint8_t*)p, eh->_ebwtTotLen, false);
+		_zOff = cp.zOff;
+		assert_lt(_zOff, cp.len);
+		_fchr.reset();
+		p = cnt_->section(comp | CNT_FCHR, sz);
+		if(p == NULL || sz != 5 * OFF_SIZE) {
+			cerr << "Error: fchr[] section of index container " << fname.c_str()
+			     << " has the wrong size" << endl;
+			throw 1;
+		}
+		_fchr.init((TIndexOffU*)p, 5, false);
+		_ftab.reset();
+		_eftab.reset();
+		if(loadFtab) {
+			p = cnt_->section(comp | CNT_FTAB, sz);
+			if(p == NULL || sz != eh->_ftabLen * OFF_SIZE) {
+				cerr << "Error: ftab[] section of index container " << fname.c_str()
+				     << " has the wrong size" << endl;
+				throw 1;
+			}
+			_ftab.init((TIndexOffU*)p, eh->_ftabLen, false);
+			p = cnt_->section(comp | CNT_EFTAB, sz);
+			if(p == NULL || sz != eh->_eftabLen * OFF_SIZE) {
+				cerr << "Error: eftab[] section of index container " << fname.c_str()
+				     << " has the wrong size" << endl;
+				throw 1;
+			}
+			_eftab.init((TIndexOffU*)p, eh->_eftabLen, false);
+		}
+		if(loadNames) {
+			p = cnt_->section(comp | CNT_NAMES, sz);
+			parseRefnames(p, sz, _refnames);
+		}
+		_offs.reset();
+		if(loadSASamp) {
+			p = cnt_->section(comp | CNT_OFFS, sz);
+			if(p == NULL || sz != eh->_offsSz) {
+				cerr << "Error: Index container " << fname.c_str() << " has no SA sample for the "
+				     << (fw_ ? "forward" : "mirror") << " index" << endl;
+				throw 1;
+			}
+			_offs.init((TIndexOffU*)p, eh->_offsLen, false);
+		}
+		this->postReadInit(*eh); // Initialize fields of Ebwt not read from file
+		if(_verbose || startVerbose) print(cerr, *eh);
+	}
+	if(deleteEh) delete eh;
+}
+
+/**
+ * Append this Ebwt's sections to the container being written by 'w'.
+ * The Ebwt must be resident in memory.  The SA sample is included
+ * only if it was loaded.
+ */
+void Ebwt::writeToContainer(IndexContainerWriter& w) const {
+	assert(isInMemory());
+	const EbwtParams& eh = this->_eh;
+	const uint32_t comp = fw_ ? CNT_COMP_FW : CNT_COMP_REV;
+	ContainerParams cp;
+	memset(&cp, 0, sizeof(cp));
+	cp.len = eh._len;
+	cp.zOff = _zOff;
+	cp.lineRate = eh._lineRate;
+	cp.offRate = eh._offRate;
+	cp.ftabChars = eh._ftabChars;
+	int32_t flags = 1;
+	if(eh._color) flags |= EBWT_COLOR;
+	if(eh._entireReverse) flags |= EBWT_ENTIRE_REV;
+	cp.flags = -flags;
+	w.addSection(comp | CNT_PARAMS, &cp, sizeof(cp));
+	w.addSection(comp | CNT_PLEN, plen(), (uint64_t)_nPat * OFF_SIZE);
+	if(rstarts() != NULL) {
+		w.addSection(comp | CNT_RSTARTS, rstarts(), (uint64_t)_nFrag * 3 * OFF_SIZE);
+	}
+	w.addSection(comp | CNT_EBWT, ebwt(), eh._ebwtTotLen);
+	w.addSection(comp | CNT_FCHR, fchr(), 5 * OFF_SIZE);
+	w.addSection(comp | CNT_FTAB, ftab(), (uint64_t)eh._ftabLen * OFF_SIZE);
+	w.addSection(comp | CNT_EFTAB, eftab(), (uint64_t)eh._eftabLen * OFF_SIZE);
+	// Same encoding as the .1 file: every name newline-terminated
+	string names;
+	size_t nnames = _refnames.size();
+	if(nnames > 0 && _refnames[nnames-1].empty()) nnames--;
+	for(size_t i = 0; i < nnames; i++) {
+		names += _refnames[i];
+		names.push_back('\n');
+	}
+	w.addSection(comp | CNT_NAMES, names.c_str(), names.length());
+	if(offs() != NULL) {
+		w.addSection(comp | CNT_OFFS, offs(), eh._offsSz);
+	}
+}
+
 /**
  * Read reference names from an input stream 'in' for an Ebwt primary
  * file and store them in 'refnames'.
@@ -737,6 +963,17 @@ readEbwtRefnames(const string& instr, EList<string>& refnames) {
 	// Initialize our primary and secondary input-stream fields
     fin = fopen((instr + ".1." + gEbwt_ext).c_str(),"rb");
 	if(fin == NULL) {
+		if(IndexContainer::exists(instr)) {
+			IndexContainer cnt;
+			cnt.open(instr, false, false);
+			uint64_t sz = 0;
+			const char *p = cnt.section(CNT_COMP_FW | CNT_NAMES, sz);
+			parseRefnames(p, sz, refnames);
+			if(!refnames.empty() && refnames.back().empty()) {
+				refnames.pop_back();
+			}
+			return;
+		}
 		throw EbwtFileOpenException("Cannot open file " + instr);
 	}
 	assert_eq(ftello(fin), 0);
@@ -752,6 +989,24 @@ int32_t Ebwt::readFlags(const string& instr) {
 	// Initialize our primary and secondary input-stream fields
 	in.open((instr + ".1." + gEbwt_ext).c_str(), ios_base::in | ios::binary);
 	if(!in.is_open()) {
+		// Fall back on the container; strip .rev to get its basename
+		string base = instr;
+		uint32_t comp = CNT_COMP_FW;
+		if(base.length() > 4 && base.substr(base.length() - 4) == ".rev") {
+			base.erase(base.length() - 4);
+			comp = CNT_COMP_REV;
+		}
+		if(IndexContainer::exists(base)) {
+			IndexContainer cnt;
+			cnt.open(base, false, false);
+			uint64_t sz = 0;
+			const char *p = cnt.section(comp | CNT_PARAMS, sz);
+			if(p != NULL && sz == sizeof(ContainerParams)) {
+				ContainerParams cp;
+				memcpy(&cp, p, sizeof(cp));
+				return cp.flags;
+			}
+		}
 		throw EbwtFileOpenException("Cannot open file " + instr);
 	}
 	assert(in.is_open());
@@ -938,6 +1193,55 @@ void Ebwt::writeFromMemory(bool justHeader,
 	}
 }
 
+/**
+ * Set _nPat, _nFrag and plen[] according to the szs array for the
+ * reference and write them to the primary index file.
+ */
+void Ebwt::joinHeaderToDisk(const EList<RefRecord>& szs, ostream& out1) {
+	assert_gt(szs.size(), 0);
+	// Not every fragment represents a distinct sequence - many
+	// fragments may correspond to a single sequence.  Count the
+	// number of sequences here by counting the number of "first"
+	// fragments.
+	this->_nPat = 0;
+	this->_nFrag = 0;
+	for(TIndexOffU i = 0; i < szs.size(); i++) {
+		if(szs[i].len > 0) this->_nFrag++;
+		if(szs[i].first && szs[i].len > 0) this->_nPat++;
+	}
+	assert_gt(this->_nPat, 0);
+	assert_geq(this->_nFrag, this->_nPat);
+	_rstarts.reset();
+	writeU<TIndexOffU>(out1, this->_nPat, this->toBe());
+	// Allocate plen[]
+	try {
+		this->_plen.init(new TIndexOffU[this->_nPat], this->_nPat);
+	} catch(bad_alloc& e) {
+		cerr << "Out of memory allocating plen[] in Ebwt::joinHeaderToDisk()"
+		     << " at " << __FILE__ << ":" << __LINE__ << endl;
+		throw e;
+	}
+	// For each pattern, set plen
+	TIndexOff npat = -1;
+	for(TIndexOffU i = 0; i < szs.size(); i++) {
+		if(szs[i].first && szs[i].len > 0) {
+			if(npat >= 0) {
+				writeU<TIndexOffU>(out1, this->plen()[npat], this->toBe());
+			}
+			this->plen()[++npat] = (szs[i].len + szs[i].off);
+		} else if(!szs[i].first) {
+			// edge case, but we could get here with npat == -1
+			// e.g. when building from a reference of all Ns
+			if (npat < 0) npat = 0;
+			this->plen()[npat] += (szs[i].len + szs[i].off);
+		}
+	}
+	assert_eq((TIndexOffU)npat, this->_nPat-1);
+	writeU<TIndexOffU>(out1, this->plen()[npat], this->toBe());
+	// Write the number of fragments
+	writeU<TIndexOffU>(out1, this->_nFrag, this->toBe());
+}
+
 /**
  * Write the rstarts array given the szs array for the reference.
  */
@@ -32,6 +32,9 @@
 
 #ifndef _WIN32
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 #endif
 
 #include "alphabet.h"
@@ -61,6 +64,8 @@
 #include "outq.h"
 #include "aligner_seed2.h"
 #include "bt2_search.h"
+#include "bt2_server.h"
+#include "cpu_numa_info.h"
 #ifdef WITH_TBB
  #include <thread>
 #endif
@@ -121,6 +126,11 @@ static bool fileParallel; // separate threads read separate input files in paral
 static bool useShmem;     // use shared memory to hold the index
 static bool useMm;        // use memory-mapped files to hold the index
 static bool mmSweep;      // sweep through memory-mapped files immediately after mapping
+static bool parallelLoad; // load index components concurrently
+static string serverSock; // serve alignment jobs on this Unix socket
+static string connectSock; // submit this run to the server on this socket
+static bool shmemCleanup; // remove unused --shmem segments and exit
+static bool numaReplicate; // copy index to each NUMA node & bind threads to nodes
 int gMinInsert;           // minimum insert size
 int gMaxInsert;           // maximum insert size
 bool gMate1fw;            // -1 mate aligns in fw orientation on fw strand
@@ -321,6 +331,11 @@ static void resetOptions() {
 	useShmem				= false; // use shared memory to hold the index
 	useMm					= false; // use memory-mapped files to hold the index
 	mmSweep					= false; // sweep through memory-mapped files immediately after mapping
+	parallelLoad			= true;  // load index components concurrently
+	serverSock.clear();              // don't run as a server
+	connectSock.clear();             // don't submit to a server
+	shmemCleanup = false;            // don't clean up shared memory
+	numaReplicate = false;           // one copy of the index, threads unbound
 	gMinInsert				= 0;     // minimum insert size
 	gMaxInsert				= 500;   // maximum insert size
 	gMate1fw				= true;  // -1 mate aligns in fw orientation on fw strand
@@ -665,6 +680,11 @@ static struct option long_options[] = {
 {(char*)"trim-to",                     required_argument,  0,                   ARG_TRIM_TO},
 {(char*)"preserve-tags",               no_argument,        0,                   ARG_PRESERVE_TAGS},
 {(char*)"align-paired-reads",          no_argument,        0,                   ARG_ALIGN_PAIRED_READS},
+{(char*)"no-parallel-load",            no_argument,        0,                   ARG_NO_PARALLEL_LOAD},
+{(char*)"server",                      required_argument,  0,                   ARG_SERVER},
+{(char*)"connect",                     required_argument,  0,                   ARG_CONNECT},
+{(char*)"shmem-cleanup",               no_argument,        0,                   ARG_SHMEM_CLEANUP},
+{(char*)"numa",                        no_argument,        0,                   ARG_NUMA},
 #ifdef USE_SRA
 {(char*)"sra-acc",                     required_argument,  0,                   ARG_SRA_ACC},
 #endif
@@ -881,7 +901,16 @@ static void printUsage(ostream& out) {
 	    << "  --mm               use memory-mapped I/O for index; many 'bowtie's can share" << endl
 #endif
 #ifdef BOWTIE_SHARED_MEM
-		//<< "  --shmem            use shared mem for index; many 'bowtie's can share" << endl
+	    << "  --shmem            use shared mem for index; many 'bowtie's can share" << endl
+	    << "  --shmem-cleanup    remove --shmem index copies no process is using, then exit" << endl
+#endif
+	    << "  --no-parallel-load load index files one after another instead of concurrently" << endl
+#ifdef __linux__
+	    << "  --numa             copy index to each NUMA node; bind threads to nodes" << endl
+#endif
+#ifndef _WIN32
+	    << "  --server <sock>    keep -x index(es) resident; run jobs sent to Unix socket <sock>" << endl
+	    << "  --connect <sock>   run this alignment on the server listening on <sock>" << endl
 #endif
 	    << endl
 	    << " Other:" << endl
@@ -1092,6 +1121,11 @@ static void parseOption(int next_option, const char *arg) {
 			saw_align_paired_reads = true;
 			break;
 		}
+		case ARG_NO_PARALLEL_LOAD: parallelLoad = false; break;
+		case ARG_SERVER: serverSock = arg; break;
+		case ARG_CONNECT: connectSock = arg; break;
+		case ARG_SHMEM_CLEANUP: shmemCleanup = true; break;
+		case ARG_NUMA: numaReplicate = true; break;
 		case ARG_MM: {
 #ifdef BOWTIE_MM
 			useMm = true;
@@ -1599,23 +1633,23 @@ static void parseOptions(int argc, const char **argv) {
 
 	if (!localAlign && scUnMapped) {
 		cerr << "ERROR: --soft-clipped-unmapped-tlen can only be set for local alignments." << endl;
-		exit(1);
+		throw 1;
 	}
 
 	if ((saw_trim3 || saw_trim5) && saw_trim_to) {
 		cerr << "ERROR: --trim5/--trim3 and --trim-to are mutually exclusive "
 			 << "options." << endl;
-		exit(1);
+		throw 1;
 	}
 
 	if (!saw_bam && saw_preserve_tags) {
 		cerr << "--preserve_tags can only be used when aligning BAM reads." << endl;
-		exit(1);
+		throw 1;
 	}
 
 	if (!saw_bam && saw_align_paired_reads) {
 		cerr << "--align-paired-reads can only be used when aligning BAM reads." << endl;
-		exit(1);
+		throw 1;
 	}
 	// Now parse all the presets.  Might want to pick which presets version to
 	// use according to other parameters.
@@ -1800,6 +1834,81 @@ static AlignmentCache*          multiseed_ca; // seed cache
 static AlnSink*                 multiseed_msink;
 static OutFileBuf*              multiseed_metricsOfb;
 
+/**
+ * A NUMA node's private copy of the index (--numa), along with counts
+ * that show whether the worker threads bound to the node really ran
+ * there.
+ */
+struct NumaReplica {
+
+	NumaReplica() :
+		fw(NULL), bw(NULL), refs(NULL), failed(false),
+		nthreads(0), nreads(0), nsamples(0), nlocal(0) { }
+
+	NumaNode          node;
+	Ebwt             *fw;       // copy of forward index
+	Ebwt             *bw;       // copy of mirror index, or NULL if not loaded
+	BitPairReference *refs;     // copy of reference
+	bool              failed;   // set if the copy couldn't be made
+	uint64_t          nthreads; // # worker threads bound to node
+	uint64_t          nreads;   // # reads/pairs aligned by those threads
+	uint64_t          nsamples; // # times a thread checked which node it was on
+	uint64_t          nlocal;   // # of those times it was on this node
+};
+
+static EList<NumaReplica> numaReplicas(MISC_CAT); // empty unless --numa is in effect
+static MUTEX_T numaMutex; // guards the counters in numaReplicas
+
+/**
+ * Bind worker thread 'tid' to a NUMA node, assigning nodes round-robin,
+ * and return the node's replica.  Returns NULL if --numa isn't in
+ * effect.
+ */
+static NumaReplica *numaBindWorker(int tid) {
+	if(numaReplicas.empty()) {
+		return NULL;
+	}
+	NumaReplica& r = numaReplicas[(size_t)tid % numaReplicas.size()];
+	numaBindThread(r.node);
+	return &r;
+}
+
+/**
+ * Check which node the calling worker is running on, every so often,
+ * and count the read it's about to align.
+ */
+static inline void numaSampleWorker(
+	const NumaReplica *r,
+	uint64_t& nreads,
+	uint64_t& nsamples,
+	uint64_t& nlocal)
+{
+	if((nreads++ & 63) == 0) {
+		int cpu = 0, node = 0;
+		get_cpu_and_node_(cpu, node);
+		nsamples++;
+		if(node == r->node.id) {
+			nlocal++;
+		}
+	}
+}
+
+/**
+ * Add a finished worker's counts to its node's totals.
+ */
+static void numaMergeWorker(
+	NumaReplica *r,
+	uint64_t nreads,
+	uint64_t nsamples,
+	uint64_t nlocal)
+{
+	ThreadSafe ts(numaMutex);
+	r->nthreads++;
+	r->nreads += nreads;
+	r->nsamples += nsamples;
+	r->nlocal += nlocal;
+}
+
 /**
  * Metrics for measuring the work done by the outer read alignment
  * loop.
@@ -2090,16 +2199,20 @@ struct PerfMetrics {
 				/* 118 */ "DPBtFiltStart"  "\t"
 				/* 119 */ "DPBtFiltScore"  "\t"
 				/* 120 */ "DpBtFiltDom"    "\t"
+
+				/* 121 */ "RefCacheHit"    "\t"
+				/* 122 */ "RefCacheMiss"   "\t"
+				/* 123 */ "RefCacheBypass" "\t"
 #ifdef USE_MEM_TALLY
-				/* 121 */ "MemPeak"        "\t"
-				/* 122 */ "UncatMemPeak"   "\t" // 0
-				/* 123 */ "EbwtMemPeak"    "\t" // EBWT_CAT
-				/* 124 */ "CacheMemPeak"   "\t" // CA_CAT
-				/* 125 */ "ResolveMemPeak" "\t" // GW_CAT
-				/* 126 */ "AlignMemPeak"   "\t" // AL_CAT
-				/* 127 */ "DPMemPeak"      "\t" // DP_CAT
-				/* 128 */ "MiscMemPeak"    "\t" // MISC_CAT
-				/* 129 */ "DebugMemPeak"   "\t" // DEBUG_CAT
+				/* 124 */ "MemPeak"        "\t"
+				/* 125 */ "UncatMemPeak"   "\t" // 0
+				/* 126 */ "EbwtMemPeak"    "\t" // EBWT_CAT
+				/* 127 */ "CacheMemPeak"   "\t" // CA_CAT
+				/* 128 */ "ResolveMemPeak" "\t" // GW_CAT
+				/* 129 */ "AlignMemPeak"   "\t" // AL_CAT
+				/* 130 */ "DPMemPeak"      "\t" // DP_CAT
+				/* 131 */ "MiscMemPeak"    "\t" // MISC_CAT
+				/* 132 */ "DebugMemPeak"   "\t" // DEBUG_CAT
 #endif
 				"\n";
 
@@ -2639,40 +2752,53 @@ struct PerfMetrics {
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
 
+		// 121. Reference stretches sliced from the window cache
+		itoa10<uint64_t>(total ? swmSeed.rchits : swmuSeed.rchits, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+		// 122. Reference stretches that filled a cache slot
+		itoa10<uint64_t>(total ? swmSeed.rcmisses : swmuSeed.rcmisses, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+		// 123. Reference stretches too long to cache
+		itoa10<uint64_t>(total ? swmSeed.rcbypass : swmuSeed.rcbypass, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+
 #ifdef USE_MEM_TALLY
-		// 121. Overall memory peak
+		// 124. Overall memory peak
 		itoa10<size_t>(gMemTally.peak() >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 122. Uncategorized memory peak
+		// 125. Uncategorized memory peak
 		itoa10<size_t>(gMemTally.peak(0) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 123. Ebwt memory peak
+		// 126. Ebwt memory peak
 		itoa10<size_t>(gMemTally.peak(EBWT_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 124. Cache memory peak
+		// 127. Cache memory peak
 		itoa10<size_t>(gMemTally.peak(CA_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 125. Resolver memory peak
+		// 128. Resolver memory peak
 		itoa10<size_t>(gMemTally.peak(GW_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 126. Seed aligner memory peak
+		// 129. Seed aligner memory peak
 		itoa10<size_t>(gMemTally.peak(AL_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 127. Dynamic programming aligner memory peak
+		// 130. Dynamic programming aligner memory peak
 		itoa10<size_t>(gMemTally.peak(DP_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 128. Miscellaneous memory peak
+		// 131. Miscellaneous memory peak
 		itoa10<size_t>(gMemTally.peak(MISC_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 129. Debug memory peak
+		// 132. Debug memory peak
 		itoa10<size_t>(gMemTally.peak(DEBUG_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf;
 		if(o != NULL) { o->writeChars(buf); }
@@ -2938,16 +3064,6 @@ static void setupMinScores(
 	x.resetCounters(); \
 }
 
-#ifdef PER_THREAD_TIMING
-/// Based on http://stackoverflow.com/questions/16862620/numa-get-current-node-core
-void get_cpu_and_node(int& cpu, int& node) {
-	unsigned long a,d,c;
-	__asm__ volatile("rdtscp" : "=a" (a), "=d" (d), "=c" (c));
-	node = (c & 0xFFF000)>>12;
-	cpu = c & 0xFFF;
-}
-#endif
-
 class ThreadCounter {
 public:
 	ThreadCounter() {
@@ -2996,12 +3112,14 @@ static void multiseedSearchWorker(void *vp) {
 #endif
 	assert(multiseed_ebwtFw != NULL);
 	assert(multiseedMms == 0 || multiseed_ebwtBw != NULL);
+	// With --numa, use the copy of the index local to our node
+	NumaReplica*            numa     = numaBindWorker(tid);
 	PatternComposer&        patsrc   = *multiseed_patsrc;
 	PatternParams           pp       = multiseed_pp;
-	const Ebwt&             ebwtFw   = *multiseed_ebwtFw;
-	const Ebwt*             ebwtBw   = multiseed_ebwtBw;
+	const Ebwt&             ebwtFw   = (numa != NULL) ? *numa->fw : *multiseed_ebwtFw;
+	const Ebwt*             ebwtBw   = (numa != NULL && numa->bw != NULL) ? numa->bw : multiseed_ebwtBw;
 	const Scoring&          sc       = *multiseed_sc;
-	const BitPairReference& ref      = *multiseed_refs;
+	const BitPairReference& ref      = (numa != NULL) ? *numa->refs : *multiseed_refs;
 	AlnSink&                msink    = *multiseed_msink;
 	OutFileBuf*             metricsOfb = multiseed_metricsOfb;
 
@@ -3011,7 +3129,7 @@ static void multiseedSearchWorker(void *vp) {
 		uint64_t nnuma_changeovers = 0;
 
 		int current_cpu = 0, current_node = 0;
-		get_cpu_and_node(current_cpu, current_node);
+		get_cpu_and_node_(current_cpu, current_node);
 
 		std::stringstream ss;
 		std::string msg;
@@ -3076,7 +3194,13 @@ static void multiseedSearchWorker(void *vp) {
 		SeedAligner al;
 		SwDriver sd(exactCacheCurrentMB * 1024 * 1024);
 		SwAligner sw(dpLog), osw(dpLogOpp);
+		// Windows for nearby seed hits and for the opposite mate overlap,
+		// so both aligners slice them from the same cache
+		sw.setRefCache(&sd.refCache());
+		osw.setRefCache(&sd.refCache());
 		SeedResults shs[2];
+		// Exact end-to-end sweeps for the current batch, two per slot
+		EList<ExactSweepJob> sweeps;
 		OuterLoopMetrics olm;
 		SeedSearchMetrics sdm;
 		WalkMetrics wlm;
@@ -3144,6 +3268,7 @@ static void multiseedSearchWorker(void *vp) {
 		rndArb.init((uint32_t)time(0));
 		int mergei = 0;
 		int mergeival = 16;
+		uint64_t numaReads = 0, numaSamples = 0, numaLocal = 0;
 		bool done = false;
 		while(!done) {
 			pair<bool, bool> ret = ps->nextReadPair();
@@ -3152,8 +3277,36 @@ static void multiseedSearchWorker(void *vp) {
 			if(!success && done) {
 				break;
 			} else if(!success) {
+				sweeps.clear(); // could be left from an earlier batch
 				continue;
 			}
+			if(doExactUpFront && ps->bufIdx() == 0) {
+				// First read of a new batch; do the exact end-to-end
+				// sweeps for the whole batch together, so their BWT
+				// lookups can overlap
+				size_t nslots = ps->parseRest();
+				sweeps.resize(2 * nslots);
+				for(size_t i = 0; i < nslots; i++) {
+					const Read& ra = ps->read_a(i);
+					const Read& rb = ps->read_b(i);
+					bool use = ps->parsed(i) && ra.rdid >= skipReads && ra.rdid < qUpto;
+					bool paired = !rb.empty();
+					bool nofw1 = paired ? (gMate1fw ? gNofw : gNorc) : gNofw;
+					bool norc1 = paired ? (gMate1fw ? gNorc : gNofw) : gNorc;
+					bool nofw2 = paired ? (gMate2fw ? gNofw : gNorc) : gNofw;
+					bool norc2 = paired ? (gMate2fw ? gNorc : gNofw) : gNorc;
+					sweeps[2*i].init(
+						(use && ra.length() >= 2) ? &ra : NULL, nofw1, norc1);
+					sweeps[2*i+1].init(
+						(use && paired && rb.length() >= 2) ? &rb : NULL, nofw2, norc2);
+				}
+				al.exactSweepBatch(
+					ebwtFw, // index
+					sweeps, // reads to sweep, and results
+					2,      // max # edits we care about
+					true,   // report 0mm hits
+					sdm);   // metrics
+			}
 			TReadId rdid = ps->read_a().rdid;
 			bool sample = true;
 			if(arbitraryRandom) {
@@ -3177,6 +3330,7 @@ static void multiseedSearchWorker(void *vp) {
 				{
 					// Do a periodic merge.  Update global metrics, in a
 					// synchronized manner if needed.
+					sd.mergeRefCache(swmSeed);
 					MERGE_METRICS(metrics);
 					mergei = 0;
 					// Check if a progress message should be printed
@@ -3191,12 +3345,15 @@ static void multiseedSearchWorker(void *vp) {
 				}
 				prm.reset(); // per-read metrics
 				prm.doFmString = false;
+				if(numa != NULL) {
+					numaSampleWorker(numa, numaReads, numaSamples, numaLocal);
+				}
 				if(sam_print_xt) {
 					gettimeofday(&prm.tv_beg, &prm.tz_beg);
 				}
 #ifdef PER_THREAD_TIMING
 				int cpu = 0, node = 0;
-				get_cpu_and_node(cpu, node);
+				get_cpu_and_node_(cpu, node);
 				if(cpu != current_cpu) {
 					ncpu_changeovers++;
 					current_cpu = cpu;
@@ -3399,18 +3556,28 @@ static void multiseedSearchWorker(void *vp) {
 									continue;
 								}
 								swmSeed.exatts++;
-								nelt[mate] = al.exactSweep(
-									ebwtFw,        // index
-									*rds[mate],    // read
-									sc,            // scoring scheme
-									nofw[mate],    // nofw?
-									norc[mate],    // norc?
-									2,             // max # edits we care about
-									minedfw[mate], // minimum # edits for fw mate
-									minedrc[mate], // minimum # edits for rc mate
-									true,          // report 0mm hits
-									shs[mate],     // put end-to-end results here
-									sdm);          // metrics
+								size_t slot = 2 * ps->bufIdx() + mate;
+								if(slot < sweeps.size() && sweeps[slot].read == rds[mate]) {
+									// Already swept along with the rest of the batch
+									nelt[mate] = sweeps[slot].install(
+										sc,            // scoring scheme
+										minedfw[mate], // minimum # edits for fw mate
+										minedrc[mate], // minimum # edits for rc mate
+										shs[mate]);    // put end-to-end results here
+								} else {
+									nelt[mate] = al.exactSweep(
+										ebwtFw,        // index
+										*rds[mate],    // read
+										sc,            // scoring scheme
+										nofw[mate],    // nofw?
+										norc[mate],    // norc?
+										2,             // max # edits we care about
+										minedfw[mate], // minimum # edits for fw mate
+										minedrc[mate], // minimum # edits for rc mate
+										true,          // report 0mm hits
+										shs[mate],     // put end-to-end results here
+										sdm);          // metrics
+								}
 								size_t bestmin = min(minedfw[mate], minedrc[mate]);
 								if(bestmin == 0) {
 									sdm.bestmin0++;
@@ -4105,6 +4272,7 @@ static void multiseedSearchWorker(void *vp) {
 			break;
 		}
 		if(metricsPerRead) {
+			sd.mergeRefCache(swmSeed);
 			MERGE_METRICS(metricsPt);
 			nametmp = ps->read_a().name;
 			metricsPt.reportInterval(
@@ -4114,7 +4282,11 @@ static void multiseedSearchWorker(void *vp) {
 	} // while(true)
 
 	// One last metrics merge
+	sd.mergeRefCache(swmSeed);
 	MERGE_METRICS(metrics);
+	if(numa != NULL) {
+		numaMergeWorker(numa, numaReads, numaSamples, numaLocal);
+	}
 
 	if(dpLog    != NULL) dpLog->close();
 	if(dpLogOpp != NULL) dpLogOpp->close();
@@ -4146,12 +4318,14 @@ static void multiseedSearchWorker_2p5(void *vp) {
 #endif
 	assert(multiseed_ebwtFw != NULL);
 	assert(multiseedMms == 0 || multiseed_ebwtBw != NULL);
+	// With --numa, use the copy of the index local to our node
+	NumaReplica*            numa     = numaBindWorker(tid);
 	PatternComposer&        patsrc   = *multiseed_patsrc;
 	PatternParams           pp       = multiseed_pp;
-	const Ebwt&             ebwtFw   = *multiseed_ebwtFw;
-	const Ebwt&             ebwtBw   = *multiseed_ebwtBw;
+	const Ebwt&             ebwtFw   = (numa != NULL) ? *numa->fw : *multiseed_ebwtFw;
+	const Ebwt&             ebwtBw   = (numa != NULL && numa->bw != NULL) ? *numa->bw : *multiseed_ebwtBw;
 	const Scoring&          sc       = *multiseed_sc;
-	const BitPairReference& ref      = *multiseed_refs;
+	const BitPairReference& ref      = (numa != NULL) ? *numa->refs : *multiseed_refs;
 	AlnSink&                msink    = *multiseed_msink;
 	OutFileBuf*             metricsOfb = multiseed_metricsOfb;
 
@@ -4258,6 +4432,7 @@ static void multiseedSearchWorker_2p5(void *vp) {
 	rndArb.init((uint32_t)time(0));
 	int mergei = 0;
 	int mergeival = 16;
+	uint64_t numaReads = 0, numaSamples = 0, numaLocal = 0;
 	while(true) {
 		pair<bool, bool> ret = ps->nextReadPair();
 		bool success = ret.first;
@@ -4302,6 +4477,9 @@ static void multiseedSearchWorker_2p5(void *vp) {
 			}
 			prm.reset(); // per-read metrics
 			prm.doFmString = sam_print_zm;
+			if(numa != NULL) {
+				numaSampleWorker(numa, numaReads, numaSamples, numaLocal);
+			}
 			// If we're reporting how long each read takes, get the initial time
 			// measurement here
 			if(sam_print_xt) {
@@ -4473,6 +4651,9 @@ static void multiseedSearchWorker_2p5(void *vp) {
 
 	// One last metrics merge
 	MERGE_METRICS(metrics);
+	if(numa != NULL) {
+		numaMergeWorker(numa, numaReads, numaSamples, numaLocal);
+	}
 #ifdef WITH_TBB
 	p->done->fetch_add(1);
 #endif
@@ -4652,6 +4833,293 @@ static void thread_monitor(int pid, int orig_threads, EList<int>& tids, EList<T*
 	}
 }
 #endif
+/**
+ * One unit of index-loading work: either an Ebwt (forward or mirror)
+ * or the BitPairReference.  Filled in by the main thread, executed by
+ * indexLoadWorker, possibly on its own thread.
+ */
+struct IndexLoadTask {
+
+	IndexLoadTask() { reset(); }
+
+	void reset() {
+		ebwt = NULL;
+		refs = NULL;
+		needEntireRev = -1;
+		loadSASamp = loadFtab = loadRstarts = false;
+		msg = "";
+		failed = false;
+	}
+
+	/**
+	 * Set up a task that loads the given Ebwt.
+	 */
+	void initEbwt(
+		Ebwt *ebwt_,
+		int needEntireRev_,
+		bool loadSASamp_,
+		bool loadFtab_,
+		bool loadRstarts_,
+		const char *msg_)
+	{
+		reset();
+		ebwt = ebwt_;
+		needEntireRev = needEntireRev_;
+		loadSASamp = loadSASamp_;
+		loadFtab = loadFtab_;
+		loadRstarts = loadRstarts_;
+		msg = msg_;
+	}
+
+	/**
+	 * Set up a task that constructs the BitPairReference and stores a
+	 * pointer to it in *refs_.
+	 */
+	void initRefs(BitPairReference **refs_, const char *msg_) {
+		reset();
+		refs = refs_;
+		msg = msg_;
+	}
+
+	Ebwt              *ebwt;          // index to load, or NULL
+	BitPairReference **refs;          // where to put reference, or NULL
+	int                needEntireRev; // passed through to loadIntoMemory
+	bool               loadSASamp;    // load SA sample?
+	bool               loadFtab;      // load ftab & eftab?
+	bool               loadRstarts;   // load rstarts?
+	const char        *msg;           // timer message
+	bool               failed;        // set if load threw or came up empty
+};
+
+/**
+ * Execute a single IndexLoadTask.  Exceptions are caught and recorded
+ * in the task so that the main thread can rethrow after joining.
+ */
+static void indexLoadWorker(void *vp) {
+	IndexLoadTask *task = (IndexLoadTask*)vp;
+	try {
+		Timer _t(cerr, task->msg, timing);
+		if(task->ebwt != NULL) {
+			task->ebwt->loadIntoMemory(
+				0,                   // colorspace?
+				task->needEntireRev, // require entire reverse?
+				task->loadSASamp,    // load SA sample?
+				task->loadFtab,      // load ftab?
+				task->loadRstarts,   // load rstarts?
+				!noRefNames,         // load names?
+				startVerbose);
+		} else {
+			assert(task->refs != NULL);
+			*task->refs = new BitPairReference(
+				adjIdxBase,
+				false,
+				sanityCheck,
+				NULL,
+				NULL,
+				false,
+				useMm,
+				useShmem,
+				mmSweep,
+				gVerbose,
+				startVerbose);
+			if(!(*task->refs)->loaded()) {
+				task->failed = true;
+			}
+		}
+	} catch(...) {
+		task->failed = true;
+	}
+}
+
+/**
+ * Run the first ntasks elements of tasks.  When parallel loading is
+ * enabled, each task gets its own thread so that the .1.bt2, .rev.1.bt2
+ * and .3/.4.bt2 files stream from disk at the same time; otherwise they
+ * run one after another on the calling thread.  Throws 1 if any task
+ * failed.
+ */
+static void loadIndexComponents(EList<IndexLoadTask>& tasks, size_t ntasks) {
+	if(parallelLoad && ntasks > 1) {
+#ifdef WITH_TBB
+		EList<std::thread*> loaders;
+#else
+		EList<tthread::thread*> loaders;
+#endif
+		for(size_t i = 0; i < ntasks; i++) {
+#ifdef WITH_TBB
+			loaders.push_back(new std::thread(indexLoadWorker, (void*)&tasks[i]));
+#else
+			loaders.push_back(new tthread::thread(indexLoadWorker, (void*)&tasks[i]));
+#endif
+		}
+		for(size_t i = 0; i < loaders.size(); i++) {
+			loaders[i]->join();
+			delete loaders[i];
+		}
+	} else {
+		for(size_t i = 0; i < ntasks; i++) {
+			indexLoadWorker((void*)&tasks[i]);
+		}
+	}
+	for(size_t i = 0; i < ntasks; i++) {
+		if(tasks[i].failed) {
+			throw 1;
+		}
+	}
+}
+
+/**
+ * Make one NUMA node's copy of the index.  Runs on a thread bound to
+ * the node, so the copy is allocated in the node's local memory.
+ */
+static void numaCopyWorker(void *vp) {
+	NumaReplica *r = (NumaReplica*)vp;
+	try {
+		if(!numaBindThread(r->node)) {
+			r->failed = true;
+			return;
+		}
+		r->fw = new Ebwt(*multiseed_ebwtFw, r->node.id);
+		if(multiseed_ebwtBw != NULL && multiseed_ebwtBw->isInMemory()) {
+			r->bw = new Ebwt(*multiseed_ebwtBw, r->node.id);
+		}
+		r->refs = new BitPairReference(*multiseed_refs, r->node.id);
+	} catch(...) {
+		r->failed = true;
+	}
+}
+
+/**
+ * Free the per-node copies of the index.
+ */
+static void numaFreeReplicas() {
+	for(size_t i = 0; i < numaReplicas.size(); i++) {
+		delete numaReplicas[i].fw;
+		delete numaReplicas[i].bw;
+		delete numaReplicas[i].refs;
+	}
+	numaReplicas.clear();
+}
+
+/**
+ * For --numa: copy the loaded index to each NUMA node that will run
+ * worker threads, in parallel, one thread per node.  Leaves
+ * numaReplicas empty, so that workers share the one loaded copy as
+ * usual, if there's only one node or a copy couldn't be made.
+ */
+static void numaCopyIndex() {
+	EList<NumaNode> nodes(MISC_CAT);
+	if(!numaNodes(nodes) || nodes.size() < 2) {
+		if(!gQuiet) {
+			cerr << "Warning: --numa has no effect; found " << nodes.size()
+			     << " NUMA node(s) with CPUs available to bowtie2" << endl;
+		}
+		return;
+	}
+	Timer _t(cerr, "Time copying index to NUMA nodes: ", timing);
+	size_t nnodes = min<size_t>(nodes.size(), (size_t)nthreads);
+	numaReplicas.resize(nnodes);
+	for(size_t i = 0; i < nnodes; i++) {
+		numaReplicas[i] = NumaReplica();
+		numaReplicas[i].node = nodes[i];
+	}
+#ifdef WITH_TBB
+	EList<std::thread*> copiers;
+#else
+	EList<tthread::thread*> copiers;
+#endif
+	for(size_t i = 0; i < nnodes; i++) {
+#ifdef WITH_TBB
+		copiers.push_back(new std::thread(numaCopyWorker, (void*)&numaReplicas[i]));
+#else
+		copiers.push_back(new tthread::thread(numaCopyWorker, (void*)&numaReplicas[i]));
+#endif
+	}
+	for(size_t i = 0; i < copiers.size(); i++) {
+		copiers[i]->join();
+		delete copiers[i];
+	}
+	for(size_t i = 0; i < nnodes; i++) {
+		if(numaReplicas[i].failed) {
+			cerr << "Warning: could not copy the index to NUMA node "
+			     << numaReplicas[i].node.id << "; ignoring --numa" << endl;
+			numaFreeReplicas();
+			return;
+		}
+	}
+}
+
+/**
+ * Print, for each NUMA node, how many threads and reads it handled and
+ * how often its threads were found running on it.
+ */
+static void numaReport() {
+	if(gQuiet) {
+		return;
+	}
+	for(size_t i = 0; i < numaReplicas.size(); i++) {
+		const NumaReplica& r = numaReplicas[i];
+		char pct[32];
+		snprintf(pct, sizeof(pct), "%0.2f",
+		         (r.nsamples == 0) ? 0.0 : (100.0 * r.nlocal / r.nsamples));
+		cerr << "NUMA node " << r.node.id << ": " << r.nthreads << " threads, "
+		     << r.nreads << " reads, " << pct << "% of samples on node" << endl;
+	}
+}
+
+/**
+ * An index kept in memory by --server for the life of the process so
+ * that jobs don't have to load it.
+ */
+struct ResidentIndex {
+	string            base; // adjusted basename, as an absolute path
+	Ebwt             *fw;   // forward index, loaded
+	Ebwt             *bw;   // mirror index, loaded
+	BitPairReference *refs; // reference, loaded
+};
+
+static EList<ResidentIndex> residents(MISC_CAT);
+static const ResidentIndex *curResident = NULL; // index used by current job
+static bool inServerJob = false; // running a job on behalf of a client
+static int serverThreads = 1;    // -p given to the server
+
+/**
+ * Turn an index basename into an absolute path with a canonical
+ * directory so that server and client agree on it no matter what
+ * their working directories are.
+ */
+static string absIndexBase(const string& base) {
+#ifndef _WIN32
+	size_t slash = base.find_last_of('/');
+	string dir = (slash == string::npos) ? string(".") : base.substr(0, slash);
+	string name = (slash == string::npos) ? base : base.substr(slash + 1);
+	if(dir.empty()) dir = "/";
+	char buf[PATH_MAX];
+	if(realpath(dir.c_str(), buf) == NULL) {
+		return base;
+	}
+	string ret = buf;
+	if(ret[ret.length()-1] != '/') ret.push_back('/');
+	return ret + name;
+#else
+	return base;
+#endif
+}
+
+/**
+ * Return the resident index with the given adjusted basename, or NULL
+ * if there isn't one.
+ */
+static const ResidentIndex *findResident(const string& base) {
+	string abase = absIndexBase(base);
+	for(size_t i = 0; i < residents.size(); i++) {
+		if(residents[i].base == abase) {
+			return &residents[i];
+		}
+	}
+	return NULL;
+}
+
 /**
  * Called once per alignment job.  Sets up global pointers to the
  * shared global data structures, creates per-thread structures, then
@@ -4673,24 +5141,43 @@ static void multiseedSearch(
 	multiseed_ebwtBw = ebwtBw;
 	multiseed_sc     = &sc;
 	multiseed_metricsOfb      = metricsOfb;
-	Timer *_t = new Timer(cerr, "Time loading reference: ", timing);
-	unique_ptr<BitPairReference> refs(
-		new BitPairReference(
-			adjIdxBase,
-			false,
-			sanityCheck,
-			NULL,
-			NULL,
-			false,
-			useMm,
-			useShmem,
-			mmSweep,
-			gVerbose,
-			startVerbose)
-	);
-	delete _t;
-	if(!refs->loaded()) throw 1;
-	multiseed_refs = refs.get();
+	// Load the reference and both halves of the index, concurrently
+	// unless the user asked otherwise.  Each component reads its own
+	// files, so the loads share no state.  A --server job finds them
+	// already resident.
+	BitPairReference *refsPtr = NULL;
+	if(curResident == NULL) {
+		EList<IndexLoadTask> loadTasks;
+		loadTasks.resize(3);
+		size_t nloads = 0;
+		loadTasks[nloads++].initRefs(&refsPtr, "Time loading reference: ");
+		assert(!ebwtFw.isInMemory());
+		loadTasks[nloads++].initEbwt(
+			&ebwtFw,
+			-1,    // not the reverse index
+			true,  // load SA samp? (yes, need forward index's SA samp)
+			true,  // load ftab (in forward index)
+			true,  // load rstarts (in forward index)
+			"Time loading forward index: ");
+		if(multiseedMms > 0 || do1mmUpFront) {
+			assert(!ebwtBw->isInMemory());
+			loadTasks[nloads++].initEbwt(
+				ebwtBw,
+				// It's bidirectional search, so we need the reverse to be
+				// constructed as the reverse of the concatenated strings.
+				1,
+				false, // don't load SA samp in reverse index
+				true,  // yes, need ftab in reverse index
+				false, // don't load rstarts in reverse index
+				"Time loading mirror index: ");
+		}
+		loadIndexComponents(loadTasks, nloads);
+	}
+	unique_ptr<BitPairReference> refs(refsPtr);
+	multiseed_refs = (curResident != NULL) ? curResident->refs : refs.get();
+	if(numaReplicate) {
+		numaCopyIndex();
+	}
 #ifndef _WIN32
 	sigset_t set;
 	sigemptyset(&set);
@@ -4707,34 +5194,6 @@ static void multiseedSearch(
 #endif
 	threads.reserveExact(std::max(nthreads, thread_ceiling));
 	tids.reserveExact(std::max(nthreads, thread_ceiling));
-	{
-		// Load the other half of the index into memory
-		assert(!ebwtFw.isInMemory());
-		Timer _t(cerr, "Time loading forward index: ", timing);
-		ebwtFw.loadIntoMemory(
-			0,  // colorspace?
-			-1, // not the reverse index
-			true,         // load SA samp? (yes, need forward index's SA samp)
-			true,         // load ftab (in forward index)
-			true,         // load rstarts (in forward index)
-			!noRefNames,  // load names?
-			startVerbose);
-	}
-	if(multiseedMms > 0 || do1mmUpFront) {
-		// Load the other half of the index into memory
-		assert(!ebwtBw->isInMemory());
-		Timer _t(cerr, "Time loading mirror index: ", timing);
-		ebwtBw->loadIntoMemory(
-			0, // colorspace?
-			// It's bidirectional search, so we need the reverse to be
-			// constructed as the reverse of the concatenated strings.
-			1,
-			false,        // don't load SA samp in reverse index
-			true,         // yes, need ftab in reverse index
-			false,        // don't load rstarts in reverse index
-			!noRefNames,  // load names?
-			startVerbose);
-	}
 	// Start the metrics thread
 
 #ifdef WITH_TBB
@@ -4805,6 +5264,8 @@ static void multiseedSearch(
 	if(!metricsPerRead && (metricsOfb != NULL || metricsStderr)) {
 		metrics.reportInterval(metricsOfb, metricsStderr, true, NULL);
 	}
+	numaReport();
+	numaFreeReplicas();
 }
 
 static string argstr;
@@ -4880,7 +5341,19 @@ static void driver(
 		cerr << "About to initialize fw Ebwt: "; logTime(cerr, true);
 	}
 	adjIdxBase = adjustEbwtBase(argv0, bt2indexBase, gVerbose);
-	Ebwt ebwt(
+	curResident = NULL;
+	if(inServerJob) {
+		curResident = findResident(adjIdxBase);
+		if(curResident == NULL) {
+			cerr << "Error: This bowtie2 server does not hold index \"" << bt2indexBase.c_str()
+			     << "\"; it holds:" << endl;
+			for(size_t i = 0; i < residents.size(); i++) {
+				cerr << "  " << residents[i].base.c_str() << endl;
+			}
+			throw 1;
+		}
+	}
+	Ebwt *ebwtp = (curResident != NULL) ? curResident->fw : new Ebwt(
 		adjIdxBase,
 		0,        // index is colorspace
 		-1,       // fw index
@@ -4898,6 +5371,8 @@ static void driver(
 		startVerbose, // talkative during initialization
 		false /*passMemExc*/,
 		sanityCheck);
+	unique_ptr<Ebwt> ebwtOwner((curResident != NULL) ? NULL : ebwtp);
+	Ebwt& ebwt = *ebwtp;
 
 	if(sanityCheck && !os.empty()) {
 		// Sanity check number of patterns and pattern lengths in Ebwt
@@ -4908,7 +5383,7 @@ static void driver(
 		}
 	}
 	// Sanity-check the restored version of the Ebwt
-	if(sanityCheck && !os.empty()) {
+	if(sanityCheck && !os.empty() && curResident == NULL) {
 		ebwt.loadIntoMemory(
 			0,
 			-1, // fw index
@@ -5042,7 +5517,7 @@ static void driver(
 			}
 
 			// We need the mirror index if mismatches are allowed
-			Ebwt ebwtBw = Ebwt(
+			Ebwt *ebwtBw = (curResident != NULL) ? curResident->bw : new Ebwt(
 				adjIdxBase + ".rev",
 				0,       // index is colorspace
 				1,       // TODO: maybe not
@@ -5060,6 +5535,7 @@ static void driver(
 				startVerbose, // talkative during initialization
 				false /*passMemExc*/,
 				sanityCheck);
+			unique_ptr<Ebwt> ebwtBwOwner((curResident != NULL) ? NULL : ebwtBw);
 
 			multiseedSearch(
 				sc,      // scoring scheme
@@ -5067,7 +5543,7 @@ static void driver(
 				*patsrc, // pattern source
 				*mssink, // hit sink
 				ebwt,    // BWT
-				&ebwtBw, // BWT'
+				ebwtBw,  // BWT'
 				metricsOfb);
                 } else {
 			multiseedSearch(
@@ -5080,8 +5556,8 @@ static void driver(
 				metricsOfb);
 		}
 
-		// Evict any loaded indexes from memory
-		if(ebwt.isInMemory()) {
+		// Evict any loaded indexes from memory, unless they're resident
+		if(curResident == NULL && ebwt.isInMemory()) {
 			ebwt.evictFromMemory();
 		}
 
@@ -5108,6 +5584,180 @@ static void driver(
 	}
 }
 
+extern "C" {
+	int bowtie(int argc, const char **argv);
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t serverStop = 0;
+
+static void serverSignalHandler(int) {
+	serverStop = 1;
+}
+#endif
+
+/**
+ * Load an index and its reference and add them to the resident set.
+ */
+static void loadResidentIndex(const string& base) {
+	adjIdxBase = adjustEbwtBase(argv0, base, gVerbose);
+	ResidentIndex r;
+	r.base = absIndexBase(adjIdxBase);
+	r.refs = NULL;
+	r.fw = new Ebwt(
+		adjIdxBase,
+		0,        // index is colorspace
+		-1,       // fw index
+		true,     // index is for the forward direction
+		/* overriding: */ offRate,
+		0, // amount to add to index offrate or <= 0 to do nothing
+		useMm,    // whether to use memory-mapped files
+		useShmem, // whether to use shared memory
+		mmSweep,  // sweep memory-mapped files
+		!noRefNames, // load names?
+		true,        // load SA sample?
+		true,        // load ftab?
+		true,        // load rstarts?
+		gVerbose, // whether to be talkative
+		startVerbose, // talkative during initialization
+		false /*passMemExc*/,
+		sanityCheck);
+	// Jobs may or may not use the mirror index; load it regardless
+	r.bw = new Ebwt(
+		adjIdxBase + ".rev",
+		0,       // index is colorspace
+		1,       // TODO: maybe not
+		false, // index is for the reverse direction
+		/* overriding: */ offRate,
+		0, // amount to add to index offrate or <= 0 to do nothing
+		useMm,    // whether to use memory-mapped files
+		useShmem, // whether to use shared memory
+		mmSweep,  // sweep memory-mapped files
+		!noRefNames, // load names?
+		true,        // load SA sample?
+		true,        // load ftab?
+		true,        // load rstarts?
+		gVerbose,    // whether to be talkative
+		startVerbose, // talkative during initialization
+		false /*passMemExc*/,
+		sanityCheck);
+	EList<IndexLoadTask> loadTasks;
+	loadTasks.resize(3);
+	loadTasks[0].initRefs(&r.refs, "Time loading reference: ");
+	loadTasks[1].initEbwt(r.fw, -1, true, true, true, "Time loading forward index: ");
+	loadTasks[2].initEbwt(r.bw, 1, false, true, false, "Time loading mirror index: ");
+	loadIndexComponents(loadTasks, 3);
+	residents.push_back(r);
+	if(!gQuiet) {
+		cerr << "Holding index " << r.base.c_str() << endl;
+	}
+}
+
+/**
+ * Run one client's job: put the client's descriptors in place of our
+ * stdin/stdout/stderr and move to its working directory, hand its
+ * argv to bowtie() as though it had been given on our own command
+ * line, then put everything back.  Returns the job's exit status.
+ */
+static int runServerJob(ServerJob& job) {
+#ifndef _WIN32
+	cout.flush();
+	cerr.flush();
+	fflush(stdout);
+	fflush(stderr);
+	int saved[3];
+	for(int i = 0; i < 3; i++) {
+		saved[i] = dup(i);
+		dup2(job.fds[i], i);
+	}
+	job.closeFds();
+	int cwdFd = open(".", O_RDONLY);
+	int ret = 1;
+	if(chdir(job.cwd.c_str()) != 0) {
+		cerr << "Error: bowtie2 server could not change to directory \"" << job.cwd.c_str() << "\"" << endl;
+	} else {
+		EList<const char *> argv(MISC_CAT);
+		for(size_t i = 0; i < job.args.size(); i++) {
+			argv.push_back(job.args[i].c_str());
+		}
+		metrics.reset();
+		inServerJob = true;
+		ret = bowtie((int)argv.size(), argv.ptr());
+		inServerJob = false;
+		curResident = NULL;
+	}
+	cout.flush();
+	cerr.flush();
+	fflush(stdout);
+	fflush(stderr);
+	for(int i = 0; i < 3; i++) {
+		dup2(saved[i], i);
+		close(saved[i]);
+	}
+	clearerr(stdin);
+	if(cwdFd >= 0) {
+		if(fchdir(cwdFd) != 0) {
+			perror("fchdir");
+		}
+		close(cwdFd);
+	}
+	return ret;
+#else
+	return 1;
+#endif
+}
+
+/**
+ * Load every index named with -x (comma-separated), then serve
+ * alignment jobs from clients on the Unix socket given with --server
+ * until interrupted.  Jobs run one at a time, each using the server's
+ * -p worker threads; the index is never reloaded.
+ */
+static int serveAlignmentJobs() {
+#ifndef _WIN32
+	string sockPath = serverSock;
+	serverThreads = nthreads;
+	EList<string> bases;
+	tokenize(bt2index, ",", bases);
+	for(size_t i = 0; i < bases.size(); i++) {
+		loadResidentIndex(bases[i]);
+	}
+	int lfd = serverListen(sockPath);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serverSignalHandler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0; // no SA_RESTART, so that accept() is interrupted
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	if(!gQuiet) {
+		cerr << "Listening for alignment jobs on " << sockPath.c_str() << endl;
+	}
+	while(!serverStop) {
+		int conn = serverAccept(lfd);
+		if(conn < 0) continue;
+		ServerJob job;
+		if(serverRecvJob(conn, job)) {
+			serverSendStatus(conn, runServerJob(job));
+		}
+		close(conn);
+	}
+	close(lfd);
+	unlink(sockPath.c_str());
+	for(size_t i = 0; i < residents.size(); i++) {
+		delete residents[i].refs;
+		delete residents[i].bw;
+		delete residents[i].fw;
+	}
+	residents.clear();
+	return 0;
+#else
+	cerr << "Error: --server is not supported on Windows" << endl;
+	return 1;
+#endif
+}
+
 // C++ name mangling is disabled for the bowtie() function to make it
 // easier to use Bowtie as a library.
 extern "C" {
@@ -5129,6 +5779,7 @@ int bowtie(int argc, const char **argv) {
 		// Reset all global state, including getopt state
 		opterr = optind = 1;
 		resetOptions();
+		argstr.clear();
 		for(int i = 0; i < argc; i++) {
 			argstr += argv[i];
 			if(i < argc-1) argstr += " ";
@@ -5136,6 +5787,16 @@ int bowtie(int argc, const char **argv) {
 		if(startVerbose) { cerr << "Entered main(): "; logTime(cerr, true); }
 		parseOptions(argc, argv);
 		argv0 = argv[0];
+		if(inServerJob) {
+			if(!serverSock.empty()) {
+				cerr << "Error: --server can't be given in a job sent to a server" << endl;
+				return 1;
+			}
+			// Jobs share the server's worker threads
+			nthreads = serverThreads;
+		} else if(!connectSock.empty()) {
+			return clientSubmitJob(connectSock, argc, argv);
+		}
 		if(showVersion) {
 			cout << argv0 << " version " << BOWTIE2_VERSION << endl;
 			if(sizeof(void*) == 4) {
@@ -5156,6 +5817,15 @@ int bowtie(int argc, const char **argv) {
 				 << ", " << sizeof(off_t) << "}" << endl;
 			return 0;
 		}
+		if(shmemCleanup) {
+#ifdef BOWTIE_SHARED_MEM
+			cleanupSharedMem(false, true);
+			return 0;
+#else
+			cerr << "Error: this bowtie2 was built without shared memory support" << endl;
+			return 1;
+#endif
+		}
 		{
 			Timer _t(cerr, "Overall time: ", timing);
 			if(startVerbose) {
@@ -5169,6 +5839,10 @@ int bowtie(int argc, const char **argv) {
 				return 1;
 			}
 
+			if(!serverSock.empty()) {
+				return serveAlignmentJobs();
+			}
+
 #ifndef _WIN32
 			thread_stealing = thread_ceiling > nthreads;
 #endif
@@ -0,0 +1,288 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+#include "bt2_server.h"
+
+using namespace std;
+
+static const uint32_t jobMagic = 0x4a325442; // "BT2J"
+static const uint32_t maxPayload = 1024 * 1024;
+
+void ServerJob::closeFds() {
+#ifndef _WIN32
+	for(int i = 0; i < 3; i++) {
+		if(fds[i] >= 0) {
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+#endif
+}
+
+#ifndef _WIN32
+
+/**
+ * Fill in a sockaddr_un for 'path'.  Throws 1 if the path is too long.
+ */
+static void socketAddr(const string& path, struct sockaddr_un& addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.length() >= sizeof(addr.sun_path)) {
+		cerr << "Error: Socket path \"" << path.c_str() << "\" is too long" << endl;
+		throw 1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+}
+
+/**
+ * Read exactly 'len' bytes, retrying on EINTR and short reads.
+ */
+static bool readFully(int fd, void *buf, size_t len) {
+	char *p = (char *)buf;
+	while(len > 0) {
+		ssize_t r = read(fd, p, len);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return false;
+		p += r;
+		len -= (size_t)r;
+	}
+	return true;
+}
+
+/**
+ * Write exactly 'len' bytes, retrying on EINTR and short writes.
+ */
+static bool writeFully(int fd, const void *buf, size_t len) {
+	const char *p = (const char *)buf;
+	while(len > 0) {
+		ssize_t r = write(fd, p, len);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return false;
+		p += r;
+		len -= (size_t)r;
+	}
+	return true;
+}
+
+int serverListen(const string& path) {
+	struct sockaddr_un addr;
+	socketAddr(path, addr);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		perror("socket");
+		throw 1;
+	}
+	// Replace a socket left behind by a server that didn't shut down
+	// cleanly, but never clobber a regular file
+	struct stat sbuf;
+	if(lstat(path.c_str(), &sbuf) == 0) {
+		if(!S_ISSOCK(sbuf.st_mode)) {
+			cerr << "Error: \"" << path.c_str() << "\" exists and is not a socket" << endl;
+			close(fd);
+			throw 1;
+		}
+		unlink(path.c_str());
+	}
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror("bind");
+		cerr << "Error: Could not bind to socket \"" << path.c_str() << "\"" << endl;
+		close(fd);
+		throw 1;
+	}
+	if(listen(fd, 64) != 0) {
+		perror("listen");
+		close(fd);
+		throw 1;
+	}
+	return fd;
+}
+
+int serverAccept(int lfd) {
+	while(true) {
+		int conn = accept(lfd, NULL, NULL);
+		if(conn >= 0) return conn;
+		if(errno == EINTR) return -1;
+		if(errno == ECONNABORTED) continue;
+		perror("accept");
+		return -1;
+	}
+}
+
+bool serverRecvJob(int conn, ServerJob& job) {
+	uint32_t hdr[2];
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+	memset(cbuf, 0, sizeof(cbuf));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	ssize_t r;
+	do {
+		r = recvmsg(conn, &msg, 0);
+	} while(r < 0 && errno == EINTR);
+	if(r != (ssize_t)sizeof(hdr)) {
+		return false;
+	}
+	for(struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+		if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS &&
+		   c->cmsg_len == CMSG_LEN(3 * sizeof(int)))
+		{
+			memcpy(job.fds, CMSG_DATA(c), 3 * sizeof(int));
+		}
+	}
+	if(hdr[0] != jobMagic || hdr[1] == 0 || hdr[1] > maxPayload ||
+	   job.fds[0] < 0 || job.fds[1] < 0 || job.fds[2] < 0)
+	{
+		job.closeFds();
+		return false;
+	}
+	EList<char> payload(MISC_CAT);
+	payload.resize(hdr[1]);
+	if(!readFully(conn, payload.ptr(), hdr[1]) || payload[hdr[1]-1] != '\0') {
+		job.closeFds();
+		return false;
+	}
+	const char *p = payload.ptr();
+	const char *end = p + hdr[1];
+	job.cwd = p;
+	p += job.cwd.length() + 1;
+	while(p < end) {
+		job.args.push_back(string(p));
+		p += job.args.back().length() + 1;
+	}
+	if(job.args.empty()) {
+		job.closeFds();
+		return false;
+	}
+	return true;
+}
+
+void serverSendStatus(int conn, int status) {
+	int32_t st = (int32_t)status;
+	// Nothing to be done if the client has already gone away
+	writeFully(conn, &st, sizeof(st));
+}
+
+int clientSubmitJob(const string& path, int argc, const char **argv) {
+	struct sockaddr_un addr;
+	socketAddr(path, addr);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		perror("socket");
+		throw 1;
+	}
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror("connect");
+		cerr << "Error: Could not connect to a bowtie2 server at \"" << path.c_str() << "\"" << endl;
+		close(fd);
+		throw 1;
+	}
+	string payload;
+	char cwd[4096];
+	if(getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("getcwd");
+		close(fd);
+		throw 1;
+	}
+	payload.append(cwd);
+	payload.push_back('\0');
+	for(int i = 0; i < argc; i++) {
+		payload.append(argv[i]);
+		payload.push_back('\0');
+	}
+	if(payload.length() > maxPayload) {
+		cerr << "Error: Command line is too long to send to a bowtie2 server" << endl;
+		close(fd);
+		throw 1;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	uint32_t hdr[2] = { jobMagic, (uint32_t)payload.length() };
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+	memset(cbuf, 0, sizeof(cbuf));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	int fds[3] = { 0, 1, 2 };
+	memcpy(CMSG_DATA(c), fds, sizeof(fds));
+	ssize_t r;
+	do {
+		r = sendmsg(fd, &msg, 0);
+	} while(r < 0 && errno == EINTR);
+	if(r != (ssize_t)sizeof(hdr) || !writeFully(fd, payload.data(), payload.length())) {
+		cerr << "Error: Could not send job to bowtie2 server at \"" << path.c_str() << "\"" << endl;
+		close(fd);
+		throw 1;
+	}
+	int32_t status;
+	if(!readFully(fd, &status, sizeof(status))) {
+		cerr << "Error: bowtie2 server at \"" << path.c_str() << "\" hung up before the job finished" << endl;
+		close(fd);
+		throw 1;
+	}
+	close(fd);
+	return (int)status;
+}
+
+#else
+
+int serverListen(const string& path) {
+	cerr << "Error: --server is not supported on Windows" << endl;
+	throw 1;
+}
+
+int serverAccept(int lfd) { return -1; }
+
+bool serverRecvJob(int conn, ServerJob& job) { return false; }
+
+void serverSendStatus(int conn, int status) { }
+
+int clientSubmitJob(const string& path, int argc, const char **argv) {
+	cerr << "Error: --connect is not supported on Windows" << endl;
+	throw 1;
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BT2_SERVER_H_
+#define BT2_SERVER_H_
+
+/**
+ * \file Unix-domain-socket plumbing for the alignment server
+ * (--server) and its clients (--connect).
+ *
+ * A client sends one job per connection: its working directory and
+ * argv, plus its stdin, stdout and stderr descriptors (passed with
+ * SCM_RIGHTS).  The server runs the job with those descriptors in
+ * place of its own, so reads, SAM output and the alignment summary
+ * flow exactly as they would for a standalone run, then replies with
+ * the job's exit status.
+ *
+ * Wire format of a job: uint32 magic, uint32 payload length (sent
+ * together with the 3 descriptors), then the payload: the working
+ * directory followed by each argument, each NUL-terminated.  The
+ * reply is a single int32 exit status.
+ */
+
+#include <string>
+#include "ds.h"
+#include "mem_ids.h"
+
+/**
+ * A job received by the server.
+ */
+struct ServerJob {
+
+	ServerJob() : args(MISC_CAT) {
+		fds[0] = fds[1] = fds[2] = -1;
+	}
+
+	/**
+	 * Close any descriptors we still hold.
+	 */
+	void closeFds();
+
+	std::string   cwd;    // client's working directory
+	EList<std::string> args; // client's argv, including argv[0]
+	int           fds[3]; // client's stdin, stdout, stderr
+};
+
+/**
+ * Create, bind and listen on a Unix domain socket at 'path', replacing
+ * a stale socket file if one is there.  Throws 1 on failure.
+ */
+extern int serverListen(const std::string& path);
+
+/**
+ * Wait for and accept the next connection.  Returns -1 if interrupted
+ * by a signal.
+ */
+extern int serverAccept(int lfd);
+
+/**
+ * Read one job from connection 'conn'.  Returns false if the client
+ * sent something malformed or hung up early.
+ */
+extern bool serverRecvJob(int conn, ServerJob& job);
+
+/**
+ * Send the job's exit status back to the client.
+ */
+extern void serverSendStatus(int conn, int status);
+
+/**
+ * Submit argv as a job to the server listening at 'path', handing
+ * over this process's working directory and standard descriptors,
+ * and wait for it to finish.  Returns the job's exit status.  Throws
+ * 1 if the server can't be reached.
+ */
+extern int clientSubmitJob(const std::string& path, int argc, const char **argv);
+
+#endif /* BT2_SERVER_H_ */
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <dirent.h>
+#include <stdlib.h>
+#endif
+#include "build_metrics.h"
+
+using namespace std;
+
+BuildMetrics gBuildMetrics;
+
+/**
+ * Append 's' to 'o' as a JSON string.
+ */
+static void jsonString(ostringstream& o, const string& s) {
+	o << '"';
+	for(size_t i = 0; i < s.length(); i++) {
+		unsigned char c = (unsigned char)s[i];
+		if(c == '"' || c == '\\') {
+			o << '\\' << c;
+		} else if(c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			o << buf;
+		} else {
+			o << c;
+		}
+	}
+	o << '"';
+}
+
+/**
+ * Append the process's memory and CPU usage to 'o', and the CPU time of
+ * each of its threads where /proc has it.
+ */
+static void resourceUsage(ostringstream& o) {
+	char buf[64];
+#ifdef __linux__
+	FILE *f = fopen("/proc/self/statm", "r");
+	if(f != NULL) {
+		unsigned long size = 0, resident = 0;
+		if(fscanf(f, "%lu %lu", &size, &resident) == 2) {
+			double mb = (double)resident * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+			snprintf(buf, sizeof(buf), ",\"rss_mb\":%.1f", mb);
+			o << buf;
+		}
+		fclose(f);
+	}
+#endif
+#ifndef _WIN32
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef __APPLE__
+		double mb = (double)ru.ru_maxrss / (1024.0 * 1024.0); // bytes on macOS
+#else
+		double mb = (double)ru.ru_maxrss / 1024.0;            // kilobytes elsewhere
+#endif
+		double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		             (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+		snprintf(buf, sizeof(buf), ",\"peak_rss_mb\":%.1f,\"cpu_secs\":%.2f", mb, cpu);
+		o << buf;
+	}
+#endif
+#ifdef __linux__
+	DIR *d = opendir("/proc/self/task");
+	if(d == NULL) {
+		return;
+	}
+	double tick = (double)sysconf(_SC_CLK_TCK);
+	bool first = true;
+	o << ",\"threads\":[";
+	struct dirent *e;
+	while((e = readdir(d)) != NULL) {
+		if(e->d_name[0] < '0' || e->d_name[0] > '9') continue;
+		string fname = string("/proc/self/task/") + e->d_name + "/stat";
+		FILE *f = fopen(fname.c_str(), "r");
+		if(f == NULL) continue; // thread just exited
+		char line[1024];
+		size_t n = fread(line, 1, sizeof(line) - 1, f);
+		fclose(f);
+		line[n] = '\0';
+		// utime and stime are the 12th and 13th fields after the
+		// parenthesized command name, which may itself hold spaces
+		char *p = strrchr(line, ')');
+		if(p == NULL) continue;
+		p++;
+		unsigned long utime = 0, stime = 0;
+		if(sscanf(p, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+			continue;
+		}
+		snprintf(buf, sizeof(buf), "%s{\"tid\":%s,\"cpu_secs\":%.2f}",
+		         first ? "" : ",", e->d_name, (utime + stime) / tick);
+		o << buf;
+		first = false;
+	}
+	closedir(d);
+	o << "]";
+#endif
+}
+
+uint64_t BuildMetrics::now() {
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void BuildMetrics::open(const string& fname, bool toStderr, int ival) {
+	close();
+	if(!fname.empty()) {
+		out_ = fopen(fname.c_str(), "w");
+		if(out_ == NULL) {
+			cerr << "Error: Could not open metrics file " << fname.c_str() << endl;
+			throw 1;
+		}
+	}
+	stderr_ = toStderr;
+	ival_ = ival;
+	start_ = now();
+	if(enabled() && ival_ > 0) {
+		stop_ = false;
+#ifdef WITH_TBB
+		heartbeat_ = new std::thread(heartbeat, (void*)this);
+#else
+		heartbeat_ = new tthread::thread(heartbeat, (void*)this);
+#endif
+	}
+}
+
+void BuildMetrics::close() {
+	if(heartbeat_ != NULL) {
+		stop_ = true;
+		heartbeat_->join();
+		delete heartbeat_;
+		heartbeat_ = NULL;
+	}
+	for(size_t i = 0; i < phases_.size(); i++) {
+		delete phases_[i];
+	}
+	phases_.clear();
+	if(out_ != NULL) {
+		fclose(out_);
+		out_ = NULL;
+	}
+	stderr_ = false;
+}
+
+BuildMetrics::Phase* BuildMetrics::begin(
+	const string& index,
+	const char *name,
+	const char *unit,
+	uint64_t total)
+{
+	if(!enabled()) return NULL;
+	Phase *p = new Phase;
+	p->index = index;
+	p->name  = name;
+	p->unit  = unit;
+	p->done  = 0;
+	p->total = total;
+	p->start = now();
+	ThreadSafe ts(lock_);
+	phases_.push_back(p);
+	report(*p, "start", string());
+	return p;
+}
+
+void BuildMetrics::block(
+	Phase *p,
+	size_t block,
+	size_t nblocks,
+	int worker,
+	uint64_t suffixes,
+	uint64_t usecs)
+{
+	if(p == NULL) return;
+	ostringstream o;
+	o << ",\"block\":" << block << ",\"blocks\":" << nblocks
+	  << ",\"worker\":" << worker << ",\"suffixes\":" << suffixes
+	  << ",\"block_secs\":" << (usecs / 1000) / 1000.0;
+	ThreadSafe ts(lock_);
+	p->done += suffixes;
+	report(*p, "block", o.str());
+}
+
+void BuildMetrics::end(Phase *p) {
+	if(p == NULL) return;
+	ThreadSafe ts(lock_);
+	if(p->total > 0 && p->done == 0) {
+		// The phase didn't count as it went; it's all done now
+		p->done = p->total;
+	}
+	report(*p, "end", string());
+	for(size_t i = 0; i < phases_.size(); i++) {
+		if(phases_[i] == p) {
+			phases_.erase(i);
+			break;
+		}
+	}
+	delete p;
+}
+
+void BuildMetrics::report(const Phase& p, const char *event, const string& extra) {
+	uint64_t t = now();
+	double secs = (t - p.start) / 1000000.0;
+	char buf[128];
+	ostringstream o;
+	snprintf(buf, sizeof(buf), "{\"time\":%lu,\"elapsed\":%.3f,\"index\":",
+	         (unsigned long)time(0), (t - start_) / 1000000.0);
+	o << buf;
+	jsonString(o, p.index);
+	o << ",\"phase\":\"" << p.name << "\",\"event\":\"" << event << "\""
+	  << ",\"done\":" << p.done << ",\"total\":" << p.total
+	  << ",\"unit\":\"" << p.unit << "\"";
+	snprintf(buf, sizeof(buf), ",\"secs\":%.3f,\"rate\":%.1f",
+	         secs, secs > 0 ? p.done / secs : 0.0);
+	o << buf << extra;
+	resourceUsage(o);
+	o << "}" << endl;
+	string s = o.str();
+	if(out_ != NULL) {
+		fputs(s.c_str(), out_);
+		fflush(out_);
+	}
+	if(stderr_) {
+		cerr << s;
+	}
+}
+
+void BuildMetrics::heartbeat(void *vp) {
+	BuildMetrics *m = (BuildMetrics*)vp;
+	uint64_t last = now();
+	while(!m->stop_) {
+		SLEEP(100);
+		if(now() - last < (uint64_t)m->ival_ * 1000000) {
+			continue;
+		}
+		last = now();
+		ThreadSafe ts(m->lock_);
+		for(size_t i = 0; i < m->phases_.size(); i++) {
+			m->report(*m->phases_[i], "progress", string());
+		}
+	}
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUILD_METRICS_H_
+#define BUILD_METRICS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "ds.h"
+#include "mem_ids.h"
+#include "threading.h"
+
+/**
+ * Machine-readable progress of an index build, for bowtie2-build's
+ * --met-file and --met-stderr.  Each phase of each index (named by the
+ * index's basename) reports when it starts and ends, and every --met
+ * seconds the phases still running report how far along they are.
+ * Every report is one JSON object on a line of its own:
+ *
+ *   {"time":1700000000,"elapsed":12.503,"index":"lambda",
+ *    "phase":"block_sort","event":"progress","done":2097152,
+ *    "total":4194305,"unit":"suffixes","secs":6.117,"rate":342836.1,
+ *    "rss_mb":310.4,"peak_rss_mb":402.9,"cpu_secs":24.31,
+ *    "threads":[{"tid":4117,"cpu_secs":6.02},...]}
+ *
+ * 'rate' is 'done' per second of the phase so far.  Each sorted block
+ * of the suffix array also gets a "block" event saying which worker
+ * thread sorted it and how long that took.  Memory and per-thread CPU
+ * times are left out where the platform can't supply them.
+ */
+class BuildMetrics {
+
+public:
+
+	/**
+	 * A phase in progress.  Phases are owned by BuildMetrics and only
+	 * ever touched under its lock.
+	 */
+	struct Phase {
+		std::string index;
+		const char *name;
+		const char *unit;
+		uint64_t    done;
+		uint64_t    total; // 0 if not known in advance
+		uint64_t    start; // microseconds
+	};
+
+	BuildMetrics() :
+		out_(NULL),
+		stderr_(false),
+		ival_(0),
+		start_(now()),
+		phases_(MISC_CAT),
+		stop_(false),
+		heartbeat_(NULL)
+	{ }
+
+	~BuildMetrics() { close(); }
+
+	/**
+	 * Start reporting to the named file (unless 'fname' is empty)
+	 * and/or stderr, with a progress report every 'ival' seconds (none
+	 * if 'ival' is 0).  Throws 1 if the file can't be opened.
+	 */
+	void open(const std::string& fname, bool toStderr, int ival);
+
+	/**
+	 * Stop the progress reports and close the file.
+	 */
+	void close();
+
+	/// Return true iff metrics are being reported anywhere
+	bool enabled() const {
+		return out_ != NULL || stderr_;
+	}
+
+	/**
+	 * Report the start of a phase and return a handle for reporting its
+	 * progress and end, or NULL if metrics are off.
+	 */
+	Phase* begin(const std::string& index, const char *name, const char *unit, uint64_t total);
+
+	/**
+	 * Note that 'done' units of the phase are now done.
+	 */
+	void progress(Phase *p, uint64_t done) {
+		if(p == NULL) return;
+		ThreadSafe ts(lock_);
+		p->done = done;
+	}
+
+	/**
+	 * Note that 'n' more units of the phase are done.
+	 */
+	void add(Phase *p, uint64_t n) {
+		if(p == NULL) return;
+		ThreadSafe ts(lock_);
+		p->done += n;
+	}
+
+	/**
+	 * Report that block 'block' (0-based) of the suffix array, holding
+	 * 'suffixes' suffixes, was sorted by worker 'worker' in 'usecs'
+	 * microseconds, and count its suffixes as done.
+	 */
+	void block(Phase *p, size_t block, size_t nblocks, int worker, uint64_t suffixes, uint64_t usecs);
+
+	/**
+	 * Report the end of the phase and forget it.
+	 */
+	void end(Phase *p);
+
+	/// Return the time of day in microseconds
+	static uint64_t now();
+
+private:
+
+	/// Write one report about phase 'p'; caller holds the lock
+	void report(const Phase& p, const char *event, const std::string& extra);
+
+	/// Body of the thread that writes the periodic progress reports
+	static void heartbeat(void *vp);
+
+	FILE            *out_;
+	bool             stderr_;
+	int              ival_;    // seconds between progress reports
+	uint64_t         start_;
+	EList<Phase*>    phases_;  // phases underway
+	volatile bool    stop_;    // tell the heartbeat thread to quit
+#ifdef WITH_TBB
+	std::thread     *heartbeat_;
+#else
+	tthread::thread *heartbeat_;
+#endif
+	MUTEX_T          lock_;
+};
+
+extern BuildMetrics gBuildMetrics;
+
+/**
+ * Reports a phase to gBuildMetrics for as long as it's in scope, in the
+ * manner of Timer.  Does nothing if metrics are off.
+ */
+class BuildPhase {
+public:
+	BuildPhase(const std::string& index, const char *name, const char *unit, uint64_t total = 0) :
+		p_(gBuildMetrics.enabled() ? gBuildMetrics.begin(index, name, unit, total) : NULL)
+	{ }
+
+	~BuildPhase() { end(); }
+
+	/// End the phase before going out of scope
+	void end() {
+		gBuildMetrics.end(p_);
+		p_ = NULL;
+	}
+
+	void progress(uint64_t done) { gBuildMetrics.progress(p_, done); }
+
+	void add(uint64_t n) { gBuildMetrics.add(p_, n); }
+
+	void block(size_t block, size_t nblocks, int worker, uint64_t suffixes, uint64_t usecs) {
+		gBuildMetrics.block(p_, block, nblocks, worker, suffixes, usecs);
+	}
+
+private:
+	BuildMetrics::Phase *p_;
+};
+
+#endif /*ndef BUILD_METRICS_H_*/
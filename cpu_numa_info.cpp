@@ -1,9 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 #include "cpu_numa_info.h"
 
-/// Based on http://stackoverflow.com/questions/16862620/numa-get-current-node-core
 void get_cpu_and_node_(int& cpu, int& node) {
+	cpu = node = 0;
+#if defined(__linux__) && defined(SYS_getcpu)
+	unsigned int c = 0, n = 0;
+	if(syscall(SYS_getcpu, &c, &n, NULL) == 0) {
+		cpu = (int)c;
+		node = (int)n;
+	}
+#elif defined(__x86_64__) || defined(__i386__)
+	/// Based on http://stackoverflow.com/questions/16862620/numa-get-current-node-core
 	unsigned long a,d,c;
 	__asm__ volatile("rdtscp" : "=a" (a), "=d" (d), "=c" (c));
 	node = (c & 0xFFF000)>>12;
 	cpu = c & 0xFFF;
+#endif
 }
+
+#ifdef __linux__
+
+static const char *sysNodeDir = "/sys/devices/system/node";
+
+/**
+ * Parse a kernel CPU list such as "0-3,8,10-11" and append each CPU
+ * that's also set in 'allowed' to 'cpus'.
+ */
+static void parseCpuList(const char *s, const cpu_set_t& allowed, EList<int>& cpus) {
+	while(*s != '\0' && *s != '\n') {
+		char *end;
+		long lo = strtol(s, &end, 10);
+		if(end == s) return;
+		long hi = lo;
+		s = end;
+		if(*s == '-') {
+			hi = strtol(s + 1, &end, 10);
+			s = end;
+		}
+		for(long c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+			if(CPU_ISSET((int)c, &allowed)) {
+				cpus.push_back((int)c);
+			}
+		}
+		if(*s == ',') s++;
+	}
+}
+
+bool numaNodes(EList<NumaNode>& nodes) {
+	nodes.clear();
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return false;
+	}
+	DIR *d = opendir(sysNodeDir);
+	if(d == NULL) {
+		return false;
+	}
+	EList<int> ids(MISC_CAT);
+	struct dirent *ent;
+	while((ent = readdir(d)) != NULL) {
+		int id;
+		char trail;
+		if(sscanf(ent->d_name, "node%d%c", &id, &trail) == 1) {
+			ids.push_back(id);
+		}
+	}
+	closedir(d);
+	ids.sort();
+	for(size_t i = 0; i < ids.size(); i++) {
+		char fname[256];
+		snprintf(fname, sizeof(fname), "%s/node%d/cpulist", sysNodeDir, ids[i]);
+		FILE *f = fopen(fname, "r");
+		if(f == NULL) continue;
+		char buf[4096];
+		if(fgets(buf, sizeof(buf), f) != NULL) {
+			nodes.expand();
+			nodes.back().id = ids[i];
+			nodes.back().cpus.clear();
+			parseCpuList(buf, allowed, nodes.back().cpus);
+			if(nodes.back().cpus.empty()) {
+				// Memory-only node, or none of its CPUs are ours
+				nodes.pop_back();
+			}
+		}
+		fclose(f);
+	}
+	return !nodes.empty();
+}
+
+bool numaBindThread(const NumaNode& node) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(size_t i = 0; i < node.cpus.size(); i++) {
+		CPU_SET(node.cpus[i], &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#else
+
+bool numaNodes(EList<NumaNode>& nodes) {
+	nodes.clear();
+	return false;
+}
+
+bool numaBindThread(const NumaNode& node) {
+	return false;
+}
+
+#endif
@@ -1,6 +1,39 @@
 #ifndef CPU_AND_NODE_H_
 #define CPU_AND_NODE_H_
 
+#include "ds.h"
+#include "mem_ids.h"
+
+/**
+ * Set 'cpu' and 'node' to the CPU the calling thread is running on and
+ * the NUMA node that CPU belongs to.  Both are set to 0 if this can't
+ * be determined.
+ */
 extern void get_cpu_and_node_(int& cpu, int& node);
 
+/**
+ * A NUMA node, along with those of its CPUs this process may run on.
+ */
+struct NumaNode {
+
+	NumaNode() : id(0), cpus(MISC_CAT) { }
+
+	int        id;   // node number, as used by the kernel
+	EList<int> cpus; // CPUs on the node in our affinity mask
+};
+
+/**
+ * Fill 'nodes' with the NUMA nodes having at least one CPU in this
+ * process's affinity mask, in order of node number.  Returns false,
+ * with 'nodes' empty, if the topology can't be determined (always the
+ * case on platforms other than Linux).
+ */
+extern bool numaNodes(EList<NumaNode>& nodes);
+
+/**
+ * Restrict the calling thread to the CPUs of the given node.  Returns
+ * false if the thread couldn't be bound.
+ */
+extern bool numaBindThread(const NumaNode& node);
+
 #endif
@@ -33,6 +33,8 @@
 #include "ds.h"
 #include "mem_ids.h"
 #include "ls.h"
+#include "prefix_doubling.h"
+#include "threading.h"
 #include "btypes.h"
 
 using namespace std;
@@ -537,7 +539,7 @@ public:
 private:
 
 	void doBuiltSanityCheck() const;
-	void buildSPrime(EList<TIndexOffU>& sPrime, size_t padding);
+	void buildSPrime(EList<TIndexOffU>& sPrime, size_t padding, int nthreads);
 
 	bool built() const {
 		return _isaPrime.size() > 0;
@@ -596,18 +598,54 @@ void DifferenceCoverSample<TStr>::doBuiltSanityCheck() const {
 #endif
 }
 
+/**
+ * Fills in s' for buildSPrime(), one range of text periods at a time:
+ * for period i, the suffix at i*v + d goes in slot i of d's section.
+ */
+struct SPrimeFiller {
+	SPrimeFiller(
+		EList<TIndexOffU>& sPrime,
+		const EList<TIndexOffU>& doffs,
+		const EList<uint32_t>& ds,
+		uint32_t v,
+		TIndexOffU tlen) :
+		sPrime(sPrime), doffs(doffs), ds(ds), v(v), tlen(tlen) { }
+
+	void operator()(size_t begin, size_t end) {
+		uint32_t d = (uint32_t)ds.size();
+		for(size_t i = begin; i < end; i++) {
+			TIndexOffU ti = (TIndexOffU)(i * v);
+			for(uint32_t di = 0; di < d; di++) {
+				TIndexOffU tti = ti + ds[di];
+				if(tti > tlen) break;
+				TIndexOffU spi = doffs[di] + (TIndexOffU)i;
+				assert_lt(spi, doffs[di+1]);
+				assert_eq(OFF_MASK, sPrime[spi]);
+				sPrime[spi] = tti;
+			}
+		}
+	}
+
+	EList<TIndexOffU>&       sPrime;
+	const EList<TIndexOffU>& doffs;
+	const EList<uint32_t>&   ds;
+	uint32_t                 v;
+	TIndexOffU               tlen;
+};
+
 /**
  * Build the s' array by sampling suffixes (suffix offsets, actually)
  * from t according to the difference-cover sample and pack them into
  * an array of machine words in the order dictated by the "mu" mapping
- * described in Burkhardt.
+ * described in Burkhardt.  The text is split among 'nthreads' threads.
  *
  * Also builds _doffs map.
  */
 template <typename TStr>
 void DifferenceCoverSample<TStr>::buildSPrime(
 	EList<TIndexOffU>& sPrime,
-	size_t padding)
+	size_t padding,
+	int nthreads)
 {
 	const TStr& t = this->text();
 	const EList<uint32_t>& ds = this->ds();
@@ -645,22 +683,13 @@ void DifferenceCoverSample<TStr>::buildSPrime(
 	sPrime.fill(OFF_MASK);
 	// Slot suffixes from text into sPrime according to the mu
 	// mapping; where the mapping would leave a blank, insert a 0
-	TIndexOffU added = 0;
-	TIndexOffU i = 0;
-	for(TIndexOffU ti = 0; ti <= tlen; ti += v) {
-		for(uint32_t di = 0; di < d; di++) {
-			TIndexOffU tti = ti + ds[di];
-			if(tti > tlen) break;
-			TIndexOffU spi = _doffs[di] + i;
-			assert_lt(spi, _doffs[di+1]);
-			assert_leq(tti, tlen);
-			assert_lt(spi, sPrimeSz);
-			assert_eq(OFF_MASK, sPrime[spi]);
-			sPrime[spi] = tti; added++;
-		}
-		i++;
+	SPrimeFiller filler(sPrime, _doffs, ds, v, tlen);
+	parallelRanges(filler, (size_t)tlenDivV + 1, nthreads);
+#ifndef NDEBUG
+	for(TIndexOffU i = 0; i < sPrimeSz; i++) {
+		assert_neq(OFF_MASK, sPrime[i]);
 	}
-	assert_eq(added, sPrimeSz);
+#endif
 }
 
 /**
@@ -684,6 +713,80 @@ static inline bool suffixSameUpTo(
 	return true;
 }
 
+/**
+ * Ranks the v-sorted samples for DifferenceCoverSample::build(), with
+ * the samples split into 'nchunks' ranges.  The first pass notes which
+ * samples differ from the next one within the first v characters and
+ * counts them in each range; the second assigns the ranks, starting
+ * each range after the count for the ranges before it.
+ */
+template<typename TStr>
+struct VSortRanker {
+	VSortRanker(
+		const TStr& t,
+		const EList<TIndexOffU>& sPrime,
+		const EList<TIndexOffU>& sPrimeOrder,
+		size_t sPrimeSz,
+		uint32_t v,
+		size_t nchunks,
+		EList<TIndexOffU>& isaPrime) :
+		t(t), sPrime(sPrime), sPrimeOrder(sPrimeOrder), sPrimeSz(sPrimeSz),
+		v(v), nchunks(nchunks), isaPrime(isaPrime), pass(0),
+		diffs(EBWTB_CAT), counts(EBWTB_CAT)
+	{
+		diffs.resizeExact(sPrimeSz);
+		counts.resizeExact(nchunks);
+	}
+
+	void operator()(size_t begin, size_t end) {
+		for(size_t c = begin; c < end; c++) {
+			size_t lo = sPrimeSz * c / nchunks;
+			size_t hi = sPrimeSz * (c+1) / nchunks;
+			if(pass == 0) {
+				TIndexOffU cnt = 0;
+				for(size_t i = lo; i < hi; i++) {
+					// If sPrime[i] and sPrime[i+1] are identical up to v,
+					// the next suffix gets the same rank
+					diffs[i] = (i+1 < sPrimeSz &&
+					            !suffixSameUpTo(t, sPrime[i], sPrime[i+1], v));
+					if(diffs[i]) cnt++;
+				}
+				counts[c] = cnt;
+			} else {
+				TIndexOffU rank = counts[c];
+				for(size_t i = lo; i < hi; i++) {
+					isaPrime[sPrimeOrder[i]] = rank;
+					if(diffs[i]) rank++;
+				}
+			}
+		}
+	}
+
+	/**
+	 * Turn the counts into the rank each range starts from.
+	 */
+	void startRanks() {
+		TIndexOffU sum = 0;
+		for(size_t c = 0; c < nchunks; c++) {
+			TIndexOffU cnt = counts[c];
+			counts[c] = sum;
+			sum += cnt;
+		}
+		pass = 1;
+	}
+
+	const TStr&              t;
+	const EList<TIndexOffU>& sPrime;
+	const EList<TIndexOffU>& sPrimeOrder;
+	size_t                   sPrimeSz;
+	uint32_t                 v;
+	size_t                   nchunks;
+	EList<TIndexOffU>&       isaPrime;
+	int                      pass;
+	EList<bool>              diffs;  // sample differs from the next
+	EList<TIndexOffU>        counts; // per range: differences, then first rank
+};
+
 template<typename TStr>
 struct VSortingParam {
     DifferenceCoverSample<TStr>* dcs;
@@ -764,12 +867,14 @@ void DifferenceCoverSample<TStr>::build(int nthreads) {
 	// arrays.  One element that's less than all others, and another that acts
 	// as needed padding for the Larsson-Sadakane sorting code.
 	size_t padding = 1;
-	VMSG_NL("  Building sPrime");
-	buildSPrime(sPrime, padding);
+	{
+		Timer timer(cout, "  Building sPrime time: ", this->verbose());
+		VMSG_NL("  Building sPrime");
+		buildSPrime(sPrime, padding, nthreads);
+	}
 	size_t sPrimeSz = sPrime.size() - padding;
 	assert_gt(sPrime.size(), padding);
 	assert_leq(sPrime.size(), t.length() + padding + 1);
-	TIndexOffU nextRank = 0;
 	{
 		VMSG_NL("  Building sPrimeOrder");
 		EList<TIndexOffU> sPrimeOrder;
@@ -873,14 +978,13 @@ void DifferenceCoverSample<TStr>::build(int nthreads) {
 		{
 			Timer timer(cout, "  Ranking v-sort output time: ", this->verbose());
 			VMSG_NL("  Ranking v-sort output");
-			for(size_t i = 0; i < sPrimeSz-1; i++) {
-				// Place the appropriate ranking
-				_isaPrime[sPrimeOrder[i]] = nextRank;
-				// If sPrime[i] and sPrime[i+1] are identical up to v, then we
-				// should give the next suffix the same rank
-				if(!suffixSameUpTo(t, sPrime[i], sPrime[i+1], v)) nextRank++;
-			}
-			_isaPrime[sPrimeOrder[sPrimeSz-1]] = nextRank; // finish off
+			// Comparing neighbors takes up to v characters each, so
+			// split the samples among the threads
+			size_t nchunks = (size_t)max<int>(nthreads, 1);
+			VSortRanker<TStr> ranker(t, sPrime, sPrimeOrder, sPrimeSz, v, nchunks, _isaPrime);
+			parallelRanges(ranker, nchunks, nthreads);
+			ranker.startRanks();
+			parallelRanges(ranker, nchunks, nthreads);
 #ifndef NDEBUG
 			for(size_t i = 0; i < sPrimeSz; i++) {
 				assert_neq(OFF_MASK, _isaPrime[i]);
@@ -895,13 +999,25 @@ void DifferenceCoverSample<TStr>::build(int nthreads) {
 	sPrime[sPrime.size()-1] = (TIndexOffU)sPrimeSz;
 	// _isaPrime[_isaPrime.size()-1] and sPrime[sPrime.size()-1] are just
 	// spacer for the Larsson-Sadakane routine to use
-	{
+	if(sPrime.size() >= LS_SIZE) {
+		cerr << "Error; sPrime array has so many elements that it can't be converted to a signed array without overflow." << endl;
+		throw 1;
+	}
+	if(nthreads > 2) {
+		// Same result as Larsson-Sadakane, but with the groups of
+		// still-tied samples sorted on all threads.  It does about
+		// twice the work, so it only pays off with a few threads
+		Timer timer(cout, "  Prefix-doubling sort of ranks time: ", this->verbose());
+		VMSG_NL("  Prefix-doubling sort of ranks");
+		PrefixDoublingSort<TIndexOff> pd(nthreads);
+		pd.suffixsort(
+			(TIndexOff*)_isaPrime.ptr(),
+			(TIndexOff*)sPrime.ptr(),
+			(TIndexOff)sPrimeSz,
+			(TIndexOff)sPrime.size());
+	} else {
 		Timer timer(cout, "  Invoking Larsson-Sadakane on ranks time: ", this->verbose());
 		VMSG_NL("  Invoking Larsson-Sadakane on ranks");
-		if(sPrime.size() >= LS_SIZE) {
-			cerr << "Error; sPrime array has so many elements that it can't be converted to a signed array without overflow." << endl;
-			throw 1;
-		}
 		LarssonSadakane<TIndexOff> ls;
 		ls.suffixsort(
 			(TIndexOff*)_isaPrime.ptr(),
@@ -277,6 +277,7 @@ public:
 	
 	inline T* get() { return p_; }
 	inline const T* get() const { return p_; }
+	inline size_t size() const { return sz_; }
 
 private:
 	int cat_;
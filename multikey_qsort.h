@@ -21,12 +21,15 @@
 #define MULTIKEY_QSORT_H_
 
 #include <iostream>
+#include <sstream>
+#include <sys/time.h>
 #include "sequence_io.h"
 #include "alphabet.h"
 #include "assert_helpers.h"
 #include "diff_sample.h"
 #include "sstring.h"
 #include "btypes.h"
+#include "threading.h"
 
 using namespace std;
 
@@ -791,10 +794,13 @@ bool sufDcLtU8(
 }
 
 /**
- * k log(k)
+ * Partition s[begin, end) about a randomly chosen pivot suffix, using
+ * the difference cover to compare in constant time.  Return the
+ * offset where the pivot ends up; everything before it is less and
+ * everything after it is greater.
  */
 template<typename T1, typename T2> inline
-void qsortSufDcU8(
+size_t partitionSufDcU8(
 	const T1& host1,
 	const T2& host,
 	size_t hlen,
@@ -807,9 +813,8 @@ void qsortSufDcU8(
 {
 	assert_leq(end, slen);
 	assert_lt(begin, slen);
-	assert_gt(end, begin);
+	assert_gt(end, begin + 1);
 	size_t n = end - begin;
-	if(n <= 1) return;                 // 1-element list already sorted
 	// Note: rand() didn't really cut it here; it seemed to run out of
 	// randomness and, after a time, returned the same thing over and
 	// over again
@@ -833,8 +838,32 @@ void qsortSufDcU8(
 	// Put pivot into place
 	assert_lt(cur, end-begin);
 	SWAP(s, end-1, begin+cur);
-	if(begin+cur > begin) qsortSufDcU8(host1, host, hlen, s, slen, dc, begin, begin+cur);
-	if(end > begin+cur+1) qsortSufDcU8(host1, host, hlen, s, slen, dc, begin+cur+1, end);
+	return begin+cur;
+}
+
+/**
+ * k log(k)
+ */
+template<typename T1, typename T2> inline
+void qsortSufDcU8(
+	const T1& host1,
+	const T2& host,
+	size_t hlen,
+	TIndexOffU* s,
+	size_t slen,
+	const DifferenceCoverSample<T1>& dc,
+	size_t begin,
+	size_t end,
+	bool sanityCheck = false)
+{
+	assert_leq(end, slen);
+	assert_lt(begin, slen);
+	assert_gt(end, begin);
+	size_t n = end - begin;
+	if(n <= 1) return;                 // 1-element list already sorted
+	size_t p = partitionSufDcU8(host1, host, hlen, s, slen, dc, begin, end, sanityCheck);
+	if(p > begin) qsortSufDcU8(host1, host, hlen, s, slen, dc, begin, p);
+	if(end > p+1) qsortSufDcU8(host1, host, hlen, s, slen, dc, p+1, end);
 }
 
 #define BUCKET_SORT_CUTOFF (4 * 1024 * 1024)
@@ -1018,10 +1047,11 @@ static void bucketSortSufDcU8(
                               size_t _depth,
                               bool sanityCheck = false)
 {
-    // 5 64-element buckets for bucket-sorting A, C, G, T, $
+    // 5 64-element buckets for bucket-sorting A, C, G, T, $; no
+    // bucket can outgrow the range we started with
     TIndexOffU* bkts[4];
     for(size_t i = 0; i < 4; i++) {
-        bkts[i] = new TIndexOffU[4 * 1024 * 1024];
+        bkts[i] = new TIndexOffU[min<size_t>(_end - _begin, BUCKET_SORT_CUTOFF)];
     }
     ELList<size_t, 5, 1024> block_list;
     bool first = true;
@@ -1104,6 +1134,82 @@ static void bucketSortSufDcU8(
     }
 }
 
+/**
+ * One ternary partitioning step of the multikey quicksort below: split
+ * s[begin, end) by the character at offset 'depth' into suffixes less
+ * than, equal to and greater than a pivot character, in that order.
+ * Sets nlt, neq and ngt to the sizes of the three parts and returns the
+ * pivot character.
+ */
+template<typename T2>
+static int mkeyPartitionSufDcU8(
+	const T2& host,
+	size_t hlen,
+	TIndexOffU* s,
+	size_t slen,
+	int hi,
+	size_t begin,
+	size_t end,
+	size_t depth,
+	size_t& nlt,
+	size_t& neq,
+	size_t& ngt)
+{
+	size_t n = end - begin;
+	size_t a, b, c, d, r;
+	CHOOSE_AND_SWAP_PIVOT(SWAP1, CHAR_AT_SUF_U8); // choose pivot, swap to begin
+	int v = CHAR_AT_SUF_U8(begin, depth); // v <- pivot value
+	#ifndef NDEBUG
+	{
+		bool stillInBounds = false;
+		for(size_t i = begin; i < end; i++) {
+			if(depth < (hlen-s[i])) {
+				stillInBounds = true;
+				break;
+			} else { /* already fell off this suffix */ }
+		}
+		assert(stillInBounds); // >=1 suffix must still be in bounds
+	}
+	#endif
+	a = b = begin;
+	c = d = end-1;
+	while(true) {
+		// Invariant: everything before a is = pivot, everything
+		// between a and b is <
+		int bc = 0; // shouldn't have to init but gcc on Mac complains
+		while(b <= c && v >= (bc = CHAR_AT_SUF_U8(b, depth))) {
+			if(v == bc) {
+				SWAP(s, a, b); a++;
+			}
+			b++;
+		}
+		// Invariant: everything after d is = pivot, everything
+		// between c and d is >
+		int cc = 0; // shouldn't have to init but gcc on Mac complains
+		//bool hiLatch = true;
+		while(b <= c && v <= (cc = CHAR_AT_SUF_U8(c, depth))) {
+			if(v == cc) {
+				SWAP(s, c, d); d--;
+			}
+			//else if(hiLatch && cc == hi) { }
+			c--;
+		}
+		if(b > c) break;
+		SWAP(s, b, c);
+		b++;
+		c--;
+	}
+	assert(a > begin || c < end-1);                      // there was at least one =s
+	assert_lt(d-c, n); // they can't all have been > pivot
+	assert_lt(b-a, n); // they can't all have been < pivot
+	r = min(a-begin, b-a); VECSWAP(s, begin, b-r,   r);  // swap left = to center
+	r = min(d-c, end-d-1); VECSWAP(s, b,     end-r, r);  // swap right = to center
+	nlt = b-a;
+	neq = (a-begin) + (end-d-1);
+	ngt = d-c;
+	return v;
+}
+
 /**
  * Main multikey quicksort function for suffixes.  Based on Bentley &
  * Sedgewick's algorithm on p.5 of their paper "Fast Algorithms for
@@ -1166,67 +1272,341 @@ void mkeyQSortSufDcU8(
 		}
 		return;
 	}
-	size_t a, b, c, d, r;
-	CHOOSE_AND_SWAP_PIVOT(SWAP1, CHAR_AT_SUF_U8); // choose pivot, swap to begin
-	int v = CHAR_AT_SUF_U8(begin, depth); // v <- pivot value
-	#ifndef NDEBUG
-	{
-		bool stillInBounds = false;
-		for(size_t i = begin; i < end; i++) {
-			if(depth < (hlen-s[i])) {
-				stillInBounds = true;
-				break;
-			} else { /* already fell off this suffix */ }
+	size_t nlt = 0, neq = 0, ngt = 0;
+	int v = mkeyPartitionSufDcU8(host, hlen, s, slen, hi, begin, end, depth, nlt, neq, ngt);
+	if(nlt > 0) {
+		MQS_RECURSE_SUF_DC_U8(begin, begin + nlt, depth); // recurse on <'s
+	}
+	// Do not recurse on ='s if the pivot was the off-the-end value;
+	// they're already fully sorted
+	if(v != hi) {
+		MQS_RECURSE_SUF_DC_U8(begin + nlt, begin + nlt + neq, depth+1); // recurse on ='s
+	}
+	if(ngt > 0 && v < hi-1) {
+		MQS_RECURSE_SUF_DC_U8(end-ngt, end, depth); // recurse on >'s
+	}
+}
+
+/// Ranges no longer than this are sorted start to finish by whichever
+/// thread picks them up, rather than partitioned into stealable tasks
+#define MKEY_TASK_CUTOFF (64 * 1024)
+
+class MkeyJob;
+
+/**
+ * A range s[begin, end) of some job's suffix array whose suffixes are
+ * known to agree on their first 'depth' characters; the unit of work
+ * handed out by MkeyStealPool.
+ */
+struct MkeyTask {
+	MkeyTask() : job(NULL), begin(0), end(0), depth(0) { }
+
+	MkeyTask(MkeyJob *j, size_t b, size_t e, size_t d) :
+		job(j), begin(b), end(e), depth(d) { }
+
+	MkeyJob *job;
+	size_t   begin;
+	size_t   end;
+	size_t   depth;
+};
+
+class MkeyStealPool;
+
+/**
+ * One suffix array to be sorted by an MkeyStealPool.  run() sorts the
+ * range named by a task, either outright or by partitioning it once
+ * and giving the parts back to the pool as new tasks.
+ */
+class MkeyJob {
+public:
+	MkeyJob() : pending_(0) { }
+	virtual ~MkeyJob() { }
+
+	virtual void run(MkeyStealPool& pool, int tid, const MkeyTask& t) = 0;
+
+protected:
+	friend class MkeyStealPool;
+	size_t pending_; // tasks pushed but not yet run; guarded by the pool
+};
+
+/**
+ * Work-stealing scheduler for the recursive partitions of the
+ * multikey quicksort, shared by the threads that sort suffix-array
+ * blocks.  Each thread owns a deque of tasks.  The owner pushes and
+ * pops at the back, so it works depth-first on the ranges it split off
+ * most recently; other threads steal from the front, where the oldest
+ * and largest ranges are.  A thread that runs out of blocks of its own
+ * therefore helps sort whatever is left of everyone else's, and one
+ * large, repetitive block no longer keeps a single thread busy while
+ * the rest sit idle.
+ *
+ * The pool also keeps track of how each thread spent its time, so
+ * that utilization can be reported at the end.
+ */
+class MkeyStealPool {
+
+	struct Worker {
+		Worker() : head(0), idle(0), finish(0), tasks(0), steals(0) { }
+
+		MUTEX_T         lock;
+		EList<MkeyTask> q;      // tasks; only [head, q.size()) are live
+		size_t          head;
+		uint64_t        idle;   // usecs spent waiting for work
+		uint64_t        finish; // usecs from start until thread retired
+		uint64_t        tasks;  // tasks run
+		uint64_t        steals; // tasks run that were stolen
+	};
+
+public:
+
+	MkeyStealPool(int nthreads) :
+		nthreads_(nthreads),
+		ws_(new Worker[nthreads]),
+		inflight_(0),
+		start_(now()) { }
+
+	~MkeyStealPool() { delete[] ws_; }
+
+	/**
+	 * Note that a thread is about to claim a block; a thread stays in
+	 * flight until it calls leave(), so helpers know more work may
+	 * still appear.
+	 */
+	void enter() {
+		ThreadSafe ts(mutex_);
+		inflight_++;
+	}
+
+	/**
+	 * Note that a thread is done with the block it claimed, or found
+	 * none left to claim.
+	 */
+	void leave() {
+		ThreadSafe ts(mutex_);
+		assert_gt(inflight_, 0);
+		inflight_--;
+	}
+
+	/**
+	 * Add a task to the back of thread tid's deque.
+	 */
+	void push(int tid, const MkeyTask& t) {
+		{
+			ThreadSafe ts(mutex_);
+			t.job->pending_++;
 		}
-		assert(stillInBounds); // >=1 suffix must still be in bounds
+		Worker& w = ws_[tid];
+		ThreadSafe ts(w.lock);
+		w.q.push_back(t);
 	}
-	#endif
-	a = b = begin;
-	c = d = end-1;
-	while(true) {
-		// Invariant: everything before a is = pivot, everything
-		// between a and b is <
-		int bc = 0; // shouldn't have to init but gcc on Mac complains
-		while(b <= c && v >= (bc = CHAR_AT_SUF_U8(b, depth))) {
-			if(v == bc) {
-				SWAP(s, a, b); a++;
+
+	/**
+	 * Sort job's s[begin, end) with whatever help other threads can
+	 * give.  While waiting on tasks that were stolen from it, thread
+	 * tid runs tasks from any job.
+	 */
+	void sort(int tid, MkeyJob& job, size_t begin, size_t end) {
+		push(tid, MkeyTask(&job, begin, end, 0));
+		while(true) {
+			{
+				ThreadSafe ts(mutex_);
+				if(job.pending_ == 0) break;
 			}
-			b++;
+			if(!work(tid)) idle(tid);
 		}
-		// Invariant: everything after d is = pivot, everything
-		// between c and d is >
-		int cc = 0; // shouldn't have to init but gcc on Mac complains
-		//bool hiLatch = true;
-		while(b <= c && v <= (cc = CHAR_AT_SUF_U8(c, depth))) {
-			if(v == cc) {
-				SWAP(s, c, d); d--;
+	}
+
+	/**
+	 * Called by a thread that has no more blocks to claim.  Steal
+	 * tasks until no thread is working on a block any longer.
+	 */
+	void help(int tid) {
+		while(true) {
+			if(work(tid)) continue;
+			{
+				ThreadSafe ts(mutex_);
+				if(inflight_ == 0) break;
 			}
-			//else if(hiLatch && cc == hi) { }
-			c--;
+			idle(tid);
 		}
-		if(b > c) break;
-		SWAP(s, b, c);
-		b++;
-		c--;
+		ws_[tid].finish = now() - start_;
 	}
-	assert(a > begin || c < end-1);                      // there was at least one =s
-	assert_lt(d-c, n); // they can't all have been > pivot
-	assert_lt(b-a, n); // they can't all have been < pivot
-	r = min(a-begin, b-a); VECSWAP(s, begin, b-r,   r);  // swap left = to center
-	r = min(d-c, end-d-1); VECSWAP(s, b,     end-r, r);  // swap right = to center
-	r = b-a; // r <- # of <'s
-	if(r > 0) {
-		MQS_RECURSE_SUF_DC_U8(begin, begin + r, depth); // recurse on <'s
+
+	/**
+	 * Print how busy each thread was between the pool's creation and
+	 * the last thread's retirement.  Only call once all threads have
+	 * returned from help().
+	 */
+	void report(ostream& out) const {
+		uint64_t wall = 1;
+		uint64_t busy = 0;
+		for(int i = 0; i < nthreads_; i++) {
+			wall = max<uint64_t>(wall, ws_[i].finish);
+		}
+		std::ostringstream oss;
+		oss << "Block-sorting thread utilization:" << endl;
+		for(int i = 0; i < nthreads_; i++) {
+			const Worker& w = ws_[i];
+			uint64_t b = w.finish - min(w.idle, w.finish);
+			busy += b;
+			oss << "  thread " << i << ": " << (b * 100 / wall) << "% busy, "
+			    << w.tasks << " sort tasks (" << w.steals << " stolen)" << endl;
+		}
+		oss << "  overall: " << (busy * 100 / (wall * nthreads_)) << "% of "
+		    << nthreads_ << " threads over " << (wall / 1000) / 1000.0 << " s" << endl;
+		out << oss.str();
 	}
-	// Do not recurse on ='s if the pivot was the off-the-end value;
-	// they're already fully sorted
-	if(v != hi) {
-		MQS_RECURSE_SUF_DC_U8(begin + r, begin + r + (a-begin) + (end-d-1), depth+1); // recurse on ='s
+
+private:
+
+	static uint64_t now() {
+		timeval tv;
+		gettimeofday(&tv, NULL);
+		return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 	}
-	r = d-c; // r <- # of >'s excluding those exhausted
-	if(r > 0 && v < hi-1) {
-		MQS_RECURSE_SUF_DC_U8(end-r, end, depth); // recurse on >'s
+
+	/**
+	 * Run one task, our own newest if we have any, otherwise the oldest
+	 * we can steal from another thread.  Return false if there was
+	 * nothing to run.
+	 */
+	bool work(int tid) {
+		MkeyTask t;
+		Worker& me = ws_[tid];
+		if(!pop(me, t, true)) {
+			bool stolen = false;
+			for(int i = 1; i < nthreads_ && !stolen; i++) {
+				stolen = pop(ws_[(tid + i) % nthreads_], t, false);
+			}
+			if(!stolen) return false;
+			me.steals++;
+		}
+		t.job->run(*this, tid, t);
+		me.tasks++;
+		ThreadSafe ts(mutex_);
+		assert_gt(t.job->pending_, 0);
+		t.job->pending_--;
+		return true;
+	}
+
+	/**
+	 * Take a task from the back (owner) or the front (thief) of w's
+	 * deque.
+	 */
+	bool pop(Worker& w, MkeyTask& t, bool back) {
+		ThreadSafe ts(w.lock);
+		if(w.head == w.q.size()) return false;
+		if(back) {
+			t = w.q.back();
+			w.q.pop_back();
+		} else {
+			t = w.q[w.head++];
+		}
+		if(w.head == w.q.size()) {
+			w.q.clear();
+			w.head = 0;
+		}
+		return true;
+	}
+
+	/// Wait a little for more work to turn up
+	void idle(int tid) {
+		uint64_t t = now();
+		SLEEP(1);
+		ws_[tid].idle += now() - t;
+	}
+
+	int      nthreads_;
+	Worker  *ws_;
+	MUTEX_T  mutex_;    // guards inflight_ and every job's pending_
+	size_t   inflight_; // threads holding a block
+	uint64_t start_;
+};
+
+/**
+ * MkeyJob for mkeyQSortSufDcU8().  Ranges larger than MKEY_TASK_CUTOFF
+ * are split with a single partitioning step; ternary on the character
+ * at 'depth' until the difference cover can break ties, then binary
+ * about a pivot suffix.
+ */
+template<typename T1, typename T2>
+class MkeySufDcU8Job : public MkeyJob {
+public:
+	MkeySufDcU8Job(
+		const T1& host1,
+		const T2& host,
+		size_t hlen,
+		TIndexOffU* s,
+		size_t slen,
+		const DifferenceCoverSample<T1>& dc,
+		int hi,
+		bool sanityCheck) :
+		host1_(host1), host_(host), hlen_(hlen), s_(s), slen_(slen),
+		dc_(dc), hi_(hi), sanityCheck_(sanityCheck) { }
+
+	virtual void run(MkeyStealPool& pool, int tid, const MkeyTask& t) {
+		size_t begin = t.begin, end = t.end, depth = t.depth;
+		if(end - begin <= MKEY_TASK_CUTOFF) {
+			mkeyQSortSufDcU8(host1_, host_, hlen_, s_, slen_, dc_, hi_,
+			                 begin, end, depth, sanityCheck_);
+			return;
+		}
+		if(depth > dc_.v()) {
+			size_t p = partitionSufDcU8(host1_, host_, hlen_, s_, slen_, dc_,
+			                            begin, end, sanityCheck_);
+			if(p > begin+1) pool.push(tid, MkeyTask(this, begin, p, depth));
+			if(end > p+2)   pool.push(tid, MkeyTask(this, p+1, end, depth));
+			return;
+		}
+		size_t nlt = 0, neq = 0, ngt = 0;
+		int v = mkeyPartitionSufDcU8(host_, hlen_, s_, slen_, hi_,
+		                             begin, end, depth, nlt, neq, ngt);
+		if(nlt > 1) {
+			pool.push(tid, MkeyTask(this, begin, begin + nlt, depth));
+		}
+		// As in the serial version, ='s to an off-the-end pivot are done
+		if(neq > 1 && v != hi_) {
+			pool.push(tid, MkeyTask(this, begin + nlt, begin + nlt + neq, depth+1));
+		}
+		if(ngt > 1 && v < hi_-1) {
+			pool.push(tid, MkeyTask(this, end - ngt, end, depth));
+		}
 	}
+
+private:
+	const T1&                        host1_;
+	const T2&                        host_;
+	size_t                           hlen_;
+	TIndexOffU*                      s_;
+	size_t                           slen_;
+	const DifferenceCoverSample<T1>& dc_;
+	int                              hi_;
+	bool                             sanityCheck_;
+};
+
+/**
+ * Toplevel function for multikey quicksort over suffixes, with the
+ * partitions shared out among the threads of 'pool'.  Same result as
+ * the serial version.
+ */
+template<typename T1, typename T2>
+void mkeyQSortSufDcU8(
+	MkeyStealPool& pool,
+	int tid,
+	const T1& host1,
+	const T2& host,
+	size_t hlen,
+	TIndexOffU* s,
+	size_t slen,
+	const DifferenceCoverSample<T1>& dc,
+	int hi,
+	bool verbose = false,
+	bool sanityCheck = false)
+{
+	if(sanityCheck) sanityCheckInputSufs(s, slen);
+	MkeySufDcU8Job<T1,T2> job(host1, host, hlen, s, slen, dc, hi, sanityCheck);
+	pool.sort(tid, job, 0, slen);
+	if(sanityCheck) sanityCheckOrderedSufs(host1, hlen, s, slen, OFF_MASK);
 }
 
 
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "offset_index.h"
+
+#ifdef MAIN_OFFSET_INDEX
+
+/*
+ * Microbenchmark for OffsetIndex.  Lays out fragments the way an
+ * N-rich scaffold or metagenome assembly would (many, of very uneven
+ * length), stores their starts as Ebwt's rstarts[] does (start, text
+ * id, text offset), and times random lookups by binary search over
+ * rstarts[], as Ebwt::joinedToTextOff() did, against OffsetIndex.
+ *
+ *   offset-index-bench [fragments [lookups]]
+ */
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <iostream>
+#include "random_source.h"
+
+using namespace std;
+
+static double now() {
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Return the index of the last start <= 'off' by binary search over
+ * the first of every three words, as joinedToTextOff() searched.
+ */
+static size_t binarySearch(const uint32_t *rstarts, size_t n, uint32_t off) {
+	size_t top = 0, bot = n;
+	while(bot - top > 1) {
+		size_t mid = top + ((bot - top) >> 1);
+		if(rstarts[mid*3] <= off) {
+			top = mid;
+		} else {
+			bot = mid;
+		}
+	}
+	return top;
+}
+
+int main(int argc, char **argv) {
+	size_t nfrag = argc > 1 ? strtoul(argv[1], NULL, 10) : 4000000;
+	size_t nlook = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000000;
+	RandomSource rnd(77);
+	EList<uint32_t> rstarts;
+	rstarts.resizeExact(nfrag * 3);
+	uint64_t len = 0;
+	for(size_t i = 0; i < nfrag; i++) {
+		rstarts[i*3]   = (uint32_t)len;
+		rstarts[i*3+1] = (uint32_t)(i >> 4);
+		rstarts[i*3+2] = 0;
+		// Mostly short fragments with the odd long one
+		uint32_t flen = 1 + rnd.nextU32() % 200;
+		if(rnd.nextU32() % 16 == 0) flen += rnd.nextU32() % 20000;
+		if(len + flen >= 0xffffffffull) {
+			nfrag = i + 1;
+			break;
+		}
+		len += flen;
+	}
+	EList<uint32_t> queries;
+	queries.resizeExact(nlook);
+	for(size_t i = 0; i < nlook; i++) {
+		queries[i] = (uint32_t)(((uint64_t)rnd.nextU32() << 32 | rnd.nextU32()) % len);
+	}
+	cerr << nfrag << " fragments over " << len << " offsets; "
+	     << nlook << " lookups" << endl;
+
+	double t = now();
+	OffsetIndex<uint32_t> idx;
+	idx.init(rstarts.ptr(), nfrag, 3, len);
+	cerr << "  build: " << (now() - t) << " s, " << (idx.bytes() >> 20) << " MB" << endl;
+
+	size_t sum1 = 0, sum2 = 0;
+	t = now();
+	for(size_t i = 0; i < nlook; i++) {
+		sum1 += binarySearch(rstarts.ptr(), nfrag, queries[i]);
+	}
+	double tbin = now() - t;
+	t = now();
+	for(size_t i = 0; i < nlook; i++) {
+		sum2 += idx.find(queries[i]);
+	}
+	double tidx = now() - t;
+	cerr << "  binary search: " << (tbin * 1e9 / nlook) << " ns/lookup" << endl;
+	cerr << "  OffsetIndex:   " << (tidx * 1e9 / nlook) << " ns/lookup" << endl;
+	for(size_t i = 0; i < min<size_t>(nlook, 100000); i++) {
+		if(binarySearch(rstarts.ptr(), nfrag, queries[i]) != idx.find(queries[i])) {
+			cerr << "MISMATCH at lookup " << i << endl;
+			return 1;
+		}
+	}
+	if(sum1 != sum2) {
+		cerr << "MISMATCH" << endl;
+		return 1;
+	}
+	cerr << "PASSED" << endl;
+	return 0;
+}
+
+#endif /*def MAIN_OFFSET_INDEX*/
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OFFSET_INDEX_H_
+#define OFFSET_INDEX_H_
+
+#include <stdint.h>
+#include "assert_helpers.h"
+#include "ds.h"
+#include "mem_ids.h"
+
+/**
+ * Finds which of a sorted list of starting offsets (of fragments,
+ * records, ...) a given offset falls under, i.e. the last start at or
+ * before it.
+ *
+ * A binary search over millions of starts misses cache on nearly every
+ * probe.  Instead, the range of offsets is cut into about as many
+ * equal, power-of-two-sized buckets as there are starts, and each
+ * bucket remembers which start covers its first offset.  A lookup
+ * goes straight to its bucket and searches just the starts between
+ * that one and the next bucket's, which are usually one or two and
+ * sit in a single cache line of a dense copy of the starts.
+ */
+template<typename T>
+class OffsetIndex {
+
+public:
+
+	explicit OffsetIndex(int cat = MISC_CAT) :
+		starts_(cat),
+		bkts_(cat),
+		shift_(0)
+	{ }
+
+	/**
+	 * Index the 'n' starts at starts[0], starts[stride], ...  They must
+	 * be non-decreasing and the first must be 0.  'len' is one past the
+	 * largest offset that will be looked up.
+	 */
+	void init(const T *starts, size_t n, size_t stride, uint64_t len) {
+		assert_gt(n, 0);
+		assert_eq(0, starts[0]);
+		starts_.resizeExact(n);
+		for(size_t i = 0; i < n; i++) {
+			starts_[i] = starts[i * stride];
+			assert(i == 0 || starts_[i] >= starts_[i-1]);
+		}
+		// Smallest power-of-two bucket size giving no more buckets
+		// than starts
+		shift_ = 0;
+		while((len >> shift_) > n) shift_++;
+		size_t nbkts = (size_t)((len >> shift_) + 1);
+		bkts_.resizeExact(nbkts + 1);
+		size_t cur = 0;
+		for(size_t b = 0; b < nbkts; b++) {
+			uint64_t off = (uint64_t)b << shift_;
+			while(cur + 1 < n && starts_[cur + 1] <= off) cur++;
+			bkts_[b] = (uint32_t)cur;
+		}
+		bkts_[nbkts] = (uint32_t)(n - 1);
+		assert(repOk());
+	}
+
+	/**
+	 * Return the index of the last start <= 'off'.  Where several starts
+	 * are equal, that's the last of them.
+	 */
+	size_t find(uint64_t off) const {
+		size_t b = (size_t)(off >> shift_);
+		if(b + 1 >= bkts_.size()) {
+			b = bkts_.size() - 2; // past 'len'; the last bucket will do
+		}
+		size_t lo = bkts_[b], hi = bkts_[b+1];
+		while(lo < hi) {
+			size_t mid = (lo + hi + 1) >> 1;
+			if(starts_[mid] <= off) {
+				lo = mid;
+			} else {
+				hi = mid - 1;
+			}
+		}
+		assert_leq(starts_[lo], off);
+		assert(lo + 1 == starts_.size() || starts_[lo + 1] > off);
+		return lo;
+	}
+
+	/// Return true iff the index has been built
+	bool inited() const {
+		return !starts_.empty();
+	}
+
+	/// Number of starts indexed
+	size_t size() const {
+		return starts_.size();
+	}
+
+	/// Bytes of memory used
+	size_t bytes() const {
+		return starts_.size() * sizeof(T) + bkts_.size() * sizeof(uint32_t);
+	}
+
+	void clear() {
+		starts_.clear();
+		bkts_.clear();
+		shift_ = 0;
+	}
+
+#ifndef NDEBUG
+	/**
+	 * Check that each bucket points at the start covering its first
+	 * offset.
+	 */
+	bool repOk() const {
+		for(size_t b = 0; b + 1 < bkts_.size(); b++) {
+			uint64_t off = (uint64_t)b << shift_;
+			assert_leq(starts_[bkts_[b]], off);
+			assert(bkts_[b] + 1 == starts_.size() || starts_[bkts_[b] + 1] > off);
+			assert_leq(bkts_[b], bkts_[b+1]);
+		}
+		return true;
+	}
+#endif
+
+protected:
+
+	EList<T>        starts_; // dense copy of the starts
+	EList<uint32_t> bkts_;   // start covering the first offset of each bucket
+	int             shift_;  // log2 of bucket size
+};
+
+#endif /*ndef OFFSET_INDEX_H_*/
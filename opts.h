@@ -160,6 +160,11 @@ enum {
 	ARG_TRIM_TO,                // --trim-to
 	ARG_PRESERVE_TAGS,          // --preserve-tags
 	ARG_ALIGN_PAIRED_READS,     // --align-paired-reads
+	ARG_NO_PARALLEL_LOAD,       // --no-parallel-load
+	ARG_SERVER,                 // --server
+	ARG_CONNECT,                // --connect
+	ARG_SHMEM_CLEANUP,          // --shmem-cleanup
+	ARG_NUMA,                   // --numa
 	ARG_SRA_ACC                 // --sra-acc
 };
 
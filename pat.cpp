@@ -115,9 +115,9 @@ PatternSource* PatternSource::patsrcFromStrings(
  * unpaired read, set all the other key fields of the Read
  * struct.
  */
-void PatternSourcePerThread::finalize(Read& ra) {
+void PatternSourcePerThread::finalize(Read& ra, TReadId rdid) {
 	ra.mate = 1;
-	ra.rdid = buf_.rdid();
+	ra.rdid = rdid;
 	ra.seed = genRandSeed(ra.patFw, ra.qual, ra.name, pp_.seed);
 	ra.finalize();
 	if(pp_.fixName) {
@@ -130,10 +130,10 @@ void PatternSourcePerThread::finalize(Read& ra) {
  * paired-end read, set all the other key fields of the Read
  * structs.
  */
-void PatternSourcePerThread::finalizePair(Read& ra, Read& rb) {
+void PatternSourcePerThread::finalizePair(Read& ra, Read& rb, TReadId rdid) {
 	ra.mate = 1;
 	rb.mate = 2;
-	ra.rdid = rb.rdid = buf_.rdid();
+	ra.rdid = rb.rdid = rdid;
 	ra.seed = genRandSeed(ra.patFw, ra.qual, ra.name, pp_.seed);
 	rb.seed = genRandSeed(rb.patFw, rb.qual, rb.name, pp_.seed);
 	ra.finalize();
@@ -144,6 +144,32 @@ void PatternSourcePerThread::finalizePair(Read& ra, Read& rb) {
 	}
 }
 
+/**
+ * Parse, trim and finalize the read/pair in slot 'i' of the current
+ * batch, outside the critical section.  Return false if it couldn't
+ * be parsed.
+ */
+bool PatternSourcePerThread::parseSlot(size_t i) {
+	Read& ra = buf_.bufa_[i];
+	Read& rb = buf_.bufb_[i];
+	TReadId rdid = buf_.rdid_ + i;
+	assert(!ra.readOrigBuf.empty());
+	assert(ra.empty());
+	if(!parse(ra, rb, rdid)) {
+		return false;
+	}
+	// Finalize read/pair
+	if(!rb.patFw.empty()) {
+		trim(ra);
+		trim(rb);
+		finalizePair(ra, rb, rdid);
+	} else {
+		trim(ra);
+		finalize(ra, rdid);
+	}
+	return true;
+}
+
 /**
  * Get the next paired or unpaired read from the wrapped
  * PatternComposer.  Returns a pair of bools; first indicates
@@ -164,25 +190,33 @@ pair<bool, bool> PatternSourcePerThread::nextReadPair() {
 		buf_.next(); // advance cursor; no parsing or locking needed
 		assert_gt(buf_.cur_buf_, 0);
 	}
-	// Now fully parse read/pair *outside* the critical section
-	assert(!buf_.read_a().readOrigBuf.empty());
-	assert(buf_.read_a().empty());
-	if(!parse(buf_.read_a(), buf_.read_b())) {
-		return make_pair(false, false);
+	// Now fully parse read/pair *outside* the critical section, unless
+	// parseRest() already did
+	int& st = parsed_[buf_.cur_buf_];
+	if(st == PARSE_NOT_YET) {
+		st = parseSlot(buf_.cur_buf_) ? PARSE_OK : PARSE_FAILED;
 	}
-	// Finalize read/pair
-	if(!buf_.read_b().patFw.empty()) {
-		trim(buf_.read_a());
-		trim(buf_.read_b());
-		finalizePair(buf_.read_a(), buf_.read_b());
-	} else {
-		trim(buf_.read_a());
-		finalize(buf_.read_a());
+	if(st == PARSE_FAILED) {
+		return make_pair(false, false);
 	}
 	bool this_is_last = buf_.cur_buf_ == static_cast<unsigned int>(last_batch_size_-1);
 	return make_pair(true, this_is_last ? last_batch_ : false);
 }
 
+/**
+ * Fully parse the reads/pairs after the current one in the current
+ * batch.  Returns the number of reads/pairs in the batch.
+ */
+size_t PatternSourcePerThread::parseRest() {
+	size_t n = buf_.cur_buf_ + 1;
+	for(; n < buf_.bufa_.size() && !buf_.bufa_[n].readOrigBuf.empty(); n++) {
+		if(parsed_[n] == PARSE_NOT_YET) {
+			parsed_[n] = parseSlot(n) ? PARSE_OK : PARSE_FAILED;
+		}
+	}
+	return n;
+}
+
 /**
  * The main member function for dispensing pairs of reads or
  * singleton reads.  Returns true iff ra and rb contain a new
@@ -532,7 +566,7 @@ void CFilePatternSource::open() {
 		return;
 	}
 	cerr << "Error: No input read files were valid" << endl;
-	exit(1);
+	throw 1;
 	return;
 }
 
@@ -1133,7 +1133,12 @@ public:
 		buf_(pp.max_buf, tid),
 		pp_(pp),
 		last_batch_(false),
-		last_batch_size_(0) { }
+		last_batch_size_(0),
+		parsed_(pp.max_buf)
+	{
+		parsed_.resize(pp.max_buf);
+		parsed_.fill(PARSE_NOT_YET);
+	}
 
 	/**
 	 * Use objects in the PatternSource and/or PatternComposer
@@ -1141,12 +1146,31 @@ public:
 	 */
 	std::pair<bool, bool> nextReadPair();
 
+	/**
+	 * Fully parse the reads/pairs that nextReadPair() has yet to dish
+	 * out from the current batch, so that the caller can work on the
+	 * whole batch at once.  nextReadPair() then hands them over
+	 * without parsing them again.  Returns the number of reads/pairs in
+	 * the batch; see parsed() for which of them are usable.
+	 */
+	size_t parseRest();
+
+	/// Return true iff slot 'i' of the current batch was parsed OK
+	bool parsed(size_t i) const { return parsed_[i] == PARSE_OK; }
+
 	Read& read_a() { return buf_.read_a(); }
 	Read& read_b() { return buf_.read_b(); }
 
 	const Read& read_a() const { return buf_.read_a(); }
 	const Read& read_b() const { return buf_.read_b(); }
 
+	/// Read/pair in slot 'i' of the current batch
+	const Read& read_a(size_t i) const { return buf_.bufa_[i]; }
+	const Read& read_b(size_t i) const { return buf_.bufb_[i]; }
+
+	/// Slot in the current batch of the read/pair last dished out
+	size_t bufIdx() const { return buf_.cur_buf_; }
+
 private:
 
 	/**
@@ -1158,6 +1182,7 @@ private:
 		buf_.reset();
 		std::pair<bool, int> res = composer_.nextBatch(buf_);
 		buf_.init();
+		parsed_.fill(PARSE_NOT_YET);
 		return res;
 	}
 
@@ -1166,23 +1191,29 @@ private:
 	 * unpaired read, set all the other key fields of the Read
 	 * struct.
 	 */
-	void finalize(Read& ra);
+	void finalize(Read& ra, TReadId rdid);
 
 	/**
 	 * Once name/sequence/qualities have been parsed for a
 	 * paired-end read, set all the other key fields of the Read
 	 * structs.
 	 */
-	void finalizePair(Read& ra, Read& rb);
+	void finalizePair(Read& ra, Read& rb, TReadId rdid);
 
 	/**
 	 * Call into composition layer (which in turn calls into
 	 * format layer) to parse the read.
 	 */
-	bool parse(Read& ra, Read& rb) {
-		return composer_.parse(ra, rb, buf_.rdid());
+	bool parse(Read& ra, Read& rb, TReadId rdid) {
+		return composer_.parse(ra, rb, rdid);
 	}
 
+	/**
+	 * Parse, trim and finalize the read/pair in slot 'i' of the
+	 * current batch.  Return false if it couldn't be parsed.
+	 */
+	bool parseSlot(size_t i);
+
 	void trim(Read& r) {
 		if (pp_.trimTo.second > 0) {
 			switch (pp_.trimTo.first) {
@@ -1209,6 +1240,9 @@ private:
 	const PatternParams& pp_;	// pattern-related parameters
 	bool last_batch_;			// true if this is final batch
 	int last_batch_size_;		// # reads read in previous batch
+
+	enum { PARSE_NOT_YET = 0, PARSE_OK, PARSE_FAILED };
+	EList<int> parsed_;			// per slot: parsed yet? by parseRest()
 };
 
 /**
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PREFIX_DOUBLING_H_
+#define PREFIX_DOUBLING_H_
+
+#include <algorithm>
+#include <utility>
+#include "assert_helpers.h"
+#include "ds.h"
+#include "mem_ids.h"
+#include "threading.h"
+
+/**
+ * Suffix sorting by prefix doubling (Manber and Myers), with the work
+ * of each round shared among threads.  It does the same job as
+ * LarssonSadakane::suffixsort() and leaves the same result.
+ *
+ * Suffixes are kept in groups that share their first h symbols, each
+ * group a range of the suffix array, and every suffix's rank is the
+ * start of its group's range.  A round sorts the suffixes of each
+ * unfinished group by the rank of the suffix h symbols on, splits the
+ * group where those ranks differ, and doubles h.  Groups are sorted
+ * independently, so threads take them from a shared list; no rank is
+ * changed until all groups in the round have been sorted.
+ */
+template<typename T>
+class PrefixDoublingSort {
+public:
+
+	PrefixDoublingSort(int nthreads) :
+		nthreads_(std::max<int>(nthreads, 1)),
+		groups_(MISC_CAT),
+		keys_(MISC_CAT),
+		next_(MISC_CAT)
+	{ }
+
+	/**
+	 * Makes suffix array p of x.  x becomes inverse of p.  p and x are
+	 * both of size n+1.  Contents of x[0...n-1] are integers in the
+	 * range 0...k-1.  Original contents of x[n] is disregarded, the
+	 * n-th symbol being regarded as end-of-string smaller than all
+	 * other symbols.
+	 */
+	void suffixsort(T *x, T *p, T n, T k) {
+		x_ = x;
+		p_ = p;
+		n_ = n;
+		bucket(k);
+		for(h_ = 1; !groups_.empty(); h_ *= 2) {
+			SortGroups sorter(*this);
+			parallelRanges(sorter, nthreads_, nthreads_);
+			SplitGroups splitter(*this);
+			parallelRanges(splitter, nthreads_, nthreads_);
+			groups_.clear();
+			for(int i = 0; i < nthreads_; i++) {
+				for(size_t j = 0; j < next_[i].size(); j++) {
+					groups_.push_back(next_[i][j]);
+				}
+			}
+		}
+#ifndef NDEBUG
+		for(T i = 0; i <= n; i++) {
+			assert_eq(i, x[p[i]]);
+		}
+#endif
+	}
+
+private:
+
+	typedef std::pair<T, T> Group; // start and length
+
+	/**
+	 * Put the suffixes in p in order of their first symbol, rank them
+	 * and list the groups with more than one suffix.
+	 */
+	void bucket(T k) {
+		keys_.resizeExact((size_t)k + 1);
+		keys_.fillZero();
+		for(T i = 0; i < n_; i++) {
+			assert_geq(x_[i], 0);
+			assert_lt(x_[i], k);
+			keys_[x_[i]]++;
+		}
+		// The end of the string sorts first, on its own
+		T start = 1;
+		groups_.clear();
+		for(T c = 0; c < k; c++) {
+			T cnt = keys_[c];
+			keys_[c] = start;
+			if(cnt > 1) groups_.push_back(Group(start, cnt));
+			start += cnt;
+		}
+		p_[0] = n_;
+		for(T i = 0; i < n_; i++) {
+			p_[keys_[x_[i]]++] = i;
+		}
+		T prev = -1;
+		for(T i = 1; i <= n_; i++) {
+			T c = x_[p_[i]];
+			if(c != prev) {
+				start = i;
+				prev = c;
+			}
+			x_[p_[i]] = start;
+		}
+		x_[n_] = 0;
+		keys_.resizeExact((size_t)n_ + 1);
+		next_.resize(nthreads_);
+	}
+
+	/**
+	 * Claim the next batch of groups to work on.  Returns false once
+	 * there are none left.
+	 */
+	bool claim(size_t& begin, size_t& end) {
+		ThreadSafe ts(lock_);
+		if(cur_ >= groups_.size()) return false;
+		begin = cur_;
+		// Hand out about 16 batches per thread, but keep them big
+		// enough to be worth taking the lock for
+		size_t batch = std::max<size_t>(groups_.size() / (nthreads_ * 16), 64);
+		end = cur_ = std::min(begin + batch, groups_.size());
+		return true;
+	}
+
+	/// Orders suffixes by the rank of the suffix h symbols on
+	struct KeyLess {
+		KeyLess(const T *x, T h) : x(x), h(h) { }
+		bool operator()(T a, T b) const { return x[a+h] < x[b+h]; }
+		const T *x;
+		T h;
+	};
+
+	/**
+	 * Sort each group by the rank of the suffix h symbols on and note
+	 * those ranks in keys_.
+	 */
+	struct SortGroups {
+		SortGroups(PrefixDoublingSort& pd) : pd(pd) { pd.cur_ = 0; }
+		void operator()(size_t, size_t) {
+			size_t begin, end;
+			T *p = pd.p_;
+			while(pd.claim(begin, end)) {
+				for(size_t g = begin; g < end; g++) {
+					T s = pd.groups_[g].first, len = pd.groups_[g].second;
+					std::sort(p + s, p + s + len, KeyLess(pd.x_, pd.h_));
+					for(T j = s; j < s + len; j++) {
+						// A suffix that shares its first h symbols
+						// with another can't reach the end of the
+						// string in fewer
+						assert_leq(p[j] + pd.h_, pd.n_);
+						pd.keys_[j] = pd.x_[p[j] + pd.h_];
+					}
+				}
+			}
+		}
+		PrefixDoublingSort& pd;
+	};
+
+	/**
+	 * Split each group where the keys differ, rank the suffixes by
+	 * where their new groups start and list the new groups that hold
+	 * more than one suffix.
+	 */
+	struct SplitGroups {
+		SplitGroups(PrefixDoublingSort& pd) : pd(pd) { pd.cur_ = 0; }
+		void operator()(size_t tid, size_t) {
+			EList<Group>& next = pd.next_[tid];
+			next.clear();
+			size_t begin, end;
+			while(pd.claim(begin, end)) {
+				for(size_t g = begin; g < end; g++) {
+					T s = pd.groups_[g].first, len = pd.groups_[g].second;
+					T start = s;
+					for(T j = s; j < s + len; j++) {
+						if(j > s && pd.keys_[j] != pd.keys_[j-1]) {
+							if(j - start > 1) next.push_back(Group(start, j - start));
+							start = j;
+						}
+						pd.x_[pd.p_[j]] = start;
+					}
+					if(s + len - start > 1) next.push_back(Group(start, s + len - start));
+				}
+			}
+		}
+		PrefixDoublingSort& pd;
+	};
+
+	int                  nthreads_;
+	T                   *x_;      // ranks, ultimately the inverse of p
+	T                   *p_;      // suffix array
+	T                    n_;
+	T                    h_;      // symbols already sorted on
+	EList<Group>         groups_; // groups with more than one suffix
+	EList<T>             keys_;   // sort key of each suffix-array slot
+	EList<EList<Group> > next_;   // groups for next round, per thread
+	size_t               cur_;    // next group to hand out
+	MUTEX_T              lock_;
+};
+
+#endif /*ndef PREFIX_DOUBLING_H_*/
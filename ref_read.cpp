@@ -23,16 +23,18 @@
  * Reads past the next ambiguous or unambiguous stretch of sequence
  * from the given FASTA file and returns its length.  Does not do
  * anything with the sequence characters themselves; this is purely for
- * measuring lengths.
+ * measuring lengths.  'lastc' carries the last character seen from one
+ * call to the next.
  */
-RefRecord fastaRefReadSize(
+template<typename TBpOut>
+static RefRecord fastaRefReadSize(
 	FileBuf& in,
 	const RefReadInParams& rparms,
 	bool first,
-	BitpairOutFileBuf* bpout)
+	int& lastc,
+	TBpOut* bpout)
 {
 	int c;
-	static int lastc = '>'; // last character seen
 
 	// RefRecord params
 	TIndexOffU len = 0; // 'len' counts toward total length
@@ -165,6 +167,139 @@ RefRecord fastaRefReadSize(
 	return RefRecord((TIndexOffU)off, (TIndexOffU)len, first);
 }
 
+/**
+ * Reads past the next ambiguous or unambiguous stretch of sequence
+ * from the given FASTA file and returns its length, writing the
+ * unambiguous characters to 'bpout' if it's non-NULL.
+ */
+RefRecord fastaRefReadSize(
+	FileBuf& in,
+	const RefReadInParams& rparms,
+	bool first,
+	BitpairOutFileBuf* bpout)
+{
+	static int lastc = '>'; // last character seen
+	return fastaRefReadSize(in, rparms, first, lastc, bpout);
+}
+
+/**
+ * Put the text of the next piece in 'buf'.  Return false if the input
+ * is used up.
+ */
+bool RefPieceReader::next(std::string& buf) {
+	buf.clear();
+	while(cur_ < in_.size()) {
+		FileBuf& in = *in_[cur_];
+		int c;
+		while((c = in.get()) != -1) {
+			buf.push_back((char)c);
+			if(c == '\n' && buf.length() >= sz_ && in.peek() == '>') {
+				return true;
+			}
+		}
+		in.reset();
+		cur_++;
+		if(!buf.empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Holds the 2-bit-encoded bases parsed from a piece of the input until
+ * they can be written in order.
+ */
+struct RefPieceBases {
+	RefPieceBases() : bps(MISC_CAT) { }
+	void write(int bp) { bps.push_back((uint8_t)bp); }
+	EList<uint8_t> bps;
+};
+
+/**
+ * Job for RefPieceParser that does what fastaRefReadSizes() does: parse
+ * pieces with fastaRefReadSize(), keep the records fastaRefReadSizes()
+ * would keep and total them up.
+ */
+class RefSizesJob {
+public:
+	struct Piece {
+		Piece() : recs(MISC_CAT), numSeqs(0) { }
+		std::string      buf;     // text of the piece
+		FileBuf          fb;      // for parsing buf
+		EList<RefRecord> recs;    // records kept
+		RefPieceBases    bases;   // unambiguous bases, if wanted
+		TIndexOff        numSeqs; // sequences started
+	};
+
+	RefSizesJob(
+		EList<RefRecord>& recs,
+		const RefReadInParams& rparms,
+		BitpairOutFileBuf* bpout,
+		TIndexOff& numSeqs) :
+		recs_(recs),
+		rparms_(rparms),
+		bpout_(bpout),
+		numSeqs_(numSeqs),
+		unambigTot_(0),
+		bothTot_(0)
+	{ }
+
+	void parse(Piece& p) {
+		p.recs.clear();
+		p.bases.bps.clear();
+		p.numSeqs = 0;
+		MemStreamBuf sb(p.buf.data(), p.buf.length());
+		std::istream is(&sb);
+		p.fb.newFile(&is);
+		bool first = true;
+		int lastc = '>';
+		while(p.fb.peek() != -1) {
+			RefRecord rec = fastaRefReadSize(
+				p.fb, rparms_, first, lastc,
+				bpout_ != NULL ? &p.bases : (RefPieceBases*)NULL);
+			first = false;
+			if(rec.len == 0 && rec.first) {
+				continue;
+			} else if(rec.first) {
+				p.numSeqs++;
+			}
+			if(rec.len == 0 && rec.off == 0 && !rec.first) continue;
+			p.recs.push_back(rec);
+		}
+	}
+
+	void merge(Piece& p) {
+		for(size_t i = 0; i < p.recs.size(); i++) {
+			const RefRecord& rec = p.recs[i];
+			if((unambigTot_ + rec.len) < unambigTot_) {
+				throw RefTooLongException();
+			}
+			unambigTot_ += rec.len;
+			bothTot_ += rec.len;
+			bothTot_ += rec.off;
+			recs_.push_back(rec);
+		}
+		numSeqs_ += p.numSeqs;
+		if(bpout_ != NULL) {
+			for(size_t i = 0; i < p.bases.bps.size(); i++) {
+				bpout_->write(p.bases.bps[i]);
+			}
+		}
+	}
+
+	TIndexOffU unambigTot() const { return unambigTot_; }
+	size_t     bothTot()    const { return bothTot_; }
+
+private:
+	EList<RefRecord>&      recs_;
+	const RefReadInParams& rparms_;
+	BitpairOutFileBuf*     bpout_;
+	TIndexOff&             numSeqs_;
+	TIndexOffU             unambigTot_;
+	size_t                 bothTot_;
+};
+
 #if 0
 static void
 printRecords(ostream& os, const EList<RefRecord>& l) {
@@ -244,6 +379,8 @@ void reverseRefRecords(
  * Calculate a vector containing the sizes of all of the patterns in
  * all of the given input files, in order.  Returns the total size of
  * all references combined.  Rewinds each istream before returning.
+ * With more than one thread the input is parsed in pieces by a
+ * RefPieceParser; the outcome is the same.
  */
 std::pair<size_t, size_t>
 fastaRefReadSizes(
@@ -251,11 +388,17 @@ fastaRefReadSizes(
 	EList<RefRecord>& recs,
 	const RefReadInParams& rparms,
 	BitpairOutFileBuf* bpout,
-	TIndexOff& numSeqs)
+	TIndexOff& numSeqs,
+	int nthreads)
 {
 	TIndexOffU unambigTot = 0;
 	size_t bothTot = 0;
 	assert_gt(in.size(), 0);
+	if(nthreads > 1) {
+		RefSizesJob job(recs, rparms, bpout, numSeqs);
+		RefPieceParser<RefSizesJob>(in, job, nthreads).run();
+		return make_pair(job.unambigTot(), job.bothTot());
+	}
 	// For each input istream
 	for(size_t i = 0; i < in.size(); i++) {
 		bool first = true;
@@ -32,6 +32,11 @@
 #include "word_io.h"
 #include "ds.h"
 #include "endian_swap.h"
+#include "mem_ids.h"
+#include "threading.h"
+#ifdef WITH_TBB
+#include <thread>
+#endif
 
 using namespace std;
 
@@ -137,7 +142,8 @@ fastaRefReadSizes(
 	EList<RefRecord>& recs,
 	const RefReadInParams& rparms,
 	BitpairOutFileBuf* bpout,
-	TIndexOff& numSeqs);
+	TIndexOff& numSeqs,
+	int nthreads = 1);
 
 extern void
 reverseRefRecords(
@@ -157,10 +163,10 @@ static RefRecord fastaRefReadAppend(
 	TStr& dst,               // destination buf for parsed characters
 	TIndexOffU& dstoff,          // index of next character in dst to assign
 	RefReadInParams& rparms, // 
+	int& lastc,              // last character seen by the previous call
 	string* name = NULL)     // put parsed FASTA name here
 {
 	int c;
-	static int lastc = '>';
 	if(first) {
 		c = in.getPastWhitespace();
 		if(c != '>') {
@@ -311,4 +317,352 @@ static RefRecord fastaRefReadAppend(
 	return RefRecord((TIndexOffU)off, (TIndexOffU)len, first);
 }
 
+/**
+ * Reads the next sequence from the given FASTA file and appends it to
+ * the end of dst, optionally reversing it.  The state carried from one
+ * record to the next is kept in a static, so only one file can be read
+ * this way at a time.
+ */
+template <typename TStr>
+static RefRecord fastaRefReadAppend(
+	FileBuf& in,             // input file
+	bool first,              // true iff this is the first record in the file
+	TStr& dst,               // destination buf for parsed characters
+	TIndexOffU& dstoff,          // index of next character in dst to assign
+	RefReadInParams& rparms, // 
+	string* name = NULL)     // put parsed FASTA name here
+{
+	static int lastc = '>';
+	return fastaRefReadAppend(in, first, dst, dstoff, rparms, lastc, name);
+}
+
+/**
+ * Size of the pieces the input is cut into when it's parsed by several
+ * threads at once.
+ */
+#define REF_PIECE_SZ (4 * 1024 * 1024)
+
+/**
+ * Read-only streambuf over characters that are already in memory, so
+ * that a FileBuf can parse a piece of the input.
+ */
+class MemStreamBuf : public std::streambuf {
+public:
+	MemStreamBuf(const char *buf, size_t len) {
+		char *b = const_cast<char*>(buf);
+		setg(b, b, b + len);
+	}
+};
+
+/**
+ * Doles out the text of the input FASTA files a piece at a time.  A
+ * piece ends only where the next line starts with '>', so it holds
+ * whole records and never spans two files.  Each input is rewound
+ * once it's used up.  Not synchronized.
+ */
+class RefPieceReader {
+public:
+	RefPieceReader(EList<FileBuf*>& in, size_t sz = REF_PIECE_SZ) :
+		in_(in), sz_(sz), cur_(0) { }
+
+	/**
+	 * Put the text of the next piece in 'buf'.  Return false if the
+	 * input is used up.
+	 */
+	bool next(std::string& buf);
+
+private:
+	EList<FileBuf*>& in_;  // input files
+	size_t           sz_;  // target piece size
+	size_t           cur_; // file we're reading from
+};
+
+/**
+ * Parses the pieces doled out by a RefPieceReader on several threads
+ * and hands the results to the job's merge() one at a time, strictly in
+ * the order the pieces appear in the input, so that what comes out
+ * doesn't depend on the number of threads.  The job supplies a Piece
+ * type to hold one piece's text and results, parse(Piece&) to fill in
+ * the results and merge(Piece&) to fold them in.  Pieces are read in
+ * order under a lock; the thread that finishes the next piece due
+ * merges it along with any finished pieces that follow.  Only a few
+ * pieces per thread are held at once.
+ */
+template<typename TJob>
+class RefPieceParser {
+public:
+	RefPieceParser(EList<FileBuf*>& in, TJob& job, int nthreads) :
+		reader_(in),
+		job_(job),
+		nthreads_(max<int>(nthreads, 1)),
+		nslots_(2 * nthreads_),
+		slots_(new Slot[nslots_]),
+		nread_(0),
+		nmerged_(0),
+		merging_(false),
+		done_(false),
+		err_(0),
+		oom_(false)
+	{ }
+
+	~RefPieceParser() {
+		delete[] slots_;
+	}
+
+	/**
+	 * Parse and merge all of the input.  Any failure is rethrown once
+	 * all the threads are done.
+	 */
+	void run() {
+#ifdef WITH_TBB
+		EList<std::thread*> threads;
+#else
+		EList<tthread::thread*> threads;
+#endif
+		for(int i = 1; i < nthreads_; i++) {
+#ifdef WITH_TBB
+			threads.push_back(new std::thread(worker, (void*)this));
+#else
+			threads.push_back(new tthread::thread(worker, (void*)this));
+#endif
+		}
+		work();
+		for(size_t i = 0; i < threads.size(); i++) {
+			threads[i]->join();
+			delete threads[i];
+		}
+		if(oom_) throw bad_alloc();
+		if(err_ != 0) throw err_;
+		assert_eq(nread_, nmerged_);
+	}
+
+private:
+
+	struct Slot {
+		Slot() : ready(false) { }
+		typename TJob::Piece piece;
+		bool ready; // parsed and waiting to be merged
+	};
+
+	static void worker(void *vp) {
+		((RefPieceParser<TJob>*)vp)->work();
+	}
+
+	void work() {
+		try {
+			Slot *slot;
+			while((slot = claim()) != NULL) {
+				job_.parse(slot->piece);
+				finish(slot);
+			}
+		} catch(RefTooLongException& e) {
+			cerr << e.what() << endl;
+			fail(1, false);
+		} catch(bad_alloc& e) {
+			fail(0, true);
+		} catch(int e) {
+			fail(e == 0 ? 1 : e, false);
+		}
+	}
+
+	/**
+	 * Read the next piece into a free slot, waiting for one if all are
+	 * taken.  Return NULL if there's nothing left to do.
+	 */
+	Slot *claim() {
+		while(true) {
+			{
+				ThreadSafe ts(readLock_);
+				bool full;
+				{
+					ThreadSafe ts2(stateLock_);
+					if(done_) return NULL;
+					full = (nread_ - nmerged_ == nslots_);
+				}
+				if(!full) {
+					Slot& slot = slots_[nread_ % nslots_];
+					if(!reader_.next(slot.piece.buf)) {
+						ThreadSafe ts2(stateLock_);
+						done_ = true;
+						return NULL;
+					}
+					nread_++;
+					return &slot;
+				}
+			}
+			SLEEP(1);
+		}
+	}
+
+	/**
+	 * Mark the slot's piece parsed.  Unless another thread is already
+	 * at it, merge all parsed pieces that are next in line.
+	 */
+	void finish(Slot *slot) {
+		{
+			ThreadSafe ts(stateLock_);
+			slot->ready = true;
+			if(merging_) return;
+			merging_ = true;
+		}
+		while(true) {
+			Slot *next;
+			{
+				ThreadSafe ts(stateLock_);
+				next = &slots_[nmerged_ % nslots_];
+				if(done_ && (err_ != 0 || oom_)) return;
+				if(!next->ready) {
+					merging_ = false;
+					return;
+				}
+			}
+			job_.merge(next->piece);
+			{
+				ThreadSafe ts(stateLock_);
+				next->ready = false;
+				nmerged_++;
+			}
+		}
+	}
+
+	/**
+	 * Record a failure and make the other threads stop early.
+	 */
+	void fail(int err, bool oom) {
+		ThreadSafe ts(stateLock_);
+		if(err_ == 0 && !oom_) {
+			err_ = err;
+			oom_ = oom;
+		}
+		done_ = true;
+	}
+
+	RefPieceReader reader_;
+	TJob&          job_;
+	int            nthreads_;
+	size_t         nslots_;    // pieces that can be held at once
+	Slot          *slots_;     // piece i goes in slot i % nslots_
+	size_t         nread_;     // pieces read; guarded by readLock_
+	size_t         nmerged_;   // pieces merged; guarded by stateLock_
+	bool           merging_;   // a thread is merging
+	bool           done_;      // input used up, or a thread failed
+	int            err_;       // int thrown by a thread
+	bool           oom_;       // a thread ran out of memory
+	MUTEX_T        readLock_;
+	MUTEX_T        stateLock_;
+};
+
+/**
+ * Job for RefPieceParser that parses pieces with fastaRefReadAppend()
+ * and appends what it reads to a destination string, along with the
+ * records and names returned.
+ */
+template <typename TStr>
+class RefAppendJob {
+public:
+	struct Piece {
+		Piece() : cap(0), len(0), recs(MISC_CAT), names(MISC_CAT) { }
+		std::string      buf;   // text of the piece
+		FileBuf          fb;    // for parsing buf
+		TStr             dst;   // bases parsed
+		size_t           cap;   // room in dst
+		TIndexOffU       len;   // bases in dst
+		EList<RefRecord> recs;  // records parsed
+		EList<string>    names; // names parsed with each record
+	};
+
+	RefAppendJob(
+		TStr& dst,
+		TIndexOffU& dstoff,
+		const RefReadInParams& rparms,
+		EList<RefRecord>& recs,
+		EList<string>& names) :
+		dst_(dst),
+		dstoff_(dstoff),
+		rparms_(rparms),
+		recs_(recs),
+		names_(names)
+	{ }
+
+	void parse(Piece& p) {
+		// No more bases than characters
+		if(p.cap < p.buf.length()) {
+			p.cap = p.buf.length();
+			p.dst.resize(p.cap);
+		}
+		p.len = 0;
+		p.recs.clear();
+		p.names.clear();
+		MemStreamBuf sb(p.buf.data(), p.buf.length());
+		std::istream is(&sb);
+		p.fb.newFile(&is);
+		RefReadInParams rparms = rparms_;
+		bool first = true;
+		int lastc = '>';
+		while(p.fb.peek() != -1) {
+			p.names.expand();
+			p.names.back().clear();
+			p.recs.push_back(fastaRefReadAppend(
+				p.fb, first, p.dst, p.len, rparms, lastc, &p.names.back()));
+			first = false;
+		}
+	}
+
+	void merge(Piece& p) {
+		for(TIndexOffU i = 0; i < p.len; i++) {
+			dst_.set(p.dst[i], dstoff_++);
+		}
+		for(size_t i = 0; i < p.recs.size(); i++) {
+			recs_.push_back(p.recs[i]);
+			names_.push_back(p.names[i]);
+		}
+	}
+
+private:
+	TStr&                  dst_;
+	TIndexOffU&            dstoff_;
+	const RefReadInParams& rparms_;
+	EList<RefRecord>&      recs_;
+	EList<string>&         names_;
+};
+
+/**
+ * Read all the input files with fastaRefReadAppend(), appending the
+ * bases to dst and each record returned, along with the name parsed
+ * with it, to 'recs' and 'names'.  With more than one thread the input
+ * is parsed in pieces by a RefPieceParser; the outcome is the same.
+ * Rewinds each input once it's done.
+ */
+template <typename TStr>
+static void fastaRefReadAppends(
+	EList<FileBuf*>& in,
+	TStr& dst,
+	TIndexOffU& dstoff,
+	RefReadInParams& rparms,
+	EList<RefRecord>& recs,
+	EList<string>& names,
+	int nthreads = 1)
+{
+	// Reversing each stretch depends on where it falls in dst, so
+	// that's done serially
+	if(nthreads > 1 && rparms.reverse != REF_READ_REVERSE_EACH) {
+		RefAppendJob<TStr> job(dst, dstoff, rparms, recs, names);
+		RefPieceParser<RefAppendJob<TStr> >(in, job, nthreads).run();
+		return;
+	}
+	for(size_t i = 0; i < in.size(); i++) {
+		assert(!in[i]->eof());
+		bool first = true;
+		while(!in[i]->eof()) {
+			names.expand();
+			names.back().clear();
+			recs.push_back(fastaRefReadAppend(
+				*in[i], first, dst, dstoff, rparms, &names.back()));
+			first = false;
+		}
+		in[i]->reset();
+		assert(!in[i]->eof());
+	}
+}
+
 #endif /*ndef REF_READ_H_*/
@@ -17,10 +17,12 @@
  * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <map>
 #include <string>
 #include <string.h>
 #include "reference.h"
 #include "mem_ids.h"
+#include "sse_wrap.h"
 
 using namespace std;
 
@@ -50,75 +52,119 @@ BitPairReference::BitPairReference(
 	string s3 = in + ".3." + gEbwt_ext;
 	string s4 = in + ".4." + gEbwt_ext;
 	
-	FILE *f3, *f4;
-	if((f3 = fopen(s3.c_str(), "rb")) == NULL) {
-	    cerr << "Could not open reference-string index file " << s3 << " for reading." << endl;
-		cerr << "This is most likely because your index was built with an older version" << endl
-		<< "(<= 0.9.8.1) of bowtie-build.  Please re-run bowtie-build to generate a new" << endl
-		<< "index (or download one from the Bowtie website) and try again." << endl;
-		loaded_ = false;
-		return;
-	}
-    if((f4 = fopen(s4.c_str(), "rb"))  == NULL) {
-        cerr << "Could not open reference-string index file " << s4 << " for reading." << endl;
-		loaded_ = false;
-		return;
-	}
+	// Prefer the single-file container when memory-mapping, or when
+	// it's the only form of the index that's present
+	struct stat sbuf3;
+	bool useCnt = IndexContainer::exists(in) &&
+	              (useMm_ || stat(s3.c_str(), &sbuf3) != 0);
+	FILE *f3 = NULL, *f4 = NULL;
+	TIndexOffU sz;
 #ifdef BOWTIE_MM
-    char *mmFile = NULL;
-	if(useMm_) {
-		if(verbose_ || startVerbose) {
-			cerr << "  Memory-mapping reference index file " << s4.c_str() << ": ";
-			logTime(cerr);
-		}
-		struct stat sbuf;
-		if (stat(s4.c_str(), &sbuf) == -1) {
-			perror("stat");
-			cerr << "Error: Could not stat index file " << s4.c_str() << " prior to memory-mapping" << endl;
+	char *mmFile = NULL;
+#endif
+	if(useCnt) {
+		cnt_.open(in, mmSweep, verbose_ || startVerbose);
+		uint64_t len = 0;
+		const char *p = cnt_.section(CNT_COMP_REF | CNT_REF_RECS, len);
+		sz = (TIndexOffU)(len / (3 * OFF_SIZE));
+		if(sz == 0) {
+			cerr << "Error: number of reference records is 0 in " << cnt_.filename().c_str() << endl;
 			throw 1;
 		}
-		mmFile = (char*)mmap((void *)0, (size_t)sbuf.st_size,
-				     PROT_READ, MAP_SHARED, fileno(f4), 0);
-		if(mmFile == (void *)(-1) || mmFile == NULL) {
-			perror("mmap");
-			cerr << "Error: Could not memory-map the index file " << s4.c_str() << endl;
-			throw 1;
+		for(TIndexOffU i = 0; i < sz; i++) {
+			TIndexOffU t[3];
+			memcpy(t, p + i * sizeof(t), sizeof(t));
+			recs_.push_back(RefRecord(t[0], t[1], t[2] != 0));
 		}
-		if(mmSweep) {
-			TIndexOff sum = 0;
-			for(off_t i = 0; i < sbuf.st_size; i += 1024) {
-				sum += (TIndexOff) mmFile[i];
-			}
-			if(startVerbose) {
-				cerr << "  Swept the memory-mapped ref index file; checksum: " << sum << ": ";
+		p = cnt_.section(CNT_COMP_REF | CNT_REF_ALIASES, len);
+		if(p != NULL) {
+			aliases_.resize((size_t)(len / OFF_SIZE));
+			memcpy(aliases_.ptr(), p, aliases_.size() * OFF_SIZE);
+		}
+		// Reference is used straight out of the mapping
+		useMm_ = true;
+		useShmem_ = false;
+	} else {
+		if((f3 = fopen(s3.c_str(), "rb")) == NULL) {
+		    cerr << "Could not open reference-string index file " << s3 << " for reading." << endl;
+			cerr << "This is most likely because your index was built with an older version" << endl
+			<< "(<= 0.9.8.1) of bowtie-build.  Please re-run bowtie-build to generate a new" << endl
+			<< "index (or download one from the Bowtie website) and try again." << endl;
+			loaded_ = false;
+			return;
+		}
+	    if((f4 = fopen(s4.c_str(), "rb"))  == NULL) {
+	        cerr << "Could not open reference-string index file " << s4 << " for reading." << endl;
+			loaded_ = false;
+			return;
+		}
+#ifdef BOWTIE_MM
+		if(useMm_) {
+			if(verbose_ || startVerbose) {
+				cerr << "  Memory-mapping reference index file " << s4.c_str() << ": ";
 				logTime(cerr);
 			}
+			struct stat sbuf;
+			if (stat(s4.c_str(), &sbuf) == -1) {
+				perror("stat");
+				cerr << "Error: Could not stat index file " << s4.c_str() << " prior to memory-mapping" << endl;
+				throw 1;
+			}
+			mmFile = (char*)mmap((void *)0, (size_t)sbuf.st_size,
+					     PROT_READ, MAP_SHARED, fileno(f4), 0);
+			if(mmFile == (void *)(-1) || mmFile == NULL) {
+				perror("mmap");
+				cerr << "Error: Could not memory-map the index file " << s4.c_str() << endl;
+				throw 1;
+			}
+			if(mmSweep) {
+				TIndexOff sum = 0;
+				for(off_t i = 0; i < sbuf.st_size; i += 1024) {
+					sum += (TIndexOff) mmFile[i];
+				}
+				if(startVerbose) {
+					cerr << "  Swept the memory-mapped ref index file; checksum: " << sum << ": ";
+					logTime(cerr);
+				}
+			}
 		}
-	}
 #endif
 	
-	// Read endianness sentinel, set 'swap'
-	uint32_t one;
-	bool swap = false;
-	one = readU<int32_t>(f3, swap);
-	if(one != 1) {
-		if(useMm_) {
-			cerr << "Error: Can't use memory-mapped files when the index is the opposite endianness" << endl;
+		// Read endianness sentinel, set 'swap'
+		uint32_t one;
+		bool swap = false;
+		one = readU<int32_t>(f3, swap);
+		if(one != 1) {
+			if(useMm_) {
+				cerr << "Error: Can't use memory-mapped files when the index is the opposite endianness" << endl;
+				throw 1;
+			}
+			assert_eq(0x1000000, one);
+			swap = true; // have to endian swap U32s
+		}
+	
+		// Read # records
+		sz = readU<TIndexOffU>(f3, swap);
+		if(sz == 0) {
+			cerr << "Error: number of reference records is 0 in " << s3.c_str() << endl;
 			throw 1;
 		}
-		assert_eq(0x1000000, one);
-		swap = true; // have to endian swap U32s
-	}
 	
-	// Read # records
-	TIndexOffU sz;
-	sz = readU<TIndexOffU>(f3, swap);
-	if(sz == 0) {
-		cerr << "Error: number of reference records is 0 in " << s3.c_str() << endl;
-		throw 1;
+		for(TIndexOffU i = 0; i < sz; i++) {
+			recs_.push_back(RefRecord(f3, swap));
+		}
+		// Sequences stored as aliases (bowtie2-build --dedup-ref), if any
+		TIndexOffU nalias;
+		if(fread(&nalias, OFF_SIZE, 1, f3) == 1) {
+			if(swap) nalias = endianSwapU(nalias);
+			for(TIndexOffU i = 0; i < 2 * nalias; i++) {
+				aliases_.push_back(readU<TIndexOffU>(f3, swap));
+			}
+		}
+		fclose(f3); // done with .3.gEbwt_ext file
 	}
 	
-	// Read records
+	// Index the records
 	nrefs_ = 0;
 	
 	// Cumulative count of all unambiguous characters on a per-
@@ -126,16 +172,29 @@ BitPairReference::BitPairReference(
 	// allocate in buf_)
 	TIndexOffU cumsz = 0;
 	TIndexOffU cumlen = 0;
+	size_t nextAlias = 0;      // next (alias, source) pair in aliases_
+	TIndexOffU src = OFF_MASK; // sequence the current one is an alias of
+	TIndexOffU srcRec = 0;     // record of 'src' matching the current one
 	// For each unambiguous stretch...
 	for(TIndexOffU i = 0; i < sz; i++) {
-		recs_.push_back(RefRecord(f3, swap));
-		if(recs_.back().first) {
+		if(recs_[i].first) {
 			// This is the first record for this reference sequence (and the
 			// last record for the one before)
-			refRecOffs_.push_back((TIndexOffU)recs_.size()-1);
+			refRecOffs_.push_back(i);
+			src = OFF_MASK;
+			if(nextAlias < aliases_.size() && aliases_[nextAlias] == nrefs_) {
+				src = aliases_[nextAlias + 1];
+				nextAlias += 2;
+				if(!sameRecords(src, i)) {
+					cerr << "Error: reference sequence " << nrefs_ << " is stored as a copy of "
+					     << "sequence " << src << " but their records differ" << endl;
+					throw 1;
+				}
+				srcRec = refRecOffs_[src];
+			}
 			// refOffs_ links each reference sequence with the total number of
 			// unambiguous characters preceding it in the pasted reference
-			refOffs_.push_back(cumsz);
+			refOffs_.push_back(src == OFF_MASK ? cumsz : refOffs_[src]);
 			if(nrefs_ > 0) {
 				// refLens_ links each reference sequence with the total number
 				// of ambiguous and unambiguous characters in it.
@@ -148,11 +207,21 @@ BitPairReference::BitPairReference(
 			     << "'first'" << endl;
 			throw 1;
 		}
-		cumUnambig_.push_back(cumsz);
+		if(src == OFF_MASK) {
+			cumUnambig_.push_back(cumsz);
+			cumsz += recs_[i].len;
+		} else {
+			// An alias's bases are those of the sequence it copies
+			cumUnambig_.push_back(cumUnambig_[srcRec++]);
+		}
 		cumRefOff_.push_back(cumlen);
-		cumsz += recs_.back().len;
-		cumlen += recs_.back().off;
-		cumlen += recs_.back().len;
+		cumlen += recs_[i].off;
+		cumlen += recs_[i].len;
+	}
+	if(nextAlias < aliases_.size()) {
+		cerr << "Error: reference alias table names sequence " << aliases_[nextAlias]
+		     << ", but there are only " << nrefs_ << endl;
+		throw 1;
 	}
 	if(verbose_ || startVerbose) {
 		cerr << "Read " << nrefs_ << " reference strings from "
@@ -168,14 +237,35 @@ BitPairReference::BitPairReference(
 	bufSz_ = cumsz;
 	assert_eq(nrefs_, refLens_.size());
 	assert_eq(sz, recs_.size());
-	if (f3 != NULL) fclose(f3); // done with .3.gEbwt_ext file
+	if(sz >= 256) {
+		EList<uint64_t> starts(MISC_CAT);
+		starts.resizeExact(sz);
+		refBases_.resizeExact(nrefs_);
+		uint64_t base = 0;
+		for(TIndexOffU t = 0; t < nrefs_; t++) {
+			refBases_[t] = base;
+			for(TIndexOffU i = refRecOffs_[t]; i < refRecOffs_[t+1]; i++) {
+				starts[i] = base + cumRefOff_[i];
+			}
+			base += refLens_[t];
+		}
+		recIdx_.init(starts.ptr(), sz, 1, base);
+	}
 	// Round cumsz up to nearest byte boundary
 	if((cumsz & 3) != 0) {
 		cumsz += (4 - (cumsz & 3));
 	}
 	bufAllocSz_ = cumsz >> 2;
 	assert_eq(0, cumsz & 3); // should be rounded up to nearest 4
-	if(useMm_) {
+	if(useCnt) {
+		uint64_t len = 0;
+		buf_ = (uint8_t*)cnt_.section(CNT_COMP_REF | CNT_REF_BUF, len);
+		if(buf_ == NULL || len < bufAllocSz_) {
+			cerr << "Error: reference section of index container " << cnt_.filename().c_str()
+			     << " is too short" << endl;
+			throw 1;
+		}
+	} else if(useMm_) {
 #ifdef BOWTIE_MM
 		buf_ = (uint8_t*)mmFile;
 		if(sanity_) {
@@ -245,24 +335,6 @@ BitPairReference::BitPairReference(
 		}
 	}
 	
-	// Populate byteToU32_
-	bool big = currentlyBigEndian();
-	for(int i = 0; i < 256; i++) {
-		uint32_t word = 0;
-		if(big) {
-			word |= ((i >> 0) & 3) << 24;
-			word |= ((i >> 2) & 3) << 16;
-			word |= ((i >> 4) & 3) << 8;
-			word |= ((i >> 6) & 3) << 0;
-		} else {
-			word |= ((i >> 0) & 3) << 0;
-			word |= ((i >> 2) & 3) << 8;
-			word |= ((i >> 4) & 3) << 16;
-			word |= ((i >> 6) & 3) << 24;
-		}
-		byteToU32_[i] = word;
-	}
-	
 #ifndef NDEBUG
 	if(sanity_) {
 		// Compare the sequence we just read from the compact index
@@ -313,8 +385,82 @@ BitPairReference::BitPairReference(
 #endif
 }
 
+/**
+ * Append the reference records and the bitpacked reference to the
+ * container being written by 'w'.
+ */
+void BitPairReference::writeToContainer(IndexContainerWriter& w) const {
+	assert(loaded_);
+	EList<TIndexOffU> trips(MISC_CAT);
+	trips.resize(recs_.size() * 3);
+	for(size_t i = 0; i < recs_.size(); i++) {
+		trips[i*3+0] = recs_[i].off;
+		trips[i*3+1] = recs_[i].len;
+		trips[i*3+2] = recs_[i].first ? 1 : 0;
+	}
+	w.addSection(CNT_COMP_REF | CNT_REF_RECS, trips.ptr(), (uint64_t)trips.size() * OFF_SIZE);
+	w.addSection(CNT_COMP_REF | CNT_REF_BUF, buf_, bufAllocSz_);
+	if(!aliases_.empty()) {
+		w.addSection(CNT_COMP_REF | CNT_REF_ALIASES, aliases_.ptr(), (uint64_t)aliases_.size() * OFF_SIZE);
+	}
+}
+
+/**
+ * Return true iff sequence 'src', already indexed, has the same records
+ * as the sequence whose first record is recs_[i].
+ */
+bool BitPairReference::sameRecords(TIndexOffU src, TIndexOffU i) const {
+	if(src >= nrefs_) {
+		return false;
+	}
+	TIndexOffU b = refRecOffs_[src];
+	TIndexOffU n = refRecOffs_[src+1] - b;
+	if(i + n > recs_.size() || (i + n < recs_.size() && !recs_[i+n].first)) {
+		return false;
+	}
+	for(TIndexOffU j = 0; j < n; j++) {
+		if(recs_[b+j].off != recs_[i+j].off || recs_[b+j].len != recs_[i+j].len) {
+			return false;
+		}
+	}
+	return true;
+}
+
+BitPairReference::BitPairReference(const BitPairReference& o, int numaNode) :
+	recs_(o.recs_),
+	cumUnambig_(o.cumUnambig_),
+	cumRefOff_(o.cumRefOff_),
+	refLens_(o.refLens_),
+	refOffs_(o.refOffs_),
+	refRecOffs_(o.refRecOffs_),
+	aliases_(o.aliases_),
+	recIdx_(o.recIdx_),
+	refBases_(o.refBases_),
+	buf_(NULL),
+	sanityBuf_(NULL),
+	bufSz_(o.bufSz_),
+	bufAllocSz_(o.bufAllocSz_),
+	nrefs_(o.nrefs_),
+	loaded_(o.loaded_),
+	sanity_(false),
+	useMm_(false),
+	useShmem_(false),
+	verbose_(o.verbose_)
+{
+	assert(o.loaded_);
+	try {
+		buf_ = new uint8_t[bufAllocSz_];
+	} catch(std::bad_alloc& e) {
+		cerr << "Error: Ran out of memory copying the bitpacked reference to NUMA node "
+		     << numaNode << endl;
+		throw 1;
+	}
+	memcpy(buf_, o.buf_, bufAllocSz_);
+}
+
 BitPairReference::~BitPairReference() {
 	if(buf_ != NULL && !useMm_ && !useShmem_) delete[] buf_;
+	if(buf_ != NULL && useShmem_) FREE_SHARED(buf_);
 	if(sanityBuf_ != NULL) delete[] sanityBuf_;
 }
 
@@ -414,6 +560,48 @@ int BitPairReference::getStretchNaive(
 	return 0;
 }
 
+/**
+ * Expand the 16 bases packed into the 4 bytes at 'src' into one byte
+ * per base at 'dst'.  Each packed byte is copied into 4 lanes, and
+ * each lane picks out its own base's two bits by testing them against
+ * a mask.  Uses only SSE2, so simde can stand in for it elsewhere.
+ */
+static inline void unpack16(const uint8_t *src, uint8_t *dst) {
+	const __m128i lo = _mm_setr_epi8(1, 4, 16, 64, 1, 4, 16, 64, 1, 4, 16, 64, 1, 4, 16, 64);
+	const __m128i hi = _mm_setr_epi8(2, 8, 32, -128, 2, 8, 32, -128, 2, 8, 32, -128, 2, 8, 32, -128);
+	int32_t w;
+	memcpy(&w, src, 4);
+	__m128i x = _mm_cvtsi32_si128(w);
+	x = _mm_unpacklo_epi8(x, x);  // each byte twice
+	x = _mm_unpacklo_epi16(x, x); // each byte 4 times
+	__m128i b0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(x, lo), lo), _mm_set1_epi8(1));
+	__m128i b1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(x, hi), hi), _mm_set1_epi8(2));
+	_mm_storeu_si128((__m128i*)dst, _mm_or_si128(b0, b1));
+}
+
+/**
+ * Write the 'count' bases starting at offset 'bufOff' of buf_ to
+ * 'dest', one byte per base.
+ */
+void BitPairReference::unpackBases(uint8_t *dest, uint64_t bufOff, uint64_t count) const {
+	assert_leq(bufOff + count, bufSz_);
+	// Bases before the first byte boundary
+	for(; count > 0 && (bufOff & 3) != 0; count--) {
+		*dest++ = (buf_[bufOff >> 2] >> ((bufOff & 3) << 1)) & 3;
+		bufOff++;
+	}
+	const uint8_t *src = buf_ + (bufOff >> 2);
+	for(; count >= 16; count -= 16) {
+		unpack16(src, dest);
+		src += 4;
+		dest += 16;
+	}
+	// Bases after the last whole 16
+	for(uint64_t i = 0; i < count; i++) {
+		*dest++ = (src[i >> 2] >> ((i & 3) << 1)) & 3;
+	}
+}
+
 /**
  * Load a stretch of the reference string into memory at 'dest'.
  */
@@ -443,34 +631,38 @@ int BitPairReference::getStretch(
 	uint64_t recf = refRecOffs_[tidx+1]; // last record (exclusive) for target seq
 	assert_gt(recf, reci);
 	uint64_t cur = 4; // keep a cushion of 4 bases at the beginning
+	const int offset = 4;
 	uint64_t bufOff = refOffs_[tidx];
 	uint64_t off = 0;
-	int64_t offset = 4;
-	bool firstStretch = true;
 	ASSERT_ONLY(bool binarySearched = false);
-	uint64_t left  = reci;
-	uint64_t right = recf;
-	uint64_t mid   = 0;
-	// For all records pertaining to the target reference sequence...
-	for(uint64_t i = reci; i < recf; i++) {
-		ASSERT_ONLY(uint64_t origBufOff = bufOff);
-		assert_geq(toff, off);
-		if (firstStretch && recf > reci + 16){
-			// binary search finds smallest i s.t. toff >= cumRefOff_[i]
+	if(recf > reci + 16) {
+		// binary search finds smallest i s.t. toff >= cumRefOff_[i]
+		uint64_t left  = reci;
+		uint64_t right = recf;
+		if(recIdx_.inited()) {
+			// An offset past the sequence's last record (in trailing
+			// Ns) can land among the next sequence's records
+			left = min<uint64_t>(recIdx_.find(refBases_[tidx] + toff), recf - 1);
+			assert_geq(left, reci);
+		} else {
 			while (left < right-1) {
-				mid = left + ((right - left) >> 1);
+				uint64_t mid = left + ((right - left) >> 1);
 				if (cumRefOff_[mid] <= toff)
 					left = mid;
 				else
 					right = mid;
 			}
-			off = cumRefOff_[left];
-			bufOff = cumUnambig_[left];
-			ASSERT_ONLY(origBufOff = bufOff);
-			i = left;
-			assert(cumRefOff_[i+1] == 0 || cumRefOff_[i+1] > toff);
-			ASSERT_ONLY(binarySearched = true);
 		}
+		off = cumRefOff_[left];
+		bufOff = cumUnambig_[left];
+		reci = left;
+		assert(cumRefOff_[reci+1] == 0 || cumRefOff_[reci+1] > toff);
+		ASSERT_ONLY(binarySearched = true);
+	}
+	// For all records pertaining to the target reference sequence...
+	for(uint64_t i = reci; i < recf; i++) {
+		ASSERT_ONLY(uint64_t origBufOff = bufOff);
+		assert_geq(toff, off);
 		off += recs_[i].off; // skip Ns at beginning of stretch
 		assert_gt(count, 0);
 		if(toff < off) {
@@ -489,80 +681,14 @@ int BitPairReference::getStretch(
 		}
 		off += recs_[i].len;
 		assert(off == cumRefOff_[i+1] || cumRefOff_[i+1] == 0);
-		assert(!binarySearched || toff < off);
+		assert(!binarySearched || i > reci || toff < off);
 		if(toff < off) {
-			if(firstStretch) {
-				if(toff + 8 < off && count > 8) {
-					// We already added some Ns, so we have to do
-					// a fixup at the beginning of the buffer so
-					// that we can start clobbering at cur >> 2
-					if(cur & 3) {
-						offset -= (cur & 3);
-					}
-					uint64_t curU32 = cur >> 2;
-					// Do the initial few bases
-					if(bufOff & 3) {
-						const uint64_t bufElt = (bufOff) >> 2;
-						const int64_t low2 = bufOff & 3;
-						// Lots of cache misses on the following line
-						destU32[curU32] = byteToU32_[buf_[bufElt]];
-						for(int j = 0; j < low2; j++) {
-							((char *)(&destU32[curU32]))[j] = 4;
-						}
-						curU32++;
-						offset += low2;
-						const int64_t chars = 4 - low2;
-						count -= chars;
-						bufOff += chars;
-						toff += chars;
-					}
-					assert_eq(0, bufOff & 3);
-					uint64_t bufOffU32 = bufOff >> 2;
-					uint64_t countLim = count >> 2;
-					uint64_t offLim = ((off - (toff + 4)) >> 2);
-					uint64_t lim = min(countLim, offLim);
-					// Do the fast thing for as far as possible
-					for(uint64_t j = 0; j < lim; j++) {
-						// Lots of cache misses on the following line
-						destU32[curU32] = byteToU32_[buf_[bufOffU32++]];
-#ifndef NDEBUG
-						if(dest_2 != NULL) {
-							assert_eq(dest[(curU32 << 2) + 0], dest_2[(curU32 << 2) - offset + 0]);
-							assert_eq(dest[(curU32 << 2) + 1], dest_2[(curU32 << 2) - offset + 1]);
-							assert_eq(dest[(curU32 << 2) + 2], dest_2[(curU32 << 2) - offset + 2]);
-							assert_eq(dest[(curU32 << 2) + 3], dest_2[(curU32 << 2) - offset + 3]);
-						}
-#endif
-						curU32++;
-					}
-					toff += (lim << 2);
-					assert_leq(toff, off);
-					assert_leq((lim << 2), count);
-					count -= (lim << 2);
-					bufOff = bufOffU32 << 2;
-					cur = curU32 << 2;
-				}
-				// Do the slow thing for the rest
-				for(; toff < off && count > 0; toff++) {
-					assert_lt(bufOff, bufSz_);
-					const uint64_t bufElt = (bufOff) >> 2;
-					const uint64_t shift = (bufOff & 3) << 1;
-					dest[cur++] = (buf_[bufElt] >> shift) & 3;
-					bufOff++;
-					count--;
-				}
-				firstStretch = false;
-			} else {
-				// Do the slow thing
-				for(; toff < off && count > 0; toff++) {
-					assert_lt(bufOff, bufSz_);
-					const uint64_t bufElt = (bufOff) >> 2;
-					const uint64_t shift = (bufOff & 3) << 1;
-					dest[cur++] = (buf_[bufElt] >> shift) & 3;
-					bufOff++;
-					count--;
-				}
-			}
+			size_t cpycnt = min((size_t)(off - toff), count);
+			unpackBases(&dest[cur], bufOff, cpycnt);
+			bufOff += cpycnt;
+			count -= cpycnt;
+			toff += cpycnt;
+			cur += cpycnt;
 		}
 		if(count == 0) break;
 		assert_eq(recs_[i].len, bufOff - origBufOff);
@@ -570,14 +696,128 @@ int BitPairReference::getStretch(
 	} // end for loop over records
 	// In any chars are left after scanning all the records,
 	// they must be ambiguous
-	while(count > 0) {
-		count--;
-		dest[cur++] = 4;
+	if(count > 0) {
+		memset(&dest[cur], 4, count);
+		cur += count;
+		count = 0;
 	}
-	assert_eq(0, count);
-	return (int)offset;
+#ifndef NDEBUG
+	if(dest_2 != NULL) {
+		for(size_t i = 0; i < origCount; i++) {
+			assert_eq(dest[offset + i], dest_2[i]);
+		}
+	}
+#endif
+	return offset;
 }
 
+/**
+ * Load several stretches of the reference at once.  The bytes holding
+ * every stretch are prefetched before any is unpacked, so that the
+ * cache misses of the windows overlap instead of coming one after the
+ * other.
+ */
+void BitPairReference::getStretches(
+	EList<RefWindow>& wins
+	ASSERT_ONLY(, SStringExpandable<uint32_t>& destU32_2)) const
+{
+	for(size_t i = 0; i < wins.size(); i++) {
+		prefetchStretch(wins[i].tidx, wins[i].toff, wins[i].count);
+	}
+	for(size_t i = 0; i < wins.size(); i++) {
+		RefWindow& w = wins[i];
+		w.offset = getStretch(w.dest, w.tidx, w.toff, w.count ASSERT_ONLY(, destU32_2));
+	}
+}
+
+/**
+ * Prefetch the records and, approximately, the packed bases for the
+ * given stretch.  The first base is taken to be at the sequence's
+ * start plus 'toff', which is exact for sequences without Ns and
+ * close enough otherwise.
+ */
+void BitPairReference::prefetchStretch(size_t tidx, size_t toff, size_t count) const {
+	uint64_t reci = refRecOffs_[tidx];
+	uint64_t recf = refRecOffs_[tidx+1];
+	if(recf > reci + 16) {
+		if(!recIdx_.inited()) {
+			// Binary search will start from the middle record
+			__builtin_prefetch(&cumRefOff_[reci + ((recf - reci) >> 1)]);
+		}
+	} else {
+		__builtin_prefetch(&recs_[reci]);
+	}
+	uint64_t first = min<uint64_t>(refOffs_[tidx] + toff, bufSz_) >> 2;
+	uint64_t last = min<uint64_t>(refOffs_[tidx] + toff + count, bufSz_) >> 2;
+	for(uint64_t b = first; b <= last && b < bufAllocSz_; b += 64) {
+		__builtin_prefetch(buf_ + b);
+	}
+}
+
+/**
+ * Load a stretch of the reference, from a cached slot if one holds all
+ * of it.
+ */
+int RefWindowCache::getStretch(
+	const BitPairReference& ref,
+	uint32_t *destU32,
+	size_t tidx,
+	size_t toff,
+	size_t count
+	ASSERT_ONLY(, SStringExpandable<uint32_t>& destU32_2))
+{
+	if(count == 0) return 0;
+	if(count > SLOT_BASES) {
+		bypasses_++;
+		return ref.getStretch(destU32, tidx, toff, count ASSERT_ONLY(, destU32_2));
+	}
+	if(ref_ != &ref) {
+		clear();
+		ref_ = &ref;
+	}
+	tick_++;
+	uint8_t *dest = (uint8_t*)destU32;
+	const int offset = 4; // the same cushion getStretch() leaves
+	size_t victim = 0;
+	for(size_t i = 0; i < NSLOTS; i++) {
+		Slot& sl = slots_[i];
+		if(sl.count > 0 && sl.tidx == tidx &&
+		   sl.toff <= toff && toff + count <= sl.toff + sl.count)
+		{
+			hits_++;
+			sl.used = tick_;
+			const uint8_t *src = (const uint8_t*)(buf_.ptr() + i * SLOT_WORDS) + sl.offset;
+			destU32[0] = 0x04040404;
+			memcpy(dest + offset, src + (toff - sl.toff), count);
+			return offset;
+		}
+		if(sl.count == 0 || (slots_[victim].count > 0 && sl.used < slots_[victim].used)) {
+			victim = i;
+		}
+	}
+	misses_++;
+	// Center a full slot's worth of characters on the request, without
+	// running off the start of the sequence or, unless the request does,
+	// its end
+	size_t lo = toff - min(toff, (SLOT_BASES - count) >> 1);
+	size_t hi = max<size_t>(toff + count, min<size_t>(lo + SLOT_BASES, ref.approxLen(tidx)));
+	if(hi - lo < SLOT_BASES) {
+		lo = hi > SLOT_BASES ? hi - SLOT_BASES : 0;
+	}
+	assert_leq(lo, toff);
+	assert_leq(toff + count, hi);
+	assert_leq(hi - lo, SLOT_BASES);
+	Slot& sl = slots_[victim];
+	uint32_t *sbuf = buf_.ptr() + victim * SLOT_WORDS;
+	sl.tidx = tidx;
+	sl.toff = lo;
+	sl.count = hi - lo;
+	sl.used = tick_;
+	sl.offset = ref.getStretch(sbuf, tidx, lo, hi - lo ASSERT_ONLY(, destU32_2));
+	destU32[0] = 0x04040404;
+	memcpy(dest + offset, (const uint8_t*)sbuf + sl.offset + (toff - lo), count);
+	return offset;
+}
 
 /**
  * Parse the input fasta files, populating the szs list and writing the
@@ -590,7 +830,8 @@ BitPairReference::szsFromFasta(
 	bool bigEndian,
 	const RefReadInParams& refparams,
 	EList<RefRecord>& szs,
-	bool sanity)
+	bool sanity,
+	int nthreads)
 {
 	RefReadInParams parms = refparams;
 	std::pair<size_t, size_t> sztot;
@@ -618,7 +859,7 @@ BitPairReference::szsFromFasta(
 			// nucleotides; not colors
 			TIndexOff numSeqs = 0;
 			ASSERT_ONLY(std::pair<size_t, size_t> sztot2 =)
-			fastaRefReadSizes(is, szs, parms, &bpout, numSeqs);
+			fastaRefReadSizes(is, szs, parms, &bpout, numSeqs, nthreads);
 			parms.color = true;
 			writeU<TIndexOffU>(fout3, (TIndexOffU)szs.size(), bigEndian); // write # records
 			for(size_t i = 0; i < szs.size(); i++) {
@@ -628,12 +869,12 @@ BitPairReference::szsFromFasta(
 			// Now read in the colorspace size records; these are
 			// the ones that were indexed
 			TIndexOff numSeqs2 = 0;
-			sztot = fastaRefReadSizes(is, szs, parms, NULL, numSeqs2);
+			sztot = fastaRefReadSizes(is, szs, parms, NULL, numSeqs2, nthreads);
 			assert_eq(numSeqs, numSeqs2);
 			assert_eq(sztot2.second, sztot.second + numSeqs);
 		} else {
 			TIndexOff numSeqs = 0;
-			sztot = fastaRefReadSizes(is, szs, parms, &bpout, numSeqs);
+			sztot = fastaRefReadSizes(is, szs, parms, &bpout, numSeqs, nthreads);
 			writeU<TIndexOffU>(fout3, (TIndexOffU)szs.size(), bigEndian); // write # records
 			for(size_t i = 0; i < szs.size(); i++) szs[i].write(fout3, bigEndian);
 		}
@@ -649,7 +890,7 @@ BitPairReference::szsFromFasta(
 		// Read in the sizes of all the unambiguous stretches of the
 		// genome into a vector of RefRecords
 		TIndexOff numSeqs = 0;
-		sztot = fastaRefReadSizes(is, szs, parms, NULL, numSeqs);
+		sztot = fastaRefReadSizes(is, szs, parms, NULL, numSeqs, nthreads);
 #ifndef NDEBUG
 		if(parms.color) {
 			parms.color = false;
@@ -666,3 +907,134 @@ BitPairReference::szsFromFasta(
 	}
 	return sztot;
 }
+
+/**
+ * Return base 'i' of the bit-pair-packed buffer 'buf'.
+ */
+static inline int packedBase(const EList<uint8_t>& buf, TIndexOffU i) {
+	return (buf[i >> 2] >> ((i & 3) << 1)) & 3;
+}
+
+/**
+ * Find the sequences in the .3.gEbwt_ext/.4.gEbwt_ext files for
+ * 'outfile' that are exact copies of an earlier sequence, drop their
+ * bases from the .4.gEbwt_ext file and append the (alias, source)
+ * table to the .3.gEbwt_ext file.
+ */
+TIndexOffU BitPairReference::dedupRefFiles(const string& outfile, TIndexOffU& saved) {
+	string file3 = outfile + ".3." + gEbwt_ext;
+	string file4 = outfile + ".4." + gEbwt_ext;
+	saved = 0;
+	FILE *f3 = fopen(file3.c_str(), "rb");
+	if(f3 == NULL) {
+		cerr << "Could not open reference-string index file " << file3.c_str() << " for reading." << endl;
+		throw 1;
+	}
+	bool swap = false;
+	uint32_t one = readU<int32_t>(f3, swap);
+	if(one != 1) {
+		assert_eq(0x1000000, one);
+		swap = true; // have to endian swap U32s
+	}
+	bool be = (currentlyBigEndian() != swap);
+	TIndexOffU sz = readU<TIndexOffU>(f3, swap);
+	EList<RefRecord> recs(MISC_CAT);
+	for(TIndexOffU i = 0; i < sz; i++) {
+		recs.push_back(RefRecord(f3, swap));
+	}
+	bool done = (fgetc(f3) != EOF); // already has an alias table
+	fclose(f3);
+	if(done || sz == 0) {
+		return 0;
+	}
+	// First record and first stored base of each sequence, plus caps
+	EList<TIndexOffU> recOffs(MISC_CAT), bufOffs(MISC_CAT);
+	TIndexOffU cumsz = 0;
+	for(TIndexOffU i = 0; i < sz; i++) {
+		if(recs[i].first) {
+			recOffs.push_back(i);
+			bufOffs.push_back(cumsz);
+		}
+		cumsz += recs[i].len;
+	}
+	recOffs.push_back(sz);
+	bufOffs.push_back(cumsz);
+	TIndexOffU nrefs = (TIndexOffU)recOffs.size() - 1;
+	EList<uint8_t> buf(MISC_CAT);
+	buf.resizeExact(((size_t)cumsz + 3) >> 2);
+	FILE *f4 = fopen(file4.c_str(), "rb");
+	if(f4 == NULL || fread(buf.ptr(), 1, buf.size(), f4) != buf.size()) {
+		cerr << "Could not read reference-string index file " << file4.c_str() << endl;
+		throw 1;
+	}
+	fclose(f4);
+	// Hash each sequence's records and bases; a sequence whose hash
+	// was seen before is compared in full with the first one to have it
+	EList<TIndexOffU> aliases(MISC_CAT);
+	std::map<uint64_t, TIndexOffU> seen;
+	for(TIndexOffU t = 0; t < nrefs; t++) {
+		TIndexOffU nrec = recOffs[t+1] - recOffs[t];
+		TIndexOffU nbase = bufOffs[t+1] - bufOffs[t];
+		if(nbase == 0) {
+			continue; // nothing to save
+		}
+		uint64_t h = 14695981039346656037ull; // FNV-1a
+		for(TIndexOffU i = recOffs[t]; i < recOffs[t+1]; i++) {
+			h = (h ^ recs[i].off) * 1099511628211ull;
+			h = (h ^ recs[i].len) * 1099511628211ull;
+		}
+		for(TIndexOffU i = bufOffs[t]; i < bufOffs[t+1]; i++) {
+			h = (h ^ (uint64_t)packedBase(buf, i)) * 1099511628211ull;
+		}
+		std::map<uint64_t, TIndexOffU>::iterator it = seen.find(h);
+		if(it == seen.end()) {
+			seen[h] = t;
+			continue;
+		}
+		TIndexOffU s = it->second;
+		bool same = (nrec == recOffs[s+1] - recOffs[s] && nbase == bufOffs[s+1] - bufOffs[s]);
+		for(TIndexOffU i = 0; same && i < nrec; i++) {
+			const RefRecord& a = recs[recOffs[s] + i];
+			const RefRecord& b = recs[recOffs[t] + i];
+			same = (a.off == b.off && a.len == b.len);
+		}
+		for(TIndexOffU i = 0; same && i < nbase; i++) {
+			same = (packedBase(buf, bufOffs[s] + i) == packedBase(buf, bufOffs[t] + i));
+		}
+		if(same) {
+			aliases.push_back(t);
+			aliases.push_back(s);
+			saved += nbase;
+		}
+	}
+	if(aliases.empty()) {
+		return 0;
+	}
+	// Rewrite the .4 file with only the bases of sequences that aren't
+	// aliases
+	{
+		BitpairOutFileBuf bpout(file4.c_str());
+		size_t a = 0;
+		for(TIndexOffU t = 0; t < nrefs; t++) {
+			if(a < aliases.size() && aliases[a] == t) {
+				a += 2;
+				continue;
+			}
+			for(TIndexOffU i = bufOffs[t]; i < bufOffs[t+1]; i++) {
+				bpout.write(packedBase(buf, i));
+			}
+		}
+		bpout.close();
+	}
+	ofstream fout3(file3.c_str(), ios::binary | ios::app);
+	writeU<TIndexOffU>(fout3, (TIndexOffU)(aliases.size() >> 1), be);
+	for(size_t i = 0; i < aliases.size(); i++) {
+		writeU<TIndexOffU>(fout3, aliases[i], be);
+	}
+	fout3.close();
+	if(fout3.fail()) {
+		cerr << "An error occurred writing the index to disk.  Please check if the disk is full." << endl;
+		throw 1;
+	}
+	return (TIndexOffU)(aliases.size() >> 1);
+}
@@ -36,8 +36,22 @@
 #include "timer.h"
 #include "sstring.h"
 #include "btypes.h"
+#include "bt2_container.h"
+#include "offset_index.h"
 
 
+/**
+ * One stretch of reference to be fetched by
+ * BitPairReference::getStretches().
+ */
+struct RefWindow {
+	uint32_t *dest;   // buffer for the stretch, as for getStretch()
+	size_t    tidx;   // reference sequence
+	size_t    toff;   // offset of first character
+	size_t    count;  // number of characters
+	int       offset; // out: where the stretch starts in 'dest'
+};
+
 /**
  * Concrete reference representation that bulk-loads the reference from
  * the bit-pair-compacted binary file and stores it in memory also in
@@ -75,6 +89,13 @@ public:
 		bool verbose = false,
 		bool startVerbose = false);
 
+	/**
+	 * Construct a private copy of loaded reference 'o' for the threads
+	 * of one NUMA node (--numa).  Call from a thread bound to that node
+	 * so that the copied buffer lands in the node's local memory.
+	 */
+	BitPairReference(const BitPairReference& o, int numaNode);
+
 	~BitPairReference();
 
 	/**
@@ -115,6 +136,23 @@ public:
 		size_t count
 		ASSERT_ONLY(, SStringExpandable<uint32_t>& destU32_2)) const;
 
+	/**
+	 * Load each of the stretches in 'wins' as getStretch() would, and
+	 * set each window's offset.  The memory for all of them is
+	 * prefetched first, so that several windows needed at once (e.g.
+	 * consecutive chunks of a sequence being printed) cost about one
+	 * round of cache misses instead of one each.
+	 */
+	void getStretches(
+		EList<RefWindow>& wins
+		ASSERT_ONLY(, SStringExpandable<uint32_t>& destU32_2)) const;
+
+	/**
+	 * Start bringing the records and bases for the given stretch into
+	 * cache.
+	 */
+	void prefetchStretch(size_t tidx, size_t toff, size_t count) const;
+
 	/**
 	 * Return the number of reference sequences.
 	 */
@@ -143,7 +181,7 @@ public:
 	/**
 	 * Given a reference sequence id, return its offset into the pasted
 	 * reference string; i.e., return the number of unambiguous nucleotides
-	 * preceding it.
+	 * preceding it.  An alias shares the offset of the sequence it copies.
 	 */
 	TIndexOffU pastedOffset(TIndexOffU idx) const {
 		return refOffs_[idx];
@@ -151,7 +189,8 @@ public:
 
 	/**
 	 * Parse the input fasta files, populating the szs list and writing the
-	 * .3.ebwt and .4.ebwt portions of the index as we go.
+	 * .3.ebwt and .4.ebwt portions of the index as we go.  The files are
+	 * parsed on 'nthreads' threads.
 	 */
 	static std::pair<size_t, size_t>
 	szsFromFasta(
@@ -160,11 +199,40 @@ public:
 		bool bigEndian,
 		const RefReadInParams& refparams,
 		EList<RefRecord>& szs,
-		bool sanity);
+		bool sanity,
+		int nthreads = 1);
+
+	/**
+	 * Find the sequences in the .3.ebwt/.4.ebwt files for 'outfile'
+	 * that are exact copies, both bases and ambiguous stretches, of an
+	 * earlier sequence.  Drop their bases from the .4.ebwt file and
+	 * append to the .3.ebwt file a table that points each of them at
+	 * the sequence it copies.  Their records stay, so loading gives
+	 * the same reference as before.  Returns the number of sequences
+	 * that became aliases and sets 'saved' to the number of bases no
+	 * longer stored.
+	 */
+	static TIndexOffU dedupRefFiles(const string& outfile, TIndexOffU& saved);
+
+	/**
+	 * Append the records and the bitpacked reference to an index
+	 * container.
+	 */
+	void writeToContainer(IndexContainerWriter& w) const;
 	
 protected:
 
-	uint32_t byteToU32_[256];
+	/**
+	 * Return true iff sequence 'src', already indexed, has the same
+	 * records as the sequence whose first record is recs_[i].
+	 */
+	bool sameRecords(TIndexOffU src, TIndexOffU i) const;
+
+	/**
+	 * Write the 'count' bases starting at offset 'bufOff' of buf_ to
+	 * 'dest', one byte per base.
+	 */
+	void unpackBases(uint8_t *dest, uint64_t bufOff, uint64_t count) const;
 
 	EList<RefRecord> recs_;       /// records describing unambiguous stretches
 	// following two lists are purely for the binary search in getStretch
@@ -173,6 +241,12 @@ protected:
 	EList<TIndexOffU> refLens_;    /// approx lens of ref seqs (excludes trailing ambig chars)
 	EList<TIndexOffU> refOffs_;    /// buf_ begin offsets per ref seq
 	EList<TIndexOffU> refRecOffs_; /// record begin/end offsets per ref seq
+	EList<TIndexOffU> aliases_;    /// (alias, source) pairs of seqs stored once
+	// With many records, getStretch() finds the one covering an offset
+	// through recIdx_, which indexes the records of all sequences laid
+	// end to end, each sequence starting at refBases_[tidx]
+	OffsetIndex<uint64_t> recIdx_;
+	EList<uint64_t>   refBases_;
 	uint8_t *buf_;      /// the whole reference as a big bitpacked byte array
 	uint8_t *sanityBuf_;/// for sanity-checking buf_
 	TIndexOffU bufSz_;    /// size of buf_
@@ -183,7 +257,91 @@ protected:
 	bool     useMm_;    /// load the reference as a memory-mapped file
 	bool     useShmem_; /// load the reference into shared memory
 	bool     verbose_;
+	IndexContainer cnt_; /// single-file container, if loaded from one
 	ASSERT_ONLY(SStringExpandable<uint32_t> tmp_destU32_);
 };
 
+/**
+ * A small cache of recently unpacked reference stretches, private to one
+ * thread.  The DP windows for nearby seed hits of a read overlap heavily,
+ * as does the window searched for the opposite mate, so most of them can
+ * be sliced out of a stretch unpacked for an earlier one.
+ *
+ * On a miss, a window of SLOT_BASES characters around the request is
+ * unpacked into the least recently used slot, so that later requests
+ * nearby, on either side, fall inside it.  Requests longer than a slot
+ * go straight to the reference.  The slots together take about 128 KB,
+ * so they stay in L2 alongside the DP matrices.
+ */
+class RefWindowCache {
+
+public:
+
+	static const size_t NSLOTS = 64;
+	static const size_t SLOT_BASES = 2048;
+
+	RefWindowCache() :
+		ref_(NULL),
+		buf_(DP_CAT),
+		tick_(0)
+	{
+		buf_.resizeExact(NSLOTS * SLOT_WORDS);
+		clear();
+		resetCounters();
+	}
+
+	/**
+	 * Load a stretch of reference 'ref' into 'destU32' with the same
+	 * contract as BitPairReference::getStretch().
+	 */
+	int getStretch(
+		const BitPairReference& ref,
+		uint32_t *destU32,
+		size_t tidx,
+		size_t toff,
+		size_t count
+		ASSERT_ONLY(, SStringExpandable<uint32_t>& destU32_2));
+
+	/**
+	 * Forget all cached stretches.
+	 */
+	void clear() {
+		for(size_t i = 0; i < NSLOTS; i++) {
+			slots_[i].count = 0;
+		}
+	}
+
+	/**
+	 * Reset the hit/miss counters.
+	 */
+	void resetCounters() {
+		hits_ = misses_ = bypasses_ = 0;
+	}
+
+	uint64_t hits()     const { return hits_; }     // served from a slot
+	uint64_t misses()   const { return misses_; }   // filled a slot
+	uint64_t bypasses() const { return bypasses_; } // too long to cache
+
+protected:
+
+	// Room for a slot's characters after getStretch()'s cushion
+	static const size_t SLOT_WORDS = (SLOT_BASES + 32) / 4;
+
+	struct Slot {
+		size_t   tidx;
+		size_t   toff;   // offset of first cached character
+		size_t   count;  // # cached characters; 0 = empty
+		uint64_t used;   // tick of last use
+		int      offset; // where the characters start in the slot
+	};
+
+	const BitPairReference *ref_; // reference the slots hold stretches of
+	EList<uint32_t> buf_;         // NSLOTS * SLOT_WORDS words
+	Slot            slots_[NSLOTS];
+	uint64_t        tick_;
+	uint64_t        hits_;
+	uint64_t        misses_;
+	uint64_t        bypasses_;
+};
+
 #endif
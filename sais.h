@@ -0,0 +1,342 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SAIS_H_
+#define SAIS_H_
+
+/**
+ * \file Suffix-array construction by induced sorting (SA-IS; Nong, Zhang
+ * and Chan, "Two Efficient Algorithms for Linear Time Suffix Array
+ * Construction", IEEE Trans. Computers 2011).
+ *
+ * Unlike the blockwise builders, which sort the suffixes a bucket at a
+ * time with a difference-cover sample, SA-IS builds the whole suffix
+ * array in one pass of O(n) time.  The price is memory: the array is
+ * held in full, one signed TIndexOff per text character, plus one bit
+ * per character for the suffix types.
+ */
+
+#include <stdint.h>
+#include <limits>
+#include <stdexcept>
+#include "assert_helpers.h"
+#include "blockwise_sa.h"
+#include "sstring.h"
+#include "ds.h"
+#include "mem_ids.h"
+#include "btypes.h"
+
+/**
+ * Character accessor for the top level of the recursion.  Presents a
+ * DNA text 't' of length 'len' as a string of length len+1 over the
+ * alphabet {0,...,4}, where 0 is a unique terminator and the
+ * nucleotides are numbered in reverse (A=4, ..., T=1).  Bowtie orders
+ * the empty suffix after every other suffix; with this numbering
+ * SA-IS yields exactly that order, back to front.
+ */
+template<typename TStr>
+struct SaisTextChars {
+	SaisTextChars(const TStr& t, TIndexOff len) : t_(t), len_(len) { }
+
+	TIndexOff operator()(TIndexOff i) const {
+		return (i == len_) ? 0 : (4 - (TIndexOff)t_[i]);
+	}
+
+	const TStr& t_;
+	TIndexOff   len_;
+};
+
+/**
+ * Character accessor for the reduced strings of the deeper levels.
+ */
+struct SaisIntChars {
+	SaisIntChars(const TIndexOff *s) : s_(s) { }
+
+	TIndexOff operator()(TIndexOff i) const { return s_[i]; }
+
+	const TIndexOff *s_;
+};
+
+/**
+ * One bit per text position: set iff the suffix there is S-type.
+ */
+class SaisTypes {
+public:
+	SaisTypes(TIndexOff n) : bits_(((size_t)n + 7) >> 3, EBWTB_CAT) { }
+
+	bool get(TIndexOff i) const {
+		return (bits_[(size_t)i >> 3] & (1 << (i & 7))) != 0;
+	}
+
+	void set(TIndexOff i, bool b) {
+		if(b) bits_[(size_t)i >> 3] |=  (uint8_t)(1 << (i & 7));
+		else  bits_[(size_t)i >> 3] &= (uint8_t)~(1 << (i & 7));
+	}
+
+	/// True iff i is a leftmost-S position
+	bool isLMS(TIndexOff i) const {
+		return i > 0 && get(i) && !get(i-1);
+	}
+
+private:
+	AutoArray<uint8_t> bits_;
+};
+
+/**
+ * Set bkt[c] to the start (or, if 'end', one past the end) of the
+ * bucket for character c, for all c in [0, k].
+ */
+template<typename TChars>
+static void saisBuckets(
+	const TChars& chr,
+	TIndexOff n,
+	TIndexOff k,
+	TIndexOff *bkt,
+	bool end)
+{
+	for(TIndexOff c = 0; c <= k; c++) bkt[c] = 0;
+	for(TIndexOff i = 0; i < n; i++) bkt[chr(i)]++;
+	TIndexOff sum = 0;
+	for(TIndexOff c = 0; c <= k; c++) {
+		sum += bkt[c];
+		bkt[c] = end ? sum : (sum - bkt[c]);
+	}
+}
+
+/**
+ * Induce the order of the L-type suffixes from the S-type suffixes
+ * already in 'sa', then of the S-type suffixes from the L-type ones.
+ */
+template<typename TChars>
+static void saisInduce(
+	const TChars& chr,
+	const SaisTypes& t,
+	TIndexOff *sa,
+	TIndexOff n,
+	TIndexOff k,
+	TIndexOff *bkt)
+{
+	saisBuckets(chr, n, k, bkt, false);
+	for(TIndexOff i = 0; i < n; i++) {
+		TIndexOff j = sa[i] - 1;
+		if(j >= 0 && !t.get(j)) sa[bkt[chr(j)]++] = j;
+	}
+	saisBuckets(chr, n, k, bkt, true);
+	for(TIndexOff i = n-1; i >= 0; i--) {
+		TIndexOff j = sa[i] - 1;
+		if(j >= 0 && t.get(j)) sa[--bkt[chr(j)]] = j;
+	}
+}
+
+/**
+ * Fill sa[0..n) with the suffix array of the length-n string presented
+ * by 'chr', whose characters are in [0, k] and whose last character is
+ * a 0 occurring nowhere else.  The reduced problem is solved in place
+ * in 'sa', so no memory beyond the type bits and the buckets is needed
+ * at any level.  Throws bad_alloc if those can't be allocated.
+ */
+template<typename TChars>
+static void saisBuild(
+	const TChars& chr,
+	TIndexOff *sa,
+	TIndexOff n,
+	TIndexOff k)
+{
+	assert_gt(n, 0);
+	if(n == 1) {
+		sa[0] = 0;
+		return;
+	}
+	SaisTypes t(n);
+	// Classify each suffix as S- or L-type
+	t.set(n-1, true);
+	t.set(n-2, false);
+	for(TIndexOff i = n-3; i >= 0; i--) {
+		TIndexOff c = chr(i), c1 = chr(i+1);
+		t.set(i, c < c1 || (c == c1 && t.get(i+1)));
+	}
+	TIndexOff n1 = 0, name = 0;
+	{
+		AutoArray<TIndexOff> bkt((size_t)k + 1, EBWTB_CAT);
+		// Stage 1: sort the LMS substrings by placing the LMS
+		// positions at the ends of their buckets and inducing
+		saisBuckets(chr, n, k, &bkt[0], true);
+		for(TIndexOff i = 0; i < n; i++) sa[i] = -1;
+		for(TIndexOff i = 1; i < n; i++) {
+			if(t.isLMS(i)) sa[--bkt[chr(i)]] = i;
+		}
+		saisInduce(chr, t, sa, n, k, &bkt[0]);
+	}
+	// Gather the sorted LMS substrings into sa[0..n1)
+	for(TIndexOff i = 0; i < n; i++) {
+		if(t.isLMS(sa[i])) sa[n1++] = sa[i];
+	}
+	// Name the LMS substrings; equal substrings get equal names.  Names
+	// go in sa[n1..n) at half the position, which can't collide since
+	// LMS positions are at least two apart
+	for(TIndexOff i = n1; i < n; i++) sa[i] = -1;
+	TIndexOff prev = -1;
+	for(TIndexOff i = 0; i < n1; i++) {
+		TIndexOff pos = sa[i];
+		bool diff = false;
+		for(TIndexOff d = 0; d < n; d++) {
+			if(prev == -1 || chr(pos+d) != chr(prev+d) || t.get(pos+d) != t.get(prev+d)) {
+				diff = true;
+				break;
+			} else if(d > 0 && (t.isLMS(pos+d) || t.isLMS(prev+d))) {
+				break;
+			}
+		}
+		if(diff) {
+			name++;
+			prev = pos;
+		}
+		sa[n1 + (pos >> 1)] = name - 1;
+	}
+	for(TIndexOff i = n-1, j = n-1; i >= n1; i--) {
+		if(sa[i] >= 0) sa[j--] = sa[i];
+	}
+	// Stage 2: sort the reduced string, recursing if any names repeat
+	TIndexOff *s1 = sa + n - n1;
+	if(name < n1) {
+		saisBuild(SaisIntChars(s1), sa, n1, name - 1);
+	} else {
+		for(TIndexOff i = 0; i < n1; i++) sa[s1[i]] = i;
+	}
+	// Stage 3: place the LMS suffixes in their final order and induce
+	// the rest
+	AutoArray<TIndexOff> bkt((size_t)k + 1, EBWTB_CAT);
+	saisBuckets(chr, n, k, &bkt[0], true);
+	for(TIndexOff i = 1, j = 0; i < n; i++) {
+		if(t.isLMS(i)) s1[j++] = i;
+	}
+	for(TIndexOff i = 0; i < n1; i++) sa[i] = s1[sa[i]];
+	for(TIndexOff i = n1; i < n; i++) sa[i] = -1;
+	for(TIndexOff i = n1-1; i >= 0; i--) {
+		TIndexOff j = sa[i];
+		sa[i] = -1;
+		sa[--bkt[chr(j)]] = j;
+	}
+	saisInduce(chr, t, sa, n, k, &bkt[0]);
+}
+
+/**
+ * Suffix-array producer that builds the entire suffix array up front
+ * with SA-IS and then doles it out in order, so that it can be fed to
+ * Ebwt::buildToDisk() in place of a blockwise builder.
+ */
+template<typename TStr>
+class SaisSA : public InorderBlockwiseSA<TStr> {
+public:
+	SaisSA(const TStr& __text,
+	       bool __sanityCheck = false,
+	       bool __passMemExc = false,
+	       bool __verbose = false,
+	       ostream& __logger = cout) :
+		InorderBlockwiseSA<TStr>(__text, OFF_MASK, __sanityCheck, __passMemExc, __verbose, __logger),
+		_sa(NULL),
+		_cur(0)
+	{ reset(); }
+
+	virtual ~SaisSA() {
+		delete _sa;
+	}
+
+	/**
+	 * Return true iff a text of the given length is short enough for
+	 * its suffix array to be indexed with a TIndexOff.
+	 */
+	static bool fits(TIndexOffU len) {
+		return (uint64_t)len < (uint64_t)std::numeric_limits<TIndexOff>::max();
+	}
+
+	/**
+	 * Return the number of bytes, besides the text itself, needed at
+	 * the peak of building the suffix array of the given text.
+	 */
+	static size_t memUsage(const TStr& text) {
+		size_t n = text.length() + 1;
+		return n * sizeof(TIndexOff) + ((n + 7) >> 3);
+	}
+
+	/**
+	 * Get the next suffix.
+	 */
+	virtual TIndexOffU nextSuffix() {
+		if(this->_itrPushedBackSuffix != OFF_MASK) {
+			TIndexOffU tmp = this->_itrPushedBackSuffix;
+			this->_itrPushedBackSuffix = OFF_MASK;
+			return tmp;
+		}
+		if(!hasMoreBlocks()) {
+			throw out_of_range("No more suffixes");
+		}
+		// The array is sorted in reverse of bowtie's suffix order
+		return (TIndexOffU)(*_sa)[_sa->size() - 1 - _cur++];
+	}
+
+protected:
+
+	/**
+	 * Build the suffix array, if it isn't built yet, and point the
+	 * cursor at its first element.
+	 */
+	virtual void reset() {
+		if(_sa == NULL) {
+			build();
+		}
+		_cur = 0;
+	}
+
+	/// Return true iff we're about to dole out the first suffix
+	virtual bool isReset() {
+		return _cur == 0;
+	}
+
+	/// The whole array is one block, built by reset()
+	virtual void nextBlock(int cur_block, int tid = 0) { }
+
+	/// Return true iff more suffixes are available
+	virtual bool hasMoreBlocks() const {
+		return _cur < _sa->size();
+	}
+
+private:
+
+	void build() {
+		const TStr& t = this->text();
+		TIndexOff n = (TIndexOff)t.length() + 1;
+		{
+			Timer timer(cout, "  Time to build suffix array with SA-IS: ", this->verbose());
+			_sa = new AutoArray<TIndexOff>((size_t)n, EBWTB_CAT);
+			saisBuild(SaisTextChars<TStr>(t, n - 1), &(*_sa)[0], n, 4);
+		}
+		assert_eq(n - 1, (*_sa)[0]);
+		if(this->sanityCheck()) {
+			for(TIndexOff i = n - 1; i > 1; i--) {
+				assert(sstr_suf_lt(t, (size_t)(*_sa)[i], t, (size_t)(*_sa)[i-1], false));
+			}
+		}
+	}
+
+	AutoArray<TIndexOff> *_sa;  /// suffix array, back to front
+	size_t                _cur; /// suffixes doled out so far
+};
+
+#endif /*SAIS_H_*/
@@ -0,0 +1,126 @@
+#!/usr/bin/perl -w
+
+#
+# Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+#
+# This file is part of Bowtie 2.
+#
+# Bowtie 2 is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Bowtie 2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# Write a random reference genome of a given size as FASTA, for
+# benchmarking bowtie2-build.  Sequences are made the way
+# RandDNA::nextSeq() makes them, from runs of randomly chosen building
+# blocks, but are written out as they're made so that genome-sized
+# references (billions of bases) take time and memory linear in their
+# length.
+#
+
+use strict;
+use warnings;
+use Getopt::Long;
+use FindBin qw($Bin);
+use lib "$Bin";
+use RandDNA;
+use Math::Random;
+
+my $usage = qq!
+make_ref.pl [options*] > ref.fa
+
+Options:
+
+  --length <size>               Total length of the reference; K/M/G ok (def: 1M)
+  --contigs <int>               Split it into <int> sequences (def: 1)
+  --blocks <int>                Build sequences from <int> building blocks (def: 10000)
+  --n-frac <float>              Fraction of Ns in building blocks (def: 0.001)
+  --iupac-frac <float>          Fraction of other IUPAC codes (def: 0.0001)
+  --seed <int>                  Seed for the random number generators (def: 0)
+  --help                        Print this usage message
+
+!;
+
+my $length = "1M";
+my $contigs = 1;
+my $blocks = 10000;
+my $nfrac = 0.001;
+my $iupacFrac = 0.0001;
+my $seed = 0;
+my $help = 0;
+
+GetOptions(
+	"length=s"     => \$length,
+	"contigs=i"    => \$contigs,
+	"blocks=i"     => \$blocks,
+	"n-frac=f"     => \$nfrac,
+	"iupac-frac=f" => \$iupacFrac,
+	"seed=i"       => \$seed,
+	"help"         => \$help,
+) || die "Bad options;";
+
+if($help) {
+	print $usage;
+	exit 0;
+}
+
+##
+# Parse a size such as 500, 64K, 100M or 3G.
+#
+sub parseSize($) {
+	my $s = shift;
+	$s =~ /^([0-9.]+)([KMG]?)$/i || die "Bad size: $s";
+	my %mult = ("" => 1, "K" => 1e3, "M" => 1e6, "G" => 1e9);
+	return int($1 * $mult{uc $2});
+}
+
+my $total = parseSize($length);
+$total > 0 || die "--length must be positive";
+$contigs > 0 || die "--contigs must be positive";
+srand($seed);
+Math::Random::random_set_seed_from_phrase("make_ref $seed");
+
+my $rd = RandDNA->new(
+	"make_ref",  # name
+	$nfrac,      # N frac
+	$iupacFrac,  # IUPAC frac
+	0.6,         # AT frac
+	0.5,         # A/AT frac
+	0.5);        # C/CG frac
+my @bbs = ();
+$rd->genBuildingBlocks(\@bbs, $blocks);
+
+for my $c (1..$contigs) {
+	my $len = int($total / $contigs) + ($c <= $total % $contigs ? 1 : 0);
+	print ">sim_$c\n";
+	my $buf = "";
+	my $done = 0;
+	while($done < $len) {
+		# Choose building block and how many times to add it, as in
+		# RandDNA::nextSeq()
+		my $bb = $bbs[int(rand(scalar(@bbs)))];
+		my $runlen = int(Math::Random::random_exponential(1, 2))+1;
+		for my $i (1..$runlen) {
+			$buf .= $bb;
+		}
+		my $n = length($buf);
+		$n = $len - $done if $n > $len - $done;
+		my $full = $n - ($n % 60);
+		$full = $n if $done + $n == $len;
+		for(my $i = 0; $i < $full; $i += 60) {
+			print substr($buf, $i, $full - $i < 60 ? $full - $i : 60), "\n";
+		}
+		$done += $full;
+		$buf = substr($buf, $full);
+	}
+}
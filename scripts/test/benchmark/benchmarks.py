@@ -8,6 +8,7 @@ import re
 import csv
 import glob
 import json
+import time
 import logging
 import subprocess
 import samreader as Sr
@@ -24,13 +25,17 @@ class Benchmarks(object):
                  data_dir=None,
                  output_dir=None,
                  bin_dir=None,
-                 benchmark_id=None):
+                 benchmark_id=None,
+                 baseline_dir=None,
+                 tolerance=0.1):
         self.set_idx = 0
         self.values = list()
         self.benchmark_id = benchmark_id
         self.data_dir = data_dir
         self.bin_dir = bin_dir
         self.benchmarks_dir = benchmarks_dir
+        self.baseline_dir = baseline_dir
+        self.tolerance = tolerance
         self.output_dir = os.path.join(output_dir, self.benchmark_id)
         # 
         if os.path.exists(self.output_dir):
@@ -91,18 +96,22 @@ class Benchmarks(object):
                         item = re.sub(r'##OUTDIR##', self.output_dir, item)
                         runable_prop[i] = item
 
-            return BenchmarkSet(set_data, self.data_dir, self.output_dir, self.bin_dir)
+            return BenchmarkSet(set_data, self.data_dir, self.output_dir, self.bin_dir,
+                                self.baseline_dir, self.tolerance)
 
 
 class BenchmarkSet(object):
     """ A Benchmark item
     """
 
-    def __init__(self, data, data_dir, out_dir, bin_dir):
+    def __init__(self, data, data_dir, out_dir, bin_dir, baseline_dir=None, tolerance=0.1):
         self.data = data
         self.data_dir = data_dir
         self.out_dir = out_dir
         self.bin_dir = bin_dir
+        self.baseline_dir = baseline_dir
+        self.tolerance = tolerance
+        self.regressions = list()
         self.input_data_loaded = False
 
     def run(self):
@@ -273,3 +282,125 @@ class TestAccuracy(Runable):
         raise LookupError("No SAM data input file defined for this test!")
 
 
+
+
+class TestBuild(Runable):
+    """ Index build benchmarks.
+
+    Runs bowtie2-build once for each "threads" value of the test and
+    records wall time, CPU time, peak RSS, thread efficiency (CPU time
+    over wall time times threads) and the time taken by each phase of
+    the build, as reported by bowtie2-build --met-file.  With a baseline
+    (a results directory of an earlier run), any of those that grew by
+    more than the tolerance is reported as a regression.
+    """
+
+    # Differences smaller than these are noise, whatever the tolerance
+    MIN_SECS = 1.0
+    MIN_RSS_MB = 16.0
+
+    def __init__(self, main_set, test):
+        super(TestBuild, self).__init__(main_set, test)
+        self.results = list()
+
+    def launch(self):
+        """ one build per thread count """
+        open(self.err_log, 'w').close()
+        for nthreads in self.test["runable"].get("threads", [1]):
+            self.results.append(self._run_build(nthreads))
+        self._format_report()
+        self._check_baseline()
+
+    def _run_build(self, nthreads):
+        """ run and measure a single build """
+        space = " "
+        test = self.test
+        base = os.path.join(self.benchmark_set.out_dir, "%s.t%d" % (test["name"], nthreads))
+        met_file = base + ".met.json"
+        cmd = os.path.join(self.benchmark_set.bin_dir, test["runable"]["program"])
+        for opt in test["runable"]["options"]:
+            cmd = cmd + space + opt
+        cmd = cmd + " --threads %d --met-file %s --met 0" % (nthreads, met_file)
+        for parm in test["runable"]["parameters"]:
+            cmd = cmd + space + parm
+        cmd = cmd + space + base
+        logging.info("Start Benchmark %s with %d thread(s)" % (test["name"], nthreads))
+        logging.info("Running: %s" % cmd)
+        with open(self.err_log, 'a') as errlog:
+            start = time.time()
+            proc = subprocess.Popen(cmd, shell=True, stdout=errlog, stderr=errlog)
+            # wait4 gives the resource usage of the build and its children
+            _, status, usage = os.wait4(proc.pid, 0)
+            wall = time.time() - start
+        proc.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+        if proc.returncode != 0:
+            raise subprocess.CalledProcessError(proc.returncode, cmd)
+
+        # Phases of the mirror index are reported for "<base>.rev"; key
+        # them as e.g. "bwt" and "bwt.rev"
+        phases = dict()
+        with open(met_file) as fp:
+            for line in fp:
+                event = json.loads(line)
+                if event["event"] == "end":
+                    key = event["phase"] + (".rev" if event["index"].endswith(".rev") else "")
+                    phases[key] = phases.get(key, 0.0) + event["secs"]
+        if not test.get("keep_index", False):
+            for fname in glob.glob(base + ".*bt2*"):
+                os.remove(fname)
+
+        cpu = usage.ru_utime + usage.ru_stime
+        return {"threads": nthreads,
+                "wall_secs": wall,
+                "cpu_secs": cpu,
+                # ru_maxrss is in kilobytes on Linux, bytes on macOS
+                "peak_rss_mb": usage.ru_maxrss / (1024.0 * 1024.0 if os.uname()[0] == "Darwin" else 1024.0),
+                "efficiency": cpu / (wall * nthreads) if wall > 0 else 0.0,
+                "phases": phases}
+
+    def _format_report(self):
+        """ formats data in csv format, and json for later baselines """
+        name = self.test["name"]
+        out_base = os.path.join(self.benchmark_set.out_dir, name)
+        with open(out_base + ".csv", 'w') as csvf:
+            writer = csv.writer(csvf)
+            writer.writerow(["Test", "Threads", "Wall Time", "CPU Time", "Peak RSS (MB)", "Thread Efficiency"])
+            for res in self.results:
+                writer.writerow([name, res["threads"], "%.2f" % res["wall_secs"], "%.2f" % res["cpu_secs"],
+                                 "%.1f" % res["peak_rss_mb"], "%.3f" % res["efficiency"]])
+        with open(out_base + ".phases.csv", 'w') as csvf:
+            writer = csv.writer(csvf)
+            writer.writerow(["Test", "Threads", "Phase", "Time"])
+            for res in self.results:
+                for phase in sorted(res["phases"]):
+                    writer.writerow([name, res["threads"], phase, "%.3f" % res["phases"][phase]])
+        with open(out_base + ".json", 'w') as fp:
+            json.dump(self.results, fp, indent=1)
+
+    def _check_baseline(self):
+        """ compare with the same test in the baseline run """
+        if self.benchmark_set.baseline_dir is None:
+            return
+        name = self.test["name"]
+        base_file = os.path.join(self.benchmark_set.baseline_dir, name + ".json")
+        if not os.path.isfile(base_file):
+            logging.warning("No baseline for %s (%s)" % (name, base_file))
+            return
+        with open(base_file) as fp:
+            baseline = dict((res["threads"], res) for res in json.load(fp))
+        tol = self.benchmark_set.tolerance
+        for res in self.results:
+            old = baseline.get(res["threads"])
+            if old is None:
+                continue
+            checks = [("wall time", res["wall_secs"], old["wall_secs"], self.MIN_SECS),
+                      ("peak RSS (MB)", res["peak_rss_mb"], old["peak_rss_mb"], self.MIN_RSS_MB)]
+            for phase in sorted(res["phases"]):
+                if phase in old["phases"]:
+                    checks.append(("phase " + phase, res["phases"][phase], old["phases"][phase], self.MIN_SECS))
+            for what, new_val, old_val, slack in checks:
+                if new_val > old_val * (1.0 + tol) and new_val - old_val > slack:
+                    msg = "%s, %d thread(s): %s went from %.2f to %.2f" % (
+                        name, res["threads"], what, old_val, new_val)
+                    logging.warning("Regression: " + msg)
+                    self.benchmark_set.regressions.append(msg)
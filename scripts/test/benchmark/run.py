@@ -18,9 +18,15 @@ Example:
    
    run.py -s ~/bt2_benchmarks -i all_tests -o records
 
+   # Runs the index-build benchmarks and flags anything more than 10%
+   # slower or bigger than in the run recorded as "before".
+
+   run.py -t data/conf/build.json -i after -r benchmark_rezults/before
+
 """
 
 import os
+import sys
 import logging
 import benchmarks as bm
 from optparse import OptionParser
@@ -61,6 +67,15 @@ def parse_args():
     parser.add_option("-l", "--log-file",
                       action="store", type="string", dest="log_fname", default=None,
                       help="(Default: stderr). Log file name if desired.")
+    parser.add_option("-r", "--baseline",
+                      action="store", type="string", dest="baseline_dir", default=None,
+                      help="Results directory of an earlier run (<output-dir>/<benchmark-id>) "
+                           "to compare with. Index-build benchmarks that got slower or "
+                           "used more memory are reported as regressions.")
+    parser.add_option("--tolerance",
+                      action="store", type="float", dest="tolerance", default=0.1,
+                      help="(Default: 0.1). Fraction by which a result may exceed "
+                           "the baseline before it's a regression.")
     parser.add_option("-v", "--verbose",
                       action="store_true", dest="verbose", default=False,
                       help="Print more info about each step.")
@@ -109,17 +124,31 @@ if __name__ == "__main__":
         if not os.path.exists(options.benchmarks_dir):
             logging.error("Cannot find benchmark directory %s" % options.benchmarks_dir)
 
+    if options.baseline_dir is not None and not os.path.isdir(options.baseline_dir):
+        logging.error("Cannot find baseline directory %s" % options.baseline_dir)
+        exit(-1)
+
     batch_benchmarks = bm.Benchmarks(benchmarks_dir=options.benchmarks_dir,
                                      benchmark_test=options.benchmark_test,
                                      data_dir=options.download_dir,
                                      output_dir=options.out_dir,
                                      bin_dir=options.bowtie_dir,
-                                     benchmark_id=options.benchmark_id)
+                                     benchmark_id=options.benchmark_id,
+                                     baseline_dir=options.baseline_dir,
+                                     tolerance=options.tolerance)
 
+    regressions = list()
     for test_set in batch_benchmarks:
         if not test_set.input_data_loaded:
             test_set.load()
         test_set.run()
+        regressions.extend(test_set.regressions)
+
+    if regressions:
+        print("%d regression(s) against %s:" % (len(regressions), options.baseline_dir))
+        for msg in regressions:
+            print("  " + msg)
+        sys.exit(1)
 
 
 
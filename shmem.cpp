@@ -21,19 +21,254 @@
 
 #include <iostream>
 #include <string>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <sys/shm.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
 #include "shmem.h"
+#include "threading.h"
 
 using namespace std;
 
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
+static const char *shmPrefix = "bowtie2-shm-";
+static const char *shmListDir = "/dev/shm"; // where shm_open objects show up
+
+/**
+ * A segment this process is attached to.
+ */
+struct SharedSeg {
+	int    fd;     // holds our flock()
+	size_t mapLen; // length of the mapping
+	string name;   // segment name, without leading '/'
+};
+
+static map<const void*, SharedSeg> shmSegs;
+static MUTEX_T shmMutex;
+
+/**
+ * Return the directory given by BOWTIE2_SHMEM_DIR, or "" if segments
+ * are POSIX shared-memory objects.
+ */
+static string shmDir() {
+	const char *d = getenv("BOWTIE2_SHMEM_DIR");
+	return (d == NULL) ? string() : string(d);
+}
+
+/**
+ * Name of the segment for 'fname', an index file name with a bracketed
+ * array name appended: a 64-bit FNV-1a hash of it, with the file name
+ * made absolute so that runs started from different directories agree.
+ */
+static string shmName(const string& fname) {
+	string key = fname;
+	size_t br = fname.rfind('[');
+	char *abs = realpath(fname.substr(0, br).c_str(), NULL);
+	if(abs != NULL) {
+		key = string(abs) + fname.substr(br == string::npos ? fname.length() : br);
+		free(abs);
+	}
+	uint64_t h = 14695981039346656037ULL;
+	for(size_t i = 0; i < key.length(); i++) {
+		h ^= (uint8_t)key[i];
+		h *= 1099511628211ULL;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+	return string(shmPrefix) + buf;
+}
+
+static int shmOpenSeg(const string& name, int flags, mode_t mode) {
+	string dir = shmDir();
+	if(dir.empty()) {
+		return shm_open(("/" + name).c_str(), flags, mode);
+	}
+	return open((dir + "/" + name).c_str(), flags, mode);
+}
+
+static int shmUnlinkSeg(const string& name) {
+	string dir = shmDir();
+	if(dir.empty()) {
+		return shm_unlink(("/" + name).c_str());
+	}
+	return unlink((dir + "/" + name).c_str());
+}
+
+/**
+ * Return the granularity segments must be sized in: the huge page
+ * size if BOWTIE2_SHMEM_DIR is a hugetlbfs mount, otherwise the page
+ * size.  Sets 'huge' accordingly.
+ */
+static size_t shmGranularity(bool& huge) {
+	huge = false;
+#ifdef __linux__
+	string dir = shmDir();
+	struct statfs sfs;
+	if(!dir.empty() && statfs(dir.c_str(), &sfs) == 0 &&
+	   (unsigned long)sfs.f_type == (unsigned long)HUGETLBFS_MAGIC)
+	{
+		huge = true;
+		return (size_t)sfs.f_bsize;
+	}
+#endif
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+bool allocSharedMemRaw(
+	const string& fname,
+	size_t len,
+	void **dst,
+	const char *memName,
+	bool verbose)
+{
+	string name = shmName(fname);
+	bool huge = false;
+	size_t gran = shmGranularity(huge);
+	// Reserve 4 bytes at the end for the initialized flag
+	size_t mapLen = ((len + 4 + gran - 1) / gran) * gran;
+	if(verbose) {
+		cerr << "Reading " << len << "+4 bytes into shared memory for " << memName
+		     << " (segment " << name.c_str() << (huge ? ", huge pages" : "") << ")" << endl;
+	}
+	for(int attempt = 0; attempt < 100; attempt++) {
+		int fd = shmOpenSeg(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+		if(fd >= 0) {
+			// We created it, so we fill it.  Hold the lock exclusively
+			// until notifySharedMem() so that others wait for us.
+			fchmod(fd, 0666); // don't let the umask lock others out
+			if(flock(fd, LOCK_EX) != 0 || ftruncate(fd, (off_t)mapLen) != 0) {
+				perror("ftruncate");
+				cerr << "Could not size shared memory segment for " << memName << endl;
+				close(fd);
+				shmUnlinkSeg(name);
+				throw 1;
+			}
+			void *p = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(p == MAP_FAILED) {
+				perror("mmap");
+				cerr << "Failed to map shared memory for " << memName << endl;
+				if(huge) {
+					cerr << "Check that enough huge pages are reserved (vm.nr_hugepages)." << endl;
+				}
+				close(fd);
+				shmUnlinkSeg(name);
+				throw 1;
+			}
+#ifdef MADV_HUGEPAGE
+			if(!huge) madvise(p, mapLen, MADV_HUGEPAGE);
+#endif
+			((volatile uint32_t*)((char*)p + len))[0] = SHMEM_UNINIT;
+			{
+				ThreadSafe ts(shmMutex);
+				SharedSeg& s = shmSegs[p];
+				s.fd = fd;
+				s.mapLen = mapLen;
+				s.name = name;
+			}
+			if(verbose) {
+				cerr << "  I (pid = " << getpid() << ") created the "
+				     << "shared memory for " << memName << endl;
+			}
+			*dst = p;
+			return true;
+		}
+		if(errno != EEXIST) {
+			perror("shm_open");
+			cerr << "Could not create shared memory segment for " << memName << endl;
+			throw 1;
+		}
+		fd = shmOpenSeg(name, O_RDWR, 0);
+		if(fd < 0) {
+			if(errno == ENOENT) continue; // removed in the meantime
+			perror("shm_open");
+			cerr << "Could not open shared memory segment for " << memName << endl;
+			throw 1;
+		}
+		// Blocks until whoever is filling the segment is done
+		if(flock(fd, LOCK_SH) != 0) {
+			perror("flock");
+			close(fd);
+			throw 1;
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0) {
+			perror("fstat");
+			close(fd);
+			throw 1;
+		}
+		if(st.st_size == 0 && attempt < 10) {
+			// Creator hasn't gotten as far as locking it yet
+			close(fd);
+			usleep(100000);
+			continue;
+		}
+		if((size_t)st.st_size != mapLen) {
+			cerr << "Warning: shared-memory chunk's segment size (" << st.st_size
+			     << ") doesn't match expected size (" << mapLen << ")" << endl
+			     << "Deleting old shared memory block and trying again." << endl;
+			shmUnlinkSeg(name);
+			close(fd);
+			continue;
+		}
+		void *p = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(p == MAP_FAILED) {
+			perror("mmap");
+			cerr << "Failed to map shared memory for " << memName << endl;
+			close(fd);
+			throw 1;
+		}
+		if(((volatile uint32_t*)((char*)p + len))[0] != SHMEM_INIT) {
+			cerr << "Warning: the process loading shared memory for " << memName
+			     << " exited before finishing." << endl
+			     << "Deleting old shared memory block and trying again." << endl;
+			munmap(p, mapLen);
+			shmUnlinkSeg(name);
+			close(fd);
+			continue;
+		}
+		{
+			ThreadSafe ts(shmMutex);
+			SharedSeg& s = shmSegs[p];
+			s.fd = fd;
+			s.mapLen = mapLen;
+			s.name = name;
+		}
+		if(verbose) {
+			cerr << "  I (pid = " << getpid()
+			     << ") attached to existing shared memory for " << memName << endl;
+		}
+		*dst = p;
+		return false;
+	}
+	cerr << "Gave up trying to set up shared memory for " << memName << endl;
+	throw 1;
+}
+
 /**
  * Notify other users of a shared-memory chunk that the leader has
  * finished initializing it.
  */
 void notifySharedMem(void *mem, size_t len) {
 	((volatile uint32_t*)((char*)mem + len))[0] = SHMEM_INIT;
+	ThreadSafe ts(shmMutex);
+	map<const void*, SharedSeg>::iterator it = shmSegs.find(mem);
+	if(it != shmSegs.end()) {
+		// Let the waiters in; we stay attached like any other user
+		flock(it->second.fd, LOCK_SH);
+	}
 }
 
 /**
@@ -46,4 +281,60 @@ void waitSharedMem(void *mem, size_t len) {
 	}
 }
 
+void freeSharedMem(const void *mem) {
+	ThreadSafe ts(shmMutex);
+	map<const void*, SharedSeg>::iterator it = shmSegs.find(mem);
+	if(it == shmSegs.end()) {
+		return;
+	}
+	munmap(const_cast<void*>(mem), it->second.mapLen);
+	close(it->second.fd);
+	shmSegs.erase(it);
+}
+
+size_t cleanupSharedMem(bool dryRun, bool verbose) {
+	string dir = shmDir();
+	const string listDir = dir.empty() ? string(shmListDir) : dir;
+	DIR *d = opendir(listDir.c_str());
+	if(d == NULL) {
+		perror("opendir");
+		cerr << "Could not list shared memory segments in " << listDir.c_str() << endl;
+		throw 1;
+	}
+	size_t nremoved = 0, nbusy = 0;
+	struct dirent *ent;
+	while((ent = readdir(d)) != NULL) {
+		string name = ent->d_name;
+		if(name.compare(0, strlen(shmPrefix), shmPrefix) != 0) {
+			continue;
+		}
+		int fd = shmOpenSeg(name, O_RDONLY, 0);
+		if(fd < 0) continue;
+		struct stat st;
+		off_t sz = (fstat(fd, &st) == 0) ? st.st_size : 0;
+		// Nobody holds a lock iff nobody is attached or loading
+		if(flock(fd, LOCK_EX | LOCK_NB) == 0) {
+			if(verbose || dryRun) {
+				cerr << (dryRun ? "Would remove " : "Removing ") << "unused segment "
+				     << name.c_str() << " (" << sz << " bytes)" << endl;
+			}
+			if(!dryRun) shmUnlinkSeg(name);
+			nremoved++;
+		} else {
+			if(verbose) {
+				cerr << "Keeping segment " << name.c_str() << " (" << sz
+				     << " bytes); it is in use" << endl;
+			}
+			nbusy++;
+		}
+		close(fd);
+	}
+	closedir(d);
+	if(verbose) {
+		cerr << nremoved << " segment(s) " << (dryRun ? "unused" : "removed") << ", "
+		     << nbusy << " in use" << endl;
+	}
+	return nremoved;
+}
+
 #endif
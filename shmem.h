@@ -20,26 +20,77 @@
 #ifndef SHMEM_H_
 #define SHMEM_H_
 
+/**
+ * \file Shared-memory index arrays (--shmem).
+ *
+ * Each array lives in a POSIX shared-memory object (shm_open) named
+ * after a hash of the index file it came from, or, if
+ * BOWTIE2_SHMEM_DIR is set, in a file of that name in the given
+ * directory; pointing it at a hugetlbfs mount backs the arrays with
+ * huge pages.  Segments outlive the processes that use them so that
+ * the next run can attach without reading the index again.
+ *
+ * Every process attached to a segment holds a shared flock() on it;
+ * the process that creates and fills a segment holds it exclusively
+ * until the data is ready.  The kernel drops these locks when a
+ * process exits, however it exits, so:
+ *
+ *  - a process that finds a segment waits for its creator simply by
+ *    taking the shared lock, and can tell that the creator died
+ *    mid-load because the segment is still marked uninitialized;
+ *  - the number of processes using a segment is the number of shared
+ *    locks on it, and cleanupSharedMem() can safely remove exactly the
+ *    segments nobody holds.
+ */
+
 #ifdef BOWTIE_SHARED_MEM
 
 #include <string>
-#include <sys/shm.h>
-#include <unistd.h>
-#include <sys/shm.h>
-#include <errno.h>
 #include <stdint.h>
-#include <stdexcept>
-#include "str_util.h"
 #include "btypes.h"
 
+/**
+ * Attach to, or create, the shared segment for 'fname' with room for
+ * 'len' bytes and set *dst to point to it.  Returns true iff this
+ * process created the segment and must now fill it and call
+ * notifySharedMem(); returns false if the segment is already filled.
+ * Throws 1 on error.
+ */
+extern bool allocSharedMemRaw(
+	const std::string& fname,
+	size_t len,
+	void **dst,
+	const char *memName,
+	bool verbose);
+
+/**
+ * Mark the segment starting at 'mem' as filled and let waiting
+ * processes proceed.
+ */
 extern void notifySharedMem(void *mem, size_t len);
 
+/**
+ * Wait until the segment starting at 'mem' has been filled.
+ */
 extern void waitSharedMem(void *mem, size_t len);
 
+/**
+ * Detach from the segment starting at 'mem'.  The segment itself
+ * stays until removed by cleanupSharedMem().
+ */
+extern void freeSharedMem(const void *mem);
+
+/**
+ * Remove every segment that no process is attached to.  If 'dryRun',
+ * just list them.  Returns the number of segments removed (or that
+ * would be).
+ */
+extern size_t cleanupSharedMem(bool dryRun, bool verbose);
+
 #define ALLOC_SHARED_U allocSharedMem<TIndexOffU>
 #define ALLOC_SHARED_U8 allocSharedMem<uint8_t>
 #define ALLOC_SHARED_U32 allocSharedMem<uint32_t>
-#define FREE_SHARED shmdt
+#define FREE_SHARED freeSharedMem
 #define NOTIFY_SHARED notifySharedMem
 #define WAIT_SHARED waitSharedMem
 
@@ -56,95 +107,10 @@ bool allocSharedMem(std::string fname,
                     const char *memName,
                     bool verbose)
 {
-	using namespace std;
-	int shmid = -1;
-	// Calculate key given string
-	key_t key = (key_t)hash_string(fname);
-	shmid_ds ds;
-	int ret;
-	// Reserve 4 bytes at the end for silly synchronization
-	size_t shmemLen = len + 4;
-	if(verbose) {
-		cerr << "Reading " << len << "+4 bytes into shared memory for " << memName << endl;
-	}
-	T *ptr = NULL;
-	while(true) {
-		// Create the shrared-memory block
-		if((shmid = shmget(key, shmemLen, IPC_CREAT | 0666)) < 0) {
-			if(errno == ENOMEM) {
-				cerr << "Out of memory allocating shared area " << memName << endl;
-			} else if(errno == EACCES) {
-				cerr << "EACCES" << endl;
-			} else if(errno == EEXIST) {
-				cerr << "EEXIST" << endl;
-			} else if(errno == EINVAL) {
-				cerr << "Warning: shared-memory chunk's segment size doesn't match expected size (" << (shmemLen) << ")" << endl
-					 << "Deleteing old shared memory block and trying again." << endl;
-				shmid = shmget(key, 0, 0);
-				if((ret = shmctl(shmid, IPC_RMID, &ds)) < 0) {
-					cerr << "shmctl returned " << ret
-						 << " for IPC_RMID, errno is " << errno
-						 << ", shmid is " << shmid << endl;
-					throw 1;
-				} else {
-					cerr << "Deleted shared mem chunk with shmid " << shmid << endl;
-				}
-				continue;
-			} else if(errno == ENOENT) {
-				cerr << "ENOENT" << endl;
-			} else if(errno == ENOSPC) {
-				cerr << "ENOSPC" << endl;
-			} else {
-				cerr << "shmget returned " << shmid << " for and errno is " << errno << endl;
-			}
-			throw 1;
-		}
-		ptr = (T*)shmat(shmid, 0, 0);
-		if(ptr == (void*)-1) {
-			cerr << "Failed to attach " << memName << " to shared memory with shmat()." << endl;
-			throw 1;
-		}
-		if(ptr == NULL) {
-			cerr << memName << " pointer returned by shmat() was NULL." << endl;
-			throw 1;
-		}
-		// Did I create it, or did I just attach to one created by
-		// another process?
-		if((ret = shmctl(shmid, IPC_STAT, &ds)) < 0) {
-			cerr << "shmctl returned " << ret << " for IPC_STAT and errno is " << errno << endl;
-			throw 1;
-		}
-		if(ds.shm_segsz != shmemLen) {
-			cerr << "Warning: shared-memory chunk's segment size (" << ds.shm_segsz
-				 << ") doesn't match expected size (" << shmemLen << ")" << endl
-				 << "Deleteing old shared memory block and trying again." << endl;
-			if((ret = shmctl(shmid, IPC_RMID, &ds)) < 0) {
-				cerr << "shmctl returned " << ret << " for IPC_RMID and errno is " << errno << endl;
-				throw 1;
-			}
-		} else {
-			break;
-		}
-	} // while(true)
-	*dst = ptr;
-	bool initid = (((volatile uint32_t*)((char*)ptr + len))[0] == SHMEM_INIT);
-	if(ds.shm_cpid == getpid() && !initid) {
-		if(verbose) {
-			cerr << "  I (pid = " << getpid() << ") created the "
-			     << "shared memory for " << memName << endl;
-		}
-		// Set this value just off the end of the chunk to
-		// indicate that the data hasn't been read yet.
-		((volatile uint32_t*)((char*)ptr + len))[0] = SHMEM_UNINIT;
-		return true;
-	} else {
-		if(verbose) {
-			cerr << "  I (pid = " << getpid()
-			     << ") did not create the shared memory for "
-			     << memName << ".  Pid " << ds.shm_cpid << " did." << endl;
-		}
-		return false;
-	}
+	void *p = NULL;
+	bool leader = allocSharedMemRaw(fname, len, &p, memName, verbose);
+	*dst = (T*)p;
+	return leader;
 }
 
 #else
@@ -988,6 +988,20 @@ public:
 		len_ = 0;
 	}
 
+	/**
+	 * Make this object into a copy of o.  Without this, the copy
+	 * constructor would share o's buffer.
+	 */
+	S2bDnaString& operator=(const S2bDnaString& o) {
+		if(this != &o) {
+			resize(o.len_);
+			if(len_ > 0) {
+				memcpy(cs_, o.cs_, nwords() * sizeof(uint32_t));
+			}
+		}
+		return *this;
+	}
+
 	/**
 	 * Assignment to other SString.
 	 */
@@ -27,6 +27,7 @@
 
 #ifdef WITH_TBB
 # include <mutex>
+# include <thread>
 # include <tbb/spin_mutex.h>
 # include <tbb/queuing_mutex.h>
 #  include <atomic>
@@ -104,6 +105,57 @@ private:
 } while(false)
 #endif
 
+template<typename TWork>
+struct ParallelRange {
+	TWork *work;
+	size_t begin;
+	size_t end;
+
+	static void run(void *vp) {
+		ParallelRange<TWork>* r = (ParallelRange<TWork>*)vp;
+		(*r->work)(r->begin, r->end);
+	}
+};
+
+/**
+ * Split [0, n) into 'nthreads' contiguous ranges of about the same size
+ * and call work(begin, end) on each, one range per thread.  The calling
+ * thread does the first range itself.  Returns once all are done.
+ */
+template<typename TWork>
+static void parallelRanges(TWork& work, size_t n, int nthreads) {
+	if((size_t)nthreads > n) nthreads = (int)n;
+	if(nthreads <= 1) {
+		work(0, n);
+		return;
+	}
+	ParallelRange<TWork> *ranges = new ParallelRange<TWork>[nthreads];
+#ifdef WITH_TBB
+	std::thread **threads = new std::thread*[nthreads];
+#else
+	tthread::thread **threads = new tthread::thread*[nthreads];
+#endif
+	for(int i = 0; i < nthreads; i++) {
+		ranges[i].work = &work;
+		ranges[i].begin = n * i / nthreads;
+		ranges[i].end = n * (i+1) / nthreads;
+		if(i > 0) {
+#ifdef WITH_TBB
+			threads[i] = new std::thread(ParallelRange<TWork>::run, (void*)&ranges[i]);
+#else
+			threads[i] = new tthread::thread(ParallelRange<TWork>::run, (void*)&ranges[i]);
+#endif
+		}
+	}
+	ParallelRange<TWork>::run((void*)&ranges[0]);
+	for(int i = 1; i < nthreads; i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+	delete[] threads;
+	delete[] ranges;
+}
+
 #ifdef WITH_TBB
 #ifdef WITH_AFFINITY
 //ripped entirely from;